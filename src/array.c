@@ -0,0 +1,330 @@
+#include "array.h"
+#include "value_support.h"
+#include "evaluator.h"
+
+// Beyond 2^53 numbers no longer hold every integer, nor can a length be
+// told apart from the one after it.
+#define ARRAY_MAX_EXACT 9007199254740992.0
+
+static bool check_array(crisp_t *crisp, expr_t value)
+{
+  if (!is_array(value))
+  {
+    crisp_eval_error(crisp, "Expected a typed array");
+    return false;
+  }
+  return true;
+}
+
+// Arrays that are both of the same kind and length.
+static bool check_same(crisp_t *crisp, expr_t a, expr_t b)
+{
+  if (!check_array(crisp, a) || !check_array(crisp, b))
+    return false;
+
+  if ((a->as.array.kind != b->as.array.kind) || (a->as.array.count != b->as.array.count))
+  {
+    crisp_eval_error(crisp, "Expected typed arrays of the same kind and length");
+    return false;
+  }
+  return true;
+}
+
+static bool to_count(crisp_t *crisp, expr_t value, size_t *count)
+{
+  double n = is_number(value) ? as_number(value) : -1.0;
+  if (!(n >= 0) || (n >= ARRAY_MAX_EXACT) || (n != (double)(size_t)n))
+  {
+    crisp_eval_error(crisp, "Expected the length of an array");
+    return false;
+  }
+  *count = (size_t)n;
+  return true;
+}
+
+static bool to_index(crisp_t *crisp, expr_t array, expr_t value, size_t *index)
+{
+  double n = is_number(value) ? as_number(value) : -1.0;
+  if (!(n >= 0) || (n >= (double)array->as.array.count) || (n != (double)(size_t)n))
+  {
+    crisp_eval_error(crisp, "Expected an index of an array of length %zu", array->as.array.count);
+    return false;
+  }
+  *index = (size_t)n;
+  return true;
+}
+
+static bool to_i64(crisp_t *crisp, expr_t value, int64_t *i)
+{
+  // The range of an int64_t, which as a double is exactly -2^63 to 2^63.
+  // Written so that NaN is outside it.
+  double n = is_number(value) ? as_number(value) : 0.5;
+  if (!(n >= -9223372036854775808.0) || (n >= 9223372036854775808.0) || (n != (double)(int64_t)n))
+  {
+    crisp_eval_error(crisp, "An i64 array holds integers");
+    return false;
+  }
+  *i = (int64_t)n;
+  return true;
+}
+
+static bool store(crisp_t *crisp, expr_t array, size_t i, expr_t value)
+{
+  if (array->as.array.kind == ARRAY_KIND_I64)
+    return to_i64(crisp, value, &array->as.array.data.i64[i]);
+
+  if (!is_number(value))
+  {
+    crisp_eval_error(crisp, "An f64 array holds numbers");
+    return false;
+  }
+  array->as.array.data.f64[i] = as_number(value);
+  return true;
+}
+
+static expr_t load(crisp_t *crisp, expr_t array, size_t i)
+{
+  if (array->as.array.kind == ARRAY_KIND_I64)
+    return number_value(crisp, (double)array->as.array.data.i64[i]);
+  return number_value(crisp, array->as.array.data.f64[i]);
+}
+
+// (make-f64-array k fill) or (make-i64-array k fill), fill being 0 if it
+// is not given.
+static expr_t make_array(crisp_t *crisp, array_kind_t kind, size_t argc, expr_t *argv)
+{
+  size_t count;
+  if (!to_count(crisp, argv[0], &count))
+    return NULL;
+
+  expr_t result = array_value(crisp, kind, count);
+  for (size_t i = 0; (argc > 1) && (i < count); i++)
+  {
+    if (!store(crisp, result, i, argv[1]))
+      return NULL;
+  }
+  return result;
+}
+
+expr_t array_make_f64(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return make_array(crisp, ARRAY_KIND_F64, argc, argv);
+}
+
+expr_t array_make_i64(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return make_array(crisp, ARRAY_KIND_I64, argc, argv);
+}
+
+static expr_t list_to_array(crisp_t *crisp, array_kind_t kind, expr_t list)
+{
+  if (!is_proper_list(list))
+  {
+    crisp_eval_error(crisp, "Expected a proper list");
+    return NULL;
+  }
+
+  expr_t result = array_value(crisp, kind, length(list));
+  for (size_t i = 0; pair(list); list = cdr(list), i++)
+  {
+    if (!store(crisp, result, i, car(list)))
+      return NULL;
+  }
+  return result;
+}
+
+expr_t array_list_to_f64(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return list_to_array(crisp, ARRAY_KIND_F64, argv[0]);
+}
+
+expr_t array_list_to_i64(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return list_to_array(crisp, ARRAY_KIND_I64, argv[0]);
+}
+
+expr_t array_to_list(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  if (!check_array(crisp, argv[0]))
+    return NULL;
+
+  expr_t result = nil_value(crisp);
+  for (size_t i = argv[0]->as.array.count; i > 0; i--)
+  {
+    result = cons(crisp, load(crisp, argv[0], i - 1), result);
+  }
+  return result;
+}
+
+expr_t array_is_array(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, is_array(argv[0]));
+}
+
+expr_t array_length(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  if (!check_array(crisp, argv[0]))
+    return NULL;
+  return number_value(crisp, (double)argv[0]->as.array.count);
+}
+
+expr_t array_ref(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  size_t i;
+  if (!check_array(crisp, argv[0]) || !to_index(crisp, argv[0], argv[1], &i))
+    return NULL;
+  return load(crisp, argv[0], i);
+}
+
+expr_t array_set(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  size_t i;
+  if (!check_array(crisp, argv[0]) || !to_index(crisp, argv[0], argv[1], &i) || !store(crisp, argv[0], i, argv[2]))
+    return NULL;
+  return nil_value(crisp);
+}
+
+expr_t array_sum(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  if (!check_array(crisp, argv[0]))
+    return NULL;
+
+  const array_kernels_t *k = array_kernels();
+  expr_t a = argv[0];
+  if (a->as.array.kind == ARRAY_KIND_I64)
+    return number_value(crisp, (double)k->sum_i64(a->as.array.data.i64, a->as.array.count));
+  return number_value(crisp, k->sum_f64(a->as.array.data.f64, a->as.array.count));
+}
+
+expr_t array_dot(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  if (!check_same(crisp, argv[0], argv[1]))
+    return NULL;
+
+  const array_kernels_t *k = array_kernels();
+  expr_t a = argv[0];
+  expr_t b = argv[1];
+  if (a->as.array.kind == ARRAY_KIND_I64)
+    return number_value(crisp, (double)k->dot_i64(a->as.array.data.i64, b->as.array.data.i64, a->as.array.count));
+  return number_value(crisp, k->dot_f64(a->as.array.data.f64, b->as.array.data.f64, a->as.array.count));
+}
+
+// The least element of an array, or with max the greatest.
+static expr_t extreme(crisp_t *crisp, expr_t a, bool max)
+{
+  if (!check_array(crisp, a))
+    return NULL;
+  if (a->as.array.count == 0)
+  {
+    crisp_eval_error(crisp, "An empty array has no %s", max ? "maximum" : "minimum");
+    return NULL;
+  }
+
+  const array_kernels_t *k = array_kernels();
+  size_t count = a->as.array.count;
+  if (a->as.array.kind == ARRAY_KIND_I64)
+  {
+    int64_t i = max ? k->max_i64(a->as.array.data.i64, count) : k->min_i64(a->as.array.data.i64, count);
+    return number_value(crisp, (double)i);
+  }
+  return number_value(crisp, max ? k->max_f64(a->as.array.data.f64, count) : k->min_f64(a->as.array.data.f64, count));
+}
+
+expr_t array_min(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return extreme(crisp, argv[0], false);
+}
+
+expr_t array_max(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return extreme(crisp, argv[0], true);
+}
+
+// A new array of the elements of a and b added, or with mul multiplied.
+static expr_t elementwise(crisp_t *crisp, expr_t a, expr_t b, bool mul)
+{
+  if (!check_same(crisp, a, b))
+    return NULL;
+
+  const array_kernels_t *k = array_kernels();
+  size_t count = a->as.array.count;
+  expr_t result = array_value(crisp, a->as.array.kind, count);
+  if (a->as.array.kind == ARRAY_KIND_I64)
+  {
+    (mul ? k->mul_i64 : k->add_i64)(result->as.array.data.i64, a->as.array.data.i64, b->as.array.data.i64, count);
+  }
+  else
+  {
+    (mul ? k->mul_f64 : k->add_f64)(result->as.array.data.f64, a->as.array.data.f64, b->as.array.data.f64, count);
+  }
+  return result;
+}
+
+expr_t array_add(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return elementwise(crisp, argv[0], argv[1], false);
+}
+
+expr_t array_mul(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return elementwise(crisp, argv[0], argv[1], true);
+}
+
+expr_t array_scale(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  expr_t a = argv[0];
+  if (!check_array(crisp, a))
+    return NULL;
+
+  const array_kernels_t *k = array_kernels();
+  size_t count = a->as.array.count;
+  if (a->as.array.kind == ARRAY_KIND_I64)
+  {
+    int64_t factor;
+    if (!to_i64(crisp, argv[1], &factor))
+      return NULL;
+    expr_t result = array_value(crisp, ARRAY_KIND_I64, count);
+    k->scale_i64(result->as.array.data.i64, a->as.array.data.i64, factor, count);
+    return result;
+  }
+
+  if (!is_number(argv[1]))
+  {
+    crisp_eval_error(crisp, "An f64 array is scaled by a number");
+    return NULL;
+  }
+  expr_t result = array_value(crisp, ARRAY_KIND_F64, count);
+  k->scale_f64(result->as.array.data.f64, a->as.array.data.f64, as_number(argv[1]), count);
+  return result;
+}
+
+expr_t array_prefix_sum(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  expr_t a = argv[0];
+  if (!check_array(crisp, a))
+    return NULL;
+
+  const array_kernels_t *k = array_kernels();
+  size_t count = a->as.array.count;
+  expr_t result = array_value(crisp, a->as.array.kind, count);
+  if (a->as.array.kind == ARRAY_KIND_I64)
+    k->prefix_sum_i64(result->as.array.data.i64, a->as.array.data.i64, count);
+  else
+    k->prefix_sum_f64(result->as.array.data.f64, a->as.array.data.f64, count);
+  return result;
+}
@@ -0,0 +1,78 @@
+#ifndef CRISP_ARRAY_H
+#define CRISP_ARRAY_H
+
+#include "common.h"
+#include "value.h"
+
+// Typed arrays
+//
+// An f64 array holds doubles and an i64 array 64 bit integers, unboxed in
+// one buffer rather than as a number value each. They are made by
+//   (make-f64-array k fill) (make-i64-array k fill) (list->f64-array list)
+//   (list->i64-array list)
+// and read and written a number at a time by array-ref, array-set!,
+// array-length and array->list. The elements of an i64 array must be
+// integers, and are exact as numbers up to 2^53. Arithmetic on them wraps.
+//
+// The builtins that work on whole arrays run the kernels below:
+//   (array-sum a) (array-dot a b) (array-min a) (array-max a)
+//   (array-add a b) (array-mul a b) (array-scale a k) (array-prefix-sum a)
+// Those that make an array make one of the kind they were given, and those
+// given two arrays require them to be of the same kind and length.
+
+// The loops over the elements of arrays. Those that take an out buffer
+// write count elements to it, which may be one of their inputs. Min and max
+// require at least one element.
+typedef struct
+{
+  const char *name;
+  double (*sum_f64)(const double *a, size_t count);
+  double (*dot_f64)(const double *a, const double *b, size_t count);
+  double (*min_f64)(const double *a, size_t count);
+  double (*max_f64)(const double *a, size_t count);
+  void (*add_f64)(double *out, const double *a, const double *b, size_t count);
+  void (*mul_f64)(double *out, const double *a, const double *b, size_t count);
+  void (*scale_f64)(double *out, const double *a, double k, size_t count);
+  void (*prefix_sum_f64)(double *out, const double *a, size_t count);
+  int64_t (*sum_i64)(const int64_t *a, size_t count);
+  int64_t (*dot_i64)(const int64_t *a, const int64_t *b, size_t count);
+  int64_t (*min_i64)(const int64_t *a, size_t count);
+  int64_t (*max_i64)(const int64_t *a, size_t count);
+  void (*add_i64)(int64_t *out, const int64_t *a, const int64_t *b, size_t count);
+  void (*mul_i64)(int64_t *out, const int64_t *a, const int64_t *b, size_t count);
+  void (*scale_i64)(int64_t *out, const int64_t *a, int64_t k, size_t count);
+  void (*prefix_sum_i64)(int64_t *out, const int64_t *a, size_t count);
+} array_kernels_t;
+
+// Kernels written in plain C, which any processor runs.
+const array_kernels_t *array_scalar_kernels(void);
+
+// Kernels that use AVX2 where it has an instruction for the operation, or
+// NULL if the processor does not support it or the interpreter was built
+// without them. Sums of doubles are added in a different order to the
+// scalar kernels, so may differ from them in the last bits.
+const array_kernels_t *array_simd_kernels(void);
+
+// The kernels that the builtins use, the SIMD ones if there are any.
+const array_kernels_t *array_kernels(void);
+
+// The builtins, each registered under the name it is given above.
+expr_t array_make_f64(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_make_i64(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_list_to_f64(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_list_to_i64(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_to_list(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_is_array(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_length(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_ref(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_set(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_sum(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_dot(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_min(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_max(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_add(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_mul(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_scale(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t array_prefix_sum(crisp_t *crisp, size_t argc, expr_t *argv);
+
+#endif
@@ -0,0 +1,500 @@
+#include "array.h"
+
+// The AVX2 kernels are compiled for that instruction set function by
+// function, so the rest of the interpreter still runs on any x86 processor,
+// and are only used once the processor has been seen to support it.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define ARRAY_AVX2
+#include <immintrin.h>
+#endif
+
+// Integer arithmetic wraps, which it only does without undefined
+// behaviour on unsigned values.
+static inline int64_t wrap(uint64_t value)
+{
+  return (int64_t)value;
+}
+
+// Scalar kernels
+
+static double sum_f64(const double *a, size_t count)
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += a[i];
+  }
+  return sum;
+}
+
+static double dot_f64(const double *a, const double *b, size_t count)
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+static double min_f64(const double *a, size_t count)
+{
+  double min = a[0];
+  for (size_t i = 1; i < count; i++)
+  {
+    min = (a[i] < min) ? a[i] : min;
+  }
+  return min;
+}
+
+static double max_f64(const double *a, size_t count)
+{
+  double max = a[0];
+  for (size_t i = 1; i < count; i++)
+  {
+    max = (a[i] > max) ? a[i] : max;
+  }
+  return max;
+}
+
+static void add_f64(double *out, const double *a, const double *b, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = a[i] + b[i];
+  }
+}
+
+static void mul_f64(double *out, const double *a, const double *b, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = a[i] * b[i];
+  }
+}
+
+static void scale_f64(double *out, const double *a, double k, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = a[i] * k;
+  }
+}
+
+static void prefix_sum_f64(double *out, const double *a, size_t count)
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += a[i];
+    out[i] = sum;
+  }
+}
+
+static int64_t sum_i64(const int64_t *a, size_t count)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += (uint64_t)a[i];
+  }
+  return wrap(sum);
+}
+
+static int64_t dot_i64(const int64_t *a, const int64_t *b, size_t count)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += (uint64_t)a[i] * (uint64_t)b[i];
+  }
+  return wrap(sum);
+}
+
+static int64_t min_i64(const int64_t *a, size_t count)
+{
+  int64_t min = a[0];
+  for (size_t i = 1; i < count; i++)
+  {
+    min = (a[i] < min) ? a[i] : min;
+  }
+  return min;
+}
+
+static int64_t max_i64(const int64_t *a, size_t count)
+{
+  int64_t max = a[0];
+  for (size_t i = 1; i < count; i++)
+  {
+    max = (a[i] > max) ? a[i] : max;
+  }
+  return max;
+}
+
+static void add_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = wrap((uint64_t)a[i] + (uint64_t)b[i]);
+  }
+}
+
+static void mul_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = wrap((uint64_t)a[i] * (uint64_t)b[i]);
+  }
+}
+
+static void scale_i64(int64_t *out, const int64_t *a, int64_t k, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    out[i] = wrap((uint64_t)a[i] * (uint64_t)k);
+  }
+}
+
+static void prefix_sum_i64(int64_t *out, const int64_t *a, size_t count)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    sum += (uint64_t)a[i];
+    out[i] = wrap(sum);
+  }
+}
+
+static const array_kernels_t sScalarKernels = {
+  "scalar",
+  &sum_f64,
+  &dot_f64,
+  &min_f64,
+  &max_f64,
+  &add_f64,
+  &mul_f64,
+  &scale_f64,
+  &prefix_sum_f64,
+  &sum_i64,
+  &dot_i64,
+  &min_i64,
+  &max_i64,
+  &add_i64,
+  &mul_i64,
+  &scale_i64,
+  &prefix_sum_i64,
+};
+
+const array_kernels_t *array_scalar_kernels(void)
+{
+  return &sScalarKernels;
+}
+
+#ifdef ARRAY_AVX2
+
+// AVX2 kernels
+//
+// Each takes four elements at a time, and finishes the last few of an array
+// as the scalar kernels do. AVX2 has no 64 bit integer multiply, so the
+// i64 dot product, mul and scale are the scalar ones.
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline double horizontal_sum_f64(__m256d v)
+{
+  __m128d low = _mm256_castpd256_pd128(v);
+  __m128d high = _mm256_extractf128_pd(v, 1);
+  low = _mm_add_pd(low, high);
+  high = _mm_unpackhi_pd(low, low);
+  return _mm_cvtsd_f64(_mm_add_sd(low, high));
+}
+
+// Two sums are kept, so that each addition need not wait for the last.
+AVX2 static double avx2_sum_f64(const double *a, size_t count)
+{
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(&a[i]));
+    sum1 = _mm256_add_pd(sum1, _mm256_loadu_pd(&a[i + 4]));
+  }
+  for (; i + 4 <= count; i += 4)
+  {
+    sum0 = _mm256_add_pd(sum0, _mm256_loadu_pd(&a[i]));
+  }
+
+  double sum = horizontal_sum_f64(_mm256_add_pd(sum0, sum1));
+  for (; i < count; i++)
+  {
+    sum += a[i];
+  }
+  return sum;
+}
+
+AVX2 static double avx2_dot_f64(const double *a, const double *b, size_t count)
+{
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+  {
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+    sum1 = _mm256_add_pd(sum1, _mm256_mul_pd(_mm256_loadu_pd(&a[i + 4]), _mm256_loadu_pd(&b[i + 4])));
+  }
+  for (; i + 4 <= count; i += 4)
+  {
+    sum0 = _mm256_add_pd(sum0, _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+
+  double sum = horizontal_sum_f64(_mm256_add_pd(sum0, sum1));
+  for (; i < count; i++)
+  {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+// The comparisons keep the current minimum unless the element is less,
+// as the scalar kernel does.
+AVX2 static double avx2_min_f64(const double *a, size_t count)
+{
+  if (count < 4)
+    return min_f64(a, count);
+
+  __m256d min = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= count; i += 4)
+  {
+    min = _mm256_min_pd(_mm256_loadu_pd(&a[i]), min);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, min);
+  double result = min_f64(lanes, 4);
+  for (; i < count; i++)
+  {
+    result = (a[i] < result) ? a[i] : result;
+  }
+  return result;
+}
+
+AVX2 static double avx2_max_f64(const double *a, size_t count)
+{
+  if (count < 4)
+    return max_f64(a, count);
+
+  __m256d max = _mm256_loadu_pd(a);
+  size_t i = 4;
+  for (; i + 4 <= count; i += 4)
+  {
+    max = _mm256_max_pd(_mm256_loadu_pd(&a[i]), max);
+  }
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, max);
+  double result = max_f64(lanes, 4);
+  for (; i < count; i++)
+  {
+    result = (a[i] > result) ? a[i] : result;
+  }
+  return result;
+}
+
+AVX2 static void avx2_add_f64(double *out, const double *a, const double *b, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    _mm256_storeu_pd(&out[i], _mm256_add_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+  add_f64(&out[i], &a[i], &b[i], count - i);
+}
+
+AVX2 static void avx2_mul_f64(double *out, const double *a, const double *b, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    _mm256_storeu_pd(&out[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), _mm256_loadu_pd(&b[i])));
+  }
+  mul_f64(&out[i], &a[i], &b[i], count - i);
+}
+
+AVX2 static void avx2_scale_f64(double *out, const double *a, double k, size_t count)
+{
+  __m256d factor = _mm256_set1_pd(k);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    _mm256_storeu_pd(&out[i], _mm256_mul_pd(_mm256_loadu_pd(&a[i]), factor));
+  }
+  scale_f64(&out[i], &a[i], k, count - i);
+}
+
+// The four elements are summed in place by adding them to themselves
+// shifted up one lane, then two, before adding the total so far.
+AVX2 static void avx2_prefix_sum_f64(double *out, const double *a, size_t count)
+{
+  __m256d zero = _mm256_setzero_pd();
+  __m256d total = zero;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256d v = _mm256_loadu_pd(&a[i]);
+    v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x1));
+    v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x3));
+    v = _mm256_add_pd(v, total);
+    _mm256_storeu_pd(&out[i], v);
+    total = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+
+  double sum = (i > 0) ? out[i - 1] : 0.0;
+  for (; i < count; i++)
+  {
+    sum += a[i];
+    out[i] = sum;
+  }
+}
+
+AVX2 static int64_t avx2_sum_i64(const int64_t *a, size_t count)
+{
+  __m256i sum = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    sum = _mm256_add_epi64(sum, _mm256_loadu_si256((const __m256i *)&a[i]));
+  }
+
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, sum);
+  return wrap((uint64_t)sum_i64(lanes, 4) + (uint64_t)sum_i64(&a[i], count - i));
+}
+
+AVX2 static int64_t avx2_min_i64(const int64_t *a, size_t count)
+{
+  if (count < 4)
+    return min_i64(a, count);
+
+  __m256i min = _mm256_loadu_si256((const __m256i *)a);
+  size_t i = 4;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&a[i]);
+    min = _mm256_blendv_epi8(min, v, _mm256_cmpgt_epi64(min, v));
+  }
+
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, min);
+  int64_t result = min_i64(lanes, 4);
+  for (; i < count; i++)
+  {
+    result = (a[i] < result) ? a[i] : result;
+  }
+  return result;
+}
+
+AVX2 static int64_t avx2_max_i64(const int64_t *a, size_t count)
+{
+  if (count < 4)
+    return max_i64(a, count);
+
+  __m256i max = _mm256_loadu_si256((const __m256i *)a);
+  size_t i = 4;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&a[i]);
+    max = _mm256_blendv_epi8(max, v, _mm256_cmpgt_epi64(v, max));
+  }
+
+  int64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, max);
+  int64_t result = max_i64(lanes, 4);
+  for (; i < count; i++)
+  {
+    result = (a[i] > result) ? a[i] : result;
+  }
+  return result;
+}
+
+AVX2 static void avx2_add_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t count)
+{
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256i sum = _mm256_add_epi64(_mm256_loadu_si256((const __m256i *)&a[i]),
+                                   _mm256_loadu_si256((const __m256i *)&b[i]));
+    _mm256_storeu_si256((__m256i *)&out[i], sum);
+  }
+  add_i64(&out[i], &a[i], &b[i], count - i);
+}
+
+AVX2 static void avx2_prefix_sum_i64(int64_t *out, const int64_t *a, size_t count)
+{
+  __m256i zero = _mm256_setzero_si256();
+  __m256i total = zero;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)&a[i]);
+    v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03));
+    v = _mm256_add_epi64(v, _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0f));
+    v = _mm256_add_epi64(v, total);
+    _mm256_storeu_si256((__m256i *)&out[i], v);
+    total = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+
+  uint64_t sum = (i > 0) ? (uint64_t)out[i - 1] : 0;
+  for (; i < count; i++)
+  {
+    sum += (uint64_t)a[i];
+    out[i] = wrap(sum);
+  }
+}
+
+#undef AVX2
+
+static const array_kernels_t sAvx2Kernels = {
+  "avx2",
+  &avx2_sum_f64,
+  &avx2_dot_f64,
+  &avx2_min_f64,
+  &avx2_max_f64,
+  &avx2_add_f64,
+  &avx2_mul_f64,
+  &avx2_scale_f64,
+  &avx2_prefix_sum_f64,
+  &avx2_sum_i64,
+  &dot_i64,
+  &avx2_min_i64,
+  &avx2_max_i64,
+  &avx2_add_i64,
+  &mul_i64,
+  &scale_i64,
+  &avx2_prefix_sum_i64,
+};
+
+#endif
+
+const array_kernels_t *array_simd_kernels(void)
+{
+#ifdef ARRAY_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return &sAvx2Kernels;
+#endif
+  return NULL;
+}
+
+const array_kernels_t *array_kernels(void)
+{
+  // Chosen once, the processor does not change.
+  static const array_kernels_t *kernels = NULL;
+  if (kernels == NULL)
+  {
+    const array_kernels_t *simd = array_simd_kernels();
+    kernels = (simd != NULL) ? simd : &sScalarKernels;
+  }
+  return kernels;
+}
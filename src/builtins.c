@@ -4,27 +4,27 @@
 #include "interpreter_internal.h"
 #include "environment.h"
 #include "evaluator.h"
+#include "cek.h"
+#include "optimizer.h"
+#include "generic.h"
+#include "record.h"
+#include "array.h"
 
 #define intern intern_string_null_terminated
 
 #define CHECK_OPERAND(c, tst, op, msg)               \
-  if (!tst)                                          \
+  if (!(tst))                                        \
   {                                                  \
-    printf("operand '");                             \
-    print_value_tree(op);                                 \
-    printf("' failed check: %s\n", msg);             \
+    if (!quiet_errors(crisp))                        \
+    {                                                \
+      printf("operand '");                           \
+      print_value_tree(op);                          \
+      printf("' failed check: %s\n", msg);           \
+    }                                                \
     crisp_eval_error(crisp, "Operand check failed"); \
     return NULL;                                     \
   }
 
-#define CHECK_ARITY(c, ops, sz)                         \
-  size_t len = length(ops);                             \
-  if (len != sz)                                        \
-  {                                                     \
-    printf("Expected arity of %u, got %zu\n", sz, len); \
-    crisp_eval_error(crisp, "Arity");                   \
-  }
-
 #define CHECK_MIN_ARITY(c, ops, sz)                             \
   size_t len = length(ops);                                     \
   if (sz > len)                                                 \
@@ -33,16 +33,20 @@
     crisp_eval_error(crisp, "Min Arity");                       \
   }
 
-static expr_t eval_first_operand(crisp_t *crisp, expr_t operands, env_t *env)
-{
-  CHECK_ARITY(crisp, operands, 1U);
-  return crisp_eval(crisp, car(operands), env);
-}
+// Special forms receive their operands unevaluated. They are not bound in
+// the root environment, the evaluator recognizes them by the keyword that
+// starts the form. All other builtins receive a vector of their evaluated
+// operands, the length of which has already been checked against the arity
+// given in register_builtins.
 
 expr_t b_quote(crisp_t *crisp, expr_t operands, env_t *env)
 {
-  (void)crisp;
   (void)env;
+  if (length(operands) != 1)
+  {
+    crisp_eval_error(crisp, "quote expects a single datum");
+    return NULL;
+  }
   return car(operands);
 }
 
@@ -50,80 +54,144 @@ static double operator_add(double a, double b) { return a + b; }
 static double operator_sub(double a, double b) { return a - b; }
 static double operator_mult(double a, double b) { return a * b; }
 static double operator_div(double a, double b) { return a / b; }
-typedef double (*binary_op_t)(double a, double b);
 
-static expr_t b_binary_numerical(crisp_t *crisp, expr_t operands, env_t *env, binary_op_t op)
+static expr_t b_binary_numerical(crisp_t *crisp, size_t argc, expr_t *argv, binary_op_t op)
 {
-  bool first = true;
-  double result = 0.0;
-  list_iter_t iter = iter_list(crisp, crisp_eval_list(crisp, operands, env));
-  expr_t operand = NULL;
+  CHECK_OPERAND(crisp, is_number(argv[0]), argv[0], "Must be a number");
+  double result = as_number(argv[0]);
 
-  while ((operand = iter_next(&iter)) != NULL)
+  for (size_t i = 1; i < argc; i++)
   {
-    CHECK_OPERAND(crisp, is_number(operand), operand, "Must be a number");
-    if (first)
-    {
-      result = as_number(operand);
-      first = false;
-    }
-    else
-    {
-      result = op(result, as_number(operand));
-    }
+    CHECK_OPERAND(crisp, is_number(argv[i]), argv[i], "Must be a number");
+    result = op(result, as_number(argv[i]));
   }
   return number_value(crisp, result);
 }
 
-static expr_t b_add(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_add(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return b_binary_numerical(crisp, argc, argv, operator_add);
+}
+
+static expr_t b_sub(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return b_binary_numerical(crisp, argc, argv, operator_sub);
+}
+
+static expr_t b_mult(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return b_binary_numerical(crisp, argc, argv, operator_mult);
+}
+
+static expr_t b_div(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  return b_binary_numerical(crisp, argc, argv, operator_div);
+}
+
+binary_op_t builtin_numeric_op(expr_t fn)
+{
+  if (!is_builtin(fn))
+    return NULL;
+
+  builtin_fn_t builtin = as_builtin(fn);
+  if (builtin == &b_add)
+    return operator_add;
+  if (builtin == &b_sub)
+    return operator_sub;
+  if (builtin == &b_mult)
+    return operator_mult;
+  if (builtin == &b_div)
+    return operator_div;
+  return NULL;
+}
+
+static expr_t b_cons(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return b_binary_numerical(crisp, operands, env, operator_add);
+  (void)argc;
+  return cons(crisp, argv[0], argv[1]);
 }
 
-static expr_t b_sub(crisp_t *crisp, expr_t operands, env_t *env)
+// The list spliced in ahead of the rest of a template, (list ... . rest).
+// The list is copied and the rest is shared.
+static expr_t b_splice(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return b_binary_numerical(crisp, operands, env, operator_sub);
+  (void)argc;
+  expr_t list = argv[0];
+  if (is_nil(list))
+    return argv[1];
+
+  CHECK_OPERAND(crisp, is_proper_list(list), list, "must be a proper list");
+
+  expr_t head = cons(crisp, car(list), argv[1]);
+  expr_t tail = head;
+  for (list = cdr(list); pair(list); list = cdr(list))
+  {
+    expr_t c = cons(crisp, car(list), argv[1]);
+    set_cdr(tail, c);
+    tail = c;
+  }
+  return head;
 }
 
-static expr_t b_mult(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_list(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return b_binary_numerical(crisp, operands, env, operator_mult);
+  return list_from_vector(crisp, argc, argv);
 }
 
-static expr_t b_div(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_car(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return b_binary_numerical(crisp, operands, env, operator_div);
+  (void)argc;
+  CHECK_OPERAND(crisp, pair(argv[0]), argv[0], "must be a pair");
+  return car(argv[0]);
 }
 
-static expr_t b_cons(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_cdr(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  expr_t ops = crisp_eval_list(crisp, operands, env);
-  CHECK_ARITY(crisp, ops, 2U);
-  return cons(crisp, car(ops), car(cdr(ops)));
+  (void)argc;
+  CHECK_OPERAND(crisp, pair(argv[0]), argv[0], "must be a pair");
+  return cdr(argv[0]);
 }
 
-static expr_t b_list(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_is_pair(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return crisp_eval_list(crisp, operands, env);
+  (void)argc;
+  return bool_value(crisp, pair(argv[0]));
 }
 
-static expr_t b_car(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_first(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  expr_t op = eval_first_operand(crisp, operands, env);
-  CHECK_OPERAND(crisp, pair(op), op, "must be a pair");
-  return car(op);
+  (void)crisp;
+  (void)argc;
+  return car(argv[0]);
+}
+
+static expr_t b_rest(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)crisp;
+  (void)argc;
+  return cdr(argv[0]);
 }
 
-static expr_t b_cdr(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_eqv(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  expr_t op = eval_first_operand(crisp, operands, env);
-  CHECK_OPERAND(crisp, pair(op), op, "must be a pair");
-  return cdr(op);
+  (void)argc;
+  return bool_value(crisp, is_eqv(argv[0], argv[1]));
 }
 
-static expr_t b_length(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_no_match(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  expr_t ops = eval_first_operand(crisp, operands, env);
+  (void)argc;
+  printf("value '");
+  print_value_tree(argv[0]);
+  printf("' matched no clause\n");
+  crisp_eval_error(crisp, "No clause of match matches");
+  return NULL;
+}
+
+static expr_t b_length(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  expr_t ops = argv[0];
 
   if (is_nil(ops))
     return number_value(crisp, 0.0);
@@ -133,44 +201,444 @@ static expr_t b_length(crisp_t *crisp, expr_t operands, env_t *env)
   return number_value(crisp, (double)length(ops));
 }
 
-static expr_t b_is_list(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_is_list(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, is_proper_list(argv[0]));
+}
+
+static expr_t b_not(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, not(argv[0]));
+}
+
+static expr_t b_boolean(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, is_bool(argv[0]));
+}
+
+static expr_t b_symbol(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, is_atom(argv[0]));
+}
+
+static expr_t b_number(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, is_proper_list(eval_first_operand(crisp, operands, env)));
+  (void)argc;
+  return bool_value(crisp, is_number(argv[0]));
 }
 
-static expr_t b_not(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_string(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, not(eval_first_operand(crisp, operands, env)));
+  (void)argc;
+  return bool_value(crisp, is_string(argv[0]));
+}
+
+// The list library. Each builtin walks its lists in a loop, so lists of
+// any length are handled without recursing, and builds its result front to
+// back through a pointer to the last pair. Procedures are applied to a
+// vector of arguments, as any other call is, without consing a list of
+// them.
+
+typedef struct
+{
+  expr_t head;
+  expr_t tail;
+  // The () that ends the list, shared by each pair as it is added.
+  expr_t end;
+} list_builder_t;
+
+static list_builder_t start_list(crisp_t *crisp)
+{
+  expr_t end = nil_value(crisp);
+  list_builder_t b = {.head = end, .tail = NULL, .end = end};
+  return b;
+}
+
+static void add_to_list(crisp_t *crisp, list_builder_t *b, expr_t value)
+{
+  expr_t c = cons(crisp, value, b->end);
+  if (b->tail == NULL)
+  {
+    b->head = c;
+  }
+  else
+  {
+    set_cdr(b->tail, c);
+  }
+  b->tail = c;
+}
+
+// (map f list...) applies f to the elements of the lists in turn, stopping
+// at the end of the shortest.
+static expr_t b_map(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  expr_t fn = argv[0];
+  size_t count = argc - 1;
+  for (size_t i = 1; i < argc; i++)
+  {
+    CHECK_OPERAND(crisp, is_proper_list(argv[i]), argv[i], "must be a proper list");
+  }
+
+  // The lists still to walk, and the arguments taken from them, are kept
+  // on the argument stack so that an escape from fn releases them.
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t *lists = cek_push_args(stack, 2 * count);
+  expr_t *args = &lists[count];
+  memcpy(lists, &argv[1], sizeof(expr_t) * count);
+
+  list_builder_t result = start_list(crisp);
+  for (;;)
+  {
+    size_t i = 0;
+    for (; (i < count) && pair(lists[i]); i++)
+    {
+      args[i] = car(lists[i]);
+      lists[i] = cdr(lists[i]);
+    }
+    if (i < count)
+      break;
+
+    expr_t value = crisp_apply_argv(crisp, fn, count, args, root_env(crisp));
+    if (value == NULL)
+    {
+      cek_pop_args(stack, 2 * count);
+      return NULL;
+    }
+    add_to_list(crisp, &result, value);
+  }
+
+  cek_pop_args(stack, 2 * count);
+  return result.head;
 }
 
-static expr_t b_boolean(crisp_t *crisp, expr_t operands, env_t *env)
+// (filter pred list), the elements of list for which pred is not false.
+static expr_t b_filter(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, is_bool(eval_first_operand(crisp, operands, env)));
+  (void)argc;
+  CHECK_OPERAND(crisp, is_proper_list(argv[1]), argv[1], "must be a proper list");
+
+  list_builder_t result = start_list(crisp);
+  for (expr_t list = argv[1]; pair(list); list = cdr(list))
+  {
+    expr_t element = car(list);
+    expr_t keep = crisp_apply_argv(crisp, argv[0], 1, &element, root_env(crisp));
+    if (keep == NULL)
+      return NULL;
+    if (!not(keep))
+      add_to_list(crisp, &result, element);
+  }
+  return result.head;
 }
 
-static expr_t b_symbol(crisp_t *crisp, expr_t operands, env_t *env)
+// (fold f init list) applies f to each element of list and the result so
+// far, from the left, starting with init.
+static expr_t b_fold(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, is_atom(eval_first_operand(crisp, operands, env)));
+  (void)argc;
+  CHECK_OPERAND(crisp, is_proper_list(argv[2]), argv[2], "must be a proper list");
+
+  expr_t acc = argv[1];
+  for (expr_t list = argv[2]; pair(list); list = cdr(list))
+  {
+    expr_t args[2] = {car(list), acc};
+    acc = crisp_apply_argv(crisp, argv[0], 2, args, root_env(crisp));
+    if (acc == NULL)
+      return NULL;
+  }
+  return acc;
 }
 
-static expr_t b_number(crisp_t *crisp, expr_t operands, env_t *env)
+// (append list... last) copies every list but the last, which the result
+// shares and which need not be a list.
+static expr_t b_append(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, is_number(eval_first_operand(crisp, operands, env)));
+  if (argc == 0)
+    return nil_value(crisp);
+
+  list_builder_t result = start_list(crisp);
+  for (size_t i = 0; i + 1 < argc; i++)
+  {
+    CHECK_OPERAND(crisp, is_proper_list(argv[i]), argv[i], "must be a proper list");
+    for (expr_t list = argv[i]; pair(list); list = cdr(list))
+    {
+      add_to_list(crisp, &result, car(list));
+    }
+  }
+
+  if (result.tail == NULL)
+    return argv[argc - 1];
+  set_cdr(result.tail, argv[argc - 1]);
+  return result.head;
 }
 
-static expr_t b_string(crisp_t *crisp, expr_t operands, env_t *env)
+static expr_t b_reverse(crisp_t *crisp, size_t argc, expr_t *argv)
 {
-  return bool_value(crisp, is_string(eval_first_operand(crisp, operands, env)));
+  (void)argc;
+  CHECK_OPERAND(crisp, is_proper_list(argv[0]), argv[0], "must be a proper list");
+
+  expr_t result = nil_value(crisp);
+  for (expr_t list = argv[0]; pair(list); list = cdr(list))
+  {
+    result = cons(crisp, car(list), result);
+  }
+  return result;
 }
 
-static expr_t b_lambda(crisp_t *crisp, expr_t operands, env_t *env)
+// (assoc key alist), the first pair in alist whose car is equal to key, or
+// false if there is none.
+static expr_t b_assoc(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  CHECK_OPERAND(crisp, is_proper_list(argv[1]), argv[1], "must be a proper list");
+
+  for (expr_t list = argv[1]; pair(list); list = cdr(list))
+  {
+    expr_t entry = car(list);
+    CHECK_OPERAND(crisp, pair(entry), entry, "must be a pair");
+    if (is_equal(car(entry), argv[0]))
+      return entry;
+  }
+  return bool_value(crisp, false);
+}
+
+// The index of an element of a vector, or false having raised an eval
+// error if the operands are not a vector and the index of one of its
+// elements.
+static bool vector_index(crisp_t *crisp, expr_t vector, expr_t number, size_t *index)
+{
+  if (!is_vector(vector) || !is_number(number))
+  {
+    crisp_eval_error(crisp, "Expected a vector and an index");
+    return false;
+  }
+
+  double n = as_number(number);
+  if (!(n >= 0) || (n >= (double)vector->as.vector.count) || (n != (double)(size_t)n))
+  {
+    crisp_eval_error(crisp, "Index %g is out of range for a vector of length %zu", n, vector->as.vector.count);
+    return false;
+  }
+  *index = (size_t)n;
+  return true;
+}
+
+// (make-vector k fill), a vector of k elements that are each fill, or ()
+// if no fill is given.
+static expr_t b_make_vector(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  CHECK_OPERAND(crisp, is_number(argv[0]), argv[0], "must be a number");
+  double n = as_number(argv[0]);
+  // Beyond 2^53 numbers no longer hold every integer.
+  CHECK_OPERAND(crisp, (n >= 0) && (n < 9007199254740992.0) && (n == (double)(size_t)n), argv[0],
+                "must be a length");
+  return vector_value(crisp, (size_t)n, (argc > 1) ? argv[1] : nil_value(crisp));
+}
+
+static expr_t b_vector(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  expr_t result = vector_value(crisp, argc, NULL);
+  for (size_t i = 0; i < argc; i++)
+  {
+    result->as.vector.items[i] = argv[i];
+  }
+  return result;
+}
+
+static expr_t b_is_vector(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return bool_value(crisp, is_vector(argv[0]));
+}
+
+static expr_t b_vector_length(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  CHECK_OPERAND(crisp, is_vector(argv[0]), argv[0], "must be a vector");
+  return number_value(crisp, (double)argv[0]->as.vector.count);
+}
+
+static expr_t b_vector_ref(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  size_t i;
+  return vector_index(crisp, argv[0], argv[1], &i) ? argv[0]->as.vector.items[i] : NULL;
+}
+
+static expr_t b_vector_set(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  size_t i;
+  if (!vector_index(crisp, argv[0], argv[1], &i))
+    return NULL;
+  argv[0]->as.vector.items[i] = argv[2];
+  return nil_value(crisp);
+}
+
+static expr_t b_vector_to_list(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  CHECK_OPERAND(crisp, is_vector(argv[0]), argv[0], "must be a vector");
+  return list_from_vector(crisp, argv[0]->as.vector.count, argv[0]->as.vector.items);
+}
+
+static expr_t b_list_to_vector(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  CHECK_OPERAND(crisp, is_proper_list(argv[0]), argv[0], "must be a proper list");
+  return vector_from_list(crisp, argv[0]);
+}
+
+static const char *sListStageNames[] = {
+  [LIST_STAGE_NONE] = NULL,
+  [LIST_STAGE_MAP] = "map",
+  [LIST_STAGE_FILTER] = "filter",
+  [LIST_STAGE_FOLD] = "fold",
+};
+
+list_stage_t builtin_list_stage(expr_t fn)
+{
+  if (!is_builtin(fn))
+    return LIST_STAGE_NONE;
+
+  builtin_fn_t builtin = as_builtin(fn);
+  if (builtin == &b_map)
+    return LIST_STAGE_MAP;
+  if (builtin == &b_filter)
+    return LIST_STAGE_FILTER;
+  if (builtin == &b_fold)
+    return LIST_STAGE_FOLD;
+  return LIST_STAGE_NONE;
+}
+
+const char *list_stage_name(list_stage_t stage)
+{
+  return sListStageNames[stage];
+}
+
+static list_stage_t list_stage_named(expr_t name)
+{
+  for (list_stage_t stage = LIST_STAGE_MAP; stage <= LIST_STAGE_FOLD; stage++)
+  {
+    if (is_atom(name) && (strcmp(as_atom(name), sListStageNames[stage]) == 0))
+      return stage;
+  }
+  return LIST_STAGE_NONE;
+}
+
+static expr_t b_fused(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  list_stage_t stages[FUSED_MAX_STAGES];
+  expr_t fns[FUSED_MAX_STAGES];
+  expr_t acc = NULL;
+  size_t count = 0;
+  size_t next = 1;
+  bool valid = is_proper_list(argv[0]) && (length(argv[0]) <= FUSED_MAX_STAGES);
+  for (expr_t s = argv[0]; valid && pair(s); s = cdr(s), count++)
+  {
+    // Only the first stage may be a fold.
+    stages[count] = list_stage_named(car(s));
+    size_t operands = (stages[count] == LIST_STAGE_FOLD) ? 2 : 1;
+    valid = (stages[count] != LIST_STAGE_NONE) && ((stages[count] != LIST_STAGE_FOLD) || (count == 0)) &&
+            (next + operands < argc);
+    if (valid)
+    {
+      fns[count] = argv[next++];
+      acc = (operands == 2) ? argv[next++] : acc;
+    }
+  }
+  if (!valid || (count == 0) || (next != argc - 1))
+  {
+    crisp_eval_error(crisp, "%s expects '(stage...) operands... list", BUILTIN_FUSED);
+    return NULL;
+  }
+
+  expr_t list = argv[next];
+  CHECK_OPERAND(crisp, is_proper_list(list), list, "must be a proper list");
+
+  // The last stage is either the fold that consumes the elements, or one
+  // more stage before they are collected into the result.
+  size_t last = (acc != NULL) ? 1 : 0;
+  list_builder_t result = start_list(crisp);
+  for (; pair(list); list = cdr(list))
+  {
+    expr_t value = car(list);
+    size_t i = count;
+    for (; i > last; i--)
+    {
+      expr_t r = crisp_apply_argv(crisp, fns[i - 1], 1, &value, root_env(crisp));
+      if (r == NULL)
+        return NULL;
+      if (stages[i - 1] == LIST_STAGE_MAP)
+        value = r;
+      else if (not(r))
+        break;
+    }
+    if (i > last)
+      continue;
+
+    if (acc != NULL)
+    {
+      expr_t args[2] = {value, acc};
+      acc = crisp_apply_argv(crisp, fns[0], 2, args, root_env(crisp));
+      if (acc == NULL)
+        return NULL;
+    }
+    else
+    {
+      add_to_list(crisp, &result, value);
+    }
+  }
+  return (acc != NULL) ? acc : result.head;
+}
+
+// A closure made within a call copies just the local variables that its
+// bodies refer to into an environment of its own, rather than keeping the
+// whole chain of frames it was made in alive. Those frames are then free to
+// be reclaimed, or reused, as soon as their calls return.
+//
+// Frames whose variables may be assigned are shared instead, along with the
+// rest of the chain, so that the closure sees later assignments.
+static env_t *closure_env(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  if (env_is_top_level(env))
+    return env;
+
+  env_t *top = env;
+  for (; !env_is_top_level(top); top = top->parent)
+  {
+    if (top->shared)
+      return env;
+  }
+
+  env_t *closure = top;
+  for (expr_t v = crisp_free_variables(crisp, operands); is_cons(v); v = cdr(v))
+  {
+    expr_t value = NULL;
+    if (env_get_local(env, as_atom(car(v)), &value))
+    {
+      if (closure == top)
+        closure = env_init_child(crisp, top);
+      env_set(closure, as_atom(car(v)), value);
+    }
+  }
+  return closure;
+}
+
+expr_t b_lambda(crisp_t *crisp, expr_t operands, env_t *env)
 {
   // This is a special form. The operands are not evalutated.
   CHECK_MIN_ARITY(crisp, operands, 2U);
-  return lambda_value(crisp, car(operands), cdr(operands), env);
+  env_t *closure = closure_env(crisp, operands, env);
+  expr_t value = lambda_value(crisp, car(operands), cdr(operands), closure);
+  as_lambda(value)->frame_escapes = crisp_frame_may_escape(crisp, operands);
+  return value;
 }
 
-static expr_t b_define(crisp_t *crisp, expr_t operands, env_t *env)
+expr_t b_define(crisp_t *crisp, expr_t operands, env_t *env)
 {
   CHECK_MIN_ARITY(crisp, operands, 1U);
 
@@ -193,29 +661,626 @@ static expr_t b_define(crisp_t *crisp, expr_t operands, env_t *env)
     crisp_eval_error(crisp, "Unsupport form of define.");   
   }
 
-  env_set(env_get_top_level(env), as_atom(key), value);
+  env_t *top = env_get_top_level(env);
+  env_set(top, as_atom(key), value);
+
+  // Calls that inlined the previous value must call the new one.
+  crisp_optimizer_redefined(crisp, env_get_cell(top, as_atom(key)));
+  return nil_value(crisp);
+}
+
+expr_t b_set(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  if (length(operands) != 2)
+  {
+    crisp_eval_error(crisp, "set! expects a variable and a value");
+    return NULL;
+  }
+
+  expr_t key = car(operands);
+  CHECK_OPERAND(crisp, is_atom(key), key, "must be an atom");
+
+  expr_t value = crisp_eval(crisp, car(cdr(operands)), env);
+  if (value == NULL)
+    return NULL;
+
+  global_cell_t *cell = NULL;
+  if (!env_assign(env, as_atom(key), value, &cell))
+  {
+    crisp_eval_error(crisp, "set! of an unbound variable: %s", as_atom(key));
+    return NULL;
+  }
+
+  if (cell != NULL)
+  {
+    crisp_optimizer_redefined(crisp, cell);
+  }
+  return nil_value(crisp);
+}
+
+// Evaluates a sequence of forms, returning the value of the last one. An
+// empty sequence is nil.
+static expr_t eval_sequence(crisp_t *crisp, expr_t forms, env_t *env)
+{
+  expr_t result = nil_value(crisp);
+  for (; is_cons(forms) && (result != NULL); forms = cdr(forms))
+  {
+    result = crisp_eval(crisp, car(forms), env);
+  }
+  return result;
+}
+
+expr_t b_begin(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  return eval_sequence(crisp, operands, env);
+}
+
+expr_t b_if(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  size_t len = length(operands);
+  if ((len != 2) && (len != 3))
+  {
+    crisp_eval_error(crisp, "if expects a test, a consequent and an optional alternative");
+    return NULL;
+  }
+
+  expr_t test = crisp_eval(crisp, car(operands), env);
+  if (test == NULL)
+    return NULL;
+
+  if (!not(test))
+    return crisp_eval(crisp, car(cdr(operands)), env);
+  if (len == 3)
+    return crisp_eval(crisp, car(cdr(cdr(operands))), env);
+  return nil_value(crisp);
+}
+
+bool is_cond_clause(expr_t clause)
+{
+  return is_cons(clause) && is_proper_list(clause);
+}
+
+expr_t b_cond(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  for (; is_cons(operands); operands = cdr(operands))
+  {
+    expr_t clause = car(operands);
+    if (!is_cond_clause(clause))
+    {
+      crisp_eval_error(crisp, "A cond clause must be a list starting with a test");
+      return NULL;
+    }
+
+    if (is_atom(car(clause)) && (as_syntax(car(clause)) == SYNTAX_ELSE))
+      return eval_sequence(crisp, cdr(clause), env);
+
+    expr_t test = crisp_eval(crisp, car(clause), env);
+    if ((test == NULL) || (!not(test) && is_nil(cdr(clause))))
+      return test;
+    if (!not(test))
+      return eval_sequence(crisp, cdr(clause), env);
+  }
   return nil_value(crisp);
 }
 
+static size_t case_slot(case_table_t *table, const char *name)
+{
+  // The low bits of a pointer are the same for every name.
+  uintptr_t hash = ((uintptr_t)name >> 3) * 2654435761u;
+  size_t slot = (size_t)hash & (table->capacity - 1);
+  while ((table->names[slot] != NULL) && (table->names[slot] != name))
+  {
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  return slot;
+}
+
+static bool is_case_clause(expr_t clause, bool last)
+{
+  if (!is_cons(clause) || !is_proper_list(clause) || !is_cons(cdr(clause)))
+    return false;
+  if (is_atom(car(clause)) && (as_syntax(car(clause)) == SYNTAX_ELSE))
+    return last;
+  return is_proper_list(car(clause));
+}
+
+static expr_t case_table(crisp_t *crisp, expr_t operands)
+{
+  size_t symbols = 0;
+  for (expr_t c = cdr(operands); is_cons(c); c = cdr(c))
+  {
+    if (!is_case_clause(car(c), is_nil(cdr(c))))
+    {
+      crisp_eval_error(crisp, "case expects a key and ((datum...) forms...) clauses");
+      return NULL;
+    }
+    for (expr_t d = car(car(c)); is_cons(d); d = cdr(d))
+    {
+      symbols += is_atom(car(d)) ? 1 : 0;
+    }
+  }
+
+  // At most half full.
+  size_t capacity = 8;
+  while (capacity < symbols * 2)
+  {
+    capacity *= 2;
+  }
+
+  expr_t value = case_table_value(crisp, capacity);
+  case_table_t *table = as_case_table(value);
+  expr_t others = NULL;
+  for (expr_t c = cdr(operands); is_cons(c); c = cdr(c))
+  {
+    expr_t clause = car(c);
+    if (is_atom(car(clause)))
+    {
+      table->otherwise = cdr(clause);
+      continue;
+    }
+    for (expr_t d = car(clause); is_cons(d); d = cdr(d))
+    {
+      if (is_atom(car(d)))
+      {
+        // A datum listed again is matched by its first clause.
+        size_t slot = case_slot(table, as_atom(car(d)));
+        if (table->names[slot] == NULL)
+        {
+          table->names[slot] = as_atom(car(d));
+          table->forms[slot] = cdr(clause);
+        }
+      }
+      else
+      {
+        expr_t other = cons(crisp, cons(crisp, car(d), cdr(clause)), nil_value(crisp));
+        if (others == NULL)
+          table->others = other;
+        else
+          set_cdr(others, other);
+        others = other;
+      }
+    }
+  }
+  return value;
+}
+
+expr_t crisp_case_forms(crisp_t *crisp, expr_t operands, expr_t key)
+{
+  if (!is_case_table(operands->as.cons.meta))
+  {
+    expr_t table = case_table(crisp, operands);
+    if (table == NULL)
+      return NULL;
+    operands->as.cons.meta = table;
+  }
+
+  case_table_t *table = as_case_table(operands->as.cons.meta);
+  if (is_atom(key))
+  {
+    size_t slot = case_slot(table, as_atom(key));
+    if (table->names[slot] != NULL)
+      return table->forms[slot];
+  }
+  else
+  {
+    for (expr_t o = table->others; is_cons(o); o = cdr(o))
+    {
+      if (is_eqv(car(car(o)), key))
+        return cdr(car(o));
+    }
+  }
+  return table->otherwise;
+}
+
+expr_t b_case(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  if (!is_cons(operands) || !is_proper_list(operands))
+  {
+    crisp_eval_error(crisp, "case expects a key and ((datum...) forms...) clauses");
+    return NULL;
+  }
+
+  expr_t key = crisp_eval(crisp, car(operands), env);
+  expr_t forms = (key != NULL) ? crisp_case_forms(crisp, operands, key) : NULL;
+  return (forms != NULL) ? eval_sequence(crisp, forms, env) : NULL;
+}
+
+static expr_t b_make_parameter(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return parameter_value(crisp, argv[0]);
+}
+
+// (parameterize ((parameter value)...) forms...) evaluates every parameter
+// and value before binding any of them.
+expr_t b_parameterize(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  if ((length(operands) < 2) || !is_proper_list(operands) ||
+      !(is_nil(car(operands)) || is_proper_list(car(operands))))
+  {
+    crisp_eval_error(crisp, "parameterize expects ((parameter value)...) forms...");
+    return NULL;
+  }
+
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t bindings = car(operands);
+  size_t argc = 2 * length(bindings);
+  expr_t *argv = cek_push_args(stack, argc);
+  for (size_t i = 0; i < argc; i += 2, bindings = cdr(bindings))
+  {
+    expr_t binding = car(bindings);
+    if (!is_proper_list(binding) || (length(binding) != 2))
+    {
+      cek_pop_args(stack, argc);
+      crisp_eval_error(crisp, "parameterize expects ((parameter value)...) forms...");
+      return NULL;
+    }
+    argv[i] = crisp_eval(crisp, car(binding), env);
+    argv[i + 1] = crisp_eval(crisp, car(cdr(binding)), env);
+    if ((argv[i] == NULL) || (argv[i + 1] == NULL))
+    {
+      cek_pop_args(stack, argc);
+      return NULL;
+    }
+    if (!is_parameter(argv[i]))
+    {
+      cek_pop_args(stack, argc);
+      crisp_eval_error(crisp, "parameterize can only bind a parameter");
+      return NULL;
+    }
+  }
+
+  size_t count = stack->binding_count;
+  for (size_t i = 0; i < argc; i += 2)
+  {
+    cek_bind_parameter(stack, argv[i], argv[i + 1]);
+  }
+  cek_pop_args(stack, argc);
+
+  expr_t result = eval_sequence(crisp, cdr(operands), env);
+  cek_unbind_parameters(stack, count);
+  return result;
+}
+
+expr_t b_and(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  expr_t result = bool_value(crisp, true);
+  for (; is_cons(operands); operands = cdr(operands))
+  {
+    result = crisp_eval(crisp, car(operands), env);
+    if ((result == NULL) || not(result))
+      break;
+  }
+  return result;
+}
+
+expr_t b_or(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  expr_t result = bool_value(crisp, false);
+  for (; is_cons(operands); operands = cdr(operands))
+  {
+    result = crisp_eval(crisp, car(operands), env);
+    if ((result == NULL) || !not(result))
+      break;
+  }
+  return result;
+}
+
+bool check_let_form(crisp_t *crisp, expr_t operands)
+{
+  if (length(operands) < 2)
+  {
+    crisp_eval_error(crisp, "let expects bindings and a body");
+    return false;
+  }
+
+  expr_t bindings = car(operands);
+  if (!is_nil(bindings) && !is_proper_list(bindings))
+  {
+    crisp_eval_error(crisp, "let bindings must be a list");
+    return false;
+  }
+
+  for (; is_cons(bindings); bindings = cdr(bindings))
+  {
+    expr_t binding = car(bindings);
+    if (!is_proper_list(binding) || (length(binding) != 2) || !is_atom(car(binding)))
+    {
+      crisp_eval_error(crisp, "A let binding must be a variable and a value");
+      return false;
+    }
+  }
+  return true;
+}
+
+env_t *crisp_let_env(crisp_t *crisp, syntax_t syntax, expr_t operands, env_t *env)
+{
+  // The values of a letrec are made in the frame that they are bound in,
+  // so closures among them must always share it.
+  bool shared = (syntax == SYNTAX_LETREC) || crisp_let_may_escape(crisp, operands);
+  return cek_frame_env(crisp, eval_stack(crisp), env, shared);
+}
+
+bool is_named_let(expr_t operands)
+{
+  return is_cons(operands) && is_atom(car(operands));
+}
+
+env_t *crisp_loop_env(crisp_t *crisp, expr_t operands, env_t *env, expr_t *argv)
+{
+  env_t *frame = crisp_let_env(crisp, SYNTAX_LET, cdr(operands), env);
+  // Only b_recur looks the name up, to find the frame that it loops in.
+  env_set(frame, as_atom(car(operands)), operands);
+  size_t i = 0;
+  for (expr_t bindings = car(cdr(operands)); is_cons(bindings); bindings = cdr(bindings))
+  {
+    env_set(frame, as_atom(car(car(bindings))), argv[i++]);
+  }
+  return frame;
+}
+
+expr_t b_let(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  bool named = is_named_let(operands);
+  expr_t let_operands = named ? cdr(operands) : operands;
+  if (!check_let_form(crisp, let_operands))
+    return NULL;
+
+  // The values are evaluated in the enclosing environment before any of
+  // them are bound.
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t envs = stack->env_count;
+  expr_t bindings = car(let_operands);
+  size_t argc = length(bindings);
+  expr_t *argv = cek_push_args(stack, argc);
+  for (size_t i = 0; i < argc; i++, bindings = cdr(bindings))
+  {
+    argv[i] = crisp_eval(crisp, car(cdr(car(bindings))), env);
+  }
+
+  env_t *frame;
+  if (named)
+  {
+    frame = crisp_loop_env(crisp, operands, env, argv);
+  }
+  else
+  {
+    frame = crisp_let_env(crisp, SYNTAX_LET, operands, env);
+    bindings = car(operands);
+    for (size_t i = 0; i < argc; i++, bindings = cdr(bindings))
+    {
+      env_set(frame, as_atom(car(car(bindings))), argv[i]);
+    }
+  }
+  cek_pop_args(stack, argc);
+
+  expr_t result;
+  do
+  {
+    result = eval_sequence(crisp, cdr(let_operands), frame);
+  } while (named && (result == operands));
+
+  cek_release_envs(stack, envs);
+  return result;
+}
+
+expr_t b_recur(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  // The innermost frame that binds the name is that of the loop.
+  const char *name = as_atom(car(operands));
+  expr_t loop = NULL;
+  env_t *frame = env;
+  while (!env_is_top_level(frame) && !hash_table_get(&frame->table, name, VALUE_PTR(&loop)))
+  {
+    frame = frame->parent;
+  }
+
+  if ((loop == NULL) || !is_named_let(loop) || (length(cdr(operands)) != length(car(cdr(loop)))))
+  {
+    crisp_eval_error(crisp, "No named let %s to loop in", name);
+    return NULL;
+  }
+
+  // Every value is evaluated before any variable is updated.
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t args = cdr(operands);
+  size_t argc = length(args);
+  expr_t *argv = cek_push_args(stack, argc);
+  for (size_t i = 0; i < argc; i++, args = cdr(args))
+  {
+    argv[i] = crisp_eval(crisp, car(args), env);
+    if (argv[i] == NULL)
+    {
+      cek_pop_args(stack, argc);
+      return NULL;
+    }
+  }
+
+  size_t i = 0;
+  for (expr_t bindings = car(cdr(loop)); is_cons(bindings); bindings = cdr(bindings))
+  {
+    env_set(frame, as_atom(car(car(bindings))), argv[i++]);
+  }
+  cek_pop_args(stack, argc);
+  return loop;
+}
+
+// let* and letrec evaluate their values in the frame that they bind them
+// in, one after the other. letrec binds every name before any value is
+// evaluated.
+static expr_t sequential_let(crisp_t *crisp, syntax_t syntax, expr_t operands, env_t *env)
+{
+  if (!check_let_form(crisp, operands))
+    return NULL;
+
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t envs = stack->env_count;
+  env_t *frame = crisp_let_env(crisp, syntax, operands, env);
+
+  expr_t bindings = car(operands);
+  if (syntax == SYNTAX_LETREC)
+  {
+    for (; is_cons(bindings); bindings = cdr(bindings))
+    {
+      env_set(frame, as_atom(car(car(bindings))), nil_value(crisp));
+    }
+    bindings = car(operands);
+  }
+
+  for (; is_cons(bindings); bindings = cdr(bindings))
+  {
+    expr_t value = crisp_eval(crisp, car(cdr(car(bindings))), frame);
+    env_set(frame, as_atom(car(car(bindings))), value);
+  }
+
+  expr_t result = eval_sequence(crisp, cdr(operands), frame);
+  cek_release_envs(stack, envs);
+  return result;
+}
+
+expr_t b_let_star(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  return sequential_let(crisp, SYNTAX_LET_STAR, operands, env);
+}
+
+expr_t b_letrec(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  return sequential_let(crisp, SYNTAX_LETREC, operands, env);
+}
+
+#define ANY TYPE_MASK_ANY
+#define NIL TYPE_MASK(VALUE_TYPE_NIL)
+#define BOOL TYPE_MASK(VALUE_TYPE_BOOL)
+#define NUMBER TYPE_MASK(VALUE_TYPE_NUMBER)
+#define LIST (TYPE_MASK(VALUE_TYPE_CONS) | TYPE_MASK(VALUE_TYPE_NIL))
+#define PAIR TYPE_MASK(VALUE_TYPE_CONS)
+#define SYMBOL TYPE_MASK(VALUE_TYPE_ATOM)
+#define GENERIC TYPE_MASK(VALUE_TYPE_GENERIC)
+#define PARAMETER TYPE_MASK(VALUE_TYPE_PARAMETER)
+#define RECORD_TYPE TYPE_MASK(VALUE_TYPE_RECORD_TYPE)
+#define RECORD_PROCEDURE TYPE_MASK(VALUE_TYPE_RECORD_PROCEDURE)
+#define VECTOR TYPE_MASK(VALUE_TYPE_VECTOR)
+#define ARRAY TYPE_MASK(VALUE_TYPE_ARRAY)
+#define APPLICABLE (TYPE_MASK(VALUE_TYPE_FN) | TYPE_MASK(VALUE_TYPE_LAMBDA) | TYPE_MASK(VALUE_TYPE_CONTINUATION) | GENERIC | PARAMETER | RECORD_PROCEDURE)
+
+static const builtin_t sBuiltins[] = {
+  {"+", &b_add, 1, ARITY_VARIADIC, true, {NUMBER}, NUMBER},
+  {"-", &b_sub, 1, ARITY_VARIADIC, true, {NUMBER}, NUMBER},
+  {"*", &b_mult, 1, ARITY_VARIADIC, true, {NUMBER}, NUMBER},
+  {"/", &b_div, 1, ARITY_VARIADIC, true, {NUMBER}, NUMBER},
+  {"cons", &b_cons, 2, 2, true, {ANY}, PAIR},
+  {"list", &b_list, 0, ARITY_VARIADIC, true, {ANY}, LIST},
+  {"car", &b_car, 1, 1, false, {PAIR}, ANY},
+  {"cdr", &b_cdr, 1, 1, false, {PAIR}, ANY},
+  {"length", &b_length, 1, 1, false, {LIST}, NUMBER},
+  {"list?", &b_is_list, 1, 1, true, {ANY}, BOOL},
+  {"not", &b_not, 1, 1, true, {ANY}, BOOL},
+  {"boolean?", &b_boolean, 1, 1, true, {ANY}, BOOL},
+  {"symbol?", &b_symbol, 1, 1, true, {ANY}, BOOL},
+  {"number?", &b_number, 1, 1, true, {ANY}, BOOL},
+  {"string?", &b_string, 1, 1, true, {ANY}, BOOL},
+  {"map", &b_map, 2, ARITY_VARIADIC, false, {APPLICABLE, LIST}, LIST},
+  {"filter", &b_filter, 2, 2, false, {APPLICABLE, LIST}, LIST},
+  {"fold", &b_fold, 3, 3, false, {APPLICABLE, ANY, LIST}, ANY},
+  // Whether these succeed depends on more than the types of their operands,
+  // so they are not folded.
+  {"append", &b_append, 0, ARITY_VARIADIC, false, {ANY}, ANY},
+  {"reverse", &b_reverse, 1, 1, false, {LIST}, LIST},
+  {"assoc", &b_assoc, 2, 2, false, {ANY, LIST}, PAIR | BOOL},
+  {"make-vector", &b_make_vector, 1, 2, false, {NUMBER, ANY}, VECTOR},
+  {"vector", &b_vector, 0, ARITY_VARIADIC, false, {ANY}, VECTOR},
+  {"vector?", &b_is_vector, 1, 1, true, {ANY}, BOOL},
+  {"vector-length", &b_vector_length, 1, 1, true, {VECTOR}, NUMBER},
+  {"vector-ref", &b_vector_ref, 2, 2, false, {VECTOR, NUMBER}, ANY},
+  {"vector-set!", &b_vector_set, 3, 3, false, {VECTOR, NUMBER, ANY}, NIL},
+  {"vector->list", &b_vector_to_list, 1, 1, false, {VECTOR}, LIST},
+  {"list->vector", &b_list_to_vector, 1, 1, false, {LIST}, VECTOR},
+  {"make-f64-array", &array_make_f64, 1, 2, false, {NUMBER}, ARRAY},
+  {"make-i64-array", &array_make_i64, 1, 2, false, {NUMBER}, ARRAY},
+  {"list->f64-array", &array_list_to_f64, 1, 1, false, {LIST}, ARRAY},
+  {"list->i64-array", &array_list_to_i64, 1, 1, false, {LIST}, ARRAY},
+  {"array->list", &array_to_list, 1, 1, false, {ARRAY}, LIST},
+  {"array?", &array_is_array, 1, 1, true, {ANY}, BOOL},
+  {"array-length", &array_length, 1, 1, true, {ARRAY}, NUMBER},
+  {"array-ref", &array_ref, 2, 2, false, {ARRAY, NUMBER}, NUMBER},
+  {"array-set!", &array_set, 3, 3, false, {ARRAY, NUMBER}, NIL},
+  {"array-sum", &array_sum, 1, 1, false, {ARRAY}, NUMBER},
+  {"array-dot", &array_dot, 2, 2, false, {ARRAY}, NUMBER},
+  {"array-min", &array_min, 1, 1, false, {ARRAY}, NUMBER},
+  {"array-max", &array_max, 1, 1, false, {ARRAY}, NUMBER},
+  {"array-add", &array_add, 2, 2, false, {ARRAY}, ARRAY},
+  {"array-mul", &array_mul, 2, 2, false, {ARRAY}, ARRAY},
+  {"array-scale", &array_scale, 2, 2, false, {ARRAY, NUMBER}, ARRAY},
+  {"array-prefix-sum", &array_prefix_sum, 1, 1, false, {ARRAY}, ARRAY},
+  {"call/ec", &cek_call_ec, 1, 1, false, {APPLICABLE}, ANY},
+  {"make-parameter", &b_make_parameter, 1, 1, false, {ANY}, PARAMETER},
+  {BUILTIN_QUASIQUOTE_CONS, &b_cons, 2, 2, true, {ANY}, PAIR},
+  {BUILTIN_QUASIQUOTE_SPLICE, &b_splice, 2, 2, true, {LIST, ANY}, PAIR},
+  {BUILTIN_MATCH_PAIR, &b_is_pair, 1, 1, true, {ANY}, BOOL},
+  {BUILTIN_MATCH_CAR, &b_first, 1, 1, true, {PAIR}, ANY},
+  {BUILTIN_MATCH_CDR, &b_rest, 1, 1, true, {PAIR}, ANY},
+  {BUILTIN_MATCH_EQV, &b_eqv, 2, 2, true, {ANY}, BOOL},
+  {BUILTIN_MATCH_FAIL, &b_no_match, 1, 1, false, {ANY}, ANY},
+  {BUILTIN_GENERIC_MAKE, &generic_make, 1, 1, false, {SYMBOL}, GENERIC},
+  {BUILTIN_GENERIC_ADD_METHOD, &generic_add_method, 3, 3, false, {GENERIC, LIST, APPLICABLE}, NIL},
+  {BUILTIN_RECORD_TYPE, &record_make_type, 2, 2, false, {SYMBOL, LIST}, RECORD_TYPE},
+  {BUILTIN_RECORD_CONSTRUCTOR, &record_constructor, 2, 2, false, {RECORD_TYPE, LIST}, RECORD_PROCEDURE},
+  {BUILTIN_RECORD_PREDICATE, &record_predicate, 1, 1, false, {RECORD_TYPE}, RECORD_PROCEDURE},
+  {BUILTIN_RECORD_ACCESSOR, &record_accessor, 2, 2, false, {RECORD_TYPE, SYMBOL}, RECORD_PROCEDURE},
+  {BUILTIN_RECORD_MODIFIER, &record_modifier, 2, 2, false, {RECORD_TYPE, SYMBOL}, RECORD_PROCEDURE},
+  {BUILTIN_FUSED, &b_fused, 3, ARITY_VARIADIC, false, {LIST, ANY}, ANY},
+};
+
+#undef ANY
+#undef NIL
+#undef BOOL
+#undef NUMBER
+#undef LIST
+#undef PAIR
+#undef SYMBOL
+#undef GENERIC
+#undef PARAMETER
+#undef RECORD_TYPE
+#undef RECORD_PROCEDURE
+#undef VECTOR
+#undef ARRAY
+#undef APPLICABLE
+
+#define BUILTIN_COUNT (sizeof(sBuiltins) / sizeof(sBuiltins[0]))
+
+const builtin_t *builtin_descriptors(size_t *count)
+{
+  *count = BUILTIN_COUNT;
+  return sBuiltins;
+}
+
+const builtin_t *builtin_descriptor(expr_t fn)
+{
+  // Found by the value rather than its function, which several
+  // descriptors may share.
+  return is_builtin(fn) ? fn->as.fn.descriptor : NULL;
+}
+
+uint32_t builtin_operand_types(const builtin_t *builtin, size_t i)
+{
+  size_t j = (i < BUILTIN_OPERAND_TYPES) ? i : BUILTIN_OPERAND_TYPES - 1;
+  while ((j > 0) && (builtin->operand_types[j] == 0))
+  {
+    j--;
+  }
+  return builtin->operand_types[j];
+}
+
 void register_builtins(crisp_t *crisp)
 {
   env_t *env = root_env(crisp);
-  env_set(env, intern(crisp, "quote"), fn_value(crisp, &b_quote));
-  env_set(env, intern(crisp, "+"), fn_value(crisp, &b_add));
-  env_set(env, intern(crisp, "-"), fn_value(crisp, &b_sub));
-  env_set(env, intern(crisp, "*"), fn_value(crisp, &b_mult));
-  env_set(env, intern(crisp, "/"), fn_value(crisp, &b_div));
-  env_set(env, intern(crisp, "cons"), fn_value(crisp, &b_cons));
-  env_set(env, intern(crisp, "list"), fn_value(crisp, &b_list));
-  env_set(env, intern(crisp, "car"), fn_value(crisp, &b_car));
-  env_set(env, intern(crisp, "cdr"), fn_value(crisp, &b_cdr));
-  env_set(env, intern(crisp, "length"), fn_value(crisp, &b_length));
-  env_set(env, intern(crisp, "list?"), fn_value(crisp, &b_is_list));
-  env_set(env, intern(crisp, "not"), fn_value(crisp, &b_not));
-  env_set(env, intern(crisp, "boolean?"), fn_value(crisp, &b_boolean));
-  env_set(env, intern(crisp, "symbol?"), fn_value(crisp, &b_symbol));
-  env_set(env, intern(crisp, "number?"), fn_value(crisp, &b_number));
-  env_set(env, intern(crisp, "string?"), fn_value(crisp, &b_string));
-  env_set(env, intern(crisp, "lambda"), fn_value(crisp, &b_lambda));
-  env_set(env, intern(crisp, "define"), fn_value(crisp, &b_define));
+  for (size_t i = 0; i < BUILTIN_COUNT; i++)
+  {
+    const builtin_t *b = &sBuiltins[i];
+    expr_t fn = builtin_value(crisp, b->fn, b->min_arity, b->max_arity);
+    fn->as.fn.descriptor = b;
+    if (b->pure)
+      fn->flags |= VALUE_FLAG_PURE;
+    env_set(env, intern(crisp, b->name), fn);
+  }
 }
@@ -2,7 +2,146 @@
 #define CRISPY_BUILTIN_H
 
 #include "common.h"
+#include "value.h"
 
 void register_builtins(crisp_t* crisp);
 
+// A bit for each value_type_t.
+#define TYPE_MASK(type) (1u << (type))
+#define TYPE_MASK_ANY (~0u)
+
+// The arguments of a builtin that have types of their own.
+#define BUILTIN_OPERAND_TYPES 3
+
+// What the interpreter knows about a builtin procedure. Each is bound in
+// the root environment by register_builtins from one of these. Special
+// forms are not values, they are the keywords of syntax_t.
+typedef struct builtin_t
+{
+  const char* name;
+  builtin_fn_t fn;
+  // The arity, checked before fn is called.
+  size_t min_arity;
+  size_t max_arity;
+  // Whether the result depends only on the arguments, in which case the
+  // optimizer may apply fn to constant arguments ahead of time.
+  bool pure;
+  // The types that each argument must have for fn to succeed, and the
+  // types that its result may have. A mask that is left out, zero, is
+  // that of the argument before it, so the last mask given holds for the
+  // rest of the arguments. See builtin_operand_types.
+  uint32_t operand_types[BUILTIN_OPERAND_TYPES];
+  uint32_t result_types;
+} builtin_t;
+
+// The types that argument i of a builtin must have.
+uint32_t builtin_operand_types(const builtin_t* builtin, size_t i);
+
+// The descriptors of all builtins, count is set to the number of them.
+const builtin_t* builtin_descriptors(size_t* count);
+// The descriptor of a builtin value, NULL for a builtin made elsewhere,
+// such as by a program translated by crispc.
+const builtin_t* builtin_descriptor(expr_t fn);
+
+// The builtins that the expander builds quasiquote templates with. No
+// program can spell their names, so no program can rebind them.
+#define BUILTIN_QUASIQUOTE_CONS "cons#quasiquote"
+#define BUILTIN_QUASIQUOTE_SPLICE "splice#quasiquote"
+
+// The builtins that the expander compiles a match form with. The parts of
+// a pair are only taken once it has been tested to be one, so they are not
+// checked again.
+#define BUILTIN_MATCH_PAIR "pair#match"
+#define BUILTIN_MATCH_CAR "car#match"
+#define BUILTIN_MATCH_CDR "cdr#match"
+#define BUILTIN_MATCH_EQV "eqv#match"
+#define BUILTIN_MATCH_FAIL "fail#match"
+
+// The builtins that the expander rewrites define-generic and
+// define-method to. See generic.h.
+#define BUILTIN_GENERIC_MAKE "make#generic"
+#define BUILTIN_GENERIC_ADD_METHOD "add-method#generic"
+
+// The builtins that the expander rewrites define-record-type to. See
+// record.h.
+#define BUILTIN_RECORD_TYPE "make#record-type"
+#define BUILTIN_RECORD_CONSTRUCTOR "constructor#record"
+#define BUILTIN_RECORD_PREDICATE "predicate#record"
+#define BUILTIN_RECORD_ACCESSOR "accessor#record"
+#define BUILTIN_RECORD_MODIFIER "modifier#record"
+
+typedef double (*binary_op_t)(double a, double b);
+
+// The operation that a numeric builtin folds over its arguments, or NULL
+// if fn is not one.
+binary_op_t builtin_numeric_op(expr_t fn);
+
+// The list builtins that the optimizer fuses a chain of into a single
+// call of BUILTIN_FUSED, (map f list), (filter f list) and
+// (fold f init list). See crisp_optimize.
+typedef enum
+{
+  LIST_STAGE_NONE,
+  LIST_STAGE_MAP,
+  LIST_STAGE_FILTER,
+  LIST_STAGE_FOLD,
+} list_stage_t;
+
+// The stage that fn is, or LIST_STAGE_NONE if it is not one of the list
+// builtins.
+list_stage_t builtin_list_stage(expr_t fn);
+// The name of a stage, as listed by a call of BUILTIN_FUSED.
+const char* list_stage_name(list_stage_t stage);
+
+// (fused#list '(stage...) operands... list) passes each element of list
+// through the stages in turn, from the last listed to the first, without
+// building the lists that the chain of calls it replaced would have built
+// in between. The operands are the procedure of each stage, followed by
+// the initial value of a fold, in the order the stages are listed.
+#define BUILTIN_FUSED "fused#list"
+#define FUSED_MAX_STAGES 8
+
+// The special forms, applied to the operands of a form by
+// crisp_eval_syntax.
+expr_t b_quote(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_lambda(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_define(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_set(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_begin(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_if(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_cond(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_and(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_or(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_let(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_let_star(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_letrec(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_recur(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_case(crisp_t* crisp, expr_t operands, env_t* env);
+expr_t b_parameterize(crisp_t* crisp, expr_t operands, env_t* env);
+
+// A clause of a cond form, (test forms...).
+bool is_cond_clause(expr_t clause);
+// Checks the operands (bindings forms...) of a let, let* or letrec form,
+// raising an eval error if they are malformed.
+bool check_let_form(crisp_t* crisp, expr_t operands);
+// The frame that a let, let* or letrec form binds its variables in.
+env_t* crisp_let_env(crisp_t* crisp, syntax_t syntax, expr_t operands, env_t* env);
+
+// The forms of the clause of a case form, with operands
+// (key ((datum...) forms...)... (else forms...)), that lists a datum
+// equivalent to the value of the key. () if no clause does. The clauses
+// are compiled into a jump table, keyed on the interned names of the
+// symbols they list, the first time the form is evaluated, and cached on
+// the operands. Returns NULL if an eval error was raised.
+expr_t crisp_case_forms(crisp_t* crisp, expr_t operands, expr_t key);
+
+// The operands (name bindings forms...) of a named let. The expander only
+// leaves a named let whose name is called in tail position and nowhere
+// else, each call having been rewritten to (recur#loop name operands...).
+// Such a let is a loop, run in the one frame, which b_recur updates in
+// place and returns the operands of the named let to go round again.
+bool is_named_let(expr_t operands);
+// The frame that a named let loops in, with its variables bound to argv.
+env_t* crisp_loop_env(crisp_t* crisp, expr_t operands, env_t* env, expr_t* argv);
+
 #endif
@@ -0,0 +1,931 @@
+#include "cek.h"
+#include "value.h"
+#include "value_support.h"
+#include "memory.h"
+#include "environment.h"
+#include "evaluator.h"
+#include "interpreter_internal.h"
+#include "builtins.h"
+#include "generic.h"
+
+#include <stdlib.h>
+
+static const size_t sMinFrames = 64;
+static const size_t sMinSegmentSize = 1024;
+static const size_t sMinEnvs = 64;
+static const size_t sMinBindings = 16;
+
+static frame_t *push_frame(crisp_t *crisp, cek_stack_t *stack, frame_type_t type, env_t *env);
+static void grow_stack(cek_stack_t *stack);
+static void free_segment(cek_stack_t *stack);
+static bool is_live_escape(cek_stack_t *stack, expr_t k);
+static void land_escape(cek_stack_t *stack);
+static void release_dead_envs(cek_stack_t *stack, size_t depth);
+static expr_t start_syntax(crisp_t *crisp, cek_stack_t *stack, expr_t node, env_t **env, expr_t *value);
+static expr_t resume_syntax(crisp_t *crisp, cek_stack_t *stack, frame_t *f, env_t **env, expr_t *value);
+static expr_t run_machine(crisp_t *crisp, cek_stack_t *stack, size_t base, expr_t control, env_t *env, expr_t value);
+
+void cek_stack_init(cek_stack_t *stack)
+{
+  stack->args = NULL;
+  stack->frames = NULL;
+  stack->depth = 0;
+  stack->capacity = 0;
+  stack->max_depth = CEK_DEFAULT_MAX_DEPTH;
+  stack->run = NULL;
+  stack->envs = NULL;
+  stack->env_count = 0;
+  stack->env_capacity = 0;
+  stack->free_envs = NULL;
+  stack->escape_frame = 0;
+  stack->escape_value = NULL;
+  stack->bindings = NULL;
+  stack->binding_count = 0;
+  stack->binding_capacity = 0;
+}
+
+void cek_stack_free(cek_stack_t *stack)
+{
+  while (stack->args != NULL)
+  {
+    free_segment(stack);
+  }
+
+  if (stack->capacity > 0)
+  {
+    FREE_ARRAY(frame_t, stack->frames, stack->capacity);
+  }
+
+  if (stack->binding_capacity > 0)
+  {
+    FREE_ARRAY(binding_t, stack->bindings, stack->binding_capacity);
+  }
+
+  cek_release_envs(stack, 0);
+  while (stack->free_envs != NULL)
+  {
+    env_t *env = stack->free_envs;
+    stack->free_envs = env->parent;
+    env_free_region(env);
+  }
+  if (stack->env_capacity > 0)
+  {
+    FREE_ARRAY(env_t *, stack->envs, stack->env_capacity);
+  }
+  cek_stack_init(stack);
+}
+
+void cek_stack_mark(crisp_t *crisp, cek_stack_t *stack)
+{
+  for (size_t i = 0; i < stack->depth; i++)
+  {
+    frame_t *f = &stack->frames[i];
+    crisp_gc_mark_value(crisp, f->fn);
+    crisp_gc_mark_value(crisp, f->rest);
+    crisp_gc_mark_env(crisp, f->env);
+  }
+
+  for (arg_segment_t *s = stack->args; s != NULL; s = s->prev)
+  {
+    for (size_t i = 0; i < s->top; i++)
+    {
+      crisp_gc_mark_value(crisp, s->values[i]);
+    }
+  }
+
+  for (size_t i = 0; i < stack->env_count; i++)
+  {
+    crisp_gc_mark_env(crisp, stack->envs[i]);
+  }
+
+  for (size_t i = 0; i < stack->binding_count; i++)
+  {
+    crisp_gc_mark_value(crisp, stack->bindings[i].parameter);
+    crisp_gc_mark_value(crisp, stack->bindings[i].saved);
+  }
+
+  crisp_gc_mark_value(crisp, stack->escape_value);
+}
+
+cek_state_t cek_save_state(cek_stack_t *stack)
+{
+  cek_state_t state;
+  state.depth = stack->depth;
+  state.run = stack->run;
+  state.args.segment = stack->args;
+  state.args.top = (stack->args != NULL) ? stack->args->top : 0;
+  state.envs = stack->env_count;
+  state.bindings = stack->binding_count;
+  return state;
+}
+
+void cek_restore_state(cek_stack_t *stack, cek_state_t state)
+{
+  stack->depth = state.depth;
+  stack->run = state.run;
+
+  while (stack->args != state.args.segment)
+  {
+    free_segment(stack);
+  }
+
+  if (stack->args != NULL)
+  {
+    stack->args->top = state.args.top;
+  }
+
+  cek_release_envs(stack, state.envs);
+  cek_unbind_parameters(stack, state.bindings);
+}
+
+void cek_bind_parameter(cek_stack_t *stack, expr_t parameter, expr_t value)
+{
+  if (stack->binding_count == stack->binding_capacity)
+  {
+    size_t new_capacity = (stack->binding_capacity < sMinBindings) ? sMinBindings : stack->binding_capacity * 2;
+    binding_t *new_bindings = ALLOCATE(binding_t, new_capacity);
+    if (stack->binding_capacity > 0)
+    {
+      memcpy(new_bindings, stack->bindings, sizeof(binding_t) * stack->binding_count);
+      FREE_ARRAY(binding_t, stack->bindings, stack->binding_capacity);
+    }
+    stack->bindings = new_bindings;
+    stack->binding_capacity = new_capacity;
+  }
+
+  binding_t *b = &stack->bindings[stack->binding_count++];
+  b->parameter = parameter;
+  b->saved = as_parameter(parameter);
+  as_parameter(parameter) = value;
+}
+
+void cek_unbind_parameters(cek_stack_t *stack, size_t count)
+{
+  // Innermost first, so a parameter bound twice gets its outermost value.
+  while (stack->binding_count > count)
+  {
+    binding_t *b = &stack->bindings[--stack->binding_count];
+    as_parameter(b->parameter) = b->saved;
+  }
+}
+
+expr_t *cek_push_args(cek_stack_t *stack, size_t count)
+{
+  arg_segment_t *s = stack->args;
+
+  if ((s == NULL) || ((s->capacity - s->top) < count))
+  {
+    size_t capacity = (count > sMinSegmentSize) ? count : sMinSegmentSize;
+    s = ALLOCATE(arg_segment_t, 1);
+    s->values = ALLOCATE(expr_t, capacity);
+    s->capacity = capacity;
+    s->top = 0;
+    s->prev = stack->args;
+    stack->args = s;
+  }
+
+  expr_t *argv = &s->values[s->top];
+  for (size_t i = 0; i < count; i++)
+  {
+    argv[i] = NULL;
+  }
+  s->top += count;
+  return argv;
+}
+
+void cek_pop_args(cek_stack_t *stack, size_t count)
+{
+  arg_segment_t *s = stack->args;
+  if (s == NULL)
+    return;
+
+  s->top -= count;
+  if ((s->top == 0) && (s->prev != NULL))
+  {
+    free_segment(stack);
+  }
+}
+
+env_t *cek_push_env(crisp_t *crisp, cek_stack_t *stack, env_t *parent)
+{
+  (void)crisp;
+
+  if (stack->env_count == stack->env_capacity)
+  {
+    size_t new_capacity = (stack->env_capacity < sMinEnvs) ? sMinEnvs : stack->env_capacity * 2;
+    env_t **new_envs = ALLOCATE(env_t *, new_capacity);
+    if (stack->env_capacity > 0)
+    {
+      memcpy(new_envs, stack->envs, sizeof(env_t *) * stack->env_count);
+      FREE_ARRAY(env_t *, stack->envs, stack->env_capacity);
+    }
+    stack->envs = new_envs;
+    stack->env_capacity = new_capacity;
+  }
+
+  env_t *env = stack->free_envs;
+  if (env != NULL)
+  {
+    stack->free_envs = env->parent;
+    env->parent = parent;
+  }
+  else
+  {
+    env = env_init_region(parent);
+  }
+
+  env->region_depth = stack->depth;
+  stack->envs[stack->env_count++] = env;
+  return env;
+}
+
+void cek_release_envs(cek_stack_t *stack, size_t count)
+{
+  while (stack->env_count > count)
+  {
+    env_t *env = stack->envs[--stack->env_count];
+
+    // A captured frame belongs to the garbage collector now.
+    if (env->in_region)
+    {
+      env_reset_region(env);
+      env->parent = stack->free_envs;
+      stack->free_envs = env;
+    }
+  }
+}
+
+env_t *cek_frame_env(crisp_t *crisp, cek_stack_t *stack, env_t *parent, bool shared)
+{
+  env_t *env = shared ? env_init_child(crisp, parent) : cek_push_env(crisp, stack, parent);
+  env->shared = shared;
+  return env;
+}
+
+expr_t cek_eval(crisp_t *crisp, expr_t node, env_t *env)
+{
+  if (node == NULL)
+    return NULL;
+
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t result = NULL;
+
+  cek_run_t run;
+  run.prev = stack->run;
+  run.base = stack->depth;
+  run.env_base = stack->env_count;
+  stack->run = &run;
+
+  if (setjmp(run.jump) == 0)
+  {
+    result = run_machine(crisp, stack, run.base, node, env, NULL);
+  }
+  else if (stack->escape_frame >= run.base)
+  {
+    // An escape targeting a frame owned by this run. Drop everything
+    // above the escape frame (including the frame itself) and continue
+    // by returning the value to whatever was waiting on the call/ec.
+    land_escape(stack);
+    result = run_machine(crisp, stack, run.base, NULL, NULL, stack->escape_value);
+  }
+  else
+  {
+    // The target is further down the stack, pass the escape on.
+    stack->run = run.prev;
+    longjmp(run.prev->jump, 1);
+  }
+
+  // Every call made by the run is over.
+  cek_release_envs(stack, run.env_base);
+  stack->run = run.prev;
+  return result;
+}
+
+expr_t cek_call_ec(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  // This is the path taken by the recursive evaluator. The CEK machine
+  // recognises call/ec and handles it without recursing.
+  (void)argc;
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t frame = stack->depth;
+  expr_t k = continuation_value(crisp, frame);
+  expr_t fn = argv[0];
+  frame_t *f = push_frame(crisp, stack, FRAME_ESCAPE, NULL);
+  if (f == NULL)
+    return NULL;
+  f->fn = k;
+
+  expr_t result = NULL;
+
+  cek_run_t run;
+  run.prev = stack->run;
+  run.base = frame;
+  run.env_base = stack->env_count;
+  stack->run = &run;
+
+  if (setjmp(run.jump) == 0)
+  {
+    result = crisp_apply(crisp, fn, cons(crisp, k, nil_value(crisp)), NULL);
+  }
+  else if (stack->escape_frame >= run.base)
+  {
+    land_escape(stack);
+    result = stack->escape_value;
+  }
+  else
+  {
+    stack->run = run.prev;
+    longjmp(run.prev->jump, 1);
+  }
+
+  cek_release_envs(stack, run.env_base);
+  stack->run = run.prev;
+  stack->depth = frame;
+  return result;
+}
+
+void cek_escape(crisp_t *crisp, expr_t k, expr_t value)
+{
+  cek_stack_t *stack = eval_stack(crisp);
+  if (!is_live_escape(stack, k))
+  {
+    crisp_eval_error(crisp, "Escape continuation is no longer active");
+    return;
+  }
+
+  stack->escape_frame = as_continuation(k);
+  stack->escape_value = value;
+  longjmp(stack->run->jump, 1);
+}
+
+static frame_t *push_frame(crisp_t *crisp, cek_stack_t *stack, frame_type_t type, env_t *env)
+{
+  if (stack->depth >= stack->max_depth)
+  {
+    crisp_eval_error(crisp, "Maximum evaluation depth of %zu exceeded", stack->max_depth);
+    return NULL;
+  }
+
+  if (stack->depth == stack->capacity)
+  {
+    grow_stack(stack);
+  }
+
+  frame_t *f = &stack->frames[stack->depth++];
+  f->type = type;
+  f->fn = NULL;
+  f->rest = NULL;
+  f->env = env;
+  if (type == FRAME_ESCAPE)
+  {
+    f->as.escape.mark.segment = stack->args;
+    f->as.escape.mark.top = (stack->args != NULL) ? stack->args->top : 0;
+    f->as.escape.bindings = stack->binding_count;
+  }
+  else
+  {
+    f->as.args.argv = NULL;
+    f->as.args.argc = 0;
+    f->as.args.argi = 0;
+  }
+  return f;
+}
+
+static void grow_stack(cek_stack_t *stack)
+{
+  size_t new_capacity = stack->capacity * 2;
+  if (new_capacity < sMinFrames)
+  {
+    new_capacity = sMinFrames;
+  }
+
+  // Reallocation is not supported by the allocator so copy the frames
+  // across by hand.
+  frame_t *new_frames = ALLOCATE(frame_t, new_capacity);
+  if (stack->capacity > 0)
+  {
+    memcpy(new_frames, stack->frames, sizeof(frame_t) * stack->depth);
+    FREE_ARRAY(frame_t, stack->frames, stack->capacity);
+  }
+  stack->frames = new_frames;
+  stack->capacity = new_capacity;
+}
+
+static void free_segment(cek_stack_t *stack)
+{
+  arg_segment_t *s = stack->args;
+  stack->args = s->prev;
+  FREE_ARRAY(expr_t, s->values, s->capacity);
+  FREE(arg_segment_t, s);
+}
+
+static bool is_live_escape(cek_stack_t *stack, expr_t k)
+{
+  size_t frame = as_continuation(k);
+  return (frame < stack->depth) &&
+         (stack->frames[frame].type == FRAME_ESCAPE) &&
+         (stack->frames[frame].fn == k);
+}
+
+// Release the region frames made at or above the given depth, those of the
+// calls that are over. Frames are made in order of increasing depth, so
+// only the newest need to be looked at.
+static void release_dead_envs(cek_stack_t *stack, size_t depth)
+{
+  size_t count = stack->env_count;
+  while ((count > stack->run->env_base) &&
+         (stack->envs[count - 1]->region_depth >= depth))
+  {
+    count--;
+  }
+  cek_release_envs(stack, count);
+}
+
+// Discard the escape frame that is the target of the escape in flight,
+// along with every frame, argument and parameter binding above it.
+static void land_escape(cek_stack_t *stack)
+{
+  cek_unbind_parameters(stack, stack->frames[stack->escape_frame].as.escape.bindings);
+  arg_mark_t mark = stack->frames[stack->escape_frame].as.escape.mark;
+  while (stack->args != mark.segment)
+  {
+    free_segment(stack);
+  }
+  if (stack->args != NULL)
+  {
+    stack->args->top = mark.top;
+  }
+  stack->depth = stack->escape_frame;
+}
+
+// Special forms
+//
+// Each of these returns the next form for the machine to evaluate, in the
+// environment left in env. Otherwise it returns NULL with the value of the
+// form in value, which is NULL if an error was raised.
+
+static expr_t fail(expr_t *value)
+{
+  *value = NULL;
+  return NULL;
+}
+
+static expr_t push_syntax_frame(crisp_t *crisp, cek_stack_t *stack, frame_type_t type,
+                                env_t *env, expr_t rest, expr_t control, expr_t *value)
+{
+  frame_t *f = push_frame(crisp, stack, type, env);
+  if (f == NULL)
+    return fail(value);
+  f->rest = rest;
+  return control;
+}
+
+// Evaluates a sequence of forms, the last of them in tail position.
+static expr_t start_sequence(crisp_t *crisp, cek_stack_t *stack, expr_t forms, env_t *env, expr_t *value)
+{
+  if (!is_cons(forms))
+  {
+    *value = nil_value(crisp);
+    return NULL;
+  }
+
+  if (is_cons(cdr(forms)))
+    return push_syntax_frame(crisp, stack, FRAME_BODY, env, cdr(forms), car(forms), value);
+  return car(forms);
+}
+
+// Evaluates the test of the first of a list of cond clauses.
+static expr_t start_clause(crisp_t *crisp, cek_stack_t *stack, expr_t clauses, env_t *env, expr_t *value)
+{
+  if (!is_cons(clauses))
+  {
+    *value = nil_value(crisp);
+    return NULL;
+  }
+
+  expr_t clause = car(clauses);
+  if (!is_cond_clause(clause))
+  {
+    crisp_eval_error(crisp, "A cond clause must be a list starting with a test");
+    return fail(value);
+  }
+
+  if (is_atom(car(clause)) && (as_syntax(car(clause)) == SYNTAX_ELSE))
+    return start_sequence(crisp, stack, cdr(clause), env, value);
+  return push_syntax_frame(crisp, stack, FRAME_COND, env, clauses, car(clause), value);
+}
+
+// Binds the values of a let once they have all been evaluated, and starts
+// on its body.
+static expr_t enter_let(crisp_t *crisp, cek_stack_t *stack, expr_t operands, env_t *env,
+                        expr_t *argv, size_t argc, env_t **body_env, expr_t *value)
+{
+  release_dead_envs(stack, stack->depth + 1);
+  if (is_named_let(operands))
+  {
+    env_t *loop = crisp_loop_env(crisp, operands, env, argv);
+    cek_pop_args(stack, argc);
+
+    *body_env = loop;
+    frame_t *f = push_frame(crisp, stack, FRAME_LOOP, loop);
+    if (f == NULL)
+      return fail(value);
+    f->fn = operands;
+    return start_sequence(crisp, stack, cdr(cdr(operands)), loop, value);
+  }
+
+  env_t *frame = crisp_let_env(crisp, SYNTAX_LET, operands, env);
+  expr_t bindings = car(operands);
+  for (size_t i = 0; i < argc; i++, bindings = cdr(bindings))
+  {
+    env_set(frame, as_atom(car(car(bindings))), argv[i]);
+  }
+  cek_pop_args(stack, argc);
+
+  *body_env = frame;
+  return start_sequence(crisp, stack, cdr(operands), frame, value);
+}
+
+static expr_t start_let(crisp_t *crisp, cek_stack_t *stack, syntax_t syntax, expr_t operands,
+                        env_t **env, expr_t *value)
+{
+  // The bindings of a named let follow its name.
+  bool named = (syntax == SYNTAX_LET) && is_named_let(operands);
+  if (!check_let_form(crisp, named ? cdr(operands) : operands))
+    return fail(value);
+
+  expr_t bindings = named ? car(cdr(operands)) : car(operands);
+  if (syntax == SYNTAX_LET)
+  {
+    // The values are collected before the frame that binds them is made.
+    size_t argc = length(bindings);
+    if (argc == 0)
+      return enter_let(crisp, stack, operands, *env, NULL, 0, env, value);
+
+    expr_t *argv = cek_push_args(stack, argc);
+    frame_t *f = push_frame(crisp, stack, FRAME_LET, *env);
+    if (f == NULL)
+      return fail(value);
+    f->fn = operands;
+    f->rest = bindings;
+    f->as.args.argv = argv;
+    f->as.args.argc = argc;
+    return car(cdr(car(bindings)));
+  }
+
+  // Frames deeper than the one that the form is evaluated in are dead,
+  // but that one may well be the parent of this one.
+  release_dead_envs(stack, stack->depth + 1);
+  env_t *frame = crisp_let_env(crisp, syntax, operands, *env);
+  if (syntax == SYNTAX_LETREC)
+  {
+    for (expr_t b = bindings; is_cons(b); b = cdr(b))
+    {
+      env_set(frame, as_atom(car(car(b))), nil_value(crisp));
+    }
+  }
+
+  *env = frame;
+  if (!is_cons(bindings))
+    return start_sequence(crisp, stack, cdr(operands), frame, value);
+
+  frame_t *f = push_frame(crisp, stack, FRAME_LET_STAR, frame);
+  if (f == NULL)
+    return fail(value);
+  f->fn = operands;
+  f->rest = bindings;
+  return car(cdr(car(bindings)));
+}
+
+static expr_t start_syntax(crisp_t *crisp, cek_stack_t *stack, expr_t node, env_t **env, expr_t *value)
+{
+  syntax_t syntax = as_syntax(car(node));
+  expr_t operands = cdr(node);
+  size_t len = length(operands);
+
+  switch (syntax)
+  {
+  case SYNTAX_IF:
+    if ((len != 2) && (len != 3))
+      break;
+    return push_syntax_frame(crisp, stack, FRAME_IF, *env, cdr(operands), car(operands), value);
+
+  case SYNTAX_COND:
+    return start_clause(crisp, stack, operands, *env, value);
+
+  case SYNTAX_CASE:
+    if (len == 0)
+      break;
+    return push_syntax_frame(crisp, stack, FRAME_CASE, *env, operands, car(operands), value);
+
+  case SYNTAX_BEGIN:
+    return start_sequence(crisp, stack, operands, *env, value);
+
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    if (len == 0)
+    {
+      *value = bool_value(crisp, syntax == SYNTAX_AND);
+      return NULL;
+    }
+    if (len == 1)
+      return car(operands);
+    return push_syntax_frame(crisp, stack, (syntax == SYNTAX_AND) ? FRAME_AND : FRAME_OR,
+                             *env, cdr(operands), car(operands), value);
+
+  case SYNTAX_LET:
+  case SYNTAX_LET_STAR:
+  case SYNTAX_LETREC:
+    return start_let(crisp, stack, syntax, operands, env, value);
+
+  default:
+    break;
+  }
+
+  // Forms with nothing in tail position, and malformed forms, are left to
+  // the recursive implementation.
+  *value = crisp_eval_syntax(crisp, syntax, operands, *env);
+  return NULL;
+}
+
+// Returns value to the special form frame f on top of the stack.
+static expr_t resume_syntax(crisp_t *crisp, cek_stack_t *stack, frame_t *f, env_t **env, expr_t *value)
+{
+  *env = f->env;
+
+  switch (f->type)
+  {
+  case FRAME_IF:
+    stack->depth--;
+    if (!not(*value))
+      return car(f->rest);
+    if (is_cons(cdr(f->rest)))
+      return car(cdr(f->rest));
+    *value = nil_value(crisp);
+    return NULL;
+
+  case FRAME_COND:
+  {
+    // The frame is popped, so read it before anything else is pushed.
+    expr_t clauses = f->rest;
+    stack->depth--;
+    if (not(*value))
+      return start_clause(crisp, stack, cdr(clauses), *env, value);
+    if (is_nil(cdr(car(clauses))))
+      return NULL;
+    return start_sequence(crisp, stack, cdr(car(clauses)), *env, value);
+  }
+
+  case FRAME_CASE:
+  {
+    stack->depth--;
+    expr_t forms = crisp_case_forms(crisp, f->rest, *value);
+    if (forms == NULL)
+      return fail(value);
+    return start_sequence(crisp, stack, forms, *env, value);
+  }
+
+  case FRAME_AND:
+  case FRAME_OR:
+    if (not(*value) == (f->type == FRAME_AND))
+    {
+      stack->depth--;
+      return NULL;
+    }
+    {
+      expr_t next = car(f->rest);
+      f->rest = cdr(f->rest);
+      if (!is_cons(f->rest))
+      {
+        // The last operand is in tail position.
+        stack->depth--;
+      }
+      return next;
+    }
+
+  case FRAME_LET:
+    f->as.args.argv[f->as.args.argi++] = *value;
+    f->rest = cdr(f->rest);
+    if (is_cons(f->rest))
+      return car(cdr(car(f->rest)));
+    stack->depth--;
+    return enter_let(crisp, stack, f->fn, f->env, f->as.args.argv, f->as.args.argc, env, value);
+
+  case FRAME_LET_STAR:
+    env_set(f->env, as_atom(car(car(f->rest))), *value);
+    f->rest = cdr(f->rest);
+    if (is_cons(f->rest))
+      return car(cdr(car(f->rest)));
+    stack->depth--;
+    return start_sequence(crisp, stack, cdr(f->fn), f->env, value);
+
+  case FRAME_LOOP:
+    if (*value != f->fn)
+    {
+      stack->depth--;
+      return NULL;
+    }
+    // b_recur has updated the variables, nothing made by the last time
+    // round the body is live.
+    release_dead_envs(stack, stack->depth);
+    return start_sequence(crisp, stack, cdr(cdr(f->fn)), f->env, value);
+
+  default:
+    break;
+  }
+  return NULL;
+}
+
+// Runs the machine until the stack returns to base.
+// When control is non-null the machine starts by evaluating it in env,
+// otherwise it starts by returning value to the top frame.
+static expr_t run_machine(crisp_t *crisp, cek_stack_t *stack, size_t base, expr_t control, env_t *env, expr_t value)
+{
+  while (true)
+  {
+    if (control != NULL)
+    {
+      if (is_atom(control))
+      {
+        value = crisp_resolve_atom(crisp, control, env);
+      }
+      else if (pair(control))
+      {
+        if (!is_proper_list(control))
+        {
+          crisp_eval_error(crisp, "Invalid list");
+          value = NULL;
+        }
+        else if (is_syntax(car(control)))
+        {
+          control = start_syntax(crisp, stack, control, &env, &value);
+          continue;
+        }
+        else
+        {
+          frame_t *f = push_frame(crisp, stack, FRAME_APPLY, env);
+          if (f != NULL)
+          {
+            f->rest = cdr(control);
+            control = car(control);
+            continue;
+          }
+          value = NULL;
+        }
+      }
+      else
+      {
+        value = control;
+      }
+      control = NULL;
+    }
+
+    // An error has been raised without a jump buffer to unwind to.
+    if (value == NULL)
+    {
+      stack->depth = base;
+      return NULL;
+    }
+
+    if (stack->depth == base)
+    {
+      return value;
+    }
+
+    frame_t *f = &stack->frames[stack->depth - 1];
+
+    if (f->type == FRAME_BODY)
+    {
+      env = f->env;
+      control = car(f->rest);
+      f->rest = cdr(f->rest);
+      if (is_nil(f->rest))
+      {
+        // The last body is evaluated in tail position.
+        stack->depth--;
+      }
+      continue;
+    }
+
+    if (f->type == FRAME_ESCAPE)
+    {
+      // Normal return through a call/ec.
+      stack->depth--;
+      continue;
+    }
+
+    if (f->type != FRAME_APPLY)
+    {
+      control = resume_syntax(crisp, stack, f, &env, &value);
+      continue;
+    }
+
+    // FRAME_APPLY
+    if (f->fn == NULL)
+    {
+      f->fn = value;
+      if (is_special_form(value))
+      {
+        // Special forms receive their operands unevaluated.
+        expr_t operands = f->rest;
+        env_t *operand_env = f->env;
+        stack->depth--;
+        value = as_fn(value)(crisp, operands, operand_env);
+        continue;
+      }
+
+      // Evaluated operands are collected in an argument vector.
+      f->as.args.site = f->rest;
+      f->as.args.argc = length(f->rest);
+      f->as.args.argv = cek_push_args(stack, f->as.args.argc);
+    }
+    else
+    {
+      f->as.args.argv[f->as.args.argi++] = value;
+    }
+
+    if (is_cons(f->rest))
+    {
+      env = f->env;
+      control = car(f->rest);
+      f->rest = cdr(f->rest);
+      continue;
+    }
+
+    // All the operands have been evaluated, apply the operator.
+    expr_t fn = f->fn;
+    size_t argc = f->as.args.argc;
+    expr_t *argv = f->as.args.argv;
+    env_t *call_env = f->env;
+    expr_t site = f->as.args.site;
+    stack->depth--;
+
+    // The method of a generic function is applied in its place, in tail
+    // position.
+    if (is_generic(fn))
+    {
+      fn = crisp_dispatch(crisp, fn, site, argc, argv);
+      if (fn == NULL)
+      {
+        cek_pop_args(stack, argc);
+        value = NULL;
+        continue;
+      }
+    }
+
+    // call/ec applies its operand to a fresh escape continuation
+    // whose extent is delimited by an escape frame.
+    if (is_builtin(fn) && (as_builtin(fn) == cek_call_ec) && (argc == 1))
+    {
+      expr_t k = continuation_value(crisp, stack->depth);
+      fn = argv[0];
+      cek_pop_args(stack, argc);
+
+      frame_t *escape = push_frame(crisp, stack, FRAME_ESCAPE, call_env);
+      if (escape == NULL)
+      {
+        stack->depth = base;
+        return NULL;
+      }
+      escape->fn = k;
+
+      argc = 1;
+      argv = cek_push_args(stack, argc);
+      argv[0] = k;
+    }
+
+    if (is_lambda(fn))
+    {
+      lambda_t *lambda = as_lambda(fn);
+      release_dead_envs(stack, stack->depth);
+      env = cek_frame_env(crisp, stack, lambda->env, lambda->frame_escapes);
+      crisp_bind_args(crisp, env, lambda->formals, argc, argv);
+      cek_pop_args(stack, argc);
+
+      control = car(lambda->bodies);
+      if (is_cons(cdr(lambda->bodies)))
+      {
+        frame_t *body = push_frame(crisp, stack, FRAME_BODY, env);
+        if (body == NULL)
+        {
+          stack->depth = base;
+          return NULL;
+        }
+        body->rest = cdr(lambda->bodies);
+      }
+    }
+    else if (is_continuation(fn) && (argc == 1) &&
+             is_live_escape(stack, fn) && (as_continuation(fn) >= base))
+    {
+      // The cheap case, the target is owned by this run.
+      value = argv[0];
+      stack->escape_frame = as_continuation(fn);
+      land_escape(stack);
+    }
+    else
+    {
+      value = crisp_apply_argv(crisp, fn, argc, argv, call_env);
+      cek_pop_args(stack, argc);
+    }
+  }
+}
@@ -0,0 +1,211 @@
+#ifndef CRISP_CEK_H
+#define CRISP_CEK_H
+
+#include "common.h"
+
+#include <setjmp.h>
+
+// An evaluator based on the CEK abstract machine (Control, Environment,
+// Kontinuation).
+//
+// Rather than recursing through crisp_eval on the native C stack, the
+// pending work of an evaluation is recorded as frames on a heap allocated
+// continuation stack. Evaluation depth is therefore bounded by the
+// configurable frame limit rather than by the size of the thread stack.
+//
+// Escape continuations (call/ec) are cheap: invoking one simply truncates
+// the continuation stack back to the frame that created it.
+
+#define CEK_DEFAULT_MAX_DEPTH ((size_t)1 << 22)
+
+typedef enum
+{
+  // An application whose operator and operands are being evaluated.
+  FRAME_APPLY,
+  // A sequence of lambda bodies, the last of which is evaluated in
+  // tail position.
+  FRAME_BODY,
+  // Delimits the extent of a call/ec escape continuation.
+  FRAME_ESCAPE,
+  // The special forms that the machine evaluates itself, so that the
+  // forms in their tail positions are evaluated in tail position. Each
+  // waits for the value of the operand it has just evaluated.
+  FRAME_IF,
+  FRAME_COND,
+  FRAME_CASE,
+  FRAME_AND,
+  FRAME_OR,
+  // A let collecting the values to bind in an argument vector.
+  FRAME_LET,
+  // A let* or letrec binding each value as it is evaluated.
+  FRAME_LET_STAR,
+  // A named let that loops, waiting for its body to finish or go round.
+  FRAME_LOOP,
+} frame_type_t;
+
+// Evaluated arguments are held on a stack of fixed size segments so that
+// an argument vector never moves once it has been reserved, even if the
+// evaluation of later arguments needs more space.
+typedef struct arg_segment_t arg_segment_t;
+struct arg_segment_t
+{
+  arg_segment_t *prev;
+  expr_t *values;
+  size_t capacity;
+  size_t top;
+};
+
+// A position on the argument stack that can be returned to.
+typedef struct
+{
+  arg_segment_t *segment;
+  size_t top;
+} arg_mark_t;
+
+// A parameter bound by parameterize, and the value that it had before.
+typedef struct
+{
+  expr_t parameter;
+  expr_t saved;
+} binding_t;
+
+typedef struct
+{
+  frame_type_t type;
+  // FRAME_APPLY: the evaluated operator (NULL until it is evaluated).
+  // FRAME_ESCAPE: the escape continuation.
+  // FRAME_LET, FRAME_LET_STAR, FRAME_LOOP: the operands of the form.
+  expr_t fn;
+  // Remaining operands, bodies or clauses to evaluate. The bindings of a
+  // let form start with the one being evaluated.
+  expr_t rest;
+  env_t *env;
+  union
+  {
+    // FRAME_APPLY, FRAME_LET: the argument vector being filled in, and
+    // for FRAME_APPLY the operands of the application, the site of the
+    // call for a generic function.
+    struct
+    {
+      expr_t *argv;
+      size_t argc;
+      size_t argi;
+      expr_t site;
+    } args;
+    // FRAME_ESCAPE: the argument stack and the number of parameters
+    // bound when the call/ec was made.
+    struct
+    {
+      arg_mark_t mark;
+      size_t bindings;
+    } escape;
+  } as;
+} frame_t;
+
+// Each (possibly nested) run of the machine records where it started on
+// the continuation stack, and a jump buffer so that an escape can unwind
+// any native frames that lie between the escape and its target.
+typedef struct cek_run_t cek_run_t;
+struct cek_run_t
+{
+  cek_run_t *prev;
+  size_t base;
+  // Region frames in use when the run started.
+  size_t env_base;
+  jmp_buf jump;
+};
+
+typedef struct
+{
+  arg_segment_t *args;
+
+  frame_t *frames;
+  size_t depth;
+  size_t capacity;
+  size_t max_depth;
+
+  // Innermost active run of the machine.
+  cek_run_t *run;
+
+  // Region frames in use, in the order they were made, and the released
+  // frames that are free for reuse.
+  env_t **envs;
+  size_t env_count;
+  size_t env_capacity;
+  env_t *free_envs;
+
+  // The target and value of an escape that is in flight.
+  size_t escape_frame;
+  expr_t escape_value;
+
+  // The parameters bound by the parameterize forms being evaluated,
+  // innermost last.
+  binding_t *bindings;
+  size_t binding_count;
+  size_t binding_capacity;
+} cek_stack_t;
+
+void cek_stack_init(cek_stack_t *stack);
+void cek_stack_free(cek_stack_t *stack);
+void cek_stack_mark(crisp_t *crisp, cek_stack_t *stack);
+
+// The state of the stacks that an error unwinds back to.
+typedef struct
+{
+  size_t depth;
+  cek_run_t *run;
+  arg_mark_t args;
+  size_t envs;
+  size_t bindings;
+} cek_state_t;
+
+cek_state_t cek_save_state(cek_stack_t *stack);
+void cek_restore_state(cek_stack_t *stack, cek_state_t state);
+
+// Reserve space for count arguments. The returned vector is released, in
+// last in first out order, with cek_pop_args.
+expr_t *cek_push_args(cek_stack_t *stack, size_t count);
+void cek_pop_args(cek_stack_t *stack, size_t count);
+
+// Region frames
+//
+// The environment of a call to a lambda that does not capture it (see
+// crisp_frame_may_escape) is taken from a region owned by the stack rather
+// than the garbage collected heap, and is reused once the call is over.
+// Should the environment be captured regardless, env_capture hands it over
+// to the garbage collector and the region lets go of it.
+//
+// The CEK machine releases frames lazily. A frame made when the
+// continuation stack was at a given depth is dead once the stack is back
+// down to that depth and another call is made, as nothing left on the
+// stack can refer to it.
+env_t *cek_push_env(crisp_t *crisp, cek_stack_t *stack, env_t *parent);
+// Release the region frames made after the first count.
+void cek_release_envs(cek_stack_t *stack, size_t count);
+// The frame for a call or let form, from the region unless it is to be
+// shared with the closures made in it (see env_t.shared), in which case it
+// comes from the heap.
+env_t *cek_frame_env(crisp_t *crisp, cek_stack_t *stack, env_t *parent, bool shared);
+
+// Dynamic parameters
+//
+// A parameter holds its current value itself, so reading one takes the
+// same time however deep the calls that bound it (shallow binding).
+// Binding a parameter saves the value it had on the stack, and unbinding
+// puts it back. An error or escape that unwinds past a parameterize form
+// unbinds what it bound, as eval and call/ec both record how many
+// parameters were bound when they started.
+void cek_bind_parameter(cek_stack_t *stack, expr_t parameter, expr_t value);
+// Unbind the parameters bound after the first count.
+void cek_unbind_parameters(cek_stack_t *stack, size_t count);
+
+// Evaluate a node using the continuation stack.
+expr_t cek_eval(crisp_t *crisp, expr_t node, env_t *env);
+
+// The call/ec builtin.
+expr_t cek_call_ec(crisp_t *crisp, size_t argc, expr_t *argv);
+
+// Return value from the call/ec that created the continuation k.
+void cek_escape(crisp_t *crisp, expr_t k, expr_t value);
+
+#endif
@@ -0,0 +1,335 @@
+#include "compiler.h"
+#include "native.h"
+#include "value_support.h"
+#include "memory.h"
+#include "environment.h"
+#include "evaluator.h"
+#include "builtins.h"
+#include "cek.h"
+#include "generic.h"
+#include "interpreter_internal.h"
+
+#define RUN(crisp, code, env) ((code)->run((crisp), (code), (env)))
+
+typedef struct
+{
+  compiled_t *compiled;
+  size_t next;
+} emitter_t;
+
+static expr_t run_constant(crisp_t *crisp, code_t *code, env_t *env)
+{
+  (void)crisp;
+  (void)env;
+  return code->node;
+}
+
+static expr_t run_variable(crisp_t *crisp, code_t *code, env_t *env)
+{
+  return crisp_resolve_atom(crisp, code->node, env);
+}
+
+static expr_t run_global(crisp_t *crisp, code_t *code, env_t *env)
+{
+  (void)crisp;
+  (void)env;
+  return code->node->as.atom.cell->value;
+}
+
+static expr_t run_invalid(crisp_t *crisp, code_t *code, env_t *env)
+{
+  (void)code;
+  (void)env;
+  crisp_eval_error(crisp, "Invalid list");
+  return NULL;
+}
+
+// Special forms that have no template of their own.
+static expr_t run_syntax(crisp_t *crisp, code_t *code, env_t *env)
+{
+  return crisp_eval_syntax(crisp, as_syntax(car(code->node)), cdr(code->node), env);
+}
+
+static expr_t run_if(crisp_t *crisp, code_t *code, env_t *env)
+{
+  expr_t test = RUN(crisp, &code->parts[0], env);
+  if (test == NULL)
+    return NULL;
+  if (!not(test))
+    return RUN(crisp, &code->parts[1], env);
+  if (code->argc == 3)
+    return RUN(crisp, &code->parts[2], env);
+  return nil_value(crisp);
+}
+
+static expr_t run_begin(crisp_t *crisp, code_t *code, env_t *env)
+{
+  expr_t result = nil_value(crisp);
+  for (size_t i = 0; (i < code->argc) && (result != NULL); i++)
+  {
+    result = RUN(crisp, &code->parts[i], env);
+  }
+  return result;
+}
+
+// and stops at the first false operand, or stops at the first operand that
+// is not false.
+static expr_t run_and_or(crisp_t *crisp, code_t *code, env_t *env)
+{
+  bool is_and = (as_syntax(car(code->node)) == SYNTAX_AND);
+  expr_t result = bool_value(crisp, is_and);
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    result = RUN(crisp, &code->parts[i], env);
+    if ((result == NULL) || (not(result) == is_and))
+      break;
+  }
+  return result;
+}
+
+static expr_t apply_parts(crisp_t *crisp, code_t *code, expr_t operator, env_t *env)
+{
+  if (is_special_form(operator))
+  {
+    return as_fn(operator)(crisp, cdr(code->node), env);
+  }
+
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t *argv = cek_push_args(stack, code->argc);
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    argv[i] = RUN(crisp, &code->parts[i + 1], env);
+  }
+
+  if (is_generic(operator))
+  {
+    operator = crisp_dispatch(crisp, operator, cdr(code->node), code->argc, argv);
+  }
+
+  expr_t result = (operator != NULL) ? crisp_apply_argv(crisp, operator, code->argc, argv, env) : NULL;
+  cek_pop_args(stack, code->argc);
+  return result;
+}
+
+static expr_t run_call(crisp_t *crisp, code_t *code, env_t *env)
+{
+  return apply_parts(crisp, code, RUN(crisp, &code->parts[0], env), env);
+}
+
+static expr_t run_numeric(crisp_t *crisp, code_t *code, env_t *env)
+{
+  expr_t operator = RUN(crisp, &code->parts[0], env);
+  if (operator != code->builtin)
+  {
+    return apply_parts(crisp, code, operator, env);
+  }
+
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t *argv = cek_push_args(stack, code->argc);
+  bool numbers = true;
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    argv[i] = RUN(crisp, &code->parts[i + 1], env);
+    numbers = numbers && is_number(argv[i]);
+  }
+
+  expr_t result = NULL;
+  if (numbers)
+  {
+    binary_op_t op = builtin_numeric_op(operator);
+    double number = as_number(argv[0]);
+    for (size_t i = 1; i < code->argc; i++)
+    {
+      number = op(number, as_number(argv[i]));
+    }
+    result = number_value(crisp, number);
+  }
+  else
+  {
+    // Let the builtin report the operand that is not a number.
+    result = crisp_apply_argv(crisp, operator, code->argc, argv, env);
+  }
+
+  cek_pop_args(stack, code->argc);
+  return result;
+}
+
+static const code_fn_t sTemplates[] = {
+  [CODE_CONSTANT] = run_constant,
+  [CODE_VARIABLE] = run_variable,
+  [CODE_GLOBAL] = run_global,
+  [CODE_INVALID] = run_invalid,
+  [CODE_SYNTAX] = run_syntax,
+  [CODE_IF] = run_if,
+  [CODE_BEGIN] = run_begin,
+  [CODE_AND_OR] = run_and_or,
+  [CODE_CALL] = run_call,
+  [CODE_NUMERIC] = run_numeric,
+};
+
+static void use_template(code_t *code, code_kind_t kind)
+{
+  code->kind = kind;
+  code->run = sTemplates[kind];
+}
+
+// The template for a special form whose operands are each compiled, or
+// CODE_SYNTAX if the form is left to run_syntax.
+static code_kind_t syntax_template(expr_t node)
+{
+  size_t argc = length(cdr(node));
+  switch (as_syntax(car(node)))
+  {
+  case SYNTAX_IF:
+    return ((argc == 2) || (argc == 3)) ? CODE_IF : CODE_SYNTAX;
+  case SYNTAX_BEGIN:
+    return CODE_BEGIN;
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    return CODE_AND_OR;
+  default:
+    return CODE_SYNTAX;
+  }
+}
+
+static size_t count_codes(expr_t node)
+{
+  if (!pair(node) || !is_proper_list(node))
+    return 1;
+
+  if (is_syntax(car(node)))
+  {
+    if (syntax_template(node) == CODE_SYNTAX)
+      return 1;
+    node = cdr(node);
+  }
+
+  size_t count = 1;
+  for (; pair(node); node = cdr(node))
+  {
+    count += count_codes(car(node));
+  }
+  return count;
+}
+
+static code_t *reserve(emitter_t *e, size_t count)
+{
+  code_t *codes = &e->compiled->codes[e->next];
+  e->next += count;
+  return codes;
+}
+
+static void emit(emitter_t *e, code_t *code, expr_t node)
+{
+  code->node = node;
+  code->parts = NULL;
+  code->argc = 0;
+  code->builtin = NULL;
+
+  if (is_atom(node))
+  {
+    // An atom that has resolved to a global always will.
+    use_template(code, (node->as.atom.cell != NULL) ? CODE_GLOBAL : CODE_VARIABLE);
+    return;
+  }
+
+  if (!pair(node))
+  {
+    use_template(code, CODE_CONSTANT);
+    return;
+  }
+
+  if (!is_proper_list(node))
+  {
+    use_template(code, CODE_INVALID);
+    return;
+  }
+
+  if (is_syntax(car(node)))
+  {
+    if ((as_syntax(car(node)) == SYNTAX_QUOTE) && (length(node) == 2))
+    {
+      code->node = car(cdr(node));
+      use_template(code, CODE_CONSTANT);
+      return;
+    }
+
+    use_template(code, syntax_template(node));
+    if (code->kind == CODE_SYNTAX)
+      return;
+
+    code->argc = length(cdr(node));
+    code->parts = reserve(e, code->argc);
+    expr_t operand = cdr(node);
+    for (size_t i = 0; i < code->argc; i++, operand = cdr(operand))
+    {
+      emit(e, &code->parts[i], car(operand));
+    }
+    return;
+  }
+
+  size_t count = length(node);
+  code->parts = reserve(e, count);
+  code->argc = count - 1;
+  use_template(code, CODE_CALL);
+
+  for (size_t i = 0; i < count; i++, node = cdr(node))
+  {
+    emit(e, &code->parts[i], car(node));
+  }
+
+  // Numeric builtins are folded inline, guarded on the global still
+  // holding the same builtin.
+  expr_t op = code->parts[0].node;
+  if (is_atom(op) && (op->as.atom.cell != NULL) && (code->argc > 0) &&
+      (builtin_numeric_op(op->as.atom.cell->value) != NULL))
+  {
+    use_template(code, CODE_NUMERIC);
+    code->builtin = op->as.atom.cell->value;
+  }
+}
+
+compiled_t *crisp_compile(crisp_t *crisp, lambda_t *lambda)
+{
+  compiled_t *compiled = ALLOCATE(compiled_t, 1);
+  compiled->body_count = length(lambda->bodies);
+  compiled->count = compiled->body_count;
+  for (expr_t body = lambda->bodies; pair(body); body = cdr(body))
+  {
+    compiled->count += count_codes(car(body)) - 1;
+  }
+  compiled->codes = ALLOCATE(code_t, compiled->count);
+  compiled->epoch = optimizer(crisp)->epoch;
+
+  emitter_t e = {.compiled = compiled, .next = 0};
+  code_t *bodies = reserve(&e, compiled->body_count);
+  expr_t body = lambda->bodies;
+  for (size_t i = 0; i < compiled->body_count; i++, body = cdr(body))
+  {
+    emit(&e, &bodies[i], car(body));
+  }
+
+  compiled->native = native_code(crisp) ? crisp_compile_native(compiled) : NULL;
+  return compiled;
+}
+
+void crisp_free_compiled(compiled_t *compiled)
+{
+  if (compiled->native != NULL)
+    crisp_free_native(compiled->native);
+  FREE_ARRAY(code_t, compiled->codes, compiled->count);
+  FREE(compiled_t, compiled);
+}
+
+expr_t crisp_run_compiled(crisp_t *crisp, compiled_t *compiled, env_t *env)
+{
+  if ((compiled->native != NULL) && native_code(crisp))
+    return crisp_run_native(crisp, compiled->native, env);
+
+  expr_t result = NULL;
+  for (size_t i = 0; i < compiled->body_count; i++)
+  {
+    result = RUN(crisp, &compiled->codes[i], env);
+  }
+  return result;
+}
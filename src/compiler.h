@@ -0,0 +1,76 @@
+#ifndef CRISP_COMPILER_H
+#define CRISP_COMPILER_H
+
+#include "common.h"
+#include "value.h"
+
+// Lambdas are compiled once they have been called this many times.
+#define CRISP_COMPILE_DEFAULT_THRESHOLD 8
+
+// The bodies of a lambda compiled to threaded code.
+//
+// Each form is translated once into a code_t that calls the template for
+// that kind of form, so running the code skips the checks the evaluator
+// makes on every visit: what type of node it is, whether an application is
+// a proper list and how many operands it has. Globals are read straight
+// from their cells, and numeric builtins are folded inline whilst their
+// operands are numbers.
+//
+// Quoted data, if, begin, and and or have templates of their own. Anything
+// else the templates do not handle themselves, such as the other special
+// forms, is passed back to the evaluator, which stays as the fallback.
+//
+// Where it is supported the threaded code is then translated to machine
+// code, see native.h, which is run in its place.
+typedef struct code_t code_t;
+typedef expr_t (*code_fn_t)(crisp_t *crisp, code_t *code, env_t *env);
+
+// The template that a code_t calls.
+typedef enum
+{
+  CODE_CONSTANT,
+  CODE_VARIABLE,
+  CODE_GLOBAL,
+  CODE_INVALID,
+  CODE_SYNTAX,
+  CODE_IF,
+  CODE_BEGIN,
+  CODE_AND_OR,
+  CODE_CALL,
+  CODE_NUMERIC,
+} code_kind_t;
+
+struct code_t
+{
+  code_fn_t run;
+  code_kind_t kind;
+  // The form that was compiled.
+  expr_t node;
+  // Applications: the operator, followed by each of the operands.
+  // Special forms with a template: each of the operands.
+  code_t *parts;
+  size_t argc;
+  // Numeric applications: the builtin that the operator referred to.
+  expr_t builtin;
+};
+
+struct compiled_t
+{
+  // Every code_t of the lambda, the first of which are its bodies.
+  code_t *codes;
+  size_t count;
+  size_t body_count;
+  // The machine code translated from the codes, NULL if there is none.
+  struct native_t *native;
+  // Inlined calls are restored when their callee is redefined, and the
+  // code compiled from them with it. See optimizer_t.
+  size_t epoch;
+};
+
+compiled_t *crisp_compile(crisp_t *crisp, lambda_t *lambda);
+void crisp_free_compiled(compiled_t *compiled);
+
+// Evaluate the bodies of a compiled lambda in the environment of a call.
+expr_t crisp_run_compiled(crisp_t *crisp, compiled_t *compiled, env_t *env);
+
+#endif
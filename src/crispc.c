@@ -0,0 +1,80 @@
+#include "interpreter.h"
+#include "parser.h"
+#include "translator.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+// Translates a crisp program into C source.
+//
+//   crispc <program.crisp> <output.c>
+//
+// The output is compiled and linked against crisp_lib to give a native
+// executable, or with CRISPC_NO_MAIN defined, an object that provides
+// crisp_program_load.
+
+static char *read_file(const char *path, size_t *size)
+{
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return NULL;
+
+  fseek(fp, 0, SEEK_END);
+  long length = ftell(fp);
+  rewind(fp);
+  if (length < 0)
+  {
+    fclose(fp);
+    return NULL;
+  }
+
+  *size = (size_t)length + 1;
+  char *source = ALLOCATE(char, *size);
+  size_t count = fread(source, 1, (size_t)length, fp);
+  source[count] = '\0';
+  fclose(fp);
+  return source;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: crispc <program.crisp> <output.c>\n");
+    return 1;
+  }
+
+  size_t size = 0;
+  char *source = read_file(argv[1], &size);
+  if (source == NULL)
+  {
+    fprintf(stderr, "crispc: can not read %s\n", argv[1]);
+    return 1;
+  }
+
+  crisp_t *crisp = init_interpreter();
+  expr_t forms = parse_program(crisp, source);
+  int status = 1;
+
+  if (forms == NULL)
+  {
+    fprintf(stderr, "crispc: %s failed to parse\n", argv[1]);
+  }
+  else
+  {
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL)
+    {
+      fprintf(stderr, "crispc: can not write %s\n", argv[2]);
+    }
+    else
+    {
+      status = crisp_translate(crisp, forms, argv[1], out) ? 0 : 1;
+      status = (fclose(out) == 0) ? status : 1;
+    }
+  }
+
+  free_interpreter(crisp);
+  FREE_ARRAY(char, source, size);
+  return status;
+}
@@ -14,6 +14,9 @@ env_t *env_init(crisp_t* crisp)
 {
   env_t *env = ALLOCATE(env_t, 1);
   env->parent = NULL;
+  env->in_region = false;
+  env->region_depth = 0;
+  env->shared = false;
   hash_table_init(&env->table);
   crisp_gc_register_object(crisp, (gc_object_t*)env, &env_gc_functions);
   return env;
@@ -23,9 +26,46 @@ env_t *env_init_child(crisp_t* crisp, env_t *parent)
 {
   env_t *env = env_init(crisp);
   env->parent = parent;
+  env_capture(crisp, parent);
   return env;
 }
 
+env_t *env_init_region(env_t *parent)
+{
+  env_t *env = ALLOCATE(env_t, 1);
+  env->base.next = NULL;
+  env->base.functions = &env_gc_functions;
+  env->base.marked = false;
+  env->parent = parent;
+  env->in_region = true;
+  env->region_depth = 0;
+  env->shared = false;
+  hash_table_init(&env->table);
+  return env;
+}
+
+void env_reset_region(env_t *env)
+{
+  hash_table_clear(&env->table);
+  env->parent = NULL;
+  env->shared = false;
+}
+
+void env_free_region(env_t *env)
+{
+  env_free((gc_object_t*)env);
+}
+
+void env_capture(crisp_t* crisp, env_t *env)
+{
+  while (env != NULL && env->in_region)
+  {
+    env->in_region = false;
+    crisp_gc_register_object(crisp, (gc_object_t*)env, &env_gc_functions);
+    env = env->parent;
+  }
+}
+
 bool env_is_top_level(env_t* env)
 {
   return (env->parent == NULL);
@@ -43,9 +83,19 @@ env_t* env_get_top_level(env_t* env)
 
 bool env_get(env_t *env, const char *name, value_t **value)
 {
+  if (env_is_top_level(env))
+  {
+    global_cell_t *cell = env_get_cell(env, name);
+    if (cell != NULL)
+    {
+      *value = cell->value;
+    }
+    return (cell != NULL);
+  }
+
   bool found = hash_table_get(&env->table, name, VALUE_PTR(value));
 
-  if ((!found) && (NULL != env->parent))
+  if (!found)
   {
     found = env_get(env->parent, name, VALUE_PTR(value));
   }
@@ -53,9 +103,66 @@ bool env_get(env_t *env, const char *name, value_t **value)
   return found;
 }
 
+bool env_get_local(env_t *env, const char *name, value_t **value)
+{
+  for (; !env_is_top_level(env); env = env->parent)
+  {
+    if (hash_table_get(&env->table, name, VALUE_PTR(value)))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 void env_set(env_t *env, const char *name, value_t *value)
 {
-  hash_table_set(&env->table, name, value);
+  if (env_is_top_level(env))
+  {
+    global_cell_t *cell = env_get_cell(env, name);
+    if (cell == NULL)
+    {
+      cell = ALLOCATE(global_cell_t, 1);
+      cell->name = name;
+      hash_table_set(&env->table, name, cell);
+    }
+    cell->value = value;
+  }
+  else
+  {
+    hash_table_set(&env->table, name, value);
+  }
+}
+
+bool env_assign(env_t *env, const char *name, value_t *value, global_cell_t **cell)
+{
+  value_t *old = NULL;
+  *cell = NULL;
+  for (; !env_is_top_level(env); env = env->parent)
+  {
+    if (hash_table_get(&env->table, name, VALUE_PTR(&old)))
+    {
+      hash_table_set(&env->table, name, value);
+      return true;
+    }
+  }
+
+  *cell = env_get_cell(env, name);
+  if (*cell == NULL)
+    return false;
+
+  (*cell)->value = value;
+  return true;
+}
+
+global_cell_t *env_get_cell(env_t *env, const char *name)
+{
+  global_cell_t *cell = NULL;
+  if (!hash_table_get(&env->table, name, VALUE_PTR(&cell)))
+  {
+    return NULL;
+  }
+  return cell;
 }
 
 void dump_env(env_t *env)
@@ -69,6 +176,17 @@ static void env_free(gc_object_t* obj)
   if(obj != NULL)
   {
     env_t *env = (env_t*)obj;
+    if (env_is_top_level(env))
+    {
+      for (size_t i = 0; i < env->table.capacity; i++)
+      {
+        hash_table_entry_t *e = &env->table.entries[i];
+        if ((e->key != NULL) && (e->value != NULL))
+        {
+          FREE(global_cell_t, e->value);
+        }
+      }
+    }
     env->parent = NULL;
     hash_table_free(&env->table);
     FREE(env_t, env);
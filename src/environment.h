@@ -5,22 +5,64 @@
 #include "hash_table.h"
 #include "gc_type.h"
 
+// Top level (global) variables are held in cells whose address is stable
+// for the life of the environment. Redefining a variable updates its cell
+// in place, which allows references to cache the cell once resolved.
+typedef struct global_cell_t
+{
+  const char* name;
+  value_t* value;
+} global_cell_t;
+
+// The table of a top level environment maps names to global_cell_t
+// pointers. The tables of child environments map names to values.
 struct env_t
 {
   gc_object_t base;
   hash_table_t table;
   env_t* parent;
+  // Set while the environment is owned by the evaluator's frame region
+  // rather than the garbage collector.
+  bool in_region;
+  // The depth of the continuation stack when a region frame was made.
+  size_t region_depth;
+  // Set for frames whose variables may be assigned after they are bound.
+  // Closures made within them share the frame rather than copying out of
+  // it. See crisp_frame_may_escape.
+  bool shared;
 };
 
 env_t* env_init(crisp_t* crisp);
 env_t* env_init_child(crisp_t* crisp, env_t* parent);
 
+// Frames for calls whose environment can not be captured are allocated
+// outside of the garbage collected heap, and are reused once the call
+// returns. See cek_push_env.
+env_t* env_init_region(env_t* parent);
+void env_reset_region(env_t* env);
+void env_free_region(env_t* env);
+
+// An environment is about to be referenced by something that may outlive
+// the call it was made for, such as a closure. Any region frames in its
+// chain are handed over to the garbage collector.
+void env_capture(crisp_t* crisp, env_t* env);
+
 bool env_is_top_level(env_t* env);
 
 env_t* env_get_top_level(env_t* env);
 
 bool env_get(env_t* env, const char* name, value_t** value);
+// As env_get, but only searches the frames below the top level.
+bool env_get_local(env_t* env, const char* name, value_t** value);
 void env_set(env_t* env, const char* name, value_t* value);
+// Updates the innermost existing binding of a name, returning false if the
+// name is not bound. When the binding is a global its cell is returned in
+// cell, otherwise cell is set to NULL.
+bool env_assign(env_t* env, const char* name, value_t* value, global_cell_t** cell);
+
+// Returns the cell for a name in a top level environment, or NULL if the
+// name has not been defined.
+global_cell_t* env_get_cell(env_t* env, const char* name);
 
 void dump_env(env_t* env);
 
@@ -4,34 +4,48 @@
 #include "interpreter_internal.h"
 #include "builtins.h"
 #include "environment.h"
+#include "cek.h"
+#include "specializer.h"
+#include "compiler.h"
+#include "generic.h"
+#include "record.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 
-static expr_t apply(crisp_t *crisp, expr_t operator, expr_t operands, env_t *env);
-static expr_t apply_lambda(crisp_t *crisp, lambda_t *lambda, expr_t operands, env_t *env);
-static expr_t resolve_atom(crisp_t *crisp, expr_t node, env_t *env);
-
 expr_t crisp_eval(crisp_t *crisp, expr_t node, env_t *env)
 {
-  (void)crisp;
-
   if (node == NULL)
     return NULL;
 
+  if (eval_mode(crisp) == CRISP_EVAL_MODE_CEK)
+  {
+    return cek_eval(crisp, node, env);
+  }
+
   if (is_bool(node) || is_string(node) || is_number(node) || is_nil(node))
     return node;
 
   if (is_atom(node))
   {
-    return resolve_atom(crisp, node, env);
+    return crisp_resolve_atom(crisp, node, env);
   }
 
   if (pair(node))
   {
     if (is_proper_list(node))
     {
-      return apply(crisp, crisp_eval(crisp, car(node), env), cdr(node), env);
+      // Special forms are recognized by their keyword, whatever the
+      // keyword may be bound to.
+      if (is_syntax(car(node)))
+      {
+        return crisp_eval_syntax(crisp, as_syntax(car(node)), cdr(node), env);
+      }
+      if (eval_mode(crisp) == CRISP_EVAL_MODE_SPECIALIZING)
+      {
+        return crisp_eval_node(crisp, node, env);
+      }
+      return crisp_apply_operands(crisp, crisp_eval(crisp, car(node), env), cdr(node), env);
     }
     else
     {
@@ -43,17 +57,193 @@ expr_t crisp_eval(crisp_t *crisp, expr_t node, env_t *env)
   return node;
 }
 
+expr_t crisp_eval_syntax(crisp_t *crisp, syntax_t syntax, expr_t operands, env_t *env)
+{
+  switch (syntax)
+  {
+  case SYNTAX_QUOTE:
+    return b_quote(crisp, operands, env);
+  case SYNTAX_LAMBDA:
+    return b_lambda(crisp, operands, env);
+  case SYNTAX_DEFINE:
+    return b_define(crisp, operands, env);
+  case SYNTAX_IF:
+    return b_if(crisp, operands, env);
+  case SYNTAX_COND:
+    return b_cond(crisp, operands, env);
+  case SYNTAX_LET:
+    return b_let(crisp, operands, env);
+  case SYNTAX_LET_STAR:
+    return b_let_star(crisp, operands, env);
+  case SYNTAX_LETREC:
+    return b_letrec(crisp, operands, env);
+  case SYNTAX_BEGIN:
+    return b_begin(crisp, operands, env);
+  case SYNTAX_AND:
+    return b_and(crisp, operands, env);
+  case SYNTAX_OR:
+    return b_or(crisp, operands, env);
+  case SYNTAX_SET:
+    return b_set(crisp, operands, env);
+  case SYNTAX_CASE:
+    return b_case(crisp, operands, env);
+  case SYNTAX_PARAMETERIZE:
+    return b_parameterize(crisp, operands, env);
+  case SYNTAX_RECUR:
+    return b_recur(crisp, operands, env);
+  case SYNTAX_NONE:
+  case SYNTAX_ELSE:
+  case SYNTAX_ELLIPSIS:
+  case SYNTAX_UNDERSCORE:
+  case SYNTAX_SYNTAX_RULES:
+  case SYNTAX_UNQUOTE:
+  case SYNTAX_UNQUOTE_SPLICING:
+  case SYNTAX_DEFINE_SYNTAX:
+  case SYNTAX_QUASIQUOTE:
+  case SYNTAX_DO:
+  case SYNTAX_MATCH:
+  case SYNTAX_DEFINE_GENERIC:
+  case SYNTAX_DEFINE_METHOD:
+  case SYNTAX_DEFINE_RECORD_TYPE:
+  case SYNTAX_COUNT:
+    break;
+  }
+
+  crisp_eval_error(crisp, "Not a special form");
+  return NULL;
+}
+
 expr_t crisp_eval_list(crisp_t *crisp, expr_t list_node, env_t *env)
 {
-  if (is_nil(list_node))
+  // Built with a tail pointer so that long operand lists do not
+  // recurse on the native stack.
+  expr_t head = nil_value(crisp);
+  expr_t tail = NULL;
+
+  while (is_cons(list_node))
   {
-    return nil_value(crisp);
+    expr_t c = cons(crisp, crisp_eval(crisp, car(list_node), env), nil_value(crisp));
+    if (tail == NULL)
+      head = c;
+    else
+      set_cdr(tail, c);
+    tail = c;
+    list_node = cdr(list_node);
+  }
+
+  return head;
+}
+
+expr_t crisp_apply(crisp_t *crisp, expr_t fn, expr_t arguments, env_t *env)
+{
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t argc = length(arguments);
+  expr_t *argv = cek_push_args(stack, argc);
+  for (size_t i = 0; i < argc; i++)
+  {
+    argv[i] = car(arguments);
+    arguments = cdr(arguments);
   }
 
-  return cons(
-      crisp,
-      crisp_eval(crisp, car(list_node), env),
-      crisp_eval_list(crisp, cdr(list_node), env));
+  expr_t result = crisp_apply_argv(crisp, fn, argc, argv, env);
+  cek_pop_args(stack, argc);
+  return result;
+}
+
+expr_t crisp_apply_argv(crisp_t *crisp, expr_t fn, size_t argc, expr_t *argv, env_t *env)
+{
+  if (is_builtin(fn))
+  {
+    if ((argc < fn->as.fn.min_arity) || (argc > fn->as.fn.max_arity))
+    {
+      crisp_eval_error(crisp, "Arity: got %zu argument(s)", argc);
+      return NULL;
+    }
+    return as_builtin(fn)(crisp, argc, argv);
+  }
+  else if (is_fn(fn))
+  {
+    return as_fn(fn)(crisp, list_from_vector(crisp, argc, argv), env);
+  }
+  else if (is_lambda(fn))
+  {
+    return crisp_apply_lambda(crisp, as_lambda(fn), argc, argv);
+  }
+  else if (is_parameter(fn))
+  {
+    if (argc != 0)
+    {
+      crisp_eval_error(crisp, "A parameter expects no arguments");
+      return NULL;
+    }
+    return as_parameter(fn);
+  }
+  else if (is_record_procedure(fn))
+  {
+    if (argc != fn->as.record_procedure.arity)
+    {
+      crisp_eval_error(crisp, "Arity: got %zu argument(s)", argc);
+      return NULL;
+    }
+    return crisp_apply_record(crisp, fn, argc, argv);
+  }
+  else if (is_generic(fn))
+  {
+    expr_t method = crisp_dispatch(crisp, fn, NULL, argc, argv);
+    return (method != NULL) ? crisp_apply_argv(crisp, method, argc, argv, env) : NULL;
+  }
+  else if (is_continuation(fn))
+  {
+    if (argc != 1)
+    {
+      crisp_eval_error(crisp, "An escape continuation expects a single value");
+      return NULL;
+    }
+    cek_escape(crisp, fn, argv[0]);
+    return NULL;
+  }
+
+  crisp_eval_error(crisp, "Can not apply a non function");
+  return NULL;
+}
+
+expr_t crisp_resolve_atom(crisp_t *crisp, expr_t node, env_t *env)
+{
+  // Atoms that previously resolved to a global go straight to its cell.
+  // Environments are lexical, so an atom that was not bound by any
+  // enclosing frame the first time it was evaluated never will be.
+  if (node->as.atom.cell != NULL)
+  {
+    return node->as.atom.cell->value;
+  }
+
+  expr_t value;
+  const char *name = as_atom(node);
+  env_t *frame = env;
+
+  while (!env_is_top_level(frame))
+  {
+    if (hash_table_get(&frame->table, name, VALUE_PTR(&value)))
+    {
+      return value;
+    }
+    frame = frame->parent;
+  }
+
+  global_cell_t *cell = env_get_cell(frame, name);
+  if (cell == NULL)
+  {
+    dump_env(env);
+    crisp_eval_error(crisp, "Failed to resolve atom: <%p>%s", (void *)name, name);
+    return NULL;
+  }
+
+  if (frame == root_env(crisp))
+  {
+    node->as.atom.cell = cell;
+  }
+
+  return cell->value;
 }
 
 void crisp_bind_env(crisp_t *crisp, env_t *env, expr_t keys, expr_t values)
@@ -86,6 +276,35 @@ void crisp_bind_env(crisp_t *crisp, env_t *env, expr_t keys, expr_t values)
   }
 }
 
+void crisp_bind_args(crisp_t *crisp, env_t *env, expr_t formals, size_t argc, expr_t *argv)
+{
+  size_t i = 0;
+
+  while (is_cons(formals))
+  {
+    if (!is_atom(car(formals)))
+    {
+      crisp_eval_error(crisp, "Formal arguments must be a atoms");
+      return;
+    }
+
+    if (i >= argc)
+    {
+      crisp_eval_error(crisp, "Insufficient number of parameters");
+      return;
+    }
+
+    env_set(env, as_atom(car(formals)), argv[i++]);
+    formals = cdr(formals);
+  }
+
+  if (is_atom(formals))
+  {
+    // Rest parameter
+    env_set(env, as_atom(formals), list_from_vector(crisp, argc - i, &argv[i]));
+  }
+}
+
 #ifndef _MSC_VER
 // Tell CLANG and GCC that the call to vprintf below
 // is made within a function that implements the behvaviour
@@ -97,40 +316,89 @@ __attribute__((__format__(__printf__, 2, 0)))
 void
 crisp_eval_error(crisp_t *crisp, const char *fmt, ...)
 {
-  (void)crisp;
-  printf("Eval Error: ");
-  va_list args;
-  va_start(args, fmt);
-  vprintf(fmt, args);
-  va_end(args);
-  printf("\n");
+  if (!quiet_errors(crisp))
+  {
+    printf("Eval Error: ");
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+  }
   crisp_error_jump(crisp, CRISP_ERROR_EVAL);
 }
 
-static expr_t apply(crisp_t *crisp, expr_t operator, expr_t operands, env_t *env)
+expr_t crisp_apply_operands(crisp_t *crisp, expr_t operator, expr_t operands, env_t *env)
 {
-  if (is_fn(operator))
+  if (is_special_form(operator))
   {
     return as_fn(operator)(crisp, operands, env);
   }
-  else if (is_lambda(operator))
+
+  // Evaluate the operands into an argument vector rather than a list.
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t argc = length(operands);
+  expr_t *argv = cek_push_args(stack, argc);
+  expr_t site = operands;
+  for (size_t i = 0; i < argc; i++)
   {
-    return apply_lambda(crisp, as_lambda(operator), operands, env);
+    argv[i] = crisp_eval(crisp, car(operands), env);
+    operands = cdr(operands);
   }
 
-  crisp_eval_error(crisp, "Can not apply a non function");
-  return NULL;
+  // A generic function chooses its method here, where the site of the
+  // call is known.
+  if (is_generic(operator))
+  {
+    operator = crisp_dispatch(crisp, operator, site, argc, argv);
+  }
+
+  expr_t result = (operator != NULL) ? crisp_apply_argv(crisp, operator, argc, argv, env) : NULL;
+  cek_pop_args(stack, argc);
+  return result;
+}
+
+// The compiled code for a lambda, compiling it if it has become hot. Code
+// compiled from bodies that the optimizer has since changed is discarded.
+static compiled_t *compiled_code(crisp_t *crisp, lambda_t *lambda)
+{
+  if ((lambda->compiled != NULL) && (lambda->compiled->epoch != optimizer(crisp)->epoch))
+  {
+    crisp_free_compiled(lambda->compiled);
+    lambda->compiled = NULL;
+    lambda->calls = 0;
+  }
+
+  size_t threshold = compile_threshold(crisp);
+  if (threshold == 0)
+    return NULL;
+
+  if ((lambda->compiled == NULL) && (++lambda->calls >= threshold))
+  {
+    lambda->compiled = crisp_compile(crisp, lambda);
+  }
+  return lambda->compiled;
 }
 
-static expr_t apply_lambda(crisp_t *crisp, lambda_t *lambda, expr_t operands, env_t *env)
+expr_t crisp_apply_lambda(crisp_t *crisp, lambda_t *lambda, size_t argc, expr_t *argv)
 {
   expr_t node = NULL;
   expr_t result = NULL;
-  expr_t evaluated_operands = crisp_eval_list(crisp, operands, env);
 
-  // Bind a new environment to the lambda parameters
-  env_t*  lambda_env = env_init_child(crisp, env);
-  crisp_bind_env(crisp, lambda_env, lambda->formals, evaluated_operands);
+  // Bind a new environment to the lambda parameters. The parent is the
+  // environment the lambda was defined in (lexical scope).
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t envs = stack->env_count;
+  env_t *lambda_env = cek_frame_env(crisp, stack, lambda->env, lambda->frame_escapes);
+  crisp_bind_args(crisp, lambda_env, lambda->formals, argc, argv);
+
+  compiled_t *compiled = compiled_code(crisp, lambda);
+  if (compiled != NULL)
+  {
+    result = crisp_run_compiled(crisp, compiled, lambda_env);
+    cek_release_envs(stack, envs);
+    return result;
+  }
 
   // Eval all the bodies and save the result of the last one.
   list_iter_t iter = iter_list(crisp, lambda->bodies);
@@ -139,18 +407,6 @@ static expr_t apply_lambda(crisp_t *crisp, lambda_t *lambda, expr_t operands, en
     result = crisp_eval(crisp, node, lambda_env);
   }
 
+  cek_release_envs(stack, envs);
   return result;
 }
-
-static expr_t resolve_atom(crisp_t *crisp, expr_t node, env_t *env)
-{
-  expr_t value;
-  const char *name = as_atom(node);
-  if (!env_get(env, name, &value))
-  {
-    dump_env(env);
-    crisp_eval_error(crisp, "Failed to resolve atom: <%p>%s", (void *)name, name);
-    return NULL;
-  }
-  return value;
-}
@@ -2,10 +2,23 @@
 #define CRISP_EVALUATOR_H
 
 #include "common.h"
+#include "value.h"
 
 expr_t crisp_eval(crisp_t* crisp, expr_t node, env_t* env);
+// Evaluate the operands of a special form.
+expr_t crisp_eval_syntax(crisp_t* crisp, syntax_t syntax, expr_t operands, env_t* env);
 expr_t crisp_eval_list(crisp_t* crisp, expr_t list_node, env_t* env);
+// Apply a function to a list of already evaluated arguments.
+expr_t crisp_apply(crisp_t* crisp, expr_t fn, expr_t arguments, env_t* env);
+// Apply a function to a vector of already evaluated arguments.
+expr_t crisp_apply_argv(crisp_t* crisp, expr_t fn, size_t argc, expr_t* argv, env_t* env);
+// Apply an evaluated operator to the unevaluated operands of a form.
+expr_t crisp_apply_operands(crisp_t* crisp, expr_t operator, expr_t operands, env_t* env);
+// Apply a lambda to a vector of already evaluated arguments.
+expr_t crisp_apply_lambda(crisp_t* crisp, lambda_t* lambda, size_t argc, expr_t* argv);
+expr_t crisp_resolve_atom(crisp_t* crisp, expr_t node, env_t* env);
 void crisp_bind_env(crisp_t* crisp, env_t* env, expr_t keys, expr_t values);
+void crisp_bind_args(crisp_t* crisp, env_t* env, expr_t formals, size_t argc, expr_t* argv);
 void crisp_eval_error(crisp_t* crisp, const char* fmt, ...);
 
 #define EVAL_ASSERT(crisp, expr, msg) \
@@ -0,0 +1,1773 @@
+#include "expander.h"
+#include "value.h"
+#include "value_support.h"
+#include "interpreter_internal.h"
+#include "evaluator.h"
+#include "builtins.h"
+#include "memory.h"
+#include "environment.h"
+
+#include <stdio.h>
+
+typedef struct
+{
+  crisp_t *crisp;
+  expander_t *expander;
+} pass_t;
+
+static bool expand_node(pass_t *x, expr_t node, expr_t scope);
+static bool expand_forms(pass_t *x, expr_t forms, expr_t scope);
+static bool expand_subforms(pass_t *x, expr_t node, expr_t scope);
+
+void expander_init(expander_t *expander)
+{
+  hash_table_init(&expander->macros);
+  expander->aliases = 0;
+}
+
+void expander_free(expander_t *expander)
+{
+  hash_table_free(&expander->macros);
+}
+
+void expander_mark(crisp_t *crisp, expander_t *expander)
+{
+  hash_table_t *t = &expander->macros;
+  for (size_t i = 0; i < t->capacity; i++)
+  {
+    if ((t->entries[i].key != NULL) && (t->entries[i].value != NULL))
+    {
+      crisp_gc_mark_value(crisp, t->entries[i].value);
+    }
+  }
+}
+
+static bool is_keyword(expr_t node, syntax_t syntax)
+{
+  return is_atom(node) && (as_syntax(node) == syntax);
+}
+
+// A (keyword datum) form, such as an unquote in a quasiquote template.
+static bool is_hole(expr_t node, syntax_t syntax)
+{
+  return pair(node) && is_keyword(car(node), syntax) && pair(cdr(node)) && is_nil(cdr(cdr(node)));
+}
+
+// Each occurrence of a name is a separate atom, as the evaluator caches
+// what an atom resolves to on the atom.
+static expr_t make_atom(pass_t *x, const char *name)
+{
+  return atom_value_null_terminated(x->crisp, name);
+}
+
+static expr_t reverse(pass_t *x, expr_t list)
+{
+  expr_t result = nil_value(x->crisp);
+  for (; pair(list); list = cdr(list))
+  {
+    result = cons(x->crisp, car(list), result);
+  }
+  return result;
+}
+
+// Scopes
+//
+// The names bound by the lambda and let forms that enclose a form, which
+// hide any macro of the same name. NULL at the top level.
+
+static bool is_bound(expr_t scope, const char *name)
+{
+  for (; (scope != NULL) && pair(scope); scope = cdr(scope))
+  {
+    if (as_atom(car(scope)) == name)
+      return true;
+  }
+  return false;
+}
+
+static expr_t bind_name(pass_t *x, expr_t scope, expr_t atom)
+{
+  return cons(x->crisp, atom, (scope != NULL) ? scope : nil_value(x->crisp));
+}
+
+static expr_t bind_formals(pass_t *x, expr_t formals, expr_t scope)
+{
+  scope = (scope != NULL) ? scope : nil_value(x->crisp);
+  for (; pair(formals); formals = cdr(formals))
+  {
+    if (is_atom(car(formals)))
+      scope = bind_name(x, scope, car(formals));
+  }
+  return is_atom(formals) ? bind_name(x, scope, formals) : scope;
+}
+
+static expr_t bind_let_names(pass_t *x, expr_t bindings, expr_t scope)
+{
+  scope = (scope != NULL) ? scope : nil_value(x->crisp);
+  for (; pair(bindings); bindings = cdr(bindings))
+  {
+    if (pair(car(bindings)) && is_atom(car(car(bindings))))
+      scope = bind_name(x, scope, car(car(bindings)));
+  }
+  return scope;
+}
+
+// Pattern matching
+//
+// The variables of a pattern are bound to what they matched as a list of
+// (atom depth . value), where depth is the number of ellipses that follow
+// the variable in the pattern. A variable of depth n is bound to a list of
+// the values of depth n - 1 that it matched.
+
+static expr_t bind(pass_t *x, expr_t bindings, expr_t atom, size_t depth, expr_t value)
+{
+  crisp_t *crisp = x->crisp;
+  return cons(crisp, cons(crisp, atom, cons(crisp, number_value(crisp, (double)depth), value)), bindings);
+}
+
+static expr_t binding(expr_t bindings, expr_t atom)
+{
+  for (; pair(bindings); bindings = cdr(bindings))
+  {
+    if (as_atom(car(car(bindings))) == as_atom(atom))
+      return car(bindings);
+  }
+  return NULL;
+}
+
+static size_t binding_depth(expr_t b)
+{
+  return (size_t)as_number(car(cdr(b)));
+}
+
+static expr_t binding_value(expr_t b)
+{
+  return cdr(cdr(b));
+}
+
+static bool is_literal(expr_t literals, expr_t atom)
+{
+  for (; pair(literals); literals = cdr(literals))
+  {
+    if (as_atom(car(literals)) == as_atom(atom))
+      return true;
+  }
+  return false;
+}
+
+static bool is_ellipsis_next(expr_t pattern)
+{
+  return pair(cdr(pattern)) && is_keyword(car(cdr(pattern)), SYNTAX_ELLIPSIS);
+}
+
+static size_t count_pairs(expr_t list)
+{
+  size_t count = 0;
+  for (; pair(list); list = cdr(list))
+  {
+    count++;
+  }
+  return count;
+}
+
+// The variables of a pattern, bound to ().
+static void pattern_variables(pass_t *x, expr_t pattern, expr_t literals, size_t depth, expr_t *vars)
+{
+  while (pair(pattern))
+  {
+    if (is_ellipsis_next(pattern))
+    {
+      pattern_variables(x, car(pattern), literals, depth + 1, vars);
+      pattern = cdr(cdr(pattern));
+    }
+    else
+    {
+      pattern_variables(x, car(pattern), literals, depth, vars);
+      pattern = cdr(pattern);
+    }
+  }
+
+  if (is_atom(pattern) && !is_literal(literals, pattern) &&
+      !is_keyword(pattern, SYNTAX_UNDERSCORE) && !is_keyword(pattern, SYNTAX_ELLIPSIS))
+  {
+    *vars = bind(x, *vars, pattern, depth, nil_value(x->crisp));
+  }
+}
+
+static bool same_datum(expr_t pattern, expr_t form)
+{
+  if (pattern->type != form->type)
+    return false;
+
+  switch (pattern->type)
+  {
+  case VALUE_TYPE_NIL:
+    return true;
+  case VALUE_TYPE_BOOL:
+    return as_bool(pattern) == as_bool(form);
+  case VALUE_TYPE_NUMBER:
+    return as_number(pattern) == as_number(form);
+  case VALUE_TYPE_STRING:
+    return as_string(pattern) == as_string(form);
+  default:
+    return false;
+  }
+}
+
+static bool match(pass_t *x, expr_t pattern, expr_t form, expr_t literals, expr_t *bindings);
+
+// Matches count forms against the pattern before an ellipsis.
+static bool match_ellipsis(pass_t *x, expr_t pattern, expr_t *forms, size_t count, expr_t literals,
+                           expr_t *bindings)
+{
+  // The values of each variable are gathered, in reverse, in place of its
+  // value.
+  expr_t vars = nil_value(x->crisp);
+  pattern_variables(x, pattern, literals, 0, &vars);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    expr_t matched = nil_value(x->crisp);
+    if (!match(x, pattern, car(*forms), literals, &matched))
+      return false;
+
+    for (expr_t v = vars; pair(v); v = cdr(v))
+    {
+      expr_t value = binding_value(binding(matched, car(car(v))));
+      set_cdr(cdr(car(v)), cons(x->crisp, value, binding_value(car(v))));
+    }
+    *forms = cdr(*forms);
+  }
+
+  for (expr_t v = vars; pair(v); v = cdr(v))
+  {
+    *bindings = bind(x, *bindings, car(car(v)), binding_depth(car(v)) + 1, reverse(x, binding_value(car(v))));
+  }
+  return true;
+}
+
+static bool match(pass_t *x, expr_t pattern, expr_t form, expr_t literals, expr_t *bindings)
+{
+  while (pair(pattern))
+  {
+    if (is_ellipsis_next(pattern))
+    {
+      // The ellipsis takes whatever the rest of the pattern does not.
+      expr_t rest = cdr(cdr(pattern));
+      size_t available = count_pairs(form);
+      size_t needed = count_pairs(rest);
+      if ((available < needed) ||
+          !match_ellipsis(x, car(pattern), &form, available - needed, literals, bindings))
+        return false;
+      pattern = rest;
+    }
+    else
+    {
+      if (!pair(form) || !match(x, car(pattern), car(form), literals, bindings))
+        return false;
+      pattern = cdr(pattern);
+      form = cdr(form);
+    }
+  }
+
+  if (is_atom(pattern))
+  {
+    if (is_literal(literals, pattern))
+      return is_atom(form) && (as_atom(form) == as_atom(pattern));
+
+    if (!is_keyword(pattern, SYNTAX_UNDERSCORE))
+      *bindings = bind(x, *bindings, pattern, 0, form);
+    return true;
+  }
+
+  return same_datum(pattern, form);
+}
+
+// Templates
+//
+// Names in a template that are not pattern variables are replaced by an
+// alias that no program can spell, recorded in renames as a list of
+// (name . alias). Once the template is filled in, the aliases that are
+// bound within it keep their new name and the rest get their own back.
+
+static expr_t alias(pass_t *x, expr_t atom, expr_t *renames)
+{
+  if (as_syntax(atom) != SYNTAX_NONE)
+    return make_atom(x, as_atom(atom));
+
+  for (expr_t r = *renames; pair(r); r = cdr(r))
+  {
+    if (as_atom(car(car(r))) == as_atom(atom))
+      return make_atom(x, as_atom(cdr(car(r))));
+  }
+
+  size_t size = strlen(as_atom(atom)) + 24;
+  char *name = ALLOCATE(char, size);
+  snprintf(name, size, "%s#%zu", as_atom(atom), ++x->expander->aliases);
+  expr_t renamed = make_atom(x, name);
+  FREE_ARRAY(char, name, size);
+
+  *renames = cons(x->crisp, cons(x->crisp, atom, renamed), *renames);
+  return make_atom(x, as_atom(renamed));
+}
+
+static expr_t instantiate(pass_t *x, expr_t template, expr_t bindings, expr_t *renames);
+static expr_t copy_form(pass_t *x, expr_t form);
+
+// The variables in a template that were matched under an ellipsis.
+static void ellipsis_variables(pass_t *x, expr_t template, expr_t bindings, expr_t *vars)
+{
+  for (; pair(template); template = cdr(template))
+  {
+    ellipsis_variables(x, car(template), bindings, vars);
+  }
+
+  if (is_atom(template))
+  {
+    expr_t b = binding(bindings, template);
+    if ((b != NULL) && (binding_depth(b) > 0) && (binding(*vars, template) == NULL))
+      *vars = cons(x->crisp, b, *vars);
+  }
+}
+
+// Instantiates the template before an ellipsis once for each value its
+// variables matched, giving a list of the results.
+static expr_t instantiate_ellipsis(pass_t *x, expr_t template, expr_t bindings, expr_t *renames)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t vars = nil_value(crisp);
+  ellipsis_variables(x, template, bindings, &vars);
+  if (!pair(vars))
+  {
+    crisp_eval_error(crisp, "An ellipsis in a template must follow a pattern variable");
+    return NULL;
+  }
+
+  // Each variable with the values it has left, as (binding . values).
+  size_t count = length(binding_value(car(vars)));
+  expr_t cursors = nil_value(crisp);
+  for (expr_t v = vars; pair(v); v = cdr(v))
+  {
+    if (length(binding_value(car(v))) != count)
+    {
+      crisp_eval_error(crisp, "Pattern variables before an ellipsis matched different numbers of forms");
+      return NULL;
+    }
+    cursors = cons(crisp, cons(crisp, car(v), binding_value(car(v))), cursors);
+  }
+
+  expr_t head = nil_value(crisp);
+  expr_t tail = NULL;
+  for (size_t i = 0; i < count; i++)
+  {
+    expr_t inner = bindings;
+    for (expr_t c = cursors; pair(c); c = cdr(c))
+    {
+      expr_t b = car(car(c));
+      expr_t values = cdr(car(c));
+      inner = bind(x, inner, car(b), binding_depth(b) - 1, car(values));
+      set_cdr(car(c), cdr(values));
+    }
+
+    expr_t value = instantiate(x, template, inner, renames);
+    if (value == NULL)
+      return NULL;
+
+    expr_t c = cons(crisp, value, nil_value(crisp));
+    if (tail == NULL)
+      head = c;
+    else
+      set_cdr(tail, c);
+    tail = c;
+  }
+  return head;
+}
+
+static expr_t instantiate(pass_t *x, expr_t template, expr_t bindings, expr_t *renames)
+{
+  if (is_atom(template))
+  {
+    expr_t b = binding(bindings, template);
+    if (b == NULL)
+      return alias(x, template, renames);
+
+    if (binding_depth(b) != 0)
+    {
+      crisp_eval_error(x->crisp, "Pattern variable %s must be followed by an ellipsis", as_atom(template));
+      return NULL;
+    }
+    // Each use is a copy of the form that was matched. The uses may end up
+    // under different bindings, and make_atom explains why they can not
+    // share atoms.
+    return copy_form(x, binding_value(b));
+  }
+
+  if (!pair(template))
+    return template;
+
+  // Built with a tail pointer, splicing in the forms each ellipsis makes.
+  expr_t head = NULL;
+  expr_t tail = NULL;
+  while (pair(template))
+  {
+    expr_t part;
+    if (is_ellipsis_next(template))
+    {
+      part = instantiate_ellipsis(x, car(template), bindings, renames);
+      template = cdr(cdr(template));
+    }
+    else
+    {
+      expr_t value = instantiate(x, car(template), bindings, renames);
+      part = (value != NULL) ? cons(x->crisp, value, nil_value(x->crisp)) : NULL;
+      template = cdr(template);
+    }
+
+    if (part == NULL)
+      return NULL;
+
+    for (; pair(part); part = cdr(part))
+    {
+      if (tail == NULL)
+        head = part;
+      else
+        set_cdr(tail, part);
+      tail = part;
+    }
+  }
+
+  expr_t rest = instantiate(x, template, bindings, renames);
+  if ((rest == NULL) || (head == NULL))
+    return rest;
+  set_cdr(tail, rest);
+  return head;
+}
+
+// The name an alias was made for, NULL if the atom is not an alias.
+static expr_t original_name(expr_t renames, expr_t atom)
+{
+  for (; pair(renames); renames = cdr(renames))
+  {
+    if (as_atom(cdr(car(renames))) == as_atom(atom))
+      return car(car(renames));
+  }
+  return NULL;
+}
+
+// Quoted data gets every name back.
+static expr_t resolve_datum(pass_t *x, expr_t node, expr_t renames)
+{
+  if (is_atom(node))
+  {
+    expr_t name = original_name(renames, node);
+    return (name != NULL) ? make_atom(x, as_atom(name)) : node;
+  }
+
+  for (expr_t p = node; pair(p); p = cdr(p))
+  {
+    set_car(p, resolve_datum(x, car(p), renames));
+  }
+  return node;
+}
+
+static expr_t resolve(pass_t *x, expr_t node, expr_t renames, expr_t bound);
+
+// The variables of a match pattern are bound within its clause, its quoted
+// data are data.
+static expr_t bind_pattern(pass_t *x, expr_t pattern, expr_t bound)
+{
+  if (is_atom(pattern) && (as_syntax(pattern) == SYNTAX_NONE))
+    return bind_name(x, bound, pattern);
+  if (!pair(pattern) || is_hole(pattern, SYNTAX_QUOTE))
+    return bound;
+  return bind_pattern(x, cdr(pattern), bind_pattern(x, car(pattern), bound));
+}
+
+static expr_t resolve_pattern(pass_t *x, expr_t pattern, expr_t renames, expr_t bound)
+{
+  if (is_hole(pattern, SYNTAX_QUOTE))
+  {
+    resolve_datum(x, cdr(pattern), renames);
+    return pattern;
+  }
+  if (!pair(pattern))
+    return resolve(x, pattern, renames, bound);
+
+  set_car(pattern, resolve_pattern(x, car(pattern), renames, bound));
+  set_cdr(pattern, resolve_pattern(x, cdr(pattern), renames, bound));
+  return pattern;
+}
+
+// A quasiquote template is data, but for the forms that it unquotes.
+static expr_t resolve_template(pass_t *x, expr_t node, expr_t renames, expr_t bound)
+{
+  if (is_hole(node, SYNTAX_UNQUOTE) || is_hole(node, SYNTAX_UNQUOTE_SPLICING))
+  {
+    set_car(cdr(node), resolve(x, car(cdr(node)), renames, bound));
+    return node;
+  }
+
+  if (!pair(node))
+    return resolve_datum(x, node, renames);
+
+  set_car(node, resolve_template(x, car(node), renames, bound));
+  set_cdr(node, resolve_template(x, cdr(node), renames, bound));
+  return node;
+}
+
+static void resolve_forms(pass_t *x, expr_t forms, expr_t renames, expr_t bound)
+{
+  for (; pair(forms); forms = cdr(forms))
+  {
+    set_car(forms, resolve(x, car(forms), renames, bound));
+  }
+}
+
+static expr_t resolve(pass_t *x, expr_t node, expr_t renames, expr_t bound)
+{
+  if (is_atom(node))
+  {
+    expr_t name = original_name(renames, node);
+    if ((name == NULL) || is_bound(bound, as_atom(node)))
+      return node;
+
+    // A free name refers to what it does where the macro was defined, the
+    // top level, so it is bound to its global cell as the inliner does,
+    // and no binding at the use site can capture it. A name that is not
+    // defined yet is looked up when it is evaluated.
+    expr_t atom = make_atom(x, as_atom(name));
+    atom->as.atom.cell = env_get_cell(root_env(x->crisp), as_atom(atom));
+    return atom;
+  }
+
+  if (!pair(node))
+    return node;
+
+  switch (is_atom(car(node)) ? as_syntax(car(node)) : SYNTAX_NONE)
+  {
+  case SYNTAX_QUOTE:
+    resolve_datum(x, cdr(node), renames);
+    return node;
+
+  case SYNTAX_QUASIQUOTE:
+    resolve_template(x, cdr(node), renames, bound);
+    return node;
+
+  case SYNTAX_LAMBDA:
+    if (pair(cdr(node)))
+    {
+      resolve_forms(x, cdr(cdr(node)), renames, bind_formals(x, car(cdr(node)), bound));
+      return node;
+    }
+    break;
+
+  case SYNTAX_LET:
+    if (pair(cdr(node)) && is_atom(car(cdr(node))) && pair(cdr(cdr(node))))
+    {
+      // A named let binds its name within its forms.
+      expr_t bindings = car(cdr(cdr(node)));
+      for (expr_t b = bindings; pair(b); b = cdr(b))
+      {
+        if (pair(car(b)))
+          resolve_forms(x, cdr(car(b)), renames, bound);
+      }
+      expr_t inner = bind_let_names(x, bindings, bind_name(x, bound, car(cdr(node))));
+      resolve_forms(x, cdr(cdr(cdr(node))), renames, inner);
+      return node;
+    }
+    // Fall through
+  case SYNTAX_LET_STAR:
+  case SYNTAX_LETREC:
+    if (pair(cdr(node)))
+    {
+      expr_t inner = bind_let_names(x, car(cdr(node)), bound);
+      expr_t init = (as_syntax(car(node)) == SYNTAX_LET) ? bound : inner;
+      for (expr_t b = car(cdr(node)); pair(b); b = cdr(b))
+      {
+        if (pair(car(b)))
+          resolve_forms(x, cdr(car(b)), renames, init);
+      }
+      resolve_forms(x, cdr(cdr(node)), renames, inner);
+      return node;
+    }
+    break;
+
+  case SYNTAX_DO:
+    if (pair(cdr(node)))
+    {
+      // Only the initial values are outside the scope of the variables.
+      expr_t inner = bind_let_names(x, car(cdr(node)), bound);
+      for (expr_t b = car(cdr(node)); pair(b); b = cdr(b))
+      {
+        if (pair(car(b)) && pair(cdr(car(b))))
+        {
+          set_car(cdr(car(b)), resolve(x, car(cdr(car(b))), renames, bound));
+          resolve_forms(x, cdr(cdr(car(b))), renames, inner);
+        }
+      }
+      if (pair(cdr(cdr(node))))
+      {
+        resolve_forms(x, car(cdr(cdr(node))), renames, inner);
+        resolve_forms(x, cdr(cdr(cdr(node))), renames, inner);
+      }
+      return node;
+    }
+    break;
+
+  case SYNTAX_CASE:
+    if (pair(cdr(node)))
+    {
+      set_car(cdr(node), resolve(x, car(cdr(node)), renames, bound));
+      for (expr_t c = cdr(cdr(node)); pair(c); c = cdr(c))
+      {
+        if (pair(car(c)))
+        {
+          set_car(car(c), resolve_datum(x, car(car(c)), renames));
+          resolve_forms(x, cdr(car(c)), renames, bound);
+        }
+      }
+      return node;
+    }
+    break;
+
+  case SYNTAX_DEFINE_METHOD:
+    if (pair(cdr(node)) && pair(car(cdr(node))))
+    {
+      // The parameters are bound within the forms, the types are names.
+      expr_t signature = car(cdr(node));
+      set_car(signature, resolve(x, car(signature), renames, bound));
+      expr_t inner = (bound != NULL) ? bound : nil_value(x->crisp);
+      expr_t p = cdr(signature);
+      for (; pair(p); p = cdr(p))
+      {
+        if (is_atom(car(p)))
+        {
+          inner = bind_name(x, inner, car(p));
+        }
+        else if (pair(car(p)) && is_atom(car(car(p))))
+        {
+          inner = bind_name(x, inner, car(car(p)));
+          resolve_datum(x, cdr(car(p)), renames);
+        }
+      }
+      inner = is_atom(p) ? bind_name(x, inner, p) : inner;
+      resolve_forms(x, cdr(cdr(node)), renames, inner);
+      return node;
+    }
+    break;
+
+  case SYNTAX_MATCH:
+    if (pair(cdr(node)))
+    {
+      set_car(cdr(node), resolve(x, car(cdr(node)), renames, bound));
+      for (expr_t c = cdr(cdr(node)); pair(c); c = cdr(c))
+      {
+        if (pair(car(c)))
+        {
+          expr_t inner = bind_pattern(x, car(car(c)), bound);
+          set_car(car(c), resolve_pattern(x, car(car(c)), renames, inner));
+          resolve_forms(x, cdr(car(c)), renames, inner);
+        }
+      }
+      return node;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  resolve_forms(x, node, renames, bound);
+  return node;
+}
+
+// Rewrites a use of a macro to the template of the first of its rules
+// whose pattern matches the use. The keyword position of a pattern is
+// ignored.
+static expr_t transcribe(pass_t *x, expr_t rules, expr_t form)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t literals = car(rules);
+
+  for (expr_t r = cdr(rules); pair(r); r = cdr(r))
+  {
+    expr_t pattern = car(car(r));
+    expr_t bindings = nil_value(crisp);
+    if (match(x, cdr(pattern), cdr(form), literals, &bindings))
+    {
+      expr_t renames = nil_value(crisp);
+      expr_t expansion = instantiate(x, car(cdr(car(r))), bindings, &renames);
+      return (expansion != NULL) ? resolve(x, expansion, renames, nil_value(crisp)) : NULL;
+    }
+  }
+
+  crisp_eval_error(crisp, "No syntax rule of %s matches", as_atom(car(form)));
+  return NULL;
+}
+
+// The form is rewritten in place, so that whatever refers to it refers to
+// its expansion.
+static void replace(pass_t *x, expr_t node, expr_t expansion)
+{
+  node->flags = 0;
+  node->as.cons.meta = NULL;
+  if (pair(expansion))
+  {
+    set_car(node, car(expansion));
+    set_cdr(node, cdr(expansion));
+  }
+  else
+  {
+    set_car(node, make_atom(x, "begin"));
+    set_cdr(node, cons(x->crisp, expansion, nil_value(x->crisp)));
+  }
+}
+
+// The transformer of the macro that a form uses, if it is a use of one.
+static expr_t macro_rules(pass_t *x, expr_t node, expr_t scope)
+{
+  expr_t op = car(node);
+  expr_t rules = NULL;
+  if (is_atom(op) && (as_syntax(op) == SYNTAX_NONE) && !is_bound(scope, as_atom(op)) &&
+      hash_table_get(&x->expander->macros, as_atom(op), VALUE_PTR(&rules)))
+  {
+    return rules;
+  }
+  return NULL;
+}
+
+// Checks a (syntax-rules (literals...) (pattern template)...) transformer,
+// returning its operands.
+static expr_t syntax_rules(pass_t *x, expr_t spec)
+{
+  crisp_t *crisp = x->crisp;
+  if (!is_proper_list(spec) || (length(spec) < 2) || !is_keyword(car(spec), SYNTAX_SYNTAX_RULES))
+  {
+    crisp_eval_error(crisp, "Expected a syntax-rules transformer");
+    return NULL;
+  }
+
+  expr_t literals = car(cdr(spec));
+  if (!is_nil(literals) && !is_proper_list(literals))
+  {
+    crisp_eval_error(crisp, "The literals of syntax-rules must be a list of atoms");
+    return NULL;
+  }
+  for (; pair(literals); literals = cdr(literals))
+  {
+    if (!is_atom(car(literals)))
+    {
+      crisp_eval_error(crisp, "The literals of syntax-rules must be a list of atoms");
+      return NULL;
+    }
+  }
+
+  for (expr_t r = cdr(cdr(spec)); pair(r); r = cdr(r))
+  {
+    expr_t rule = car(r);
+    if (!is_proper_list(rule) || (length(rule) != 2) || !pair(car(rule)))
+    {
+      crisp_eval_error(crisp, "A syntax rule must be a (pattern template) list");
+      return NULL;
+    }
+  }
+  return cdr(spec);
+}
+
+static bool define_syntax(pass_t *x, expr_t node, expr_t scope)
+{
+  crisp_t *crisp = x->crisp;
+  if (scope != NULL)
+  {
+    crisp_eval_error(crisp, "define-syntax is only allowed at the top level");
+    return false;
+  }
+
+  expr_t operands = cdr(node);
+  if (!is_proper_list(operands) || (length(operands) != 2) || !is_atom(car(operands)) ||
+      (as_syntax(car(operands)) != SYNTAX_NONE))
+  {
+    crisp_eval_error(crisp, "define-syntax expects a name and a transformer");
+    return false;
+  }
+
+  expr_t rules = syntax_rules(x, car(cdr(operands)));
+  if (rules == NULL)
+    return false;
+
+  hash_table_set(&x->expander->macros, as_atom(car(operands)), rules);
+
+  // Nothing is left to evaluate, the value is that of a define.
+  set_car(node, make_atom(x, "quote"));
+  set_cdr(node, cons(crisp, nil_value(crisp), nil_value(crisp)));
+  return true;
+}
+
+// Quasiquote
+//
+// A template is compiled, once, into the code that builds it. Subtrees
+// without an unquote are constants that every evaluation shares, quoted
+// as they are. Only the pairs on the path to an unquote are consed afresh.
+
+static expr_t list2(pass_t *x, expr_t a, expr_t b)
+{
+  crisp_t *crisp = x->crisp;
+  return cons(crisp, a, cons(crisp, b, nil_value(crisp)));
+}
+
+static expr_t call2(pass_t *x, const char *fn, expr_t a, expr_t b)
+{
+  return cons(x->crisp, make_atom(x, fn), list2(x, a, b));
+}
+
+static expr_t quoted(pass_t *x, expr_t datum)
+{
+  return list2(x, make_atom(x, "quote"), datum);
+}
+
+static expr_t build(pass_t *x, expr_t template, size_t depth);
+
+static expr_t build_pair(pass_t *x, expr_t template, size_t depth)
+{
+  expr_t a = build(x, car(template), depth);
+  expr_t d = build(x, cdr(template), depth);
+  if ((a == NULL) && (d == NULL))
+    return NULL;
+  return call2(x, BUILTIN_QUASIQUOTE_CONS,
+               (a != NULL) ? a : quoted(x, car(template)),
+               (d != NULL) ? d : quoted(x, cdr(template)));
+}
+
+// The code that builds a template, NULL if the template is a constant.
+// Depth counts the quasiquotes the template is nested in, beyond the one
+// being compiled, each of which an unquote must leave before it is one.
+static expr_t build(pass_t *x, expr_t template, size_t depth)
+{
+  if (!pair(template))
+    return NULL;
+
+  if (is_hole(template, SYNTAX_UNQUOTE) || is_hole(template, SYNTAX_UNQUOTE_SPLICING))
+  {
+    if ((depth == 0) && is_keyword(car(template), SYNTAX_UNQUOTE))
+      return car(cdr(template));
+    return build_pair(x, template, (depth > 0) ? depth - 1 : 0);
+  }
+
+  if (is_hole(template, SYNTAX_QUASIQUOTE))
+    return build_pair(x, template, depth + 1);
+
+  if ((depth == 0) && is_hole(car(template), SYNTAX_UNQUOTE_SPLICING))
+  {
+    expr_t rest = build(x, cdr(template), depth);
+    return call2(x, BUILTIN_QUASIQUOTE_SPLICE, car(cdr(car(template))),
+                 (rest != NULL) ? rest : quoted(x, cdr(template)));
+  }
+
+  return build_pair(x, template, depth);
+}
+
+static bool quasiquote(pass_t *x, expr_t node)
+{
+  if (!is_hole(node, SYNTAX_QUASIQUOTE))
+  {
+    crisp_eval_error(x->crisp, "quasiquote expects a single template");
+    return false;
+  }
+
+  expr_t template = car(cdr(node));
+  if (is_hole(template, SYNTAX_UNQUOTE_SPLICING))
+  {
+    crisp_eval_error(x->crisp, "unquote-splicing must be within a list");
+    return false;
+  }
+
+  expr_t code = build(x, template, 0);
+  replace(x, node, (code != NULL) ? code : quoted(x, template));
+  return true;
+}
+
+// Loops
+//
+// A do loop is rewritten to the named let
+//   (let do#loop ((variable init)...)
+//     (if test (begin result...) (begin forms... (do#loop step...))))
+// in which a variable without a step is passed on as it is.
+//
+// A named let whose name is only ever called, with a value for each of its
+// variables, in tail position within its forms is a loop. Each call is
+// rewritten to (recur#loop name values...), which the evaluators run by
+// updating the variables in place and going round the forms again, all in
+// the one frame. Any other named let is rewritten to the call
+//   ((letrec ((name (lambda (variable...) forms...))) name) init...)
+
+static bool is_do_spec(expr_t spec)
+{
+  return is_proper_list(spec) && is_atom(car(spec)) && ((length(spec) == 2) || (length(spec) == 3));
+}
+
+static bool expand_do(pass_t *x, expr_t node)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t operands = cdr(node);
+  bool valid = is_proper_list(operands) && (length(operands) >= 2) && is_proper_list(car(operands)) &&
+               pair(car(cdr(operands))) && is_proper_list(car(cdr(operands)));
+  for (expr_t s = valid ? car(operands) : operands; valid && pair(s); s = cdr(s))
+  {
+    valid = is_do_spec(car(s));
+  }
+  if (!valid)
+  {
+    crisp_eval_error(crisp, "do expects ((variable init step)...) (test result...) forms...");
+    return false;
+  }
+
+  // The lists are built back to front.
+  expr_t bindings = nil_value(crisp);
+  expr_t steps = nil_value(crisp);
+  for (expr_t s = reverse(x, car(operands)); pair(s); s = cdr(s))
+  {
+    expr_t spec = car(s);
+    bindings = cons(crisp, list2(x, car(spec), car(cdr(spec))), bindings);
+    expr_t step = pair(cdr(cdr(spec))) ? car(cdr(cdr(spec))) : make_atom(x, as_atom(car(spec)));
+    steps = cons(crisp, step, steps);
+  }
+
+  expr_t forms = cons(crisp, cons(crisp, make_atom(x, "do#loop"), steps), nil_value(crisp));
+  for (expr_t f = reverse(x, cdr(cdr(operands))); pair(f); f = cdr(f))
+  {
+    forms = cons(crisp, car(f), forms);
+  }
+
+  expr_t exit = car(cdr(operands));
+  expr_t body = cons(crisp, make_atom(x, "if"),
+                     cons(crisp, car(exit),
+                          list2(x, cons(crisp, make_atom(x, "begin"), cdr(exit)),
+                                cons(crisp, make_atom(x, "begin"), forms))));
+  replace(x, node, cons(crisp, make_atom(x, "let"),
+                        cons(crisp, make_atom(x, "do#loop"), list2(x, bindings, body))));
+  return true;
+}
+
+// The operands (bindings forms...) of a well formed let.
+static bool is_let_operands(expr_t operands)
+{
+  if (!is_proper_list(operands) || (length(operands) < 2) || !is_proper_list(car(operands)))
+    return false;
+
+  for (expr_t b = car(operands); pair(b); b = cdr(b))
+  {
+    if (!is_proper_list(car(b)) || (length(car(b)) != 2) || !is_atom(car(car(b))))
+      return false;
+  }
+  return true;
+}
+
+static bool binds_formal(expr_t formals, const char *name)
+{
+  for (; pair(formals); formals = cdr(formals))
+  {
+    if (is_atom(car(formals)) && (as_atom(car(formals)) == name))
+      return true;
+  }
+  return is_atom(formals) && (as_atom(formals) == name);
+}
+
+static bool binds_variable(expr_t bindings, const char *name)
+{
+  for (; pair(bindings); bindings = cdr(bindings))
+  {
+    if (pair(car(bindings)) && is_atom(car(car(bindings))) && (as_atom(car(car(bindings))) == name))
+      return true;
+  }
+  return false;
+}
+
+static bool mentions(expr_t node, syntax_t syntax)
+{
+  for (; pair(node); node = cdr(node))
+  {
+    if (mentions(car(node), syntax))
+      return true;
+  }
+  return is_keyword(node, syntax);
+}
+
+// The name and number of variables of the named let being checked, and
+// the calls of it found so far.
+typedef struct
+{
+  const char *name;
+  size_t argc;
+  expr_t calls;
+} loop_t;
+
+static bool loop_calls(pass_t *x, loop_t *loop, expr_t node, bool tail);
+
+// Every element of a list, none of them in tail position.
+static bool loop_elements(pass_t *x, loop_t *loop, expr_t node)
+{
+  for (; pair(node); node = cdr(node))
+  {
+    if (!loop_calls(x, loop, car(node), false))
+      return false;
+  }
+  return loop_calls(x, loop, node, false);
+}
+
+// A sequence of forms, the last of which is in the tail position of the
+// sequence.
+static bool loop_sequence(pass_t *x, loop_t *loop, expr_t forms, bool tail)
+{
+  for (; pair(forms); forms = cdr(forms))
+  {
+    if (!loop_calls(x, loop, car(forms), tail && !pair(cdr(forms))))
+      return false;
+  }
+  return true;
+}
+
+static bool loop_let(pass_t *x, loop_t *loop, expr_t node, bool tail)
+{
+  syntax_t syntax = as_syntax(car(node));
+  expr_t operands = cdr(node);
+  bool shadowed = false;
+  if ((syntax == SYNTAX_LET) && pair(operands) && is_atom(car(operands)))
+  {
+    shadowed = (as_atom(car(operands)) == loop->name);
+    operands = cdr(operands);
+  }
+  if (!pair(operands))
+    return loop_elements(x, loop, operands);
+
+  // The values of a letrec, and those of a let* after the binding, are in
+  // the scope of the variable.
+  expr_t bindings = car(operands);
+  bool in_scope = (syntax == SYNTAX_LETREC) && binds_variable(bindings, loop->name);
+  for (expr_t b = bindings; pair(b); b = cdr(b))
+  {
+    if (!in_scope && !loop_elements(x, loop, pair(car(b)) ? cdr(car(b)) : car(b)))
+      return false;
+    in_scope = in_scope || ((syntax == SYNTAX_LET_STAR) && binds_variable(b, loop->name));
+  }
+
+  if (shadowed || binds_variable(bindings, loop->name))
+    return true;
+  return loop_sequence(x, loop, cdr(operands), tail);
+}
+
+// Collects the calls of the named let in a form, returning false if the
+// form uses the name in any other way.
+static bool loop_calls(pass_t *x, loop_t *loop, expr_t node, bool tail)
+{
+  if (is_atom(node))
+    return as_atom(node) != loop->name;
+
+  if (!pair(node))
+    return true;
+
+  expr_t op = car(node);
+  expr_t operands = cdr(node);
+  if (is_atom(op) && (as_atom(op) == loop->name))
+  {
+    if (!tail || !is_proper_list(operands) || (length(operands) != loop->argc))
+      return false;
+    loop->calls = cons(x->crisp, node, loop->calls);
+    return loop_elements(x, loop, operands);
+  }
+
+  if (!is_proper_list(node))
+    return loop_elements(x, loop, node);
+
+  switch (is_atom(op) ? as_syntax(op) : SYNTAX_NONE)
+  {
+  case SYNTAX_QUOTE:
+    return true;
+
+  case SYNTAX_LAMBDA:
+    // A closure may call the name from anywhere.
+    return (pair(operands) && binds_formal(car(operands), loop->name)) ||
+           loop_elements(x, loop, operands);
+
+  case SYNTAX_IF:
+    if (!pair(operands) || !loop_calls(x, loop, car(operands), false))
+      return false;
+    for (expr_t branches = cdr(operands); pair(branches); branches = cdr(branches))
+    {
+      if (!loop_calls(x, loop, car(branches), tail))
+        return false;
+    }
+    return true;
+
+  case SYNTAX_COND:
+    for (expr_t clauses = operands; pair(clauses); clauses = cdr(clauses))
+    {
+      expr_t clause = car(clauses);
+      if (!pair(clause))
+        return loop_elements(x, loop, clause);
+      if (!is_keyword(car(clause), SYNTAX_ELSE) && !loop_calls(x, loop, car(clause), false))
+        return false;
+      if (!loop_sequence(x, loop, cdr(clause), tail))
+        return false;
+    }
+    return true;
+
+  case SYNTAX_CASE:
+    if (!pair(operands) || !loop_calls(x, loop, car(operands), false))
+      return false;
+    for (expr_t clauses = cdr(operands); pair(clauses); clauses = cdr(clauses))
+    {
+      if (!pair(car(clauses)) || !loop_sequence(x, loop, cdr(car(clauses)), tail))
+        return false;
+    }
+    return true;
+
+  case SYNTAX_BEGIN:
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    return loop_sequence(x, loop, operands, tail);
+
+  case SYNTAX_LET:
+  case SYNTAX_LET_STAR:
+  case SYNTAX_LETREC:
+    return loop_let(x, loop, node, tail);
+
+  default:
+    return loop_elements(x, loop, node);
+  }
+}
+
+// Whether a named let, the parts of which have been expanded, is a loop.
+// If so its calls are rewritten.
+static bool is_loop(pass_t *x, expr_t node)
+{
+  expr_t operands = cdr(cdr(node));
+  loop_t loop = {.name = as_atom(car(cdr(node))), .argc = length(car(operands)), .calls = nil_value(x->crisp)};
+  if (!loop_sequence(x, &loop, cdr(operands), true))
+    return false;
+
+  // The variables are updated in place, which closures that share the
+  // frame of the loop would see. See crisp_let_may_escape.
+  if (mentions(cdr(operands), SYNTAX_LAMBDA) && mentions(operands, SYNTAX_SET))
+    return false;
+
+  for (expr_t c = loop.calls; pair(c); c = cdr(c))
+  {
+    expr_t call = car(c);
+    set_cdr(call, cons(x->crisp, car(call), cdr(call)));
+    set_car(call, make_atom(x, "recur#loop"));
+  }
+  return true;
+}
+
+static bool expand_named_let(pass_t *x, expr_t node, expr_t scope)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t name = car(cdr(node));
+  expr_t operands = cdr(cdr(node));
+
+  // A malformed let is left for the evaluator to report.
+  if (!is_let_operands(operands))
+    return true;
+
+  for (expr_t b = car(operands); pair(b); b = cdr(b))
+  {
+    if (!expand_forms(x, cdr(car(b)), scope))
+      return false;
+  }
+  if (!expand_forms(x, cdr(operands), bind_let_names(x, car(operands), bind_name(x, scope, name))))
+    return false;
+
+  if (is_loop(x, node))
+    return true;
+
+  expr_t variables = nil_value(crisp);
+  expr_t values = nil_value(crisp);
+  for (expr_t b = reverse(x, car(operands)); pair(b); b = cdr(b))
+  {
+    variables = cons(crisp, car(car(b)), variables);
+    values = cons(crisp, car(cdr(car(b))), values);
+  }
+
+  expr_t lambda = cons(crisp, make_atom(x, "lambda"), cons(crisp, variables, cdr(operands)));
+  expr_t letrec = cons(crisp, make_atom(x, "letrec"),
+                       list2(x, cons(crisp, list2(x, name, lambda), nil_value(crisp)),
+                             make_atom(x, as_atom(name))));
+  replace(x, node, cons(crisp, letrec, values));
+  return expand_subforms(x, node, scope);
+}
+
+// Match
+//
+// A form (match subject (pattern forms...)...) is compiled, once, into a
+// decision tree of if and let forms that evaluate the forms of the first
+// clause whose pattern matches the subject. A pattern is _, a variable, a
+// number, string or boolean, a quoted datum, () or a pair of patterns.
+//
+// The tree tests the subterms of the subject in the order that the
+// clauses need them and never makes the same test twice on any path. Each
+// subterm is taken once it is needed and tested, or bound directly to the
+// variable that matched it. The forms of a clause that more than one leaf
+// of the tree reaches are copied into each of them.
+//
+// The rows of the tree still to decide are a list of
+// (patterns bindings . clause), the patterns being those for the subterms
+// still to test, the columns, and the bindings the (variable . subterm)
+// matched so far.
+
+typedef struct
+{
+  // The temporary the subject is bound to.
+  expr_t subject;
+  // The clauses whose forms are already in the tree.
+  expr_t placed;
+} match_t;
+
+static bool is_literal_pattern(expr_t pattern)
+{
+  return is_hole(pattern, SYNTAX_QUOTE);
+}
+
+// A variable is bound to the temporary a subterm is held in as soon as
+// the subterm is tested, before which it is the (car#match temporary) or
+// (cdr#match temporary) that takes the subterm.
+static expr_t temporary(pass_t *x)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "match#%zu", ++x->expander->aliases);
+  return make_atom(x, name);
+}
+
+static expr_t copy_form(pass_t *x, expr_t form)
+{
+  if (is_atom(form))
+    return make_atom(x, as_atom(form));
+  if (!pair(form))
+    return form;
+  return cons(x->crisp, copy_form(x, car(form)), copy_form(x, cdr(form)));
+}
+
+// A quoted datum matches the pairs of its structure, each of the rest of
+// it being a literal.
+static expr_t datum_pattern(pass_t *x, expr_t datum)
+{
+  if (pair(datum))
+    return cons(x->crisp, datum_pattern(x, car(datum)), datum_pattern(x, cdr(datum)));
+  return quoted(x, datum);
+}
+
+// The pattern of a clause with every literal quoted, NULL if an eval error
+// was raised. Variables are collected in vars.
+static expr_t clause_pattern(pass_t *x, expr_t pattern, expr_t *vars)
+{
+  if (is_atom(pattern))
+  {
+    if (is_keyword(pattern, SYNTAX_UNDERSCORE))
+      return pattern;
+    if (as_syntax(pattern) != SYNTAX_NONE)
+    {
+      crisp_eval_error(x->crisp, "The keyword %s is not a pattern variable", as_atom(pattern));
+      return NULL;
+    }
+    if (is_bound(*vars, as_atom(pattern)))
+    {
+      crisp_eval_error(x->crisp, "Pattern variable %s is bound more than once", as_atom(pattern));
+      return NULL;
+    }
+    *vars = bind_name(x, *vars, pattern);
+    return pattern;
+  }
+
+  if (is_literal_pattern(pattern))
+    return datum_pattern(x, car(cdr(pattern)));
+
+  if (pair(pattern))
+  {
+    expr_t a = clause_pattern(x, car(pattern), vars);
+    expr_t d = (a != NULL) ? clause_pattern(x, cdr(pattern), vars) : NULL;
+    return (d != NULL) ? cons(x->crisp, a, d) : NULL;
+  }
+
+  if (is_nil(pattern) || is_bool(pattern) || is_number(pattern) || is_string(pattern))
+    return quoted(x, pattern);
+
+  crisp_eval_error(x->crisp, "Not a pattern");
+  return NULL;
+}
+
+static expr_t nth(expr_t list, size_t n)
+{
+  for (; n > 0; n--)
+  {
+    list = cdr(list);
+  }
+  return car(list);
+}
+
+// The list with its element n replaced by the elements of parts.
+static expr_t splice_column(pass_t *x, expr_t list, size_t n, expr_t parts)
+{
+  if (n > 0)
+    return cons(x->crisp, car(list), splice_column(x, cdr(list), n - 1, parts));
+
+  expr_t rest = cdr(list);
+  for (parts = reverse(x, parts); pair(parts); parts = cdr(parts))
+  {
+    rest = cons(x->crisp, car(parts), rest);
+  }
+  return rest;
+}
+
+// The rows that remain once the subterm of a column is known to pass the
+// test of the pattern given, or to fail it. Passing a pair test replaces
+// the column with the columns of its car and cdr, passing a literal test
+// removes it.
+static expr_t specialize(pass_t *x, expr_t rows, size_t column, expr_t test, expr_t subterm, bool passed)
+{
+  crisp_t *crisp = x->crisp;
+  bool pair_test = !is_literal_pattern(test);
+  expr_t result = nil_value(crisp);
+
+  for (expr_t r = reverse(x, rows); pair(r); r = cdr(r))
+  {
+    expr_t patterns = car(car(r));
+    expr_t bindings = car(cdr(car(r)));
+    expr_t clause = cdr(cdr(car(r)));
+    expr_t p = nth(patterns, column);
+
+    bool matches = is_atom(p) ||
+                   (pair_test ? !is_literal_pattern(p)
+                              : (is_literal_pattern(p) && is_eqv(car(cdr(p)), car(cdr(test)))));
+    if (!passed)
+    {
+      // Only the patterns that certainly matched are ruled out.
+      if (!matches || is_atom(p))
+        result = cons(crisp, car(r), result);
+      continue;
+    }
+    if (!matches)
+      continue;
+
+    expr_t parts = nil_value(crisp);
+    if (pair_test)
+    {
+      parts = is_atom(p) ? list2(x, make_atom(x, "_"), make_atom(x, "_")) : list2(x, car(p), cdr(p));
+    }
+    if (is_atom(p) && !is_keyword(p, SYNTAX_UNDERSCORE))
+    {
+      bindings = cons(crisp, cons(crisp, p, subterm), bindings);
+    }
+    expr_t row = cons(crisp, splice_column(x, patterns, column, parts), cons(crisp, bindings, clause));
+    result = cons(crisp, row, result);
+  }
+  return result;
+}
+
+static expr_t let1(pass_t *x, expr_t variable, expr_t value, expr_t form)
+{
+  return cons(x->crisp, make_atom(x, "let"),
+              list2(x, cons(x->crisp, list2(x, variable, value), nil_value(x->crisp)), form));
+}
+
+// The forms of a row whose remaining patterns all match, within the
+// bindings of its variables.
+static expr_t leaf(pass_t *x, match_t *m, expr_t columns, expr_t row)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t bindings = nil_value(crisp);
+  for (expr_t b = reverse(x, car(cdr(row))); pair(b); b = cdr(b))
+  {
+    bindings = cons(crisp, list2(x, make_atom(x, as_atom(car(car(b)))), copy_form(x, cdr(car(b)))), bindings);
+  }
+  for (expr_t p = car(row), c = columns; pair(p); p = cdr(p), c = cdr(c))
+  {
+    if (!is_keyword(car(p), SYNTAX_UNDERSCORE))
+      bindings = cons(crisp, list2(x, make_atom(x, as_atom(car(p))), copy_form(x, car(c))), bindings);
+  }
+
+  expr_t clause = cdr(cdr(row));
+  expr_t forms = cdr(clause);
+  bool placed = false;
+  for (expr_t c = m->placed; pair(c) && !placed; c = cdr(c))
+  {
+    placed = (car(c) == clause);
+  }
+  if (placed)
+    forms = copy_form(x, forms);
+  else
+    m->placed = cons(crisp, clause, m->placed);
+
+  if (is_nil(bindings))
+    return cons(crisp, make_atom(x, "begin"), forms);
+  return cons(crisp, make_atom(x, "let"), cons(crisp, reverse(x, bindings), forms));
+}
+
+static expr_t decide(pass_t *x, match_t *m, expr_t columns, expr_t rows)
+{
+  crisp_t *crisp = x->crisp;
+  if (!pair(rows))
+    return list2(x, make_atom(x, BUILTIN_MATCH_FAIL), copy_form(x, m->subject));
+
+  // The first subterm the first row tests.
+  size_t column = 0;
+  expr_t p = car(car(rows));
+  for (; pair(p) && is_atom(car(p)); p = cdr(p))
+  {
+    column++;
+  }
+  if (!pair(p))
+    return leaf(x, m, columns, car(rows));
+
+  expr_t subterm = nth(columns, column);
+  if (!is_atom(subterm))
+  {
+    expr_t t = temporary(x);
+    expr_t tree = decide(x, m, splice_column(x, columns, column, cons(crisp, t, nil_value(crisp))), rows);
+    return let1(x, make_atom(x, as_atom(t)), copy_form(x, subterm), tree);
+  }
+
+  expr_t test = car(p);
+  expr_t passed_columns = splice_column(x, columns, column, nil_value(crisp));
+  expr_t condition = NULL;
+  if (is_literal_pattern(test))
+  {
+    condition = cons(crisp, make_atom(x, BUILTIN_MATCH_EQV),
+                     list2(x, copy_form(x, subterm), quoted(x, car(cdr(test)))));
+  }
+  else
+  {
+    passed_columns = splice_column(x, columns, column,
+                                   list2(x, list2(x, make_atom(x, BUILTIN_MATCH_CAR), subterm),
+                                         list2(x, make_atom(x, BUILTIN_MATCH_CDR), subterm)));
+    condition = list2(x, make_atom(x, BUILTIN_MATCH_PAIR), copy_form(x, subterm));
+  }
+
+  expr_t passed = decide(x, m, passed_columns, specialize(x, rows, column, test, subterm, true));
+  expr_t failed = decide(x, m, columns, specialize(x, rows, column, test, subterm, false));
+  return cons(crisp, make_atom(x, "if"), cons(crisp, condition, list2(x, passed, failed)));
+}
+
+static bool compile_match(pass_t *x, expr_t node)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t operands = cdr(node);
+  bool valid = is_proper_list(operands) && pair(operands);
+  for (expr_t c = valid ? cdr(operands) : operands; valid && pair(c); c = cdr(c))
+  {
+    valid = is_proper_list(car(c)) && (length(car(c)) >= 2);
+  }
+  if (!valid)
+  {
+    crisp_eval_error(crisp, "match expects a subject and (pattern forms...) clauses");
+    return false;
+  }
+
+  match_t m = {.subject = temporary(x), .placed = nil_value(crisp)};
+  expr_t rows = nil_value(crisp);
+  for (expr_t c = reverse(x, cdr(operands)); pair(c); c = cdr(c))
+  {
+    expr_t vars = nil_value(crisp);
+    expr_t pattern = clause_pattern(x, car(car(c)), &vars);
+    if (pattern == NULL)
+      return false;
+    expr_t row = cons(crisp, cons(crisp, pattern, nil_value(crisp)), cons(crisp, nil_value(crisp), car(c)));
+    rows = cons(crisp, row, rows);
+  }
+
+  expr_t tree = decide(x, &m, cons(crisp, m.subject, nil_value(crisp)), rows);
+  replace(x, node, let1(x, make_atom(x, as_atom(m.subject)), car(operands), tree));
+  return true;
+}
+
+// Generic functions
+//
+//   (define-generic name)
+// is rewritten to
+//   (define name (make#generic 'name))
+// and
+//   (define-method (name (parameter type) parameter... . rest) forms...)
+// to
+//   (add-method#generic name '(type _...) (lambda (parameter... . rest) forms...))
+// in which a parameter without a type has the type _, of any value.
+
+static bool define_generic(pass_t *x, expr_t node)
+{
+  crisp_t *crisp = x->crisp;
+  if (!is_hole(node, SYNTAX_DEFINE_GENERIC) || !is_atom(car(cdr(node))))
+  {
+    crisp_eval_error(crisp, "define-generic expects a name");
+    return false;
+  }
+
+  expr_t name = car(cdr(node));
+  expr_t make = list2(x, make_atom(x, BUILTIN_GENERIC_MAKE), quoted(x, make_atom(x, as_atom(name))));
+  replace(x, node, cons(crisp, make_atom(x, "define"), list2(x, name, make)));
+  return true;
+}
+
+static bool define_method(pass_t *x, expr_t node)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t operands = cdr(node);
+  bool valid = is_proper_list(operands) && (length(operands) >= 2) && pair(car(operands)) &&
+               is_atom(car(car(operands)));
+  expr_t p = valid ? cdr(car(operands)) : operands;
+  for (; valid && pair(p); p = cdr(p))
+  {
+    expr_t parameter = car(p);
+    valid = is_atom(parameter) ||
+            (is_proper_list(parameter) && (length(parameter) == 2) &&
+             is_atom(car(parameter)) && is_atom(car(cdr(parameter))));
+  }
+  if (!valid || !(is_nil(p) || is_atom(p)))
+  {
+    crisp_eval_error(crisp, "define-method expects (name (parameter type)...) forms...");
+    return false;
+  }
+
+  // The lists are built back to front, leaving any rest parameter at the
+  // end of the formals.
+  expr_t types = nil_value(crisp);
+  expr_t formals = p;
+  for (p = reverse(x, cdr(car(operands))); pair(p); p = cdr(p))
+  {
+    expr_t parameter = car(p);
+    types = cons(crisp, is_atom(parameter) ? make_atom(x, "_") : car(cdr(parameter)), types);
+    formals = cons(crisp, is_atom(parameter) ? parameter : car(parameter), formals);
+  }
+
+  expr_t lambda = cons(crisp, make_atom(x, "lambda"), cons(crisp, formals, cdr(operands)));
+  replace(x, node, cons(crisp, make_atom(x, BUILTIN_GENERIC_ADD_METHOD),
+                        cons(crisp, car(car(operands)), list2(x, quoted(x, types), lambda))));
+  return true;
+}
+
+// Whether every element of a proper list is an atom.
+static bool is_atom_list(expr_t list)
+{
+  for (; pair(list); list = cdr(list))
+  {
+    if (!is_atom(car(list)))
+      return false;
+  }
+  return is_nil(list);
+}
+
+// The variable that the expansion of define-record-type holds the record
+// type in whilst it defines its procedures, so that one of them may have
+// the name of the type.
+#define RECORD_TYPE_VARIABLE "type#record"
+
+// (define name (builtin type 'datum)), without the datum if it is NULL.
+static expr_t define_record_procedure(pass_t *x, expr_t name, const char *builtin, expr_t datum)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t arguments = (datum != NULL) ? cons(crisp, quoted(x, datum), nil_value(crisp)) : nil_value(crisp);
+  expr_t call = cons(crisp, make_atom(x, builtin), cons(crisp, make_atom(x, RECORD_TYPE_VARIABLE), arguments));
+  return cons(crisp, make_atom(x, "define"), list2(x, name, call));
+}
+
+static bool define_record_type(pass_t *x, expr_t node)
+{
+  crisp_t *crisp = x->crisp;
+  expr_t operands = cdr(node);
+  bool valid = is_proper_list(operands) && (length(operands) >= 3) && is_atom(car(operands)) &&
+               (is_atom(car(cdr(operands))) ||
+                (pair(car(cdr(operands))) && is_atom_list(car(cdr(operands))))) &&
+               is_atom(car(cdr(cdr(operands))));
+  expr_t specs = valid ? cdr(cdr(cdr(operands))) : operands;
+  for (expr_t f = specs; valid && pair(f); f = cdr(f))
+  {
+    valid = pair(car(f)) && is_atom_list(car(f)) && (length(car(f)) >= 2) && (length(car(f)) <= 3);
+  }
+  if (!valid)
+  {
+    crisp_eval_error(crisp, "define-record-type expects name (constructor field...) predicate "
+                            "(field accessor modifier)...");
+    return false;
+  }
+
+  expr_t type = car(operands);
+  expr_t fields = nil_value(crisp);
+  for (expr_t f = specs; pair(f); f = cdr(f))
+  {
+    fields = cons(crisp, car(car(f)), fields);
+  }
+  fields = reverse(x, fields);
+
+  // The definitions are built back to front, that of the type first of
+  // all. They are made within a let, as define always defines a global.
+  expr_t definitions = nil_value(crisp);
+  for (expr_t f = reverse(x, specs); pair(f); f = cdr(f))
+  {
+    expr_t spec = car(f);
+    if (pair(cdr(cdr(spec))))
+    {
+      definitions = cons(crisp, define_record_procedure(x, car(cdr(cdr(spec))), BUILTIN_RECORD_MODIFIER, car(spec)),
+                         definitions);
+    }
+    definitions = cons(crisp, define_record_procedure(x, car(cdr(spec)), BUILTIN_RECORD_ACCESSOR, car(spec)),
+                       definitions);
+  }
+
+  expr_t constructor = car(cdr(operands));
+  expr_t predicate = car(cdr(cdr(operands)));
+  definitions = cons(crisp, define_record_procedure(x, predicate, BUILTIN_RECORD_PREDICATE, NULL), definitions);
+  definitions = cons(crisp,
+                     is_atom(constructor)
+                         ? define_record_procedure(x, constructor, BUILTIN_RECORD_CONSTRUCTOR, fields)
+                         : define_record_procedure(x, car(constructor), BUILTIN_RECORD_CONSTRUCTOR, cdr(constructor)),
+                     definitions);
+
+  definitions = cons(crisp, cons(crisp, make_atom(x, "define"), list2(x, type, make_atom(x, RECORD_TYPE_VARIABLE))),
+                     definitions);
+  expr_t make = cons(crisp, make_atom(x, BUILTIN_RECORD_TYPE),
+                     list2(x, quoted(x, make_atom(x, as_atom(type))), quoted(x, fields)));
+  expr_t bindings = cons(crisp, list2(x, make_atom(x, RECORD_TYPE_VARIABLE), make), nil_value(crisp));
+  replace(x, node, cons(crisp, make_atom(x, "let"), cons(crisp, bindings, definitions)));
+  return true;
+}
+
+static bool expand_forms(pass_t *x, expr_t forms, expr_t scope)
+{
+  for (; pair(forms); forms = cdr(forms))
+  {
+    if (!expand_node(x, car(forms), scope))
+      return false;
+  }
+  return true;
+}
+
+static bool expand_subforms(pass_t *x, expr_t node, expr_t scope)
+{
+  switch (is_atom(car(node)) ? as_syntax(car(node)) : SYNTAX_NONE)
+  {
+  case SYNTAX_QUOTE:
+    return true;
+
+  case SYNTAX_DEFINE_SYNTAX:
+    return define_syntax(x, node, scope);
+
+  case SYNTAX_QUASIQUOTE:
+    // The unquoted forms in the code that replaces the template are
+    // expanded in turn.
+    return quasiquote(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_UNQUOTE:
+  case SYNTAX_UNQUOTE_SPLICING:
+    crisp_eval_error(x->crisp, "%s outside of a quasiquote", as_atom(car(node)));
+    return false;
+
+  case SYNTAX_DEFINE:
+    if (!expand_forms(x, cdr(node), scope))
+      return false;
+    // A global of the same name replaces a macro.
+    if ((scope == NULL) && pair(cdr(node)) && is_atom(car(cdr(node))))
+      hash_table_delete(&x->expander->macros, as_atom(car(cdr(node))));
+    return true;
+
+  case SYNTAX_LAMBDA:
+    if (pair(cdr(node)))
+      return expand_forms(x, cdr(cdr(node)), bind_formals(x, car(cdr(node)), scope));
+    return true;
+
+  case SYNTAX_DO:
+    return expand_do(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_MATCH:
+    return compile_match(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_DEFINE_GENERIC:
+    return define_generic(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_DEFINE_METHOD:
+    return define_method(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_DEFINE_RECORD_TYPE:
+    return define_record_type(x, node) && expand_node(x, node, scope);
+
+  case SYNTAX_LET:
+    if (pair(cdr(node)) && is_atom(car(cdr(node))))
+      return expand_named_let(x, node, scope);
+    // Fall through
+  case SYNTAX_LET_STAR:
+  case SYNTAX_LETREC:
+    if (pair(cdr(node)))
+    {
+      expr_t inner = bind_let_names(x, car(cdr(node)), scope);
+      expr_t init = (as_syntax(car(node)) == SYNTAX_LET) ? scope : inner;
+      for (expr_t b = car(cdr(node)); pair(b); b = cdr(b))
+      {
+        if (pair(car(b)) && !expand_forms(x, cdr(car(b)), init))
+          return false;
+      }
+      return expand_forms(x, cdr(cdr(node)), inner);
+    }
+    return true;
+
+  case SYNTAX_COND:
+    // The clauses are not forms, their parts are.
+    for (expr_t clauses = cdr(node); pair(clauses); clauses = cdr(clauses))
+    {
+      if (!expand_forms(x, car(clauses), scope))
+        return false;
+    }
+    return true;
+
+  case SYNTAX_CASE:
+    // Nor are the data of the clauses.
+    if (pair(cdr(node)))
+    {
+      if (!expand_node(x, car(cdr(node)), scope))
+        return false;
+      for (expr_t clauses = cdr(cdr(node)); pair(clauses); clauses = cdr(clauses))
+      {
+        if (pair(car(clauses)) && !expand_forms(x, cdr(car(clauses)), scope))
+          return false;
+      }
+    }
+    return true;
+
+  case SYNTAX_PARAMETERIZE:
+    // Nor are the bindings, the parameters and values of which are.
+    if (pair(cdr(node)))
+    {
+      for (expr_t b = car(cdr(node)); pair(b); b = cdr(b))
+      {
+        if (!expand_forms(x, car(b), scope))
+          return false;
+      }
+      return expand_forms(x, cdr(cdr(node)), scope);
+    }
+    return true;
+
+  default:
+    return expand_forms(x, node, scope);
+  }
+}
+
+static bool expand_node(pass_t *x, expr_t node, expr_t scope)
+{
+  if (!pair(node) || (node->flags & VALUE_FLAG_EXPANDED))
+    return true;
+
+  expr_t rules;
+  while ((rules = macro_rules(x, node, scope)) != NULL)
+  {
+    expr_t expansion = transcribe(x, rules, node);
+    if (expansion == NULL)
+      return false;
+    replace(x, node, expansion);
+  }
+
+  if (!expand_subforms(x, node, scope))
+    return false;
+
+  node->flags |= VALUE_FLAG_EXPANDED;
+  return true;
+}
+
+expr_t crisp_expand(crisp_t *crisp, expr_t node)
+{
+  pass_t x = {.crisp = crisp, .expander = expander(crisp)};
+  return ((node != NULL) && expand_node(&x, node, NULL)) ? node : NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef CRISP_EXPANDER_H
+#define CRISP_EXPANDER_H
+
+#include "common.h"
+#include "hash_table.h"
+
+// The macros defined so far, and the number of names made for the
+// variables that their templates bind.
+typedef struct
+{
+  hash_table_t macros;
+  size_t aliases;
+} expander_t;
+
+void expander_init(expander_t *expander);
+void expander_free(expander_t *expander);
+// Keeps the transformers of the macros alive.
+void expander_mark(crisp_t *crisp, expander_t *expander);
+
+// Expand, in place, the uses of macros within a form.
+//
+// Macros are defined at the top level with
+//   (define-syntax name (syntax-rules (literals...) (pattern template)...))
+// which the expander consumes, leaving (quote ()) in its place. A use of a
+// macro is a form whose operator is the name of a macro that no enclosing
+// lambda or let binds. The use is rewritten to the template of the first
+// pattern that matches it, which is expanded in turn.
+//
+// Variables that a template binds are renamed, so that they can not
+// capture the variables of the forms substituted into the template. Other
+// names in the template mean what they do where the macro is used.
+//
+// The forms that have been expanded are flagged as such, so that
+// evaluating a form again, or calling a lambda, never expands it again. A
+// form must therefore be expanded after the macros that it uses are
+// defined. Returns the form, or NULL if an eval error was raised.
+expr_t crisp_expand(crisp_t *crisp, expr_t node);
+
+#endif
@@ -0,0 +1,272 @@
+#include "generic.h"
+#include "value_support.h"
+#include "builtins.h"
+#include "evaluator.h"
+#include "memory.h"
+
+#include <stdio.h>
+
+// The types that a method may give a parameter.
+static const struct
+{
+  const char *name;
+  uint32_t types;
+} sTypes[] = {
+  {"_", TYPE_MASK_ANY},
+  {"boolean", TYPE_MASK(VALUE_TYPE_BOOL)},
+  {"number", TYPE_MASK(VALUE_TYPE_NUMBER)},
+  {"string", TYPE_MASK(VALUE_TYPE_STRING)},
+  {"symbol", TYPE_MASK(VALUE_TYPE_ATOM)},
+  {"null", TYPE_MASK(VALUE_TYPE_NIL)},
+  {"pair", TYPE_MASK(VALUE_TYPE_CONS)},
+  {"list", TYPE_MASK(VALUE_TYPE_CONS) | TYPE_MASK(VALUE_TYPE_NIL)},
+  {"procedure", TYPE_MASK(VALUE_TYPE_FN) | TYPE_MASK(VALUE_TYPE_LAMBDA) |
+                    TYPE_MASK(VALUE_TYPE_CONTINUATION) | TYPE_MASK(VALUE_TYPE_GENERIC) |
+                    TYPE_MASK(VALUE_TYPE_PARAMETER) | TYPE_MASK(VALUE_TYPE_RECORD_PROCEDURE)},
+  {"record", TYPE_MASK(VALUE_TYPE_RECORD)},
+  {"vector", TYPE_MASK(VALUE_TYPE_VECTOR)},
+  {"array", TYPE_MASK(VALUE_TYPE_ARRAY)},
+};
+
+static bool type_named(expr_t name, uint32_t *types)
+{
+  if (!is_atom(name))
+    return false;
+
+  for (size_t i = 0; i < sizeof(sTypes) / sizeof(sTypes[0]); i++)
+  {
+    if (strcmp(sTypes[i].name, as_atom(name)) == 0)
+    {
+      *types = sTypes[i].types;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The number of types in a mask, the fewer the more specific.
+static size_t type_count(uint32_t types)
+{
+  size_t count = 0;
+  for (; types != 0; types &= types - 1)
+  {
+    count++;
+  }
+  return count;
+}
+
+// Negative if method a is to be tried before method b, which it is if it
+// has fewer types for the first argument where they differ.
+static int compare_methods(const method_t *a, const method_t *b)
+{
+  for (size_t i = 0; i < GENERIC_DISPATCH_MAX; i++)
+  {
+    size_t count_a = type_count(a->types[i]);
+    size_t count_b = type_count(b->types[i]);
+    if (count_a != count_b)
+      return (count_a < count_b) ? -1 : 1;
+  }
+  return 0;
+}
+
+static void insert_method(generic_t *generic, const method_t *method)
+{
+  size_t i = 0;
+  for (; i < generic->count; i++)
+  {
+    if (memcmp(generic->methods[i].types, method->types, sizeof(method->types)) == 0)
+    {
+      generic->methods[i] = *method;
+      return;
+    }
+    if (compare_methods(method, &generic->methods[i]) < 0)
+      break;
+  }
+
+  if (generic->count == generic->capacity)
+  {
+    // Reallocation is not supported by the allocator so copy the methods
+    // across by hand.
+    size_t new_capacity = (generic->capacity < 4) ? 4 : generic->capacity * 2;
+    method_t *new_methods = ALLOCATE(method_t, new_capacity);
+    if (generic->capacity > 0)
+    {
+      memcpy(new_methods, generic->methods, sizeof(method_t) * generic->count);
+      FREE_ARRAY(method_t, generic->methods, generic->capacity);
+    }
+    generic->methods = new_methods;
+    generic->capacity = new_capacity;
+  }
+
+  memmove(&generic->methods[i + 1], &generic->methods[i], sizeof(method_t) * (generic->count - i));
+  generic->methods[i] = *method;
+  generic->count++;
+}
+
+expr_t generic_make(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return generic_value(crisp, as_atom(argv[0]));
+}
+
+expr_t generic_add_method(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  if (!is_generic(argv[0]))
+  {
+    crisp_eval_error(crisp, "A method can only be added to a generic function");
+    return NULL;
+  }
+
+  generic_t *generic = as_generic(argv[0]);
+  method_t method = {.procedure = argv[2]};
+  for (size_t i = 0; i < GENERIC_DISPATCH_MAX; i++)
+  {
+    method.types[i] = TYPE_MASK_ANY;
+  }
+
+  size_t arity = 0;
+  for (expr_t names = argv[1]; pair(names); names = cdr(names), arity++)
+  {
+    uint32_t types;
+    if (!type_named(car(names), &types))
+    {
+      crisp_eval_error(crisp, "A method of %s names an unknown type", generic->name);
+      return NULL;
+    }
+    if (arity < GENERIC_DISPATCH_MAX)
+    {
+      method.types[arity] = types;
+    }
+    else if (types != TYPE_MASK_ANY)
+    {
+      crisp_eval_error(crisp, "A method can only choose on its first %d arguments", GENERIC_DISPATCH_MAX);
+      return NULL;
+    }
+  }
+
+  if ((generic->count > 0) && (arity != generic->arity))
+  {
+    crisp_eval_error(crisp, "Every method of %s takes %zu argument(s)", generic->name, generic->arity);
+    return NULL;
+  }
+
+  generic->arity = arity;
+  insert_method(generic, &method);
+  generic->version++;
+  return nil_value(crisp);
+}
+
+// The types of the arguments that are chosen on, a value_type_t in each
+// 16 bits.
+static uint64_t signature(size_t count, expr_t *argv)
+{
+  uint64_t result = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    result |= (uint64_t)argv[i]->type << (16 * i);
+  }
+  return result;
+}
+
+static expr_t find_method(generic_t *generic, size_t count, expr_t *argv)
+{
+  for (size_t m = 0; m < generic->count; m++)
+  {
+    const method_t *method = &generic->methods[m];
+    size_t i = 0;
+    while ((i < count) && ((method->types[i] & TYPE_MASK(argv[i]->type)) != 0))
+    {
+      i++;
+    }
+    if (i == count)
+      return method->procedure;
+  }
+  return NULL;
+}
+
+// The cache of a call site, emptied if it was made for a different generic
+// function or version of it. NULL if the site holds something else.
+static dispatch_t *site_cache(crisp_t *crisp, expr_t fn, expr_t site)
+{
+  if (!is_cons(site))
+    return NULL;
+
+  if (site->as.cons.meta == NULL)
+  {
+    site->as.cons.meta = dispatch_value(crisp, fn);
+  }
+  else if (!is_dispatch(site->as.cons.meta))
+  {
+    return NULL;
+  }
+
+  dispatch_t *cache = as_dispatch(site->as.cons.meta);
+  if ((cache->generic != fn) || (cache->version != as_generic(fn)->version))
+  {
+    cache->generic = fn;
+    cache->version = as_generic(fn)->version;
+    cache->count = 0;
+    cache->megamorphic = false;
+  }
+  return cache;
+}
+
+expr_t crisp_dispatch(crisp_t *crisp, expr_t fn, expr_t site, size_t argc, expr_t *argv)
+{
+  generic_t *generic = as_generic(fn);
+  if (argc < generic->arity)
+  {
+    crisp_eval_error(crisp, "%s expects %zu argument(s), got %zu", generic->name, generic->arity, argc);
+    return NULL;
+  }
+
+  size_t count = (generic->arity < GENERIC_DISPATCH_MAX) ? generic->arity : GENERIC_DISPATCH_MAX;
+  for (size_t i = 0; i < count; i++)
+  {
+    // An argument that failed to evaluate.
+    if (argv[i] == NULL)
+      return NULL;
+  }
+
+  uint64_t key = signature(count, argv);
+  dispatch_t *cache = site_cache(crisp, fn, site);
+  if (cache != NULL)
+  {
+    for (size_t i = 0; i < cache->count; i++)
+    {
+      if (cache->entries[i].signature == key)
+        return cache->entries[i].method;
+    }
+  }
+
+  expr_t method = find_method(generic, count, argv);
+  if (method == NULL)
+  {
+    printf("arguments '");
+    for (size_t i = 0; i < argc; i++)
+    {
+      if (i > 0)
+        printf(" ");
+      print_value_tree(argv[i]);
+    }
+    printf("' matched no method\n");
+    crisp_eval_error(crisp, "No method of %s matches the arguments", generic->name);
+    return NULL;
+  }
+
+  if ((cache != NULL) && !cache->megamorphic)
+  {
+    if (cache->count < DISPATCH_CACHE_ENTRIES)
+    {
+      cache->entries[cache->count].signature = key;
+      cache->entries[cache->count].method = method;
+      cache->count++;
+    }
+    else
+    {
+      cache->megamorphic = true;
+    }
+  }
+  return method;
+}
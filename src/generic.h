@@ -0,0 +1,42 @@
+#ifndef CRISP_GENERIC_H
+#define CRISP_GENERIC_H
+
+#include "common.h"
+#include "value.h"
+
+// Generic functions
+//
+//   (define-generic name)
+// binds name to a generic function without any methods, and
+//   (define-method (name (parameter type) parameter...) forms...)
+// adds a method to it, replacing any method with the same types. The
+// expander rewrites both forms into calls of the builtins below. A
+// parameter without a type matches any value, the types being boolean,
+// number, string, symbol, null, pair, list, procedure, record, vector and
+// array.
+//
+// Calling a generic function applies the first of its methods whose types
+// the arguments have. Methods are kept ordered from the most specific, so
+// that a method for a number is chosen over one for any value.
+
+// The method of a generic function to apply to the arguments of a call.
+//
+// The site of the call is the pair that holds the operands of the
+// application, on which the methods chosen there are cached by the types
+// of the arguments they were chosen for. A site that has only seen the one
+// combination of types is monomorphic, and one that has seen up to
+// DISPATCH_CACHE_ENTRIES of them is polymorphic. One that has seen more is
+// megamorphic, and searches the methods on every call. Adding a method
+// changes the version of the generic function, which empties each of its
+// caches the next time it is used. The site may be NULL, for a call that
+// has none, such as one made by crisp_apply.
+//
+// Returns NULL, having raised an eval error, if no method applies.
+expr_t crisp_dispatch(crisp_t *crisp, expr_t generic, expr_t site, size_t argc, expr_t *argv);
+
+// The builtins that define-generic and define-method are rewritten to,
+// BUILTIN_GENERIC_MAKE and BUILTIN_GENERIC_ADD_METHOD.
+expr_t generic_make(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t generic_add_method(crisp_t *crisp, size_t argc, expr_t *argv);
+
+#endif
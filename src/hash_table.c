@@ -46,6 +46,15 @@ void hash_table_free(hash_table_t *table)
   }
 }
 
+void hash_table_clear(hash_table_t *table)
+{
+  if (table->capacity > 0)
+  {
+    memset(table->entries, 0, sizeof(hash_table_entry_t) * table->capacity);
+    table->size = 0;
+  }
+}
+
 bool hash_table_set(hash_table_t *table, const char *key, VALUE_TYPE value)
 {
   increase_capacity_if_required(table);
@@ -292,7 +301,8 @@ static bool key_match(const char *key1, const char *key2, bool compare_string_co
 {
   if (compare_string_contents)
   {
-    return (strncmp(key1, key2, key_len) == 0);
+    // key2 need not be terminated, but key1 must end where it does.
+    return (strncmp(key1, key2, key_len) == 0) && (key1[key_len] == '\0');
   }
   return key1 == key2;
 }
@@ -28,6 +28,8 @@ typedef struct
 void hash_table_init(hash_table_t* table);
 void hash_table_init_custom_hash(hash_table_t* table, hash_fn_t hash_fn, void* hash_state);
 void hash_table_free(hash_table_t* table);
+// Remove every entry, keeping the storage for reuse.
+void hash_table_clear(hash_table_t* table);
 bool hash_table_set(hash_table_t* table, const char* key, VALUE_TYPE value);
 bool hash_table_get(hash_table_t* table, const char* key, VALUE_TYPE* value);
 bool hash_table_delete(hash_table_t* table, const char* key);
@@ -7,19 +7,23 @@
 #include "evaluator.h"
 #include "builtins.h"
 #include "value.h"
+#include "cek.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "expander.h"
 
 #include <stdarg.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 static jmp_buf sJumpBuffer;
 static sig_atomic_t sSignal = 0;
 static bool sHandlerInstalled = false;
 
-static void crisp_gc_mark_value(crisp_t *crisp, expr_t obj);
-static void crisp_gc_mark_env(crisp_t *crisp, env_t* obj);
 static void crisp_gc_sweep(crisp_t *crisp);
 static gc_object_t* crisp_free_object(gc_object_t* obj);
 
@@ -35,18 +39,83 @@ struct crisp_t
   error_handler_t handler_fn;
   void *handler_state;
   bool jump_buffer_ready;
+  bool quiet_errors;
   gc_object_t* gc_head;
+  crisp_eval_mode_t eval_mode;
+  cek_stack_t stack;
+  optimizer_t optimizer;
+  expander_t expander;
+  size_t compile_threshold;
+  bool native_code;
+  gc_stats_t gc_stats;
+  // The interned name of each keyword, indexed by syntax_t.
+  const char *keywords[SYNTAX_COUNT];
+};
+
+static const char *sKeywordNames[SYNTAX_COUNT] = {
+  [SYNTAX_NONE] = NULL,
+  [SYNTAX_ELSE] = "else",
+  [SYNTAX_ELLIPSIS] = "...",
+  [SYNTAX_UNDERSCORE] = "_",
+  [SYNTAX_SYNTAX_RULES] = "syntax-rules",
+  [SYNTAX_UNQUOTE] = "unquote",
+  [SYNTAX_UNQUOTE_SPLICING] = "unquote-splicing",
+  [SYNTAX_DEFINE_SYNTAX] = "define-syntax",
+  [SYNTAX_QUASIQUOTE] = "quasiquote",
+  [SYNTAX_DO] = "do",
+  [SYNTAX_MATCH] = "match",
+  [SYNTAX_DEFINE_GENERIC] = "define-generic",
+  [SYNTAX_DEFINE_METHOD] = "define-method",
+  [SYNTAX_DEFINE_RECORD_TYPE] = "define-record-type",
+  [SYNTAX_QUOTE] = "quote",
+  [SYNTAX_LAMBDA] = "lambda",
+  [SYNTAX_DEFINE] = "define",
+  [SYNTAX_IF] = "if",
+  [SYNTAX_COND] = "cond",
+  [SYNTAX_LET] = "let",
+  [SYNTAX_LET_STAR] = "let*",
+  [SYNTAX_LETREC] = "letrec",
+  [SYNTAX_BEGIN] = "begin",
+  [SYNTAX_AND] = "and",
+  [SYNTAX_OR] = "or",
+  [SYNTAX_SET] = "set!",
+  [SYNTAX_CASE] = "case",
+  [SYNTAX_PARAMETERIZE] = "parameterize",
+  [SYNTAX_RECUR] = "recur#loop",
 };
 
 crisp_t *init_interpreter()
 {
   crisp_t *crisp = ALLOCATE(crisp_t, 1);
   string_table_init(&crisp->string_table);
+  // Keywords are interned before any atom is made, so that atoms can be
+  // tagged by comparing names by pointer.
+  crisp->keywords[SYNTAX_NONE] = NULL;
+  for (int i = SYNTAX_NONE + 1; i < SYNTAX_COUNT; i++)
+  {
+    crisp->keywords[i] = intern_string_null_terminated(crisp, sKeywordNames[i]);
+  }
   crisp->gc_head = NULL;
+  memset(&crisp->gc_stats, 0, sizeof(crisp->gc_stats));
   crisp->root_env = env_init(crisp);
   crisp->jump_buffer_ready = false;
+  crisp->quiet_errors = false;
   crisp->handler_fn = NULL;
   crisp->handler_state = NULL;
+  crisp->eval_mode = CRISP_EVAL_MODE_RECURSIVE;
+  cek_stack_init(&crisp->stack);
+  optimizer_init(&crisp->optimizer);
+  expander_init(&crisp->expander);
+  crisp->compile_threshold = CRISP_COMPILE_DEFAULT_THRESHOLD;
+  crisp->native_code = true;
+  // So that the test suite can be run with other settings, see
+  // test/CMakeLists.txt.
+  const char *threshold = getenv("CRISP_COMPILE_THRESHOLD");
+  if (threshold != NULL)
+    crisp->compile_threshold = (size_t)strtoul(threshold, NULL, 10);
+  const char *native = getenv("CRISP_NATIVE_CODE");
+  if (native != NULL)
+    crisp->native_code = (strcmp(native, "0") != 0);
   register_builtins(crisp);
 
   if(!sHandlerInstalled)
@@ -62,6 +131,9 @@ void free_interpreter(crisp_t *crisp)
   if (crisp != NULL)
   {
     string_table_free(&crisp->string_table);
+    cek_stack_free(&crisp->stack);
+    optimizer_free(&crisp->optimizer);
+    expander_free(&crisp->expander);
     crisp_gc_sweep(crisp);
     FREE(crisp_t, crisp);
   }
@@ -73,25 +145,92 @@ void install_error_handler(crisp_t *crisp, error_handler_t handler, void *handle
   crisp->handler_state = handler_state;
 }
 
+void set_eval_mode(crisp_t *crisp, crisp_eval_mode_t mode)
+{
+  crisp->eval_mode = mode;
+}
+
+void set_max_eval_depth(crisp_t *crisp, size_t max_depth)
+{
+  crisp->stack.max_depth = max_depth;
+}
+
+void set_max_inline_size(crisp_t *crisp, size_t max_size)
+{
+  crisp->optimizer.max_inline_size = max_size;
+}
+
+void set_compile_threshold(crisp_t *crisp, size_t calls)
+{
+  crisp->compile_threshold = calls;
+}
+
+void set_native_code(crisp_t *crisp, bool enabled)
+{
+  crisp->native_code = enabled;
+}
+
+gc_stats_t get_gc_stats(crisp_t *crisp)
+{
+  return crisp->gc_stats;
+}
+
 expr_t read(crisp_t *crisp, const char *source)
 {
   return parse(crisp, source);
 }
 
-expr_t eval(crisp_t *crisp, expr_t node, env_t *env)
+// Applies fn to a form with errors unwinding straight back to here,
+// discarding any continuation frames and arguments that were live at the
+// time.
+static expr_t run_guarded(crisp_t *crisp, expr_t (*fn)(crisp_t *, expr_t, env_t *), expr_t node, env_t *env)
 {
   expr_t result = NULL;
   crisp->jump_buffer_ready = true;
 
+  cek_state_t state = cek_save_state(&crisp->stack);
+
   if (setjmp(sJumpBuffer) == CRISP_ERROR_NONE)
   {
-    result = crisp_eval(crisp, node, env);
+    result = fn(crisp, node, env);
+  }
+  else
+  {
+    cek_restore_state(&crisp->stack, state);
   }
 
   crisp->jump_buffer_ready = false;
   return result;
 }
 
+static expr_t expand_form(crisp_t *crisp, expr_t node, env_t *env)
+{
+  (void)env;
+  return crisp_expand(crisp, node);
+}
+
+static expr_t expand_and_eval(crisp_t *crisp, expr_t node, env_t *env)
+{
+  return crisp_eval(crisp, crisp_expand(crisp, node), env);
+}
+
+expr_t expand(crisp_t *crisp, expr_t node)
+{
+  return run_guarded(crisp, &expand_form, node, crisp->root_env);
+}
+
+optimize_report_t optimize(crisp_t *crisp, expr_t node)
+{
+  optimize_report_t none = {0, 0, 0};
+  node = expand(crisp, node);
+  return (node != NULL) ? crisp_optimize(crisp, node, crisp->root_env) : none;
+}
+
+expr_t eval(crisp_t *crisp, expr_t node, env_t *env)
+{
+  return run_guarded(crisp, &expand_and_eval, node, env);
+}
+
 void repl(crisp_t *crisp)
 {
   char line[1024];
@@ -103,7 +242,9 @@ void repl(crisp_t *crisp)
 
     if (fgets(line, sizeof(line), stdin))
     {
-      print_value_tree(eval(crisp, read(crisp, line), root_env(crisp)));
+      expr_t node = expand(crisp, read(crisp, line));
+      optimize(crisp, node);
+      print_value_tree(eval(crisp, node, root_env(crisp)));
       crisp_gc(crisp);
     }
     else
@@ -118,6 +259,70 @@ env_t *root_env(crisp_t *crisp)
   return crisp->root_env;
 }
 
+crisp_eval_mode_t eval_mode(crisp_t *crisp)
+{
+  return crisp->eval_mode;
+}
+
+cek_stack_t *eval_stack(crisp_t *crisp)
+{
+  return &crisp->stack;
+}
+
+optimizer_t *optimizer(crisp_t *crisp)
+{
+  return &crisp->optimizer;
+}
+
+expander_t *expander(crisp_t *crisp)
+{
+  return &crisp->expander;
+}
+
+size_t compile_threshold(crisp_t *crisp)
+{
+  return crisp->compile_threshold;
+}
+
+bool native_code(crisp_t *crisp)
+{
+  return crisp->native_code;
+}
+
+bool quiet_errors(crisp_t *crisp)
+{
+  return crisp->quiet_errors;
+}
+
+expr_t crisp_apply_quietly(crisp_t *crisp, builtin_fn_t fn, size_t argc, expr_t *argv)
+{
+  // The recovery position of whatever is running, restored afterwards.
+  jmp_buf outer;
+  memcpy(&outer, &sJumpBuffer, sizeof(jmp_buf));
+  bool ready = crisp->jump_buffer_ready;
+  bool quiet = crisp->quiet_errors;
+
+  expr_t result = NULL;
+  crisp->jump_buffer_ready = true;
+  crisp->quiet_errors = true;
+
+  cek_state_t state = cek_save_state(&crisp->stack);
+
+  if (setjmp(sJumpBuffer) == CRISP_ERROR_NONE)
+  {
+    result = fn(crisp, argc, argv);
+  }
+  else
+  {
+    cek_restore_state(&crisp->stack, state);
+  }
+
+  crisp->quiet_errors = quiet;
+  crisp->jump_buffer_ready = ready;
+  memcpy(&sJumpBuffer, &outer, sizeof(jmp_buf));
+  return result;
+}
+
 const char *intern_string(crisp_t *crisp, const char *str, size_t length)
 {
   const char *result = string_table_store(&crisp->string_table, str, length);
@@ -129,12 +334,24 @@ const char *intern_string_null_terminated(crisp_t *crisp, const char *str)
   return intern_string(crisp, str, strlen(str));
 }
 
+syntax_t crisp_syntax(crisp_t *crisp, const char *name)
+{
+  for (int i = SYNTAX_NONE + 1; i < SYNTAX_COUNT; i++)
+  {
+    if (crisp->keywords[i] == name)
+    {
+      return (syntax_t)i;
+    }
+  }
+  return SYNTAX_NONE;
+}
+
 void crisp_error_jump(crisp_t *crisp, crisp_error_t err)
 {
   (void)crisp;
   if (err != CRISP_ERROR_NONE)
   {
-    if (crisp->handler_fn)
+    if (crisp->handler_fn && !crisp->quiet_errors)
     {
       crisp->handler_fn(crisp, crisp->handler_state);
     }
@@ -152,48 +369,136 @@ void crisp_gc_register_object(crisp_t *crisp, gc_object_t* obj, gc_fn_t* fns)
   obj->next = crisp->gc_head;
   obj->marked = false;
   crisp->gc_head = obj;
+  crisp->gc_stats.objects_allocated++;
 }
 
 void crisp_gc(crisp_t *crisp)
 {
-  // All objects reachable from the root environment are marked.
+  clock_t start = clock();
+
+  // All objects reachable from the root environment, or from a live
+  // continuation frame, are marked.
   crisp_gc_mark_env(crisp, crisp->root_env);
+  cek_stack_mark(crisp, &crisp->stack);
+  expander_mark(crisp, &crisp->expander);
+  optimizer_mark(crisp, &crisp->optimizer);
 
   crisp_gc_sweep(crisp);
+  crisp->gc_stats.collections++;
+  crisp->gc_stats.collection_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
 }
 
 void crisp_gc_mark_value(crisp_t *crisp, expr_t obj)
 {
-  if(obj == NULL) return;
-
-  ((gc_object_t*)obj)->marked = true;
-  if(is_cons(obj))
+  // Lists are followed along their cdr iteratively so that marking a long
+  // list does not recurse once per element.
+  while(obj != NULL && !((gc_object_t*)obj)->marked)
   {
-    crisp_gc_mark_value(crisp, car(obj));
-    crisp_gc_mark_value(crisp, cdr(obj));
-  }
-  else if(is_lambda(obj))
-  {
-    crisp_gc_mark_value(crisp, as_lambda(obj)->bodies);
-    crisp_gc_mark_value(crisp, as_lambda(obj)->formals);
-    crisp_gc_mark_env(crisp, as_lambda(obj)->env);
+    ((gc_object_t*)obj)->marked = true;
+    if(is_cons(obj))
+    {
+      crisp_gc_mark_value(crisp, car(obj));
+      crisp_gc_mark_value(crisp, obj->as.cons.meta);
+      obj = cdr(obj);
+    }
+    else
+    {
+      if(is_lambda(obj))
+      {
+        crisp_gc_mark_value(crisp, as_lambda(obj)->bodies);
+        crisp_gc_mark_value(crisp, as_lambda(obj)->formals);
+        crisp_gc_mark_env(crisp, as_lambda(obj)->env);
+      }
+      else if(is_node(obj))
+      {
+        crisp_gc_mark_value(crisp, as_node(obj)->operator);
+      }
+      else if(is_case_table(obj))
+      {
+        // The forms are those of the case form that holds the table.
+        crisp_gc_mark_value(crisp, as_case_table(obj)->others);
+        crisp_gc_mark_value(crisp, as_case_table(obj)->otherwise);
+      }
+      else if(is_generic(obj))
+      {
+        generic_t *generic = as_generic(obj);
+        for(size_t i = 0; i < generic->count; i++)
+        {
+          crisp_gc_mark_value(crisp, generic->methods[i].procedure);
+        }
+      }
+      else if(is_parameter(obj))
+      {
+        crisp_gc_mark_value(crisp, as_parameter(obj));
+      }
+      else if(is_record_type(obj))
+      {
+        crisp_gc_mark_value(crisp, obj->as.record_type.fields);
+      }
+      else if(is_record(obj))
+      {
+        crisp_gc_mark_value(crisp, obj->as.record.type);
+        for(size_t i = 0; i < obj->as.record.count; i++)
+        {
+          crisp_gc_mark_value(crisp, obj->as.record.slots[i]);
+        }
+      }
+      else if(is_record_procedure(obj))
+      {
+        crisp_gc_mark_value(crisp, obj->as.record_procedure.type);
+      }
+      else if(is_vector(obj))
+      {
+        for(size_t i = 0; i < obj->as.vector.count; i++)
+        {
+          crisp_gc_mark_value(crisp, obj->as.vector.items[i]);
+        }
+      }
+      else if(is_dispatch(obj))
+      {
+        dispatch_t *dispatch = as_dispatch(obj);
+        crisp_gc_mark_value(crisp, dispatch->generic);
+        for(size_t i = 0; i < dispatch->count; i++)
+        {
+          crisp_gc_mark_value(crisp, dispatch->entries[i].method);
+        }
+      }
+      obj = NULL;
+    }
   }
 }
 
-static void crisp_gc_mark_env(crisp_t *crisp, env_t* obj)
+void crisp_gc_mark_env(crisp_t *crisp, env_t* obj)
 {
-  if(obj == NULL) return;
+  // Environments can be reached from lambdas that they contain.
+  // Skip ones that have already been visited.
+  if(obj == NULL || ((gc_object_t*)obj)->marked) return;
 
-  ((gc_object_t*)obj)->marked = true;
+  // Region frames are not swept so are never left marked. Nothing they
+  // hold can refer back to them, as a closure would have captured them.
+  if(!obj->in_region)
+  {
+    ((gc_object_t*)obj)->marked = true;
+  }
+  bool cells = env_is_top_level(obj);
   hash_table_t* t = &(obj->table);
   for(size_t i = 0; i < t->capacity; i++)
   {
-    if(t->entries[i].key != NULL)
+    if((t->entries[i].key != NULL) && (t->entries[i].value != NULL))
     {
-      crisp_gc_mark_value(crisp, t->entries[i].value);
+      if(cells)
+      {
+        crisp_gc_mark_value(crisp, ((global_cell_t*)t->entries[i].value)->value);
+      }
+      else
+      {
+        crisp_gc_mark_value(crisp, t->entries[i].value);
+      }
     }
   }
 
+  // A closure keeps its whole lexical chain alive.
+  crisp_gc_mark_env(crisp, obj->parent);
 }
 
 void crisp_gc_sweep(crisp_t *crisp)
@@ -215,6 +520,7 @@ void crisp_gc_sweep(crisp_t *crisp)
     else
     {
       current = crisp_free_object(current);
+      crisp->gc_stats.objects_freed++;
 
       if(previous == NULL)
       {
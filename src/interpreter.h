@@ -11,6 +11,36 @@ typedef enum
     CRISP_ERROR_EVAL,
 } crisp_error_t;
 
+typedef enum
+{
+    // Evaluate by recursing on the native C stack.
+    CRISP_EVAL_MODE_RECURSIVE = 0,
+    // Evaluate using an explicit, heap allocated, continuation stack.
+    CRISP_EVAL_MODE_CEK,
+    // Evaluate recursively, specializing each application to the operator
+    // and operand types that it has seen.
+    CRISP_EVAL_MODE_SPECIALIZING,
+} crisp_eval_mode_t;
+
+typedef struct
+{
+    size_t objects_allocated;
+    size_t objects_freed;
+    size_t collections;
+    // The processor time spent collecting, in seconds.
+    double collection_seconds;
+} gc_stats_t;
+
+typedef struct
+{
+    // Applications of builtins evaluated ahead of time.
+    size_t folded;
+    // Calls replaced by the body of the lambda they called.
+    size_t inlined;
+    // Chains of list builtins fused into a single pass.
+    size_t fused;
+} optimize_report_t;
+
 typedef void (*error_handler_t)(crisp_t *, void *);
 
 crisp_t *init_interpreter();
@@ -18,7 +48,36 @@ void free_interpreter(crisp_t *crisp);
 
 void install_error_handler(crisp_t *crisp, error_handler_t handler, void *handler_state);
 
+void set_eval_mode(crisp_t *crisp, crisp_eval_mode_t mode);
+// Limit the number of continuation frames available to the CEK evaluator.
+// Exceeding the limit raises an eval error.
+void set_max_eval_depth(crisp_t *crisp, size_t max_depth);
+
+// Lambdas whose body is larger than this many nodes are not inlined by
+// optimize. Zero disables inlining.
+void set_max_inline_size(crisp_t *crisp, size_t max_size);
+
+// Lambdas applied by the recursive evaluators are compiled to threaded
+// code once they have been called this many times. Zero disables the
+// compiler.
+void set_compile_threshold(crisp_t *crisp, size_t calls);
+
+// Whether compiled lambdas are also translated to machine code and run as
+// that, where it is supported. On by default. Turned off, lambdas run the
+// threaded code they were compiled to.
+void set_native_code(crisp_t *crisp, bool enabled);
+
+// Running totals kept by the garbage collector.
+gc_stats_t get_gc_stats(crisp_t *crisp);
+
 expr_t read(crisp_t *crisp, const char *source);
+// Expand, in place, the macros used by a form, defining those that it
+// defines. Optimize and eval expand the forms they are given, so this is
+// only needed to see the expansion. Returns NULL if expansion failed.
+expr_t expand(crisp_t *crisp, expr_t node);
+// Optimize, in place, a form that is to be evaluated in the root
+// environment.
+optimize_report_t optimize(crisp_t *crisp, expr_t node);
 expr_t eval(crisp_t *crisp, expr_t node, env_t *env);
 void repl(crisp_t *crisp);
 
@@ -3,20 +3,41 @@
 
 #include "interpreter.h"
 #include "gc_type.h"
+#include "cek.h"
+#include "optimizer.h"
+#include "expander.h"
+#include "value.h"
 
 // Internal API functions for the crisp interpreter.
 
 env_t *root_env(crisp_t *crisp);
+crisp_eval_mode_t eval_mode(crisp_t *crisp);
+cek_stack_t *eval_stack(crisp_t *crisp);
+optimizer_t *optimizer(crisp_t *crisp);
+expander_t *expander(crisp_t *crisp);
+size_t compile_threshold(crisp_t *crisp);
+bool native_code(crisp_t *crisp);
 
 const char *intern_string(crisp_t *crisp, const char *str, size_t length);
 const char *intern_string_null_terminated(crisp_t *crisp, const char *str);
 
+// The keyword that an interned name spells, SYNTAX_NONE if it is not one.
+syntax_t crisp_syntax(crisp_t *crisp, const char *name);
+
 // Signals that an error has occurred
 // Call flow will jump to the recovery position.
 void crisp_error_jump(crisp_t *crisp, crisp_error_t err);
 
+// Applies a builtin with any error that it raises unwinding straight back
+// to here without being reported, in which case NULL is returned.
+expr_t crisp_apply_quietly(crisp_t *crisp, builtin_fn_t fn, size_t argc, expr_t *argv);
+// Whether errors are currently being raised by crisp_apply_quietly.
+bool quiet_errors(crisp_t *crisp);
+
 // Garbage collection functions.
 void crisp_gc_register_object(crisp_t *crisp, gc_object_t* obj, gc_fn_t* fns);
 void crisp_gc(crisp_t *crisp);
+void crisp_gc_mark_value(crisp_t *crisp, expr_t obj);
+void crisp_gc_mark_env(crisp_t *crisp, env_t* obj);
 
 #endif //CRISP_INTERPRETER_INTERNAL_H
@@ -0,0 +1,659 @@
+#include "native.h"
+#include "value_support.h"
+#include "memory.h"
+#include "evaluator.h"
+#include "builtins.h"
+#include "cek.h"
+#include "environment.h"
+#include "generic.h"
+#include "interpreter_internal.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define NATIVE_X64
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#endif
+
+typedef expr_t (*native_fn_t)(crisp_t *crisp, env_t *env);
+
+struct native_t
+{
+  native_fn_t fn;
+  // The executable memory that fn points into.
+  void *memory;
+  size_t size;
+};
+
+#ifdef NATIVE_X64
+
+// Runtime
+//
+// The functions that machine code calls for what it does not do itself.
+
+static bool is_false(expr_t value)
+{
+  return not(value);
+}
+
+static bool is_special(expr_t operator)
+{
+  return (operator != NULL) && is_special_form(operator);
+}
+
+static expr_t apply_special(crisp_t *crisp, code_t *code, expr_t operator, env_t *env)
+{
+  return as_fn(operator)(crisp, cdr(code->node), env);
+}
+
+static expr_t *push_args(crisp_t *crisp, size_t count)
+{
+  return cek_push_args(eval_stack(crisp), count);
+}
+
+static void pop_args(crisp_t *crisp, size_t count)
+{
+  cek_pop_args(eval_stack(crisp), count);
+}
+
+// The rest of an application once its operands are in argv, as the
+// threaded code does it.
+static expr_t apply_args(crisp_t *crisp, code_t *code, expr_t operator, expr_t *argv, env_t *env)
+{
+  if (is_generic(operator))
+  {
+    operator = crisp_dispatch(crisp, operator, cdr(code->node), code->argc, argv);
+  }
+
+  expr_t result = (operator != NULL) ? crisp_apply_argv(crisp, operator, code->argc, argv, env) : NULL;
+  cek_pop_args(eval_stack(crisp), code->argc);
+  return result;
+}
+
+// Assembler
+//
+// Only the few instructions the translation uses are encoded. The result
+// of every form is left in rax. Through the code rbx holds crisp, r12 the
+// environment and rbp the frame, whose slots hold what must outlive a call
+// made while evaluating an operand.
+
+typedef enum
+{
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RBP = 5,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R11 = 11,
+  R12 = 12,
+} reg_t;
+
+typedef enum
+{
+  CC_E = 0x4,
+  CC_NE = 0x5,
+} cc_t;
+
+// SSE2 scalar double operations, op xmm0, [rax + disp].
+typedef enum
+{
+  SSE_MOV = 0x10,
+  SSE_ADD = 0x58,
+  SSE_MUL = 0x59,
+  SSE_SUB = 0x5c,
+  SSE_DIV = 0x5e,
+} sse_t;
+
+// Forward jumps not yet bound to their target are chained through their
+// displacements, each holding one more than the offset of the last.
+#define NO_JUMPS 0
+
+typedef struct
+{
+  uint8_t *bytes;
+  size_t count;
+  size_t capacity;
+  // The most frame slots that any form has used.
+  size_t slots;
+  // The offset of the code that returns rax.
+  size_t exit;
+} assembler_t;
+
+static void emit_byte(assembler_t *a, uint8_t byte)
+{
+  if (a->count == a->capacity)
+  {
+    size_t capacity = (a->capacity == 0) ? 256 : a->capacity * 2;
+    uint8_t *bytes = ALLOCATE(uint8_t, capacity);
+    if (a->count > 0)
+    {
+      memcpy(bytes, a->bytes, a->count);
+      FREE_ARRAY(uint8_t, a->bytes, a->capacity);
+    }
+    a->bytes = bytes;
+    a->capacity = capacity;
+  }
+  a->bytes[a->count++] = byte;
+}
+
+static void emit_bytes(assembler_t *a, const uint8_t *bytes, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    emit_byte(a, bytes[i]);
+  }
+}
+
+static void emit_32(assembler_t *a, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    emit_byte(a, (uint8_t)(value >> (8 * i)));
+  }
+}
+
+static void emit_64(assembler_t *a, uint64_t value)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    emit_byte(a, (uint8_t)(value >> (8 * i)));
+  }
+}
+
+static void patch_32(assembler_t *a, size_t at, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    a->bytes[at + (size_t)i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+static uint32_t read_32(assembler_t *a, size_t at)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    value |= (uint32_t)a->bytes[at + (size_t)i] << (8 * i);
+  }
+  return value;
+}
+
+static uint8_t rex(reg_t reg, reg_t base)
+{
+  return (uint8_t)(0x48 | ((reg >> 3) << 2) | (base >> 3));
+}
+
+// mov reg, imm64
+static void mov_imm(assembler_t *a, reg_t reg, uint64_t value)
+{
+  emit_byte(a, rex(RAX, reg));
+  emit_byte(a, (uint8_t)(0xb8 + (reg & 7)));
+  emit_64(a, value);
+}
+
+static void mov_ptr(assembler_t *a, reg_t reg, const void *value)
+{
+  mov_imm(a, reg, (uint64_t)(uintptr_t)value);
+}
+
+// mov dst, src
+static void mov_reg(assembler_t *a, reg_t dst, reg_t src)
+{
+  emit_byte(a, rex(src, dst));
+  emit_byte(a, 0x89);
+  emit_byte(a, (uint8_t)(0xc0 | ((src & 7) << 3) | (dst & 7)));
+}
+
+// The [base + disp32] operand of a memory access. Neither rsp nor r12 are
+// used as a base, which would need a SIB byte.
+static void memory_operand(assembler_t *a, reg_t reg, reg_t base, int32_t disp)
+{
+  emit_byte(a, (uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7)));
+  emit_32(a, (uint32_t)disp);
+}
+
+// mov reg, [base + disp]
+static void load(assembler_t *a, reg_t reg, reg_t base, int32_t disp)
+{
+  emit_byte(a, rex(reg, base));
+  emit_byte(a, 0x8b);
+  memory_operand(a, reg, base, disp);
+}
+
+// mov [base + disp], reg
+static void store(assembler_t *a, reg_t base, int32_t disp, reg_t reg)
+{
+  emit_byte(a, rex(reg, base));
+  emit_byte(a, 0x89);
+  memory_operand(a, reg, base, disp);
+}
+
+static int32_t slot(size_t index)
+{
+  // Below the saved rbx and r12.
+  return -(int32_t)(24 + 8 * index);
+}
+
+static void use_slots(assembler_t *a, size_t count)
+{
+  a->slots = (count > a->slots) ? count : a->slots;
+}
+
+// The calls made by machine code go through r11, which no argument uses.
+static void call(assembler_t *a, uint64_t fn)
+{
+  mov_imm(a, R11, fn);
+  static const uint8_t call_r11[] = {0x41, 0xff, 0xd3};
+  emit_bytes(a, call_r11, sizeof(call_r11));
+}
+
+#define CALL(a, fn) call((a), (uint64_t)(uintptr_t)(fn))
+
+static void test_rax(assembler_t *a)
+{
+  static const uint8_t test[] = {0x48, 0x85, 0xc0};
+  emit_bytes(a, test, sizeof(test));
+}
+
+static void test_al(assembler_t *a)
+{
+  static const uint8_t test[] = {0x84, 0xc0};
+  emit_bytes(a, test, sizeof(test));
+}
+
+// jcc or jmp to a target that is not yet known, added to a chain of such
+// jumps.
+static size_t jump_forward(assembler_t *a, bool conditional, cc_t cc, size_t chain)
+{
+  if (conditional)
+  {
+    emit_byte(a, 0x0f);
+    emit_byte(a, (uint8_t)(0x80 | cc));
+  }
+  else
+  {
+    emit_byte(a, 0xe9);
+  }
+  emit_32(a, (uint32_t)chain);
+  return a->count - 4 + 1;
+}
+
+static size_t jcc(assembler_t *a, cc_t cc, size_t chain)
+{
+  return jump_forward(a, true, cc, chain);
+}
+
+static size_t jmp(assembler_t *a, size_t chain)
+{
+  return jump_forward(a, false, CC_E, chain);
+}
+
+// Points a chain of jumps at the code that follows.
+static void bind(assembler_t *a, size_t chain)
+{
+  while (chain != NO_JUMPS)
+  {
+    size_t at = chain - 1;
+    chain = read_32(a, at);
+    patch_32(a, at, (uint32_t)(int32_t)((int64_t)a->count - (int64_t)(at + 4)));
+  }
+}
+
+static void jump_back(assembler_t *a, bool conditional, cc_t cc, size_t target)
+{
+  size_t at = jump_forward(a, conditional, cc, NO_JUMPS) - 1;
+  patch_32(a, at, (uint32_t)(int32_t)((int64_t)target - (int64_t)(at + 4)));
+}
+
+// Jumps, with rax still NULL, if a form failed. The templates stop at the
+// first operand of a form that fails and return NULL for the form.
+static size_t jump_if_null(assembler_t *a, size_t chain)
+{
+  test_rax(a);
+  return jcc(a, CC_E, chain);
+}
+
+// Translation
+
+static void translate(assembler_t *a, code_t *code, size_t base);
+
+// A call to the template of a code, for the forms that are not translated.
+static void call_template(assembler_t *a, code_t *code)
+{
+  mov_reg(a, RDI, RBX);
+  mov_ptr(a, RSI, code);
+  mov_reg(a, RDX, R12);
+  CALL(a, code->run);
+}
+
+static void nil(assembler_t *a)
+{
+  mov_reg(a, RDI, RBX);
+  CALL(a, &nil_value);
+}
+
+static void translate_if(assembler_t *a, code_t *code, size_t base)
+{
+  translate(a, &code->parts[0], base);
+  size_t end = jump_if_null(a, NO_JUMPS);
+  mov_reg(a, RDI, RAX);
+  CALL(a, &is_false);
+  test_al(a);
+  size_t otherwise = jcc(a, CC_NE, NO_JUMPS);
+
+  translate(a, &code->parts[1], base);
+  end = jmp(a, end);
+
+  bind(a, otherwise);
+  if (code->argc == 3)
+    translate(a, &code->parts[2], base);
+  else
+    nil(a);
+  bind(a, end);
+}
+
+static void translate_begin(assembler_t *a, code_t *code, size_t base)
+{
+  if (code->argc == 0)
+  {
+    nil(a);
+    return;
+  }
+
+  size_t end = NO_JUMPS;
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    translate(a, &code->parts[i], base);
+    if (i + 1 < code->argc)
+      end = jump_if_null(a, end);
+  }
+  bind(a, end);
+}
+
+static void translate_and_or(assembler_t *a, code_t *code, size_t base)
+{
+  bool is_and = (as_syntax(car(code->node)) == SYNTAX_AND);
+  if (code->argc == 0)
+  {
+    mov_reg(a, RDI, RBX);
+    mov_imm(a, RSI, is_and);
+    CALL(a, &bool_value);
+    return;
+  }
+
+  // The operand that stopped the evaluation is kept in the slot.
+  use_slots(a, base + 1);
+  size_t stopped = NO_JUMPS;
+  size_t end = NO_JUMPS;
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    translate(a, &code->parts[i], base + 1);
+    if (i + 1 == code->argc)
+      break;
+
+    end = jump_if_null(a, end);
+    store(a, RBP, slot(base), RAX);
+    mov_reg(a, RDI, RAX);
+    CALL(a, &is_false);
+    test_al(a);
+    stopped = jcc(a, is_and ? CC_NE : CC_E, stopped);
+  }
+
+  end = jmp(a, end);
+  bind(a, stopped);
+  load(a, RAX, RBP, slot(base));
+  bind(a, end);
+}
+
+// The instruction that a numeric builtin folds its operands with.
+static sse_t numeric_instruction(expr_t builtin)
+{
+  const char *name = builtin_descriptor(builtin)->name;
+  switch (name[0])
+  {
+  case '+':
+    return SSE_ADD;
+  case '-':
+    return SSE_SUB;
+  case '*':
+    return SSE_MUL;
+  default:
+    return SSE_DIV;
+  }
+}
+
+// The operands, once they are all numbers, are folded in xmm0 and boxed.
+// Otherwise, or if the operator is no longer the builtin, the application
+// is made as any other.
+static size_t translate_numeric(assembler_t *a, code_t *code, size_t base, size_t generic)
+{
+  int32_t operator = slot(base);
+  int32_t args = slot(base + 1);
+
+  load(a, RAX, RBP, operator);
+  mov_ptr(a, RCX, code->builtin);
+  static const uint8_t cmp_rax_rcx[] = {0x48, 0x39, 0xc8};
+  emit_bytes(a, cmp_rax_rcx, sizeof(cmp_rax_rcx));
+  generic = jcc(a, CC_NE, generic);
+
+  sse_t op = numeric_instruction(code->builtin);
+  load(a, RCX, RBP, args);
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    load(a, RAX, RCX, (int32_t)(i * sizeof(expr_t)));
+    test_rax(a);
+    generic = jcc(a, CC_E, generic);
+
+    // cmp dword [rax + type], VALUE_TYPE_NUMBER
+    emit_byte(a, 0x81);
+    emit_byte(a, 0xb8);
+    emit_32(a, (uint32_t)offsetof(value_t, type));
+    emit_32(a, (uint32_t)VALUE_TYPE_NUMBER);
+    generic = jcc(a, CC_NE, generic);
+
+    static const uint8_t sse_prefix[] = {0xf2, 0x0f};
+    emit_bytes(a, sse_prefix, sizeof(sse_prefix));
+    emit_byte(a, (uint8_t)((i == 0) ? SSE_MOV : op));
+    memory_operand(a, RAX, RAX, (int32_t)offsetof(value_t, as.number));
+  }
+
+  mov_reg(a, RDI, RBX);
+  CALL(a, &number_value);
+  store(a, RBP, operator, RAX);
+  mov_reg(a, RDI, RBX);
+  mov_imm(a, RSI, code->argc);
+  CALL(a, &pop_args);
+  load(a, RAX, RBP, operator);
+  return generic;
+}
+
+static void translate_call(assembler_t *a, code_t *code, size_t base)
+{
+  int32_t operator = slot(base);
+  int32_t args = slot(base + 1);
+  use_slots(a, base + 2);
+
+  translate(a, &code->parts[0], base + 2);
+  store(a, RBP, operator, RAX);
+
+  // Special forms are given the operands unevaluated.
+  mov_reg(a, RDI, RAX);
+  CALL(a, &is_special);
+  test_al(a);
+  size_t applicative = jcc(a, CC_E, NO_JUMPS);
+  mov_reg(a, RDI, RBX);
+  mov_ptr(a, RSI, code);
+  load(a, RDX, RBP, operator);
+  mov_reg(a, RCX, R12);
+  CALL(a, &apply_special);
+  size_t end = jmp(a, NO_JUMPS);
+
+  // The operands are evaluated onto the argument stack, where the garbage
+  // collector sees them.
+  bind(a, applicative);
+  mov_reg(a, RDI, RBX);
+  mov_imm(a, RSI, code->argc);
+  CALL(a, &push_args);
+  store(a, RBP, args, RAX);
+  for (size_t i = 0; i < code->argc; i++)
+  {
+    translate(a, &code->parts[i + 1], base + 2);
+    load(a, RCX, RBP, args);
+    store(a, RCX, (int32_t)(i * sizeof(expr_t)), RAX);
+  }
+
+  size_t generic = NO_JUMPS;
+  if (code->kind == CODE_NUMERIC)
+  {
+    generic = translate_numeric(a, code, base, generic);
+    end = jmp(a, end);
+  }
+
+  bind(a, generic);
+  mov_reg(a, RDI, RBX);
+  mov_ptr(a, RSI, code);
+  load(a, RDX, RBP, operator);
+  load(a, RCX, RBP, args);
+  mov_reg(a, R8, R12);
+  CALL(a, &apply_args);
+  bind(a, end);
+}
+
+// Translates a code, whose result is left in rax. Slots from base on are
+// free for it to use.
+static void translate(assembler_t *a, code_t *code, size_t base)
+{
+  switch (code->kind)
+  {
+  case CODE_CONSTANT:
+    mov_ptr(a, RAX, code->node);
+    break;
+  case CODE_GLOBAL:
+    mov_ptr(a, RAX, &code->node->as.atom.cell->value);
+    load(a, RAX, RAX, 0);
+    break;
+  case CODE_VARIABLE:
+    mov_reg(a, RDI, RBX);
+    mov_ptr(a, RSI, code->node);
+    mov_reg(a, RDX, R12);
+    CALL(a, &crisp_resolve_atom);
+    break;
+  case CODE_IF:
+    translate_if(a, code, base);
+    break;
+  case CODE_BEGIN:
+    translate_begin(a, code, base);
+    break;
+  case CODE_AND_OR:
+    translate_and_or(a, code, base);
+    break;
+  case CODE_CALL:
+  case CODE_NUMERIC:
+    translate_call(a, code, base);
+    break;
+  case CODE_INVALID:
+  case CODE_SYNTAX:
+    call_template(a, code);
+    break;
+  }
+}
+
+bool crisp_native_supported(void)
+{
+  return true;
+}
+
+native_t *crisp_compile_native(compiled_t *compiled)
+{
+  assembler_t a = {.bytes = NULL, .count = 0, .capacity = 0, .slots = 0, .exit = 0};
+
+  // The epilogue comes first, so that every jump to it is backwards.
+  static const uint8_t epilogue[] = {
+    0x48, 0x8d, 0x65, 0xf0, // lea rsp, [rbp - 16]
+    0x41, 0x5c,             // pop r12
+    0x5b,                   // pop rbx
+    0x5d,                   // pop rbp
+    0xc3,                   // ret
+  };
+  emit_bytes(&a, epilogue, sizeof(epilogue));
+
+  size_t entry = a.count;
+  static const uint8_t prologue[] = {
+    0x55,             // push rbp
+    0x48, 0x89, 0xe5, // mov rbp, rsp
+    0x53,             // push rbx
+    0x41, 0x54,       // push r12
+    0x48, 0x81, 0xec, // sub rsp, frame
+  };
+  emit_bytes(&a, prologue, sizeof(prologue));
+  size_t frame = a.count;
+  emit_32(&a, 0);
+  mov_reg(&a, RBX, RDI);
+  mov_reg(&a, R12, RSI);
+
+  for (size_t i = 0; i < compiled->body_count; i++)
+  {
+    translate(&a, &compiled->codes[i], 0);
+  }
+  jump_back(&a, false, CC_E, a.exit);
+
+  // Calls are made with the stack aligned to 16 bytes, as it is once rbp,
+  // rbx and r12 have been pushed.
+  patch_32(&a, frame, (uint32_t)((a.slots * 8 + 15) & ~(size_t)15));
+
+  native_t *native = NULL;
+  void *memory = mmap(NULL, a.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory != MAP_FAILED)
+  {
+    memcpy(memory, a.bytes, a.count);
+    if (mprotect(memory, a.count, PROT_READ | PROT_EXEC) == 0)
+    {
+      native = ALLOCATE(native_t, 1);
+      native->memory = memory;
+      native->size = a.count;
+      uint8_t *start = (uint8_t *)memory + entry;
+      memcpy(&native->fn, &start, sizeof(native->fn));
+    }
+    else
+    {
+      munmap(memory, a.count);
+    }
+  }
+
+  FREE_ARRAY(uint8_t, a.bytes, a.capacity);
+  return native;
+}
+
+void crisp_free_native(native_t *native)
+{
+  munmap(native->memory, native->size);
+  FREE(native_t, native);
+}
+
+#else
+
+bool crisp_native_supported(void)
+{
+  return false;
+}
+
+native_t *crisp_compile_native(compiled_t *compiled)
+{
+  (void)compiled;
+  return NULL;
+}
+
+void crisp_free_native(native_t *native)
+{
+  (void)native;
+}
+
+#endif
+
+expr_t crisp_run_native(crisp_t *crisp, native_t *native, env_t *env)
+{
+  return native->fn(crisp, env);
+}
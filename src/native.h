@@ -0,0 +1,33 @@
+#ifndef CRISP_NATIVE_H
+#define CRISP_NATIVE_H
+
+#include "common.h"
+#include "value.h"
+#include "compiler.h"
+
+// Native code
+//
+// The threaded code of a compiled lambda is translated, template by
+// template, into x86-64 machine code held in executable memory. Constants
+// and globals are loaded directly, if, begin, and and or become branches,
+// and numeric builtins applied to numbers become floating point
+// instructions. Everything else calls into the same runtime that the
+// templates do: crisp_apply_argv for applications and the templates
+// themselves for the special forms that have none of their own.
+//
+// Machine code is only made on x86-64 Linux. Elsewhere, or once
+// set_native_code has turned it off, the threaded code is run instead.
+typedef struct native_t native_t;
+
+// Whether machine code can be made at all.
+bool crisp_native_supported(void);
+
+// Translate the codes of a lambda, NULL if that is not supported or no
+// executable memory could be had.
+native_t *crisp_compile_native(compiled_t *compiled);
+void crisp_free_native(native_t *native);
+
+// Evaluate the bodies of a lambda in the environment of a call.
+expr_t crisp_run_native(crisp_t *crisp, native_t *native, env_t *env);
+
+#endif
@@ -0,0 +1,1136 @@
+#include "optimizer.h"
+#include "value.h"
+#include "value_support.h"
+#include "interpreter_internal.h"
+#include "environment.h"
+#include "evaluator.h"
+#include "builtins.h"
+#include "cek.h"
+#include "memory.h"
+
+// The lambda and let forms that enclose the form being optimized. A let
+// scope binds the names of the first visible of its bindings.
+typedef struct scope_t scope_t;
+struct scope_t
+{
+  scope_t *parent;
+  expr_t formals;
+  expr_t bindings;
+  size_t visible;
+};
+
+typedef struct
+{
+  crisp_t *crisp;
+  env_t *env;
+  optimizer_t *optimizer;
+  // How many inlined bodies enclose the form being optimized.
+  size_t depth;
+  optimize_report_t report;
+} pass_t;
+
+static expr_t fold(pass_t *f, expr_t node, scope_t *scope, expr_t *deps);
+static void fold_form(pass_t *f, expr_t node, scope_t *scope);
+static void fold_forms(pass_t *f, expr_t forms, scope_t *scope);
+
+// A folded form is rewritten in place to
+//   (<folded> value dependencies original)
+// where dependencies is a list of (atom . value) pairs, each of which must
+// still hold for the folded value to be used.
+static expr_t b_folded(crisp_t *crisp, expr_t operands, env_t *env)
+{
+  expr_t deps = car(cdr(operands));
+  while (is_cons(deps))
+  {
+    if (crisp_resolve_atom(crisp, car(car(deps)), root_env(crisp)) != cdr(car(deps)))
+    {
+      return crisp_eval(crisp, car(cdr(cdr(operands))), env);
+    }
+    deps = cdr(deps);
+  }
+  return car(operands);
+}
+
+static bool is_folded(expr_t node)
+{
+  return is_cons(node) && is_special_form(car(node)) && (as_fn(car(node)) == &b_folded);
+}
+
+void optimizer_init(optimizer_t *optimizer)
+{
+  optimizer->sites = NULL;
+  optimizer->max_inline_size = CRISP_INLINE_DEFAULT_MAX_SIZE;
+  optimizer->epoch = 0;
+}
+
+void optimizer_free(optimizer_t *optimizer)
+{
+  inline_site_t *s = optimizer->sites;
+  while (s != NULL)
+  {
+    inline_site_t *next = s->next;
+    FREE(inline_site_t, s);
+    s = next;
+  }
+  optimizer->sites = NULL;
+}
+
+static bool is_marked(expr_t value)
+{
+  return ((gc_object_t *)value)->marked;
+}
+
+void optimizer_mark(crisp_t *crisp, optimizer_t *optimizer)
+{
+  // The original form of a site is only reachable through the site. It
+  // may itself contain other sites, so repeat until nothing new is found.
+  bool marked = true;
+  while (marked)
+  {
+    marked = false;
+    for (inline_site_t *s = optimizer->sites; s != NULL; s = s->next)
+    {
+      if (is_marked(s->site) && !(is_marked(s->car) && is_marked(s->cdr)))
+      {
+        crisp_gc_mark_value(crisp, s->car);
+        crisp_gc_mark_value(crisp, s->cdr);
+        marked = true;
+      }
+    }
+  }
+
+  // Forget the sites that are about to be swept.
+  inline_site_t **link = &optimizer->sites;
+  while (*link != NULL)
+  {
+    inline_site_t *s = *link;
+    if (is_marked(s->site))
+    {
+      link = &s->next;
+    }
+    else
+    {
+      *link = s->next;
+      FREE(inline_site_t, s);
+    }
+  }
+}
+
+void crisp_optimizer_redefined(crisp_t *crisp, global_cell_t *cell)
+{
+  inline_site_t **link = &optimizer(crisp)->sites;
+  while (*link != NULL)
+  {
+    inline_site_t *s = *link;
+    if (s->cell == cell)
+    {
+      set_car(s->site, s->car);
+      set_cdr(s->site, s->cdr);
+      s->site->flags &= (uint8_t)~VALUE_FLAG_INLINED;
+      optimizer(crisp)->epoch++;
+      *link = s->next;
+      FREE(inline_site_t, s);
+    }
+    else
+    {
+      link = &s->next;
+    }
+  }
+}
+
+optimize_report_t crisp_optimize(crisp_t *crisp, expr_t node, env_t *env)
+{
+  pass_t f = {.crisp = crisp, .env = env, .optimizer = optimizer(crisp), .depth = 0, .report = {0, 0, 0}};
+
+  // Only top level forms are optimized, so that every free variable in
+  // the form is either bound by a lambda within it or is a global.
+  if (node != NULL && env_is_top_level(env) && env == root_env(crisp))
+  {
+    fold_form(&f, node, NULL);
+  }
+  return f.report;
+}
+
+static scope_t lambda_scope(scope_t *parent, expr_t formals)
+{
+  scope_t scope = {.parent = parent, .formals = formals, .bindings = NULL, .visible = 0};
+  return scope;
+}
+
+static scope_t let_scope(scope_t *parent, expr_t bindings, size_t visible)
+{
+  scope_t scope = {.parent = parent, .formals = NULL, .bindings = bindings, .visible = visible};
+  return scope;
+}
+
+static bool is_shadowed(scope_t *scope, const char *name)
+{
+  for (; scope != NULL; scope = scope->parent)
+  {
+    size_t i = 0;
+    for (expr_t b = scope->bindings; is_cons(b) && (i < scope->visible); b = cdr(b), i++)
+    {
+      if (is_cons(car(b)) && is_atom(car(car(b))) && as_atom(car(car(b))) == name)
+        return true;
+    }
+
+    expr_t formals = scope->formals;
+    while (is_cons(formals))
+    {
+      if (is_atom(car(formals)) && as_atom(car(formals)) == name)
+        return true;
+      formals = cdr(formals);
+    }
+    if (is_atom(formals) && as_atom(formals) == name)
+      return true;
+  }
+  return false;
+}
+
+// The global cell an operator refers to, or NULL if it is not an atom
+// that is known to refer to a global.
+static global_cell_t *global_cell(pass_t *f, expr_t op, scope_t *scope)
+{
+  if (!is_atom(op))
+    return NULL;
+
+  // Atoms copied in from an inlined body are bound to their global.
+  if (op->as.atom.cell != NULL)
+    return op->as.atom.cell;
+
+  if (is_shadowed(scope, as_atom(op)))
+    return NULL;
+
+  return env_get_cell(f->env, as_atom(op));
+}
+
+static expr_t global_operator(pass_t *f, expr_t op, scope_t *scope)
+{
+  global_cell_t *cell = global_cell(f, op, scope);
+  return (cell != NULL) ? cell->value : NULL;
+}
+
+static void add_dependency(pass_t *f, expr_t *deps, expr_t atom, expr_t value)
+{
+  for (expr_t d = *deps; is_cons(d); d = cdr(d))
+  {
+    if (as_atom(car(car(d))) == as_atom(atom))
+      return;
+  }
+  *deps = cons(f->crisp, cons(f->crisp, atom, value), *deps);
+}
+
+static void add_dependencies(pass_t *f, expr_t *deps, expr_t more)
+{
+  for (; is_cons(more); more = cdr(more))
+  {
+    add_dependency(f, deps, car(car(more)), cdr(car(more)));
+  }
+}
+
+static void rewrite(pass_t *f, expr_t node, expr_t value, expr_t deps)
+{
+  crisp_t *crisp = f->crisp;
+  expr_t original = cons(crisp, car(node), cdr(node));
+  set_car(node, special_form_value(crisp, &b_folded));
+  set_cdr(node,
+          cons(crisp, value,
+               cons(crisp, deps,
+                    cons(crisp, original, nil_value(crisp)))));
+}
+
+static bool is_keyword(expr_t node, syntax_t syntax)
+{
+  return is_atom(node) && (as_syntax(node) == syntax);
+}
+
+static bool is_quote(expr_t node)
+{
+  return is_cons(node) && is_keyword(car(node), SYNTAX_QUOTE);
+}
+
+// The operands (bindings forms...) of a let form, which follow the name of
+// a named let.
+static expr_t let_operands(expr_t node)
+{
+  bool named = is_keyword(car(node), SYNTAX_LET) && is_named_let(cdr(node));
+  return named ? cdr(cdr(node)) : cdr(node);
+}
+
+// A well formed let, let* or letrec form.
+static bool is_let_form(expr_t node)
+{
+  if (!is_cons(node) || !is_atom(car(node)))
+    return false;
+
+  syntax_t syntax = as_syntax(car(node));
+  if ((syntax != SYNTAX_LET) && (syntax != SYNTAX_LET_STAR) && (syntax != SYNTAX_LETREC))
+    return false;
+
+  expr_t operands = let_operands(node);
+  if (!is_proper_list(operands) || (length(operands) < 2))
+    return false;
+
+  expr_t bindings = car(operands);
+  if (!is_nil(bindings) && !is_proper_list(bindings))
+    return false;
+  for (; is_cons(bindings); bindings = cdr(bindings))
+  {
+    expr_t b = car(bindings);
+    if (!is_proper_list(b) || (length(b) != 2) || !is_atom(car(b)))
+      return false;
+  }
+  return true;
+}
+
+// The scope that the value of the i'th binding of a let form is evaluated
+// in, given the scope of the form.
+static scope_t binding_scope(expr_t node, scope_t *scope, size_t i)
+{
+  switch (as_syntax(car(node)))
+  {
+  case SYNTAX_LET_STAR:
+    return let_scope(scope, car(cdr(node)), i);
+  case SYNTAX_LETREC:
+    return let_scope(scope, car(cdr(node)), SIZE_MAX);
+  default:
+    return let_scope(scope, NULL, 0);
+  }
+}
+
+// The scope of the forms of a let, in which a named let binds its name as
+// well.
+static scope_t body_scope(expr_t node, scope_t *scope)
+{
+  expr_t operands = let_operands(node);
+  scope_t inner = let_scope(scope, car(operands), SIZE_MAX);
+  if (operands != cdr(node))
+    inner.formals = car(cdr(node));
+  return inner;
+}
+
+// The forms of a let.
+static expr_t let_body(expr_t node)
+{
+  return cdr(let_operands(node));
+}
+
+// Literals and quoted data are constant already, so only applications
+// that were folded are rewritten.
+static bool needs_rewrite(expr_t node)
+{
+  return is_cons(node) && !is_folded(node) && !is_quote(node);
+}
+
+static void fold_form(pass_t *f, expr_t node, scope_t *scope)
+{
+  expr_t deps = nil_value(f->crisp);
+  expr_t value = fold(f, node, scope, &deps);
+  if (value != NULL && needs_rewrite(node))
+  {
+    rewrite(f, node, value, deps);
+  }
+}
+
+static void fold_forms(pass_t *f, expr_t forms, scope_t *scope)
+{
+  for (; is_cons(forms); forms = cdr(forms))
+  {
+    fold_form(f, car(forms), scope);
+  }
+}
+
+// Folds the subforms of a special form, returning the value of the form if
+// it is quoted data.
+static expr_t fold_syntax(pass_t *f, expr_t node, scope_t *scope)
+{
+  size_t len = length(node);
+
+  switch (as_syntax(car(node)))
+  {
+  case SYNTAX_QUOTE:
+    return (len == 2) ? car(cdr(node)) : NULL;
+
+  case SYNTAX_LAMBDA:
+    if (len >= 3)
+    {
+      scope_t inner = lambda_scope(scope, car(cdr(node)));
+      fold_forms(f, cdr(cdr(node)), &inner);
+    }
+    break;
+
+  case SYNTAX_DEFINE:
+  case SYNTAX_SET:
+    if (len == 3)
+    {
+      fold_forms(f, cdr(cdr(node)), scope);
+    }
+    break;
+
+  case SYNTAX_IF:
+  case SYNTAX_BEGIN:
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    fold_forms(f, cdr(node), scope);
+    break;
+
+  case SYNTAX_COND:
+    for (expr_t clauses = cdr(node); is_cons(clauses); clauses = cdr(clauses))
+    {
+      if (is_proper_list(car(clauses)))
+        fold_forms(f, car(clauses), scope);
+    }
+    break;
+
+  case SYNTAX_CASE:
+    if (len >= 2)
+    {
+      fold_form(f, car(cdr(node)), scope);
+      for (expr_t clauses = cdr(cdr(node)); is_cons(clauses); clauses = cdr(clauses))
+      {
+        if (is_proper_list(car(clauses)))
+          fold_forms(f, cdr(car(clauses)), scope);
+      }
+    }
+    break;
+
+  case SYNTAX_PARAMETERIZE:
+    if ((len >= 3) && is_proper_list(car(cdr(node))))
+    {
+      for (expr_t b = car(cdr(node)); is_cons(b); b = cdr(b))
+      {
+        if (is_proper_list(car(b)))
+          fold_forms(f, car(b), scope);
+      }
+      fold_forms(f, cdr(cdr(node)), scope);
+    }
+    break;
+
+  case SYNTAX_LET:
+  case SYNTAX_LET_STAR:
+  case SYNTAX_LETREC:
+    if (is_let_form(node))
+    {
+      size_t i = 0;
+      for (expr_t b = car(let_operands(node)); is_cons(b); b = cdr(b), i++)
+      {
+        scope_t init = binding_scope(node, scope, i);
+        fold_forms(f, cdr(car(b)), &init);
+      }
+      scope_t inner = body_scope(node, scope);
+      fold_forms(f, let_body(node), &inner);
+    }
+    break;
+
+  case SYNTAX_RECUR:
+    fold_forms(f, cdr(cdr(node)), scope);
+    break;
+
+  default:
+    break;
+  }
+  return NULL;
+}
+
+static void add_free_variable(pass_t *f, expr_t *free, expr_t atom)
+{
+  for (expr_t v = *free; is_cons(v); v = cdr(v))
+  {
+    if (as_atom(car(v)) == as_atom(atom))
+      return;
+  }
+  *free = cons(f->crisp, atom, *free);
+}
+
+static void collect_free_variables(pass_t *f, expr_t node, scope_t *scope, expr_t *free)
+{
+  if (is_atom(node))
+  {
+    // Keywords are not variables.
+    if ((node->as.atom.cell == NULL) && !is_syntax(node) &&
+        !is_shadowed(scope, as_atom(node)))
+      add_free_variable(f, free, node);
+    return;
+  }
+
+  if (!pair(node) || is_folded(node) || is_quote(node))
+    return;
+
+  if (is_keyword(car(node), SYNTAX_LAMBDA) && pair(cdr(node)))
+  {
+    scope_t inner = lambda_scope(scope, car(cdr(node)));
+    for (expr_t body = cdr(cdr(node)); pair(body); body = cdr(body))
+    {
+      collect_free_variables(f, car(body), &inner, free);
+    }
+    return;
+  }
+
+  if (is_let_form(node))
+  {
+    size_t i = 0;
+    for (expr_t b = car(let_operands(node)); is_cons(b); b = cdr(b), i++)
+    {
+      scope_t init = binding_scope(node, scope, i);
+      collect_free_variables(f, car(cdr(car(b))), &init, free);
+    }
+    scope_t inner = body_scope(node, scope);
+    for (expr_t body = let_body(node); pair(body); body = cdr(body))
+    {
+      collect_free_variables(f, car(body), &inner, free);
+    }
+    return;
+  }
+
+  if (is_keyword(car(node), SYNTAX_CASE) && pair(cdr(node)))
+  {
+    // The data of the clauses are not variables.
+    collect_free_variables(f, car(cdr(node)), scope, free);
+    for (expr_t clauses = cdr(cdr(node)); pair(clauses); clauses = cdr(clauses))
+    {
+      for (expr_t forms = pair(car(clauses)) ? cdr(car(clauses)) : NULL; pair(forms); forms = cdr(forms))
+      {
+        collect_free_variables(f, car(forms), scope, free);
+      }
+    }
+    return;
+  }
+
+  for (; pair(node); node = cdr(node))
+  {
+    collect_free_variables(f, car(node), scope, free);
+  }
+  collect_free_variables(f, node, scope, free);
+}
+
+expr_t crisp_free_variables(crisp_t *crisp, expr_t operands)
+{
+  if (operands->as.cons.meta == NULL)
+  {
+    pass_t f = {.crisp = crisp, .env = root_env(crisp), .optimizer = optimizer(crisp), .depth = 0, .report = {0, 0, 0}};
+    scope_t scope = lambda_scope(NULL, car(operands));
+    expr_t free = nil_value(crisp);
+    for (expr_t body = cdr(operands); pair(body); body = cdr(body))
+    {
+      collect_free_variables(&f, car(body), &scope, &free);
+    }
+    operands->as.cons.meta = free;
+  }
+  return operands->as.cons.meta;
+}
+
+static bool may_assign(expr_t node)
+{
+  if (is_atom(node))
+    return as_syntax(node) == SYNTAX_SET;
+
+  if (!pair(node) || is_folded(node) || is_quote(node))
+    return false;
+
+  for (; pair(node); node = cdr(node))
+  {
+    if (may_assign(car(node)))
+      return true;
+  }
+  return may_assign(node);
+}
+
+// The result of may_assign on forms, cached on the operands pair.
+static bool cached_may_assign(expr_t operands, expr_t forms)
+{
+  if (!(operands->flags & VALUE_FLAG_ESCAPE_KNOWN))
+  {
+    bool escapes = may_assign(forms);
+    operands->flags |= (uint8_t)(VALUE_FLAG_ESCAPE_KNOWN | (escapes ? VALUE_FLAG_FRAME_ESCAPES : 0));
+  }
+  return (operands->flags & VALUE_FLAG_FRAME_ESCAPES) != 0;
+}
+
+bool crisp_frame_may_escape(crisp_t *crisp, expr_t operands)
+{
+  (void)crisp;
+  return cached_may_assign(operands, cdr(operands));
+}
+
+bool crisp_let_may_escape(crisp_t *crisp, expr_t operands)
+{
+  (void)crisp;
+  return cached_may_assign(operands, operands);
+}
+
+// Inlining
+//
+// A call (f a b) to a lambda (lambda (x y) body) bound to the global f is
+// replaced, in place, by a copy of body in which x and y are replaced by
+// the argument expressions a and b. Free variables of the body are bound
+// to their global cells in the copy, so that they can not be captured by
+// the variables in scope at the call.
+//
+// The copy must evaluate each argument as the call would have done. An
+// argument that is an application is therefore only substituted for a
+// parameter that the body uses exactly once, in the same order as the
+// parameters, and before the body makes any call of its own. Variables are
+// substituted anywhere before the body makes a call, and literals and
+// quoted data anywhere at all.
+
+static void add_site(pass_t *f, expr_t node, expr_t car, expr_t cdr, global_cell_t *cell)
+{
+  inline_site_t *site = ALLOCATE(inline_site_t, 1);
+  site->site = node;
+  site->car = car;
+  site->cdr = cdr;
+  site->cell = cell;
+  site->next = f->optimizer->sites;
+  f->optimizer->sites = site;
+}
+
+#define INLINE_MAX_ARGS 8
+
+typedef enum
+{
+  ARG_LITERAL,
+  ARG_VARIABLE,
+  ARG_EXPRESSION,
+} arg_kind_t;
+
+typedef struct
+{
+  const char *name;
+  expr_t formals;
+  size_t argc;
+  expr_t args[INLINE_MAX_ARGS];
+  arg_kind_t kinds[INLINE_MAX_ARGS];
+  size_t uses[INLINE_MAX_ARGS];
+  // The next argument expression that the body must use.
+  size_t next_expression;
+  // The body has made a call.
+  bool called;
+  size_t size;
+} inline_t;
+
+static inline_site_t *find_site(pass_t *f, expr_t node)
+{
+  for (inline_site_t *s = f->optimizer->sites; s != NULL; s = s->next)
+  {
+    if (s->site == node)
+      return s;
+  }
+  return NULL;
+}
+
+// A body that was itself optimized is copied from its original form, and
+// the copy optimized afresh.
+static void original_form(pass_t *f, expr_t node, expr_t *op, expr_t *operands)
+{
+  if (node->flags & VALUE_FLAG_INLINED)
+  {
+    inline_site_t *s = find_site(f, node);
+    *op = s->car;
+    *operands = s->cdr;
+  }
+  else if (is_folded(node))
+  {
+    original_form(f, car(cdr(cdr(cdr(node)))), op, operands);
+  }
+  else
+  {
+    *op = car(node);
+    *operands = cdr(node);
+  }
+}
+
+static size_t formal_index(inline_t *in, const char *name)
+{
+  size_t i = 0;
+  for (expr_t formals = in->formals; is_cons(formals); formals = cdr(formals), i++)
+  {
+    if (as_atom(car(formals)) == name)
+      return i;
+  }
+  return INLINE_MAX_ARGS;
+}
+
+static size_t next_expression(inline_t *in, size_t from)
+{
+  while (from < in->argc && in->kinds[from] != ARG_EXPRESSION)
+    from++;
+  return from;
+}
+
+static bool use_formal(inline_t *in, size_t i)
+{
+  in->uses[i]++;
+  switch (in->kinds[i])
+  {
+  case ARG_LITERAL:
+    return true;
+  case ARG_VARIABLE:
+    return !in->called;
+  case ARG_EXPRESSION:
+    if (in->called || i != in->next_expression)
+      return false;
+    in->next_expression = next_expression(in, i + 1);
+    return true;
+  }
+  return false;
+}
+
+// Checks that a body can be inlined, walking it in evaluation order.
+static bool can_inline(pass_t *f, inline_t *in, expr_t node)
+{
+  if (++in->size > f->optimizer->max_inline_size)
+    return false;
+
+  if (is_bool(node) || is_string(node) || is_number(node) || is_nil(node))
+    return true;
+
+  if (is_atom(node))
+  {
+    if (as_atom(node) == in->name)
+      return false;
+
+    size_t i = formal_index(in, as_atom(node));
+    if (i < in->argc)
+      return use_formal(in, i);
+
+    return env_get_cell(f->env, as_atom(node)) != NULL;
+  }
+
+  if (!pair(node))
+    return false;
+
+  expr_t op, operands;
+  original_form(f, node, &op, &operands);
+  if (!is_proper_list(operands))
+    return false;
+
+  if (is_syntax(op))
+  {
+    // Quoted data is the only special form that may appear.
+    return (as_syntax(op) == SYNTAX_QUOTE) && (length(operands) == 1);
+  }
+
+  if (!can_inline(f, in, op))
+    return false;
+
+  for (; is_cons(operands); operands = cdr(operands))
+  {
+    if (!can_inline(f, in, car(operands)))
+      return false;
+  }
+
+  in->called = true;
+  return true;
+}
+
+static expr_t copy_body(pass_t *f, inline_t *in, expr_t node)
+{
+  if (is_atom(node))
+  {
+    size_t i = formal_index(in, as_atom(node));
+    if (i < in->argc)
+      return in->args[i];
+
+    // No local frame binds the free variables of a top level lambda,
+    // so the atom can be bound to its global cell for good.
+    node->as.atom.cell = env_get_cell(f->env, as_atom(node));
+    return node;
+  }
+
+  if (!pair(node))
+    return node;
+
+  expr_t op, operands;
+  original_form(f, node, &op, &operands);
+  if (is_syntax(op))
+  {
+    // Quoted data is shared with the body.
+    return cons(f->crisp, op, operands);
+  }
+
+  crisp_t *crisp = f->crisp;
+  expr_t head = cons(crisp, copy_body(f, in, op), nil_value(crisp));
+  expr_t tail = head;
+  for (; is_cons(operands); operands = cdr(operands))
+  {
+    expr_t c = cons(crisp, copy_body(f, in, car(operands)), nil_value(crisp));
+    set_cdr(tail, c);
+    tail = c;
+  }
+  return head;
+}
+
+// Replaces a call to a global lambda with a copy of its body.
+static bool inline_call(pass_t *f, expr_t node, scope_t *scope)
+{
+  expr_t op = car(node);
+  if (!is_atom(op) || f->depth >= CRISP_INLINE_MAX_DEPTH)
+    return false;
+
+  global_cell_t *cell = op->as.atom.cell;
+  if (cell == NULL)
+  {
+    if (is_shadowed(scope, as_atom(op)))
+      return false;
+    cell = env_get_cell(f->env, as_atom(op));
+  }
+
+  if (cell == NULL || !is_lambda(cell->value))
+    return false;
+
+  lambda_t *lambda = as_lambda(cell->value);
+  if (lambda->env != f->env || !is_cons(lambda->bodies) || !is_nil(cdr(lambda->bodies)))
+    return false;
+
+  expr_t body = car(lambda->bodies);
+  if (!pair(body) || !is_proper_list(lambda->formals))
+    return false;
+
+  inline_t in = {
+      .name = as_atom(op),
+      .formals = lambda->formals,
+      .argc = length(lambda->formals),
+      .called = false,
+      .size = 0};
+
+  if (in.argc > INLINE_MAX_ARGS || in.argc != length(cdr(node)))
+    return false;
+
+  expr_t args = cdr(node);
+  expr_t formals = lambda->formals;
+  for (size_t i = 0; i < in.argc; i++, args = cdr(args), formals = cdr(formals))
+  {
+    expr_t arg = car(args);
+    if (!is_atom(car(formals)))
+      return false;
+
+    in.args[i] = arg;
+    in.uses[i] = 0;
+    if (is_atom(arg))
+      in.kinds[i] = ARG_VARIABLE;
+    else if (pair(arg) && !is_folded(arg) && !is_quote(arg))
+      in.kinds[i] = ARG_EXPRESSION;
+    else
+      in.kinds[i] = ARG_LITERAL;
+  }
+  in.next_expression = next_expression(&in, 0);
+
+  if (!can_inline(f, &in, body))
+    return false;
+
+  // Every argument that is not a literal must still be evaluated.
+  for (size_t i = 0; i < in.argc; i++)
+  {
+    if (in.kinds[i] != ARG_LITERAL && in.uses[i] == 0)
+      return false;
+  }
+
+  expr_t copy = copy_body(f, &in, body);
+
+  add_site(f, node, car(node), cdr(node), cell);
+
+  set_car(node, car(copy));
+  set_cdr(node, cdr(copy));
+  node->flags |= VALUE_FLAG_INLINED;
+  f->report.inlined++;
+  return true;
+}
+
+// Fusion
+//
+// A chain such as
+//   (fold f init (map g (filter p xs)))
+// is rewritten, in place, to
+//   (fused#list '(fold map filter) f init g p xs)
+// which takes each element of xs through filter, map and fold in turn.
+// The operands are evaluated in the order the chain evaluated them.
+//
+// Each procedure of the chain must be a pure builtin, or a lambda form
+// whose bodies only call pure builtins and assign nothing, so that the
+// order in which they are applied can not be observed. Redefining any of
+// the stages or of the builtins that their procedures call restores the
+// chain.
+
+#define FUSED_MAX_CALLEES 16
+
+// The global cells that a chain was found to be fusable by.
+typedef struct
+{
+  global_cell_t *cells[FUSED_MAX_CALLEES];
+  size_t count;
+} callees_t;
+
+static bool add_callee(callees_t *callees, global_cell_t *cell)
+{
+  for (size_t i = 0; i < callees->count; i++)
+  {
+    if (callees->cells[i] == cell)
+      return true;
+  }
+  if (callees->count == FUSED_MAX_CALLEES)
+    return false;
+  callees->cells[callees->count++] = cell;
+  return true;
+}
+
+static bool is_pure_operator(pass_t *f, expr_t op, scope_t *scope, callees_t *callees)
+{
+  global_cell_t *cell = global_cell(f, op, scope);
+  return (cell != NULL) && (cell->value != NULL) && (cell->value->flags & VALUE_FLAG_PURE) &&
+         add_callee(callees, cell);
+}
+
+// Whether evaluating a form within a stage procedure has no effect that
+// another stage could see.
+static bool is_pure_form(pass_t *f, expr_t node, scope_t *scope, callees_t *callees)
+{
+  if (!pair(node))
+    return !is_atom(node) || !is_syntax(node);
+
+  if (is_folded(node) || is_quote(node))
+    return true;
+
+  if (!is_proper_list(node))
+    return false;
+
+  expr_t op = car(node);
+  if (is_syntax(op))
+  {
+    switch (as_syntax(op))
+    {
+    case SYNTAX_IF:
+    case SYNTAX_AND:
+    case SYNTAX_OR:
+    case SYNTAX_BEGIN:
+      break;
+    default:
+      return false;
+    }
+  }
+  else if (!is_pure_operator(f, op, scope, callees))
+  {
+    return false;
+  }
+
+  for (expr_t operands = cdr(node); pair(operands); operands = cdr(operands))
+  {
+    if (!is_pure_form(f, car(operands), scope, callees))
+      return false;
+  }
+  return true;
+}
+
+static bool is_pure_procedure(pass_t *f, expr_t node, scope_t *scope, callees_t *callees)
+{
+  if (is_atom(node))
+    return is_pure_operator(f, node, scope, callees);
+
+  if (!pair(node) || !is_keyword(car(node), SYNTAX_LAMBDA) || !is_proper_list(node) ||
+      (length(node) < 3))
+    return false;
+
+  scope_t inner = lambda_scope(scope, car(cdr(node)));
+  for (expr_t body = cdr(cdr(node)); pair(body); body = cdr(body))
+  {
+    if (!is_pure_form(f, car(body), &inner, callees))
+      return false;
+  }
+  return true;
+}
+
+// The stage that a call is, if it can be part of a chain, adding the cells
+// that it relies upon to callees.
+static list_stage_t call_stage(pass_t *f, expr_t node, scope_t *scope, callees_t *callees)
+{
+  if (!pair(node) || is_folded(node) || (node->flags & VALUE_FLAG_INLINED) || !is_proper_list(node))
+    return LIST_STAGE_NONE;
+
+  global_cell_t *cell = global_cell(f, car(node), scope);
+  list_stage_t stage = builtin_list_stage((cell != NULL) ? cell->value : NULL);
+  size_t argc = length(cdr(node));
+  if ((stage == LIST_STAGE_NONE) || (argc != ((stage == LIST_STAGE_FOLD) ? 3U : 2U)))
+    return LIST_STAGE_NONE;
+
+  // The procedure is the first operand.
+  size_t count = callees->count;
+  if (!add_callee(callees, cell) || !is_pure_procedure(f, car(cdr(node)), scope, callees))
+  {
+    callees->count = count;
+    return LIST_STAGE_NONE;
+  }
+  return stage;
+}
+
+static expr_t last_operand(expr_t node)
+{
+  expr_t operands = cdr(node);
+  while (pair(cdr(operands)))
+  {
+    operands = cdr(operands);
+  }
+  return car(operands);
+}
+
+static bool fuse_chain(pass_t *f, expr_t node, scope_t *scope)
+{
+  crisp_t *crisp = f->crisp;
+  expr_t calls[FUSED_MAX_STAGES];
+  list_stage_t stages[FUSED_MAX_STAGES];
+  size_t count = 0;
+  callees_t callees = {.count = 0};
+
+  stages[0] = call_stage(f, node, scope, &callees);
+  if (stages[0] == LIST_STAGE_NONE)
+    return false;
+  calls[count++] = node;
+
+  for (expr_t list = last_operand(node); count < FUSED_MAX_STAGES; list = last_operand(list))
+  {
+    list_stage_t stage = call_stage(f, list, scope, &callees);
+    if ((stage != LIST_STAGE_MAP) && (stage != LIST_STAGE_FILTER))
+      break;
+    stages[count] = stage;
+    calls[count++] = list;
+  }
+  if (count < 2)
+    return false;
+
+  expr_t names = nil_value(crisp);
+  for (size_t i = count; i > 0; i--)
+  {
+    names = cons(crisp, atom_value_null_terminated(crisp, list_stage_name(stages[i - 1])), names);
+  }
+
+  // The names of the stages, then the operands of each call but the list
+  // it takes, then the list that the innermost takes.
+  expr_t quoted = cons(crisp, atom_value_null_terminated(crisp, "quote"), cons(crisp, names, nil_value(crisp)));
+  expr_t operands = cons(crisp, quoted, nil_value(crisp));
+  expr_t tail = operands;
+  for (size_t i = 0; i < count; i++)
+  {
+    for (expr_t o = cdr(calls[i]); pair(cdr(o)); o = cdr(o))
+    {
+      expr_t c = cons(crisp, car(o), nil_value(crisp));
+      set_cdr(tail, c);
+      tail = c;
+    }
+  }
+  set_cdr(tail, cons(crisp, last_operand(calls[count - 1]), nil_value(crisp)));
+
+  for (size_t i = 0; i < callees.count; i++)
+  {
+    add_site(f, node, car(node), cdr(node), callees.cells[i]);
+  }
+
+  // The builtin is not one that a program can name, so can not be shadowed.
+  expr_t fused = atom_value_null_terminated(crisp, BUILTIN_FUSED);
+  fused->as.atom.cell = env_get_cell(f->env, BUILTIN_FUSED);
+  set_car(node, fused);
+  set_cdr(node, operands);
+  node->flags |= VALUE_FLAG_INLINED;
+  f->report.fused++;
+  return true;
+}
+
+// Returns the value of node if it is constant, adding the bindings that
+// the value depends upon to deps. Otherwise returns NULL, having folded
+// any constant subexpressions of node in place.
+static expr_t fold(pass_t *f, expr_t node, scope_t *scope, expr_t *deps)
+{
+  crisp_t *crisp = f->crisp;
+
+  if (is_bool(node) || is_string(node) || is_number(node) || is_nil(node))
+    return node;
+
+  if (!pair(node) || !is_proper_list(node))
+    return NULL;
+
+  if (is_folded(node))
+  {
+    add_dependencies(f, deps, car(cdr(cdr(node))));
+    return car(cdr(node));
+  }
+
+  if (is_syntax(car(node)))
+  {
+    return fold_syntax(f, node, scope);
+  }
+
+  expr_t op = global_operator(f, car(node), scope);
+  // Calls are only inlined within lambdas, top level forms are evaluated
+  // just the once.
+  if (scope != NULL && op != NULL && is_lambda(op) && inline_call(f, node, scope))
+  {
+    // The body may itself be folded or have calls to inline.
+    f->depth++;
+    expr_t value = fold(f, node, scope, deps);
+    f->depth--;
+    return value;
+  }
+
+  if (!is_atom(car(node)))
+  {
+    fold_form(f, car(node), scope);
+  }
+  else if ((builtin_list_stage(op) != LIST_STAGE_NONE) && fuse_chain(f, node, scope))
+  {
+    op = global_operator(f, car(node), scope);
+  }
+
+  expr_t operands = cdr(node);
+  size_t argc = length(operands);
+  const builtin_t *builtin = ((op != NULL) && (op->flags & VALUE_FLAG_PURE)) ? builtin_descriptor(op) : NULL;
+  bool constant = (builtin != NULL) && (argc >= builtin->min_arity) && (argc <= builtin->max_arity);
+
+  // The value and dependencies of each operand.
+  cek_stack_t *stack = eval_stack(crisp);
+  expr_t *argv = cek_push_args(stack, argc * 2);
+  expr_t *depv = &argv[argc];
+
+  expr_t o = operands;
+  for (size_t i = 0; i < argc; i++)
+  {
+    depv[i] = nil_value(crisp);
+    argv[i] = fold(f, car(o), scope, &depv[i]);
+
+    if (argv[i] == NULL)
+      constant = false;
+    else if (constant && !(builtin_operand_types(builtin, i) & TYPE_MASK(argv[i]->type)))
+      constant = false;
+    o = cdr(o);
+  }
+
+  // A builtin may still fail on operands of the types it takes, in which
+  // case the call is left to fail when it is evaluated.
+  expr_t result = NULL;
+  if (constant)
+  {
+    result = crisp_apply_quietly(crisp, as_builtin(op), argc, argv);
+  }
+
+  if (result != NULL)
+  {
+    add_dependency(f, deps, car(node), op);
+    for (size_t i = 0; i < argc; i++)
+    {
+      add_dependencies(f, deps, depv[i]);
+    }
+    f->report.folded++;
+  }
+  else
+  {
+    // Rewrite the operands that were constant.
+    o = operands;
+    for (size_t i = 0; i < argc; i++)
+    {
+      if ((argv[i] != NULL) && needs_rewrite(car(o)))
+      {
+        rewrite(f, car(o), argv[i], depv[i]);
+      }
+      o = cdr(o);
+    }
+  }
+
+  cek_pop_args(stack, argc * 2);
+  return result;
+}
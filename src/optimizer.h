@@ -0,0 +1,87 @@
+#ifndef CRISP_OPTIMIZER_H
+#define CRISP_OPTIMIZER_H
+
+#include "common.h"
+#include "interpreter.h"
+
+struct global_cell_t;
+
+// Lambdas whose body has more nodes than this are not inlined.
+#define CRISP_INLINE_DEFAULT_MAX_SIZE 24
+// Limits how deeply inlined bodies are themselves inlined into, which
+// bounds the expansion of mutually recursive helpers.
+#define CRISP_INLINE_MAX_DEPTH 4
+
+// A call that has been replaced by a copy of the body of the lambda it
+// called. The original call is restored if the name the lambda was bound
+// to is redefined.
+typedef struct inline_site_t inline_site_t;
+struct inline_site_t
+{
+  inline_site_t *next;
+  expr_t site;
+  expr_t car;
+  expr_t cdr;
+  struct global_cell_t *cell;
+};
+
+typedef struct
+{
+  inline_site_t *sites;
+  size_t max_inline_size;
+  // Advanced whenever an inlined call is restored, which makes any code
+  // compiled before then stale.
+  size_t epoch;
+} optimizer_t;
+
+void optimizer_init(optimizer_t *optimizer);
+void optimizer_free(optimizer_t *optimizer);
+
+// Keeps the original form of each live inline site alive, and forgets the
+// sites that are no longer reachable. Called once every other root has
+// been marked.
+void optimizer_mark(crisp_t *crisp, optimizer_t *optimizer);
+
+// Optimize a parsed form in place.
+//
+// Applications of pure builtins to constant arguments of the types the
+// builtin takes are evaluated once, ahead of time, provided the builtin is reached through a top level
+// binding that no enclosing lambda shadows. The folded value is guarded by
+// the bindings it was computed from: should any of them be redefined later
+// the original expression is evaluated instead.
+//
+// Within lambda bodies, calls to small non-recursive lambdas bound at the
+// top level are replaced by a copy of the lambda body.
+//
+// Chains of map and filter calls, each taking the list the next one makes,
+// and ending in a map, filter or fold, are fused into one pass over the
+// list that builds no list in between. The procedures of the chain are
+// then applied element by element rather than list by list, so only
+// chains whose procedures can not tell the difference are fused. As with
+// inlining the original chain is restored should any of the builtins it
+// calls be redefined.
+optimize_report_t crisp_optimize(crisp_t *crisp, expr_t node, env_t *env);
+
+// The variables that occur free in the operands (formals . bodies) of a
+// lambda form, as a list of atoms. Names that can only refer to globals
+// are included unless the optimizer has already bound them to their cell.
+// The result is cached on the form.
+expr_t crisp_free_variables(crisp_t *crisp, expr_t operands);
+
+// Escape analysis of the operands (formals . bodies) of a lambda form.
+//
+// Returns false when nothing can hold on to the environment of a call to
+// the lambda. Closures copy the variables they use out of the environment
+// they were made in, which is only sound when those variables are never
+// assigned afterwards, so that is when the bodies contain no set!.
+// Otherwise the frame is shared by the closures made in it. The result is
+// cached on the form.
+bool crisp_frame_may_escape(crisp_t *crisp, expr_t operands);
+// As crisp_frame_may_escape, for the operands (bindings . bodies) of a let,
+// let* or letrec form.
+bool crisp_let_may_escape(crisp_t *crisp, expr_t operands);
+
+// Restore the calls that inlined the value of a redefined global.
+void crisp_optimizer_redefined(crisp_t *crisp, struct global_cell_t *cell);
+
+#endif
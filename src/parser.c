@@ -1,5 +1,6 @@
 #include "parser.h"
 #include "value.h"
+#include "value_support.h"
 #include "scanner.h"
 #include "interpreter_internal.h"
 
@@ -16,6 +17,7 @@ typedef enum
 // Parse functions return true on success
 static expr_t parse_form(crisp_t *crisp, token_t next);
 static expr_t parse_list(crisp_t *crisp, bracket_type_t bt);
+static expr_t parse_vector(crisp_t *crisp, token_t hash);
 static expr_t parse_symbol_atom(crisp_t *crisp, token_t token);
 static expr_t parse_string_atom(crisp_t *crisp, token_t token);
 static expr_t parse_number_atom(crisp_t *crisp, token_t token);
@@ -45,6 +47,32 @@ expr_t parse(crisp_t *crisp, const char *source)
   return result;
 }
 
+expr_t parse_program(crisp_t *crisp, const char *source)
+{
+  init_scanner(source);
+  parse_error = false;
+
+  expr_t head = nil_value(crisp);
+  expr_t tail = NULL;
+  for (token_t next = scan_token(); next.type != TOKEN_EOF; next = scan_token())
+  {
+    expr_t form = parse_form(crisp, next);
+    if (parse_error || form == NULL)
+    {
+      return NULL;
+    }
+
+    expr_t c = cons(crisp, form, nil_value(crisp));
+    if (tail == NULL)
+      head = c;
+    else
+      set_cdr(tail, c);
+    tail = c;
+  }
+
+  return head;
+}
+
 static expr_t parse_form(crisp_t *crisp, token_t next)
 {
   expr_t result = NULL;
@@ -59,6 +87,10 @@ static expr_t parse_form(crisp_t *crisp, token_t next)
     result = parse_list(crisp, BRACKET_TYPE_BOX);
     break;
 
+  case TOKEN_HASH:
+    result = parse_vector(crisp, next);
+    break;
+
   case TOKEN_STRING:
     result = parse_string_atom(crisp, next);
     break;
@@ -87,6 +119,10 @@ static expr_t parse_form(crisp_t *crisp, token_t next)
     result = parse_abbreviation(crisp, "unquote");
     break;
 
+  case TOKEN_COMMA_AT:
+    result = parse_abbreviation(crisp, "unquote-splicing");
+    break;
+
   case TOKEN_BACKTICK:
     result = parse_abbreviation(crisp, "quasiquote");
     break;
@@ -104,65 +140,119 @@ static expr_t parse_form(crisp_t *crisp, token_t next)
 
 static expr_t parse_list(crisp_t *crisp, bracket_type_t bt)
 {
-  expr_t result = NULL;
-  bool dot_list = false;
+  // The list is built iteratively using a tail pointer so that the
+  // length of a list literal is not limited by the native stack.
+  expr_t head = NULL;
+  expr_t tail = NULL;
+  expr_t last = NULL;
 
-  token_t next = scan_token();
-
-  if (next.type == TOKEN_DOT)
+  while (last == NULL)
   {
-    next = scan_token();
-    dot_list = true;
-  }
+    bool dot_list = false;
+    token_t next = scan_token();
 
-  if (next.type == TOKEN_EOF)
-  {
-    errorAt(crisp, &next, "Eof found whilst parsing list");
-    return NULL;
-  }
+    if (next.type == TOKEN_DOT)
+    {
+      next = scan_token();
+      dot_list = true;
+    }
 
-  if (is_list_end(next.type, bt))
-  {
-    if (dot_list)
+    if (next.type == TOKEN_EOF)
     {
-      errorAt(crisp, &next, "Expecting a single datum after '.'");
+      errorAt(crisp, &next, "Eof found whilst parsing list");
       return NULL;
     }
+
+    if (is_list_end(next.type, bt))
+    {
+      if (dot_list)
+      {
+        errorAt(crisp, &next, "Expecting a single datum after '.'");
+        return NULL;
+      }
+
+      last = nil_value(crisp);
+    }
     else
     {
-      return nil_value(crisp);
+      expr_t datum = parse_form(crisp, next);
+      if (datum == NULL)
+      {
+        return NULL;
+      }
+
+      if (dot_list)
+      {
+        // A dot can only preceed the last item in a list.
+        // Ensure that there is a trailing bracket and place the
+        // datum in the cdr position of the final pair.
+        next = scan_token();
+        if (!is_list_end(next.type, bt))
+        {
+          errorAt(crisp, &next, "Expecting only one datum after '.'");
+          return NULL;
+        }
+
+        last = datum;
+      }
+      else
+      {
+        expr_t c = cons(crisp, datum, NULL);
+        if (tail == NULL)
+          head = c;
+        else
+          set_cdr(tail, c);
+        tail = c;
+      }
     }
   }
 
-  result = parse_form(crisp, next);
-  if (result == NULL)
+  if (tail == NULL)
+  {
+    return last;
+  }
+
+  set_cdr(tail, last);
+  return head;
+}
+
+// A vector literal, #(datum...), which evaluates to itself.
+static expr_t parse_vector(crisp_t *crisp, token_t hash)
+{
+  token_t next = scan_token();
+  if ((next.type != TOKEN_LEFT_PAREN) || (next.start != hash.start + 1))
   {
+    errorAt(crisp, &hash, "Expecting '(' after '#'");
     return NULL;
   }
 
-  if (dot_list)
+  // The elements are gathered into a list, then copied into the vector
+  // once their number is known.
+  expr_t head = nil_value(crisp);
+  expr_t tail = NULL;
+  for (next = scan_token(); next.type != TOKEN_RIGHT_PAREN; next = scan_token())
   {
-    // value in result should be the last value in the list.
-    // ensure that there is a trailing bracket
-    next = scan_token();
-    if (!is_list_end(next.type, bt))
+    if (next.type == TOKEN_EOF)
     {
-      errorAt(crisp, &next, "Expecting only one datum after '.'");
+      errorAt(crisp, &next, "Eof found whilst parsing vector");
       return NULL;
     }
 
-    // return the result of parsing the form directly.
-    // since a dot can only preceed the last item in a list
-    // returning it directly will mean that the caller
-    // will cons it into the cdr position.
-  }
-  else
-  {
-    // Return a normal list form.
-    result = cons(crisp, result, parse_list(crisp, bt));
+    expr_t datum = parse_form(crisp, next);
+    if (datum == NULL)
+    {
+      return NULL;
+    }
+
+    expr_t c = cons(crisp, datum, nil_value(crisp));
+    if (tail == NULL)
+      head = c;
+    else
+      set_cdr(tail, c);
+    tail = c;
   }
 
-  return result;
+  return vector_from_list(crisp, head);
 }
 
 static expr_t parse_symbol_atom(crisp_t *crisp, token_t token)
@@ -4,5 +4,8 @@
 #include "common.h"
 
 expr_t parse(crisp_t* crisp, const char* source);
+// Parse every form in the source, returning them as a list. Returns NULL
+// if any of them fail to parse.
+expr_t parse_program(crisp_t* crisp, const char* source);
 
 #endif
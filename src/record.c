@@ -0,0 +1,134 @@
+#include "record.h"
+#include "value_support.h"
+#include "evaluator.h"
+
+// The slot of the field that the type names, or the count of its fields if
+// it has no such field.
+static size_t field_slot(expr_t type, expr_t name)
+{
+  size_t slot = 0;
+  for (expr_t fields = type->as.record_type.fields; pair(fields); fields = cdr(fields), slot++)
+  {
+    if (as_atom(car(fields)) == as_atom(name))
+      break;
+  }
+  return slot;
+}
+
+static bool check_type(crisp_t *crisp, expr_t type)
+{
+  if (!is_record_type(type))
+  {
+    crisp_eval_error(crisp, "define-record-type expects the name of a record type");
+    return false;
+  }
+  return true;
+}
+
+expr_t record_make_type(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  expr_t fields = argv[1];
+  for (expr_t f = fields; pair(f); f = cdr(f))
+  {
+    // Names are interned, so equal names are the same string.
+    for (expr_t g = cdr(f); pair(g); g = cdr(g))
+    {
+      if (as_atom(car(f)) == as_atom(car(g)))
+      {
+        crisp_eval_error(crisp, "Record type %s names field %s twice", as_atom(argv[0]), as_atom(car(f)));
+        return NULL;
+      }
+    }
+  }
+  return record_type_value(crisp, as_atom(argv[0]), fields);
+}
+
+// A procedure of the type that refers to the slots of the named fields.
+static expr_t make_procedure(crisp_t *crisp, record_op_t op, expr_t type, size_t arity, expr_t names)
+{
+  if (!check_type(crisp, type))
+    return NULL;
+
+  expr_t procedure = record_procedure_value(crisp, op, type, arity);
+  size_t i = 0;
+  for (; pair(names); names = cdr(names), i++)
+  {
+    size_t slot = field_slot(type, car(names));
+    if (slot == type->as.record_type.count)
+    {
+      crisp_eval_error(crisp, "Record type %s has no field %s", type->as.record_type.name, as_atom(car(names)));
+      return NULL;
+    }
+    procedure->as.record_procedure.slots[i] = slot;
+  }
+  return procedure;
+}
+
+expr_t record_constructor(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return make_procedure(crisp, RECORD_OP_CONSTRUCT, argv[0], length(argv[1]), argv[1]);
+}
+
+expr_t record_predicate(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return make_procedure(crisp, RECORD_OP_TEST, argv[0], 1, nil_value(crisp));
+}
+
+expr_t record_accessor(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return make_procedure(crisp, RECORD_OP_GET, argv[0], 1, cons(crisp, argv[1], nil_value(crisp)));
+}
+
+expr_t record_modifier(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)argc;
+  return make_procedure(crisp, RECORD_OP_SET, argv[0], 2, cons(crisp, argv[1], nil_value(crisp)));
+}
+
+expr_t crisp_apply_record(crisp_t *crisp, expr_t fn, size_t argc, expr_t *argv)
+{
+  expr_t type = fn->as.record_procedure.type;
+  size_t *slots = fn->as.record_procedure.slots;
+  (void)argc;
+
+  switch (fn->as.record_procedure.op)
+  {
+  case RECORD_OP_CONSTRUCT:
+  {
+    expr_t record = record_value(crisp, type);
+    for (size_t i = 0; i < fn->as.record_procedure.arity; i++)
+    {
+      record->as.record.slots[slots[i]] = argv[i];
+    }
+    for (size_t i = 0; i < record->as.record.count; i++)
+    {
+      if (record->as.record.slots[i] == NULL)
+        record->as.record.slots[i] = nil_value(crisp);
+    }
+    return record;
+  }
+
+  case RECORD_OP_TEST:
+    return bool_value(crisp, is_record(argv[0]) && (argv[0]->as.record.type == type));
+
+  case RECORD_OP_GET:
+  case RECORD_OP_SET:
+    break;
+  }
+
+  if (!is_record(argv[0]) || (argv[0]->as.record.type != type))
+  {
+    crisp_eval_error(crisp, "Expected a record of type %s", type->as.record_type.name);
+    return NULL;
+  }
+
+  if (fn->as.record_procedure.op == RECORD_OP_GET)
+    return argv[0]->as.record.slots[slots[0]];
+
+  argv[0]->as.record.slots[slots[0]] = argv[1];
+  return nil_value(crisp);
+}
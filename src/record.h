@@ -0,0 +1,35 @@
+#ifndef CRISP_RECORD_H
+#define CRISP_RECORD_H
+
+#include "common.h"
+#include "value.h"
+
+// Record types
+//
+//   (define-record-type name (constructor field...) predicate
+//     (field accessor modifier)...)
+// defines a type of record with the fields listed, and procedures to make
+// a record of the type, test whether a value is one, and get and set each
+// field. The modifier of a field may be left out, and a constructor given
+// as a name alone takes every field in order. A field that the constructor
+// does not take is (). The expander rewrites the form into a definition of
+// each of these, made by the builtins below.
+//
+// A record keeps its fields in an array of slots, in the order its type
+// lists them. Each procedure of a record type is made knowing the slots it
+// refers to, so it gets or sets a field by index rather than by name.
+
+// Applies a procedure of a record type, once the number of arguments has
+// been checked against the one it takes.
+expr_t crisp_apply_record(crisp_t *crisp, expr_t fn, size_t argc, expr_t *argv);
+
+// The builtins that define-record-type is rewritten to,
+// BUILTIN_RECORD_TYPE, BUILTIN_RECORD_CONSTRUCTOR, BUILTIN_RECORD_PREDICATE,
+// BUILTIN_RECORD_ACCESSOR and BUILTIN_RECORD_MODIFIER.
+expr_t record_make_type(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t record_constructor(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t record_predicate(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t record_accessor(crisp_t *crisp, size_t argc, expr_t *argv);
+expr_t record_modifier(crisp_t *crisp, size_t argc, expr_t *argv);
+
+#endif
@@ -63,8 +63,15 @@ token_t scan_token()
   case '\'':
     return make_token(TOKEN_APOSTROPHE);
   case ',':
-    return make_token(TOKEN_COMMA);
+    return make_token(match('@') ? TOKEN_COMMA_AT : TOKEN_COMMA);
   case '.':
+    // The ellipsis of syntax-rules is the one identifier that starts
+    // with a dot.
+    if ((scanner.current[0] == '.') && (scanner.current[1] == '.') && is_delimiter(scanner.current[2]))
+    {
+      scanner.current += 2;
+      return make_token(TOKEN_IDENTIFIER);
+    }
     return make_token(TOKEN_DOT);
   case '#':
     if (match('t') || match('T'))
@@ -13,6 +13,7 @@ typedef enum {
   
   // One or two character tokens.
   TOKEN_HASH, TOKEN_TRUE, TOKEN_FALSE,
+  TOKEN_COMMA_AT,
 
   // Literals.
   TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
@@ -0,0 +1,121 @@
+#include "specializer.h"
+#include "value.h"
+#include "value_support.h"
+#include "interpreter_internal.h"
+#include "builtins.h"
+#include "evaluator.h"
+#include "cek.h"
+#include "generic.h"
+
+// Operands that failed to evaluate are recorded as a type no value has.
+#define TYPE_BIT(value) (((value) != NULL) ? (1u << (value)->type) : (1u << 31))
+
+static node_t *specialize(crisp_t *crisp, expr_t node, expr_t operator, size_t argc)
+{
+  node_kind_t kind = NODE_KIND_DIRECT;
+  if (is_builtin(operator))
+  {
+    if ((argc < operator->as.fn.min_arity) || (argc > operator->as.fn.max_arity))
+      kind = NODE_KIND_GENERIC;
+    else if (builtin_numeric_op(operator) != NULL)
+      kind = NODE_KIND_NUMERIC;
+  }
+  else if (!is_fn(operator) && !is_lambda(operator))
+  {
+    kind = NODE_KIND_GENERIC;
+  }
+
+  node->as.cons.meta = node_value(crisp, kind, (kind == NODE_KIND_GENERIC) ? NULL : operator);
+  return as_node(node->as.cons.meta);
+}
+
+static expr_t apply_numeric(crisp_t *crisp, expr_t operator, size_t argc, expr_t *argv)
+{
+  binary_op_t op = builtin_numeric_op(operator);
+  double result = as_number(argv[0]);
+  for (size_t i = 1; i < argc; i++)
+  {
+    result = op(result, as_number(argv[i]));
+  }
+  return number_value(crisp, result);
+}
+
+expr_t crisp_eval_node(crisp_t *crisp, expr_t node, env_t *env)
+{
+  expr_t operator = crisp_eval(crisp, car(node), env);
+  expr_t operands = cdr(node);
+
+  // The meta slot of a pair that is not an application may hold
+  // something else, in which case the node is not specialized.
+  node_t *spec = NULL;
+  if (node->as.cons.meta == NULL)
+  {
+    spec = specialize(crisp, node, operator, length(operands));
+  }
+  else if (is_node(node->as.cons.meta))
+  {
+    spec = as_node(node->as.cons.meta);
+  }
+
+  if ((spec != NULL) && (spec->kind != NODE_KIND_GENERIC) && (spec->operator != operator))
+  {
+    spec->kind = NODE_KIND_GENERIC;
+    spec->operator = NULL;
+  }
+
+  if ((spec == NULL) || (spec->kind == NODE_KIND_GENERIC))
+  {
+    return crisp_apply_operands(crisp, operator, operands, env);
+  }
+
+  if (is_special_form(operator))
+  {
+    return as_fn(operator)(crisp, operands, env);
+  }
+
+  cek_stack_t *stack = eval_stack(crisp);
+  size_t argc = length(operands);
+  expr_t *argv = cek_push_args(stack, argc);
+  uint32_t types = 0;
+  for (size_t i = 0; i < argc; i++)
+  {
+    argv[i] = crisp_eval(crisp, car(operands), env);
+    types |= TYPE_BIT(argv[i]);
+    operands = cdr(operands);
+  }
+  spec->operand_types |= types;
+
+  // Seeing anything other than a number ends the numeric specialization,
+  // though the operator is still the same.
+  if ((spec->kind == NODE_KIND_NUMERIC) && (spec->operand_types != (1u << VALUE_TYPE_NUMBER)))
+  {
+    spec->kind = NODE_KIND_DIRECT;
+  }
+
+  expr_t result = NULL;
+  if (spec->kind == NODE_KIND_NUMERIC)
+  {
+    result = apply_numeric(crisp, operator, argc, argv);
+  }
+  else if (is_builtin(operator))
+  {
+    // The arity was checked when the node was specialized.
+    result = as_builtin(operator)(crisp, argc, argv);
+  }
+  else if (is_lambda(operator))
+  {
+    result = crisp_apply_lambda(crisp, as_lambda(operator), argc, argv);
+  }
+  else if (is_generic(operator))
+  {
+    expr_t method = crisp_dispatch(crisp, operator, cdr(node), argc, argv);
+    result = (method != NULL) ? crisp_apply_argv(crisp, method, argc, argv, env) : NULL;
+  }
+  else
+  {
+    result = crisp_apply_argv(crisp, operator, argc, argv, env);
+  }
+
+  cek_pop_args(stack, argc);
+  return result;
+}
@@ -0,0 +1,18 @@
+#ifndef CRISP_SPECIALIZER_H
+#define CRISP_SPECIALIZER_H
+
+#include "common.h"
+
+// Evaluate an application, specializing it to what it has seen.
+//
+// The first time an application is evaluated a node is attached to it
+// recording the operator it was applied with. Later evaluations guard on
+// the operator being the same value and then skip the generic dispatch:
+// builtins are called without their arity being checked again, lambdas
+// are applied directly, and the numeric builtins are folded inline for as
+// long as their operands are all numbers. When a guard fails the node
+// falls back to the generic path, and stays there for the operator or
+// operand types it could not handle.
+expr_t crisp_eval_node(crisp_t *crisp, expr_t node, env_t *env);
+
+#endif
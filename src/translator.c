@@ -0,0 +1,617 @@
+#include "translator.h"
+#include "value.h"
+#include "value_support.h"
+#include "environment.h"
+#include "builtins.h"
+#include "interpreter_internal.h"
+#include "expander.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct
+{
+  crisp_t *crisp;
+  // Code for the compiled functions, and for the body of the load function.
+  FILE *functions;
+  FILE *load;
+  // Literals, and the names of the globals that are referred to, in the
+  // order they are numbered in the generated code.
+  expr_t constants;
+  size_t constant_count;
+  expr_t globals;
+  size_t global_count;
+  // Each compiled function as (name . arity).
+  expr_t compiled;
+  size_t compiled_count;
+  bool uses_numeric;
+  // The function being compiled.
+  expr_t formals;
+  size_t temps;
+} translator_t;
+
+static size_t append(translator_t *t, expr_t *list, size_t *count, expr_t value)
+{
+  expr_t c = cons(t->crisp, value, nil_value(t->crisp));
+  if (*count == 0)
+  {
+    *list = c;
+  }
+  else
+  {
+    expr_t tail = *list;
+    while (pair(cdr(tail)))
+      tail = cdr(tail);
+    set_cdr(tail, c);
+  }
+  return (*count)++;
+}
+
+static size_t constant(translator_t *t, expr_t value)
+{
+  return append(t, &t->constants, &t->constant_count, value);
+}
+
+static size_t global(translator_t *t, expr_t atom)
+{
+  size_t i = 0;
+  for (expr_t g = t->globals; i < t->global_count; g = cdr(g), i++)
+  {
+    if (as_atom(car(g)) == as_atom(atom))
+      return i;
+  }
+  return append(t, &t->globals, &t->global_count, atom);
+}
+
+// The index of a compiled function that a global is bound to, if it is
+// compiled with the given arity.
+static bool compiled_function(translator_t *t, expr_t atom, size_t argc, size_t *index)
+{
+  size_t i = 0;
+  for (expr_t c = t->compiled; i < t->compiled_count; c = cdr(c), i++)
+  {
+    if (as_atom(car(car(c))) == as_atom(atom))
+    {
+      *index = i;
+      return (size_t)as_number(cdr(car(c))) == argc;
+    }
+  }
+  return false;
+}
+
+static bool formal_index(expr_t formals, expr_t atom, size_t *index)
+{
+  size_t i = 0;
+  for (; pair(formals); formals = cdr(formals), i++)
+  {
+    if (as_atom(car(formals)) == as_atom(atom))
+    {
+      *index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// The special form that a form is, SYNTAX_NONE for an application.
+static syntax_t form_syntax(expr_t node)
+{
+  return (pair(node) && is_syntax(car(node))) ? as_syntax(car(node)) : SYNTAX_NONE;
+}
+
+static void write_string(FILE *out, const char *str)
+{
+  fputc('"', out);
+  for (; *str != '\0'; str++)
+  {
+    if ((*str == '"') || (*str == '\\'))
+      fprintf(out, "\\%c", *str);
+    else if (*str == '\n')
+      fprintf(out, "\\n");
+    else
+      fputc(*str, out);
+  }
+  fputc('"', out);
+}
+
+// A C expression that builds a datum.
+static void write_datum(FILE *out, expr_t value)
+{
+  if (is_number(value) && isinf(as_number(value)))
+  {
+    fprintf(out, "number_value(crisp, %sHUGE_VAL)", (as_number(value) < 0) ? "-" : "");
+  }
+  else if (is_number(value))
+  {
+    fprintf(out, "number_value(crisp, %.17g)", as_number(value));
+  }
+  else if (is_string(value))
+  {
+    fprintf(out, "string_value(crisp, ");
+    write_string(out, as_string(value));
+    fprintf(out, ", %zu)", strlen(as_string(value)));
+  }
+  else if (is_bool(value))
+  {
+    fprintf(out, "bool_value(crisp, %s)", as_bool(value) ? "true" : "false");
+  }
+  else if (is_atom(value))
+  {
+    fprintf(out, "atom_value_null_terminated(crisp, ");
+    write_string(out, as_atom(value));
+    fprintf(out, ")");
+  }
+  else if (is_cons(value))
+  {
+    fprintf(out, "cons(crisp, ");
+    write_datum(out, car(value));
+    fprintf(out, ", ");
+    write_datum(out, cdr(value));
+    fprintf(out, ")");
+  }
+  else if (is_vector(value))
+  {
+    fprintf(out, "vector_from_list(crisp, ");
+    for (size_t i = 0; i < value->as.vector.count; i++)
+    {
+      fprintf(out, "cons(crisp, ");
+      write_datum(out, value->as.vector.items[i]);
+      fprintf(out, ", ");
+    }
+    fprintf(out, "nil_value(crisp)");
+    for (size_t i = 0; i <= value->as.vector.count; i++)
+    {
+      fprintf(out, ")");
+    }
+  }
+  else
+  {
+    fprintf(out, "nil_value(crisp)");
+  }
+}
+
+static bool can_compile(translator_t *t, expr_t node)
+{
+  if (!pair(node))
+    return true;
+
+  if (!is_proper_list(node))
+    return false;
+
+  // Of the special forms, only quoted data and those that decide which of
+  // their operands to evaluate are compiled.
+  switch (form_syntax(node))
+  {
+  case SYNTAX_NONE:
+    break;
+  case SYNTAX_QUOTE:
+    return length(node) == 2;
+  case SYNTAX_IF:
+    if ((length(node) != 3) && (length(node) != 4))
+      return false;
+    node = cdr(node);
+    break;
+  case SYNTAX_BEGIN:
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    node = cdr(node);
+    break;
+  default:
+    return false;
+  }
+
+  for (; pair(node); node = cdr(node))
+  {
+    if (!can_compile(t, car(node)))
+      return false;
+  }
+  return true;
+}
+
+// The lambda of a (define name (lambda (formals...) bodies...)) form that
+// can be compiled, or NULL.
+static expr_t compilable_definition(translator_t *t, expr_t form)
+{
+  t->formals = nil_value(t->crisp);
+  if (!is_proper_list(form) || (length(form) != 3) || (form_syntax(form) != SYNTAX_DEFINE) ||
+      !is_atom(car(cdr(form))))
+    return NULL;
+
+  expr_t lambda = car(cdr(cdr(form)));
+  if (!is_proper_list(lambda) || (length(lambda) < 3) || (form_syntax(lambda) != SYNTAX_LAMBDA))
+    return NULL;
+
+  expr_t formals = car(cdr(lambda));
+  if (!is_nil(formals) && !is_proper_list(formals))
+    return NULL;
+  for (expr_t f = formals; pair(f); f = cdr(f))
+  {
+    size_t duplicate = 0;
+    if (!is_atom(car(f)) || formal_index(cdr(f), car(f), &duplicate))
+      return NULL;
+  }
+
+  t->formals = formals;
+  for (expr_t body = cdr(cdr(lambda)); pair(body); body = cdr(body))
+  {
+    if (!can_compile(t, car(body)))
+    {
+      t->formals = nil_value(t->crisp);
+      return NULL;
+    }
+  }
+  return lambda;
+}
+
+// Whether a global refers to one of the numeric builtins, which are folded
+// inline whilst their operands are numbers.
+static bool numeric_global(translator_t *t, expr_t op)
+{
+  global_cell_t *cell = env_get_cell(root_env(t->crisp), as_atom(op));
+  return (cell != NULL) && (builtin_numeric_op(cell->value) != NULL);
+}
+
+static size_t emit_expr(translator_t *t, expr_t node);
+
+// Only false is false.
+#define FALSE_TEST "(is_bool(t%zu) && !as_bool(t%zu))"
+
+// Emit statements that evaluate the operands of an if form into temp.
+static void emit_if(translator_t *t, size_t temp, expr_t operands)
+{
+  FILE *out = t->functions;
+  fprintf(out, "  expr_t t%zu;\n", temp);
+  size_t test = emit_expr(t, car(operands));
+  fprintf(out, "  if (!" FALSE_TEST ")\n  {\n", test, test);
+  fprintf(out, "  t%zu = t%zu;\n", temp, emit_expr(t, car(cdr(operands))));
+  fprintf(out, "  }\n  else\n  {\n");
+  if (pair(cdr(cdr(operands))))
+    fprintf(out, "  t%zu = t%zu;\n", temp, emit_expr(t, car(cdr(cdr(operands)))));
+  else
+    fprintf(out, "  t%zu = nil_value(crisp);\n", temp);
+  fprintf(out, "  }\n");
+}
+
+// Emit statements that evaluate the operands of a begin, and or or form
+// into temp, the latter two stopping at the first operand that decides
+// their value.
+static void emit_sequence(translator_t *t, size_t temp, syntax_t syntax, expr_t operands)
+{
+  FILE *out = t->functions;
+  if (syntax == SYNTAX_BEGIN)
+    fprintf(out, "  expr_t t%zu = nil_value(crisp);\n", temp);
+  else
+    fprintf(out, "  expr_t t%zu = bool_value(crisp, %s);\n", temp, (syntax == SYNTAX_AND) ? "true" : "false");
+
+  fprintf(out, "  do\n  {\n");
+  for (; pair(operands); operands = cdr(operands))
+  {
+    fprintf(out, "  t%zu = t%zu;\n", temp, emit_expr(t, car(operands)));
+    if (syntax == SYNTAX_AND)
+      fprintf(out, "  if (" FALSE_TEST ")\n    break;\n", temp, temp);
+    else if (syntax == SYNTAX_OR)
+      fprintf(out, "  if (!" FALSE_TEST ")\n    break;\n", temp, temp);
+  }
+  fprintf(out, "  } while (false);\n");
+}
+
+// Emit statements that evaluate a node, returning the temporary that holds
+// the result.
+static size_t emit_expr(translator_t *t, expr_t node)
+{
+  FILE *out = t->functions;
+  size_t temp = t->temps++;
+  size_t index = 0;
+
+  if (is_atom(node) && formal_index(t->formals, node, &index))
+  {
+    fprintf(out, "  expr_t t%zu = argv[%zu];\n", temp, index);
+    return temp;
+  }
+
+  if (is_atom(node))
+  {
+    fprintf(out, "  expr_t t%zu = crispc_global(crisp, %zu);\n", temp, global(t, node));
+    return temp;
+  }
+
+  if (!pair(node))
+  {
+    fprintf(out, "  expr_t t%zu = crispc_constants[%zu];\n", temp, constant(t, node));
+    return temp;
+  }
+
+  switch (form_syntax(node))
+  {
+  case SYNTAX_QUOTE:
+    fprintf(out, "  expr_t t%zu = crispc_constants[%zu];\n", temp, constant(t, car(cdr(node))));
+    return temp;
+  case SYNTAX_IF:
+    emit_if(t, temp, cdr(node));
+    return temp;
+  case SYNTAX_BEGIN:
+  case SYNTAX_AND:
+  case SYNTAX_OR:
+    emit_sequence(t, temp, form_syntax(node), cdr(node));
+    return temp;
+  default:
+    break;
+  }
+
+  // The operator, then each operand in turn, is evaluated before the
+  // operator is applied.
+  expr_t op = car(node);
+  size_t op_temp = emit_expr(t, op);
+  size_t argc = length(cdr(node));
+  if (argc > 0)
+  {
+    fprintf(out, "  expr_t v%zu[%zu];\n", temp, argc);
+  }
+  size_t i = 0;
+  for (expr_t operand = cdr(node); pair(operand); operand = cdr(operand), i++)
+  {
+    size_t operand_temp = emit_expr(t, car(operand));
+    fprintf(out, "  v%zu[%zu] = t%zu;\n", temp, i, operand_temp);
+  }
+
+  char argv[32] = "NULL";
+  if (argc > 0)
+  {
+    snprintf(argv, sizeof(argv), "v%zu", temp);
+  }
+
+  size_t fn = 0;
+  bool is_global = is_atom(op) && !formal_index(t->formals, op, &index);
+  if (is_global && compiled_function(t, op, argc, &fn))
+  {
+    // Calls to functions of the program skip the generic dispatch for as
+    // long as the global still refers to them.
+    fprintf(out, "  expr_t t%zu = (t%zu == crispc_functions[%zu]) ? crispc_function_%zu(crisp, %zu, %s)\n",
+            temp, op_temp, fn, fn, argc, argv);
+    fprintf(out, "           : crisp_apply_argv(crisp, t%zu, %zu, %s, root_env(crisp));\n", op_temp, argc, argv);
+  }
+  else if (is_global && (argc > 0) && numeric_global(t, op))
+  {
+    t->uses_numeric = true;
+    fprintf(out, "  expr_t t%zu = crispc_numeric(crisp, t%zu, %zu, %s);\n", temp, op_temp, argc, argv);
+  }
+  else
+  {
+    fprintf(out, "  expr_t t%zu = crisp_apply_argv(crisp, t%zu, %zu, %s, root_env(crisp));\n",
+            temp, op_temp, argc, argv);
+  }
+  return temp;
+}
+
+static void emit_function(translator_t *t, expr_t name, expr_t lambda)
+{
+  size_t index = append(t, &t->compiled, &t->compiled_count,
+                        cons(t->crisp, name, number_value(t->crisp, (double)length(t->formals))));
+  FILE *out = t->functions;
+  fprintf(out, "\n// %s\n", as_atom(name));
+  fprintf(out, "static expr_t crispc_function_%zu(crisp_t *crisp, size_t argc, expr_t *argv)\n{\n", index);
+  fprintf(out, "  (void)crisp;\n  (void)argc;\n  (void)argv;\n");
+
+  t->temps = 0;
+  size_t result = 0;
+  for (expr_t body = cdr(cdr(lambda)); pair(body); body = cdr(body))
+  {
+    result = emit_expr(t, car(body));
+  }
+  fprintf(out, "  return t%zu;\n}\n", result);
+
+  fprintf(t->load, "  crispc_functions[%zu] = builtin_value(crisp, &crispc_function_%zu, %zu, %zu);\n",
+          index, index, length(t->formals), length(t->formals));
+  fprintf(t->load, "  crispc_define(crisp, ");
+  write_string(t->load, as_atom(name));
+  fprintf(t->load, ", crispc_functions[%zu]);\n", index);
+}
+
+static bool emit_form(translator_t *t, expr_t form)
+{
+  // Macros are expanded as the program is translated, which leaves nothing
+  // of their definitions to emit.
+  bool defines_syntax = pair(form) && is_atom(car(form)) && (as_syntax(car(form)) == SYNTAX_DEFINE_SYNTAX);
+  form = crisp_expand(t->crisp, form);
+  if (form == NULL || defines_syntax)
+    return form != NULL;
+
+  expr_t lambda = compilable_definition(t, form);
+  if (lambda != NULL)
+  {
+    emit_function(t, car(cdr(form)), lambda);
+    t->formals = nil_value(t->crisp);
+    return true;
+  }
+
+  // Definitions are not printed, as in the REPL the value of any other
+  // form is.
+  bool print = (form_syntax(form) != SYNTAX_DEFINE);
+  fprintf(t->load, "  crispc_eval(crisp, ");
+  write_datum(t->load, form);
+  fprintf(t->load, ", %s);\n", print ? "true" : "false");
+  return true;
+}
+
+static void copy(FILE *from, FILE *to)
+{
+  rewind(from);
+  int c;
+  while ((c = fgetc(from)) != EOF)
+  {
+    fputc(c, to);
+  }
+}
+
+static void write_prelude(translator_t *t, const char *source_name, FILE *out)
+{
+  fprintf(out, "// Generated by crispc from %s.\n\n", source_name);
+  fprintf(out, "#include \"interpreter_internal.h\"\n");
+  fprintf(out, "#include \"value.h\"\n");
+  fprintf(out, "#include \"value_support.h\"\n");
+  fprintf(out, "#include \"environment.h\"\n");
+  fprintf(out, "#include \"evaluator.h\"\n");
+  fprintf(out, "#include \"builtins.h\"\n");
+  fprintf(out, "#include \"optimizer.h\"\n\n");
+  fprintf(out, "#include <math.h>\n#include <stdio.h>\n\n");
+
+  if (t->constant_count > 0)
+  {
+    fprintf(out, "static expr_t crispc_constants[%zu];\n", t->constant_count);
+  }
+
+  if (t->global_count > 0)
+  {
+    fprintf(out, "static const char *const crispc_names[%zu] = {\n", t->global_count);
+    for (expr_t g = t->globals; pair(g); g = cdr(g))
+    {
+      fprintf(out, "  ");
+      write_string(out, as_atom(car(g)));
+      fprintf(out, ",\n");
+    }
+    fprintf(out, "};\n");
+    fprintf(out, "static global_cell_t *crispc_cells[%zu];\n\n", t->global_count);
+    fprintf(out,
+            "static expr_t crispc_global(crisp_t *crisp, size_t i)\n"
+            "{\n"
+            "  if (crispc_cells[i] == NULL)\n"
+            "  {\n"
+            "    crispc_cells[i] = env_get_cell(root_env(crisp), intern_string_null_terminated(crisp, crispc_names[i]));\n"
+            "    if (crispc_cells[i] == NULL)\n"
+            "    {\n"
+            "      crisp_eval_error(crisp, \"Failed to resolve atom: %%s\", crispc_names[i]);\n"
+            "      return NULL;\n"
+            "    }\n"
+            "  }\n"
+            "  return crispc_cells[i]->value;\n"
+            "}\n\n");
+  }
+
+  if (t->compiled_count > 0)
+  {
+    fprintf(out, "static expr_t crispc_functions[%zu];\n\n", t->compiled_count);
+    for (size_t i = 0; i < t->compiled_count; i++)
+    {
+      fprintf(out, "static expr_t crispc_function_%zu(crisp_t *crisp, size_t argc, expr_t *argv);\n", i);
+    }
+    fprintf(out,
+            "\nstatic void crispc_define(crisp_t *crisp, const char *name, expr_t value)\n"
+            "{\n"
+            "  env_t *env = root_env(crisp);\n"
+            "  name = intern_string_null_terminated(crisp, name);\n"
+            "  env_set(env, name, value);\n"
+            "  crisp_optimizer_redefined(crisp, env_get_cell(env, name));\n"
+            "}\n\n");
+  }
+
+  if (t->uses_numeric)
+  {
+    fprintf(out,
+            "static expr_t crispc_numeric(crisp_t *crisp, expr_t op, size_t argc, expr_t *argv)\n"
+            "{\n"
+            "  binary_op_t fn = builtin_numeric_op(op);\n"
+            "  for (size_t i = 0; (fn != NULL) && (i < argc); i++)\n"
+            "  {\n"
+            "    if (!is_number(argv[i]))\n"
+            "      fn = NULL;\n"
+            "  }\n"
+            "  if (fn == NULL)\n"
+            "    return crisp_apply_argv(crisp, op, argc, argv, root_env(crisp));\n\n"
+            "  double result = as_number(argv[0]);\n"
+            "  for (size_t i = 1; i < argc; i++)\n"
+            "    result = fn(result, as_number(argv[i]));\n"
+            "  return number_value(crisp, result);\n"
+            "}\n\n");
+  }
+
+  fprintf(out,
+          "static void crispc_eval(crisp_t *crisp, expr_t form, bool print)\n"
+          "{\n"
+          "  optimize(crisp, form);\n"
+          "  expr_t result = eval(crisp, form, root_env(crisp));\n"
+          "  if (print && (result != NULL))\n"
+          "  {\n"
+          "    print_value_tree(result);\n"
+          "    printf(\"\\n\");\n"
+          "  }\n"
+          "}\n");
+}
+
+bool crisp_translate(crisp_t *crisp, expr_t forms, const char *source_name, FILE *out)
+{
+  translator_t t = {
+    .crisp = crisp,
+    .functions = tmpfile(),
+    .load = tmpfile(),
+    .constants = nil_value(crisp),
+    .constant_count = 0,
+    .globals = nil_value(crisp),
+    .global_count = 0,
+    .compiled = nil_value(crisp),
+    .compiled_count = 0,
+    .uses_numeric = false,
+    .formals = nil_value(crisp),
+    .temps = 0,
+  };
+
+  if ((t.functions == NULL) || (t.load == NULL))
+  {
+    if (t.functions != NULL)
+      fclose(t.functions);
+    if (t.load != NULL)
+      fclose(t.load);
+    return false;
+  }
+
+  bool ok = true;
+  for (; ok && pair(forms); forms = cdr(forms))
+  {
+    ok = emit_form(&t, car(forms));
+  }
+
+  if (!ok)
+  {
+    fclose(t.functions);
+    fclose(t.load);
+    return false;
+  }
+
+  write_prelude(&t, source_name, out);
+  copy(t.functions, out);
+
+  fprintf(out, "\nvoid crisp_program_load(crisp_t *crisp)\n{\n");
+  if (t.global_count > 0)
+  {
+    fprintf(out, "  for (size_t i = 0; i < %zu; i++)\n    crispc_cells[i] = NULL;\n\n", t.global_count);
+  }
+  if (t.constant_count > 0)
+  {
+    // The constants are kept alive by a global that no program can name.
+    fprintf(out, "  expr_t constants = nil_value(crisp);\n");
+    size_t i = 0;
+    for (expr_t c = t.constants; pair(c); c = cdr(c), i++)
+    {
+      fprintf(out, "  crispc_constants[%zu] = ", i);
+      write_datum(out, car(c));
+      fprintf(out, ";\n  constants = cons(crisp, crispc_constants[%zu], constants);\n", i);
+    }
+    fprintf(out, "  env_set(root_env(crisp), intern_string_null_terminated(crisp, \"crispc constants\"), constants);\n\n");
+  }
+  copy(t.load, out);
+  fprintf(out, "}\n");
+
+  fprintf(out,
+          "\n#ifndef CRISPC_NO_MAIN\n"
+          "int main(void)\n"
+          "{\n"
+          "  crisp_t *crisp = init_interpreter();\n"
+          "  crisp_program_load(crisp);\n"
+          "  free_interpreter(crisp);\n"
+          "  return 0;\n"
+          "}\n"
+          "#endif\n");
+
+  fclose(t.functions);
+  fclose(t.load);
+  return !ferror(out);
+}
@@ -0,0 +1,23 @@
+#ifndef CRISP_TRANSLATOR_H
+#define CRISP_TRANSLATOR_H
+
+#include "common.h"
+
+#include <stdio.h>
+
+// Translate a program, a list of top level forms, into C source that runs
+// it when linked against crisp_lib.
+//
+// Top level definitions of lambdas whose bodies are made up of literals,
+// quoted data, references to their formals or to globals, and
+// applications, are compiled to C functions and bound as builtins. Every
+// other form is rebuilt when the program is loaded and handed to the
+// interpreter, as is anything the compiled functions can not handle
+// themselves. Macros are expanded as the program is translated.
+//
+// The generated source defines crisp_program_load(crisp_t*), which runs
+// the program in the root environment, and a main that does so in a new
+// interpreter unless CRISPC_NO_MAIN is defined.
+bool crisp_translate(crisp_t *crisp, expr_t forms, const char *source_name, FILE *out);
+
+#endif
@@ -1,7 +1,11 @@
 #include "value.h"
+#include "value_support.h"
 #include "memory.h"
+#include "environment.h"
+#include "compiler.h"
 #include "interpreter_internal.h"
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -46,7 +50,9 @@ value_t *string_value(crisp_t *crisp, const char *chars, size_t length)
 value_t *atom_value(crisp_t *crisp, const char *chars, size_t length)
 {
   value_t *value = allocate_value(crisp, VALUE_TYPE_ATOM);
-  value->as.str = intern_string(crisp, chars, length);
+  value->as.atom.name = intern_string(crisp, chars, length);
+  value->as.atom.cell = NULL;
+  value->as.atom.syntax = crisp_syntax(crisp, value->as.atom.name);
   return value;
 }
 
@@ -58,13 +64,36 @@ value_t *atom_value_null_terminated(crisp_t *crisp, const char *chars)
 value_t *fn_value(crisp_t *crisp, fn_ptr_t ptr)
 {
   value_t *value = allocate_value(crisp, VALUE_TYPE_FN);
-  value->as.fn_ptr = ptr;
+  value->as.fn.kind = FN_KIND_PROCEDURE;
+  value->as.fn.ptr = ptr;
+  value->as.fn.builtin = NULL;
+  value->as.fn.min_arity = 0;
+  value->as.fn.max_arity = ARITY_VARIADIC;
+  value->as.fn.descriptor = NULL;
+  return value;
+}
+
+value_t *special_form_value(crisp_t *crisp, fn_ptr_t ptr)
+{
+  value_t *value = fn_value(crisp, ptr);
+  value->as.fn.kind = FN_KIND_SPECIAL_FORM;
+  return value;
+}
+
+value_t *builtin_value(crisp_t *crisp, builtin_fn_t fn, size_t min_arity, size_t max_arity)
+{
+  value_t *value = fn_value(crisp, NULL);
+  value->as.fn.kind = FN_KIND_BUILTIN;
+  value->as.fn.builtin = fn;
+  value->as.fn.min_arity = min_arity;
+  value->as.fn.max_arity = max_arity;
   return value;
 }
 
 value_t *lambda_value(crisp_t *crisp, value_t *formals, value_t *bodies, env_t *env)
 {
-  (void)crisp;
+  // The closure outlives the call that made it.
+  env_capture(crisp, env);
 
   value_t *value = allocate_value(crisp, VALUE_TYPE_LAMBDA);
   lambda_t *lambda = ALLOCATE(lambda_t, 1);
@@ -73,15 +102,174 @@ value_t *lambda_value(crisp_t *crisp, value_t *formals, value_t *bodies, env_t *
   lambda->formals = formals;
   lambda->bodies = bodies;
   lambda->env = env;
+  lambda->frame_escapes = true;
+  lambda->calls = 0;
+  lambda->compiled = NULL;
+
+  return value;
+}
+
+value_t *continuation_value(crisp_t *crisp, size_t frame)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_CONTINUATION);
+  value->as.continuation = frame;
+  return value;
+}
+
+value_t *node_value(crisp_t *crisp, node_kind_t kind, value_t *operator)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_NODE);
+  node_t *node = ALLOCATE(node_t, 1);
+  value->as.node = node;
+
+  node->kind = kind;
+  node->operator = operator;
+  node->operand_types = 0;
 
   return value;
 }
 
+value_t *case_table_value(crisp_t *crisp, size_t capacity)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_CASE_TABLE);
+  case_table_t *table = ALLOCATE(case_table_t, 1);
+  value->as.case_table = table;
+
+  table->capacity = capacity;
+  table->names = ALLOCATE(const char *, capacity);
+  table->forms = ALLOCATE(value_t *, capacity);
+  memset(table->names, 0, sizeof(const char *) * capacity);
+  memset(table->forms, 0, sizeof(value_t *) * capacity);
+  table->others = nil_value(crisp);
+  table->otherwise = nil_value(crisp);
+
+  return value;
+}
+
+value_t *generic_value(crisp_t *crisp, const char *name)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_GENERIC);
+  generic_t *generic = ALLOCATE(generic_t, 1);
+  value->as.generic = generic;
+
+  generic->name = name;
+  generic->arity = 0;
+  generic->methods = NULL;
+  generic->count = 0;
+  generic->capacity = 0;
+  generic->version = 0;
+
+  return value;
+}
+
+value_t *dispatch_value(crisp_t *crisp, value_t *generic)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_DISPATCH);
+  dispatch_t *dispatch = ALLOCATE(dispatch_t, 1);
+  value->as.dispatch = dispatch;
+
+  memset(dispatch, 0, sizeof(dispatch_t));
+  dispatch->generic = generic;
+  dispatch->version = as_generic(generic)->version;
+
+  return value;
+}
+
+value_t *parameter_value(crisp_t *crisp, value_t *v)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_PARAMETER);
+  value->as.parameter = v;
+  return value;
+}
+
+value_t *record_type_value(crisp_t *crisp, const char *name, value_t *fields)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_RECORD_TYPE);
+  value->as.record_type.name = name;
+  value->as.record_type.fields = fields;
+  value->as.record_type.count = length(fields);
+  return value;
+}
+
+value_t *record_value(crisp_t *crisp, value_t *type)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_RECORD);
+  size_t count = type->as.record_type.count;
+  value->as.record.type = type;
+  value->as.record.count = count;
+  value->as.record.slots = NULL;
+  if (count > 0)
+  {
+    value->as.record.slots = ALLOCATE(value_t *, count);
+    memset(value->as.record.slots, 0, sizeof(value_t *) * count);
+  }
+  return value;
+}
+
+// The number of slots that a record procedure refers to.
+static size_t record_procedure_slots(record_op_t op, size_t arity)
+{
+  switch (op)
+  {
+  case RECORD_OP_CONSTRUCT:
+    return arity;
+  case RECORD_OP_GET:
+  case RECORD_OP_SET:
+    return 1;
+  case RECORD_OP_TEST:
+    return 0;
+  }
+  return 0;
+}
+
+value_t *record_procedure_value(crisp_t *crisp, record_op_t op, value_t *type, size_t arity)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_RECORD_PROCEDURE);
+  size_t count = record_procedure_slots(op, arity);
+  value->as.record_procedure.op = op;
+  value->as.record_procedure.type = type;
+  value->as.record_procedure.arity = arity;
+  value->as.record_procedure.slots = (count > 0) ? ALLOCATE(size_t, count) : NULL;
+  return value;
+}
+
+value_t *vector_value(crisp_t *crisp, size_t count, value_t *fill)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_VECTOR);
+  value->as.vector.count = count;
+  value->as.vector.items = NULL;
+  if (count > 0)
+  {
+    value->as.vector.items = ALLOCATE(value_t *, count);
+    for (size_t i = 0; i < count; i++)
+    {
+      value->as.vector.items[i] = fill;
+    }
+  }
+  return value;
+}
+
+value_t *array_value(crisp_t *crisp, array_kind_t kind, size_t count)
+{
+  value_t *value = allocate_value(crisp, VALUE_TYPE_ARRAY);
+  value->as.array.kind = kind;
+  value->as.array.count = count;
+  value->as.array.data.f64 = NULL;
+  if (count > 0)
+  {
+    // Both kinds of element are eight bytes.
+    value->as.array.data.f64 = ALLOCATE(double, count);
+    memset(value->as.array.data.f64, 0, sizeof(double) * count);
+  }
+  return value;
+}
+
 value_t *cons(crisp_t* crisp, value_t *car, value_t *cdr)
 {
   value_t *value = allocate_value(crisp, VALUE_TYPE_CONS);
   value->as.cons.car = car;
   value->as.cons.cdr = cdr;
+  value->as.cons.meta = NULL;
   return value;
 }
 
@@ -128,6 +316,74 @@ void print_value_to_fp(value_t *value, FILE *fp)
   {
     fprintf(fp, "<lambda>");
   }
+  else if (is_continuation(value))
+  {
+    fprintf(fp, "<continuation>");
+  }
+  else if (is_node(value))
+  {
+    fprintf(fp, "<node>");
+  }
+  else if (is_case_table(value))
+  {
+    fprintf(fp, "<case table>");
+  }
+  else if (is_generic(value))
+  {
+    fprintf(fp, "<generic %s>", as_generic(value)->name);
+  }
+  else if (is_dispatch(value))
+  {
+    fprintf(fp, "<dispatch cache>");
+  }
+  else if (is_parameter(value))
+  {
+    fprintf(fp, "<parameter>");
+  }
+  else if (is_record_type(value))
+  {
+    fprintf(fp, "<record type %s>", value->as.record_type.name);
+  }
+  else if (is_record(value))
+  {
+    fprintf(fp, "<%s", value->as.record.type->as.record_type.name);
+    for (size_t i = 0; i < value->as.record.count; i++)
+    {
+      fprintf(fp, " ");
+      print_value_to_fp(value->as.record.slots[i], fp);
+    }
+    fprintf(fp, ">");
+  }
+  else if (is_record_procedure(value))
+  {
+    fprintf(fp, "<procedure of %s>", value->as.record_procedure.type->as.record_type.name);
+  }
+  else if (is_vector(value))
+  {
+    fprintf(fp, "#(");
+    for (size_t i = 0; i < value->as.vector.count; i++)
+    {
+      if (i > 0)
+        fprintf(fp, " ");
+      print_value_tree_to_fp(value->as.vector.items[i], fp);
+    }
+    fprintf(fp, ")");
+  }
+  else if (is_array(value))
+  {
+    bool f64 = (value->as.array.kind == ARRAY_KIND_F64);
+    fprintf(fp, f64 ? "#f64(" : "#i64(");
+    for (size_t i = 0; i < value->as.array.count; i++)
+    {
+      if (i > 0)
+        fprintf(fp, " ");
+      if (f64)
+        fprintf(fp, "%g", value->as.array.data.f64[i]);
+      else
+        fprintf(fp, "%" PRId64, value->as.array.data.i64[i]);
+    }
+    fprintf(fp, ")");
+  }
   else if (is_cons(value))
   {
     fprintf(fp, "<cons>");
@@ -178,6 +434,7 @@ static value_t *allocate_value(crisp_t *crisp, value_type_t type)
 {
   value_t *value = ALLOCATE(value_t, 1);
   value->type = type;
+  value->flags = 0;
   crisp_gc_register_object(crisp, (gc_object_t*)value, &value_gc_functions);
   return value;
 }
@@ -194,9 +451,71 @@ static void free_value(gc_object_t *obj)
   }
   else if (is_lambda(value))
   {
+    if (value->as.lambda->compiled != NULL)
+    {
+      crisp_free_compiled(value->as.lambda->compiled);
+    }
     FREE(lambda_t, value->as.lambda);
     value->as.lambda = NULL;
   }
+  else if (is_node(value))
+  {
+    FREE(node_t, value->as.node);
+    value->as.node = NULL;
+  }
+  else if (is_case_table(value))
+  {
+    case_table_t *table = value->as.case_table;
+    FREE_ARRAY(const char *, table->names, table->capacity);
+    FREE_ARRAY(value_t *, table->forms, table->capacity);
+    FREE(case_table_t, table);
+    value->as.case_table = NULL;
+  }
+  else if (is_generic(value))
+  {
+    generic_t *generic = value->as.generic;
+    FREE_ARRAY(method_t, generic->methods, generic->capacity);
+    FREE(generic_t, generic);
+    value->as.generic = NULL;
+  }
+  else if (is_dispatch(value))
+  {
+    FREE(dispatch_t, value->as.dispatch);
+    value->as.dispatch = NULL;
+  }
+  else if (is_record(value))
+  {
+    if (value->as.record.count > 0)
+    {
+      FREE_ARRAY(value_t *, value->as.record.slots, value->as.record.count);
+    }
+    value->as.record.slots = NULL;
+  }
+  else if (is_record_procedure(value))
+  {
+    size_t count = record_procedure_slots(value->as.record_procedure.op, value->as.record_procedure.arity);
+    if (count > 0)
+    {
+      FREE_ARRAY(size_t, value->as.record_procedure.slots, count);
+    }
+    value->as.record_procedure.slots = NULL;
+  }
+  else if (is_vector(value))
+  {
+    if (value->as.vector.count > 0)
+    {
+      FREE_ARRAY(value_t *, value->as.vector.items, value->as.vector.count);
+    }
+    value->as.vector.items = NULL;
+  }
+  else if (is_array(value))
+  {
+    if (value->as.array.count > 0)
+    {
+      FREE_ARRAY(double, value->as.array.data.f64, value->as.array.count);
+    }
+    value->as.array.data.f64 = NULL;
+  }
   FREE(value_t, value);
 }
 
@@ -14,32 +14,315 @@ typedef enum
   VALUE_TYPE_CONS,
   VALUE_TYPE_FN,
   VALUE_TYPE_LAMBDA,
+  VALUE_TYPE_CONTINUATION,
+  VALUE_TYPE_NODE,
+  VALUE_TYPE_CASE_TABLE,
+  VALUE_TYPE_GENERIC,
+  VALUE_TYPE_DISPATCH,
+  VALUE_TYPE_PARAMETER,
+  VALUE_TYPE_RECORD_TYPE,
+  VALUE_TYPE_RECORD,
+  VALUE_TYPE_RECORD_PROCEDURE,
+  VALUE_TYPE_VECTOR,
+  VALUE_TYPE_ARRAY,
 } value_type_t;
 
+struct global_cell_t;
+struct builtin_t;
+
 typedef expr_t (*fn_ptr_t)(crisp_t *, expr_t, env_t *);
 
+// Builtins receive a vector of their already evaluated arguments.
+// The number of arguments has been checked against the arity the
+// builtin was registered with before it is called.
+typedef expr_t (*builtin_fn_t)(crisp_t *, size_t argc, expr_t *argv);
+
+#define ARITY_VARIADIC SIZE_MAX
+
+// The keywords of the language. Atoms are tagged with the keyword they
+// spell when they are made, so the evaluator recognizes a special form
+// without looking its name up in the environment.
+typedef enum
+{
+  SYNTAX_NONE = 0,
+  // Only keywords within another form, atoms anywhere else. The test of a
+  // cond clause, the parts of a syntax-rules transformer, and the holes of
+  // a quasiquote template.
+  SYNTAX_ELSE,
+  SYNTAX_ELLIPSIS,
+  SYNTAX_UNDERSCORE,
+  SYNTAX_SYNTAX_RULES,
+  SYNTAX_UNQUOTE,
+  SYNTAX_UNQUOTE_SPLICING,
+  // Consumed by the macro expander, never seen by an evaluator.
+  SYNTAX_DEFINE_SYNTAX,
+  SYNTAX_QUASIQUOTE,
+  SYNTAX_DO,
+  SYNTAX_MATCH,
+  SYNTAX_DEFINE_GENERIC,
+  SYNTAX_DEFINE_METHOD,
+  SYNTAX_DEFINE_RECORD_TYPE,
+  // The special forms.
+  SYNTAX_QUOTE,
+  SYNTAX_LAMBDA,
+  SYNTAX_DEFINE,
+  SYNTAX_IF,
+  SYNTAX_COND,
+  SYNTAX_LET,
+  SYNTAX_LET_STAR,
+  SYNTAX_LETREC,
+  SYNTAX_BEGIN,
+  SYNTAX_AND,
+  SYNTAX_OR,
+  SYNTAX_SET,
+  SYNTAX_CASE,
+  SYNTAX_PARAMETERIZE,
+  // The tail calls of a named let that loops, which no program can spell.
+  SYNTAX_RECUR,
+  SYNTAX_COUNT,
+} syntax_t;
+
+typedef enum
+{
+  // Receives its operands unevaluated.
+  FN_KIND_SPECIAL_FORM,
+  // Receives a list of its evaluated operands.
+  FN_KIND_PROCEDURE,
+  // Receives a vector of its evaluated operands.
+  FN_KIND_BUILTIN,
+} fn_kind_t;
+
+typedef struct compiled_t compiled_t;
+
 typedef struct
 {
   value_t *formals;
   value_t *bodies;
   env_t *env;
+  // False when the environment of a call can not outlive the call, in
+  // which case the frame is allocated from the evaluator's region.
+  bool frame_escapes;
+  // Calls made so far, and the code the bodies were compiled to once
+  // there had been enough of them. See crisp_compile.
+  size_t calls;
+  compiled_t *compiled;
 } lambda_t;
 
+typedef enum
+{
+  // Applied as any other application.
+  NODE_KIND_GENERIC,
+  // A numeric builtin whose operands have only ever been numbers.
+  NODE_KIND_NUMERIC,
+  // An application whose operator has only ever been the one value.
+  NODE_KIND_DIRECT,
+} node_kind_t;
+
+// What the specializing evaluator has learnt about an application it has
+// evaluated. See crisp_eval_node.
+typedef struct
+{
+  node_kind_t kind;
+  // The operator value that the node is specialized to.
+  value_t *operator;
+  // A bit for each value_type_t of the operand values seen so far.
+  uint32_t operand_types;
+} node_t;
+
+// The jump table of a case form, built the first time the form is
+// evaluated. See crisp_case_forms.
+typedef struct
+{
+  // Open addressed on the interned name of each symbol a clause lists,
+  // the capacity being a power of two. Empty slots have a NULL name.
+  size_t capacity;
+  const char **names;
+  value_t **forms;
+  // The clauses for the other data, a list of (datum . forms) tried in
+  // order.
+  value_t *others;
+  // The forms of the else clause, () if there is none.
+  value_t *otherwise;
+} case_table_t;
+
+// Methods choose on at most this many of their first arguments.
+#define GENERIC_DISPATCH_MAX 4
+
+typedef struct
+{
+  // A bit for each value_type_t that each of the first arguments may
+  // have, every bit for a parameter without a type.
+  uint32_t types[GENERIC_DISPATCH_MAX];
+  value_t *procedure;
+} method_t;
+
+// A procedure that chooses one of its methods by the types of its
+// arguments. See crisp_dispatch.
+typedef struct
+{
+  const char *name;
+  // The parameters that every method has before any rest parameter, set
+  // by the first method to be added.
+  size_t arity;
+  // Ordered most specific first.
+  method_t *methods;
+  size_t count;
+  size_t capacity;
+  // Changed whenever a method is added.
+  size_t version;
+} generic_t;
+
+// Calls made at one site with this many different combinations of
+// argument types are cached, with more the site is megamorphic.
+#define DISPATCH_CACHE_ENTRIES 4
+
+// The methods that a call site has chosen, for the combinations of types
+// its arguments have had. Valid only whilst the generic function it was
+// made for is the same version.
+typedef struct
+{
+  value_t *generic;
+  size_t version;
+  size_t count;
+  bool megamorphic;
+  struct
+  {
+    uint64_t signature;
+    value_t *method;
+  } entries[DISPATCH_CACHE_ENTRIES];
+} dispatch_t;
+
+// What a procedure made by define-record-type does with a record of its
+// type. See crisp_apply_record.
+typedef enum
+{
+  RECORD_OP_CONSTRUCT,
+  RECORD_OP_TEST,
+  RECORD_OP_GET,
+  RECORD_OP_SET,
+} record_op_t;
+
+// The type of the elements of a typed array. See array.h.
+typedef enum
+{
+  ARRAY_KIND_F64,
+  ARRAY_KIND_I64,
+} array_kind_t;
+
+// Header flags cached on a value.
+// A pair records whether it starts a proper list, and if so its length,
+// the first time either is asked for.
+#define VALUE_FLAG_LENGTH_KNOWN 0x01
+#define VALUE_FLAG_PROPER_LIST 0x02
+#define VALUE_FLAG_LENGTH_MASK (VALUE_FLAG_LENGTH_KNOWN | VALUE_FLAG_PROPER_LIST)
+// A builtin whose result depends only on its arguments, which may be
+// applied ahead of time to constant arguments. See builtin_t.
+#define VALUE_FLAG_PURE 0x04
+// A call that the optimizer has replaced with the body of the lambda it
+// called.
+#define VALUE_FLAG_INLINED 0x10
+// The operands of a lambda form whose frames have been checked for escape,
+// and the result of that check.
+#define VALUE_FLAG_ESCAPE_KNOWN 0x20
+#define VALUE_FLAG_FRAME_ESCAPES 0x40
+// A form that the macro expander has already expanded.
+#define VALUE_FLAG_EXPANDED 0x80
+
 struct value_t
 {
   gc_object_t base;
   value_type_t type;
+  uint8_t flags;
   union value_store
   {
     bool boolean;
     double number;
     const char *str;
-    fn_ptr_t fn_ptr;
+    struct
+    {
+      const char *name;
+      // Inline cache of the global cell that the atom resolved to when
+      // evaluated. Only set for atoms that are not bound by any
+      // enclosing lambda.
+      struct global_cell_t *cell;
+      // The keyword the name spells, if any.
+      syntax_t syntax;
+    } atom;
+    struct
+    {
+      fn_kind_t kind;
+      fn_ptr_t ptr;
+      builtin_fn_t builtin;
+      size_t min_arity;
+      size_t max_arity;
+      // The descriptor a builtin was registered from, NULL for any other.
+      // See builtin_descriptor.
+      const struct builtin_t *descriptor;
+    } fn;
     lambda_t *lambda;
+    node_t *node;
+    case_table_t *case_table;
+    generic_t *generic;
+    dispatch_t *dispatch;
+    // The value that a parameter has, as bound by the innermost
+    // parameterize form being evaluated. See cek_bind_parameter.
+    value_t *parameter;
+    struct
+    {
+      const char *name;
+      // The names of the fields, a list in slot order.
+      value_t *fields;
+      size_t count;
+    } record_type;
+    // The fields of a record, one slot each in the order its type lists
+    // them. The count is kept with the slots so a record can be freed
+    // after its type.
+    struct
+    {
+      value_t *type;
+      size_t count;
+      value_t **slots;
+    } record;
+    // The constructor, predicate, accessor or modifier of a record type.
+    // A constructor has a slot for each of its arguments, an accessor or
+    // modifier the slot of its field, a predicate none.
+    struct
+    {
+      record_op_t op;
+      value_t *type;
+      size_t arity;
+      size_t *slots;
+    } record_procedure;
+    // The elements of a vector, held contiguously so that any of them is
+    // got or set by index.
+    struct
+    {
+      size_t count;
+      value_t **items;
+    } vector;
+    // The elements of a typed array, unboxed in one buffer.
+    struct
+    {
+      array_kind_t kind;
+      size_t count;
+      union
+      {
+        double *f64;
+        int64_t *i64;
+      } data;
+    } array;
+    // An escape continuation refers to the frame on the continuation
+    // stack that it returns to.
+    size_t continuation;
     struct
     {
       value_t *car;
       value_t *cdr;
+      // Valid when VALUE_FLAG_LENGTH_KNOWN is set.
+      size_t length;
+      // Analysis of the form that starts with this pair, cached by the
+      // evaluator or optimizer. NULL until it is computed.
+      value_t *meta;
     } cons;
   } as;
 };
@@ -57,13 +340,36 @@ static inline bool is_value_type(value_t const *const value, value_type_t t)
 #define is_cons(value) (is_value_type(value, VALUE_TYPE_CONS))
 #define is_fn(value) (is_value_type(value, VALUE_TYPE_FN))
 #define is_lambda(value) (is_value_type(value, VALUE_TYPE_LAMBDA))
+#define is_continuation(value) (is_value_type(value, VALUE_TYPE_CONTINUATION))
+#define is_node(value) (is_value_type(value, VALUE_TYPE_NODE))
+#define is_case_table(value) (is_value_type(value, VALUE_TYPE_CASE_TABLE))
+#define is_generic(value) (is_value_type(value, VALUE_TYPE_GENERIC))
+#define is_dispatch(value) (is_value_type(value, VALUE_TYPE_DISPATCH))
+#define is_parameter(value) (is_value_type(value, VALUE_TYPE_PARAMETER))
+#define is_record_type(value) (is_value_type(value, VALUE_TYPE_RECORD_TYPE))
+#define is_record(value) (is_value_type(value, VALUE_TYPE_RECORD))
+#define is_record_procedure(value) (is_value_type(value, VALUE_TYPE_RECORD_PROCEDURE))
+#define is_vector(value) (is_value_type(value, VALUE_TYPE_VECTOR))
+#define is_array(value) (is_value_type(value, VALUE_TYPE_ARRAY))
+#define is_special_form(value) (is_fn(value) && ((value)->as.fn.kind == FN_KIND_SPECIAL_FORM))
+// An atom that names a special form of the language.
+#define is_syntax(value) (is_atom(value) && ((value)->as.atom.syntax >= SYNTAX_QUOTE))
+#define is_builtin(value) (is_fn(value) && ((value)->as.fn.kind == FN_KIND_BUILTIN))
 
 #define as_bool(value) ((value)->as.boolean)
 #define as_number(value) ((value)->as.number)
 #define as_string(value) ((value)->as.str)
-#define as_atom(value) ((value)->as.str)
-#define as_fn(value) ((value)->as.fn_ptr)
+#define as_atom(value) ((value)->as.atom.name)
+#define as_syntax(value) ((value)->as.atom.syntax)
+#define as_fn(value) ((value)->as.fn.ptr)
+#define as_builtin(value) ((value)->as.fn.builtin)
 #define as_lambda(value) ((value)->as.lambda)
+#define as_continuation(value) ((value)->as.continuation)
+#define as_node(value) ((value)->as.node)
+#define as_case_table(value) ((value)->as.case_table)
+#define as_generic(value) ((value)->as.generic)
+#define as_dispatch(value) ((value)->as.dispatch)
+#define as_parameter(value) ((value)->as.parameter)
 
 value_t *bool_value(crisp_t *crisp, bool v);
 value_t *number_value(crisp_t *crisp, double v);
@@ -72,7 +378,28 @@ value_t *string_value(crisp_t *crisp, const char *chars, size_t length);
 value_t *atom_value(crisp_t *crisp, const char *chars, size_t length);
 value_t *atom_value_null_terminated(crisp_t *crisp, const char *chars);
 value_t *fn_value(crisp_t *crisp, fn_ptr_t ptr);
+value_t *special_form_value(crisp_t *crisp, fn_ptr_t ptr);
+value_t *builtin_value(crisp_t *crisp, builtin_fn_t fn, size_t min_arity, size_t max_arity);
 value_t *lambda_value(crisp_t* crisp, value_t* formals, value_t* bodies, env_t* env);
+value_t *continuation_value(crisp_t* crisp, size_t frame);
+value_t *node_value(crisp_t* crisp, node_kind_t kind, value_t *operator);
+// An empty table with room for capacity symbols, which must be a power of two.
+value_t *case_table_value(crisp_t* crisp, size_t capacity);
+// A generic function without any methods.
+value_t *generic_value(crisp_t* crisp, const char *name);
+// An empty dispatch cache for a call site of a generic function.
+value_t *dispatch_value(crisp_t* crisp, value_t *generic);
+value_t *parameter_value(crisp_t* crisp, value_t *value);
+// A record type with the fields named by a list of atoms.
+value_t *record_type_value(crisp_t* crisp, const char *name, value_t *fields);
+// A record of the type whose slots are all NULL, for the caller to fill.
+value_t *record_value(crisp_t* crisp, value_t *type);
+// A procedure of a record type with room for the slots its op needs.
+value_t *record_procedure_value(crisp_t* crisp, record_op_t op, value_t *type, size_t arity);
+// A vector of count elements, each of them fill.
+value_t *vector_value(crisp_t* crisp, size_t count, value_t *fill);
+// A typed array of count elements that are each zero.
+value_t *array_value(crisp_t* crisp, array_kind_t kind, size_t count);
 value_t *cons(crisp_t* crisp, value_t *car, value_t *cdr);
 
 static inline value_t *car(value_t *cons)
@@ -85,6 +412,20 @@ static inline value_t *cdr(value_t *cons)
   return cons->as.cons.cdr;
 }
 
+static inline void set_car(value_t *cons, value_t *car)
+{
+  cons->as.cons.car = car;
+}
+
+// Only for use whilst building a list with a tail pointer, before the
+// length of the list has been observed, or when rewriting a form that is
+// not the tail of another list.
+static inline void set_cdr(value_t *cons, value_t *cdr)
+{
+  cons->as.cons.cdr = cdr;
+  cons->flags &= (uint8_t)~VALUE_FLAG_LENGTH_MASK;
+}
+
 void print_value(value_t *value);
 void print_value_to_fp(value_t *value, FILE *fp);
 void print_value_tree(value_t *value);
@@ -13,21 +13,119 @@ bool is_improper_list(expr_t value)
 
 size_t length(expr_t value)
 {
-  size_t sz = 0;
-  expr_t c = value;
-  while (true)
+  if (!is_cons(value))
+    return 0;
+
+  if (!(value->flags & VALUE_FLAG_LENGTH_KNOWN))
   {
-    if (is_cons(c))
+    // Walk to the end of the list, or to the first pair that already
+    // knows its length, then record the result on every pair walked so
+    // that this and any suffix of the list is O(1) from now on.
+    size_t walked = 0;
+    expr_t c = value;
+    while (is_cons(c) && !(c->flags & VALUE_FLAG_LENGTH_KNOWN))
+    {
+      c = cdr(c);
+      ++walked;
+    }
+
+    bool proper = is_cons(c) ? (c->flags & VALUE_FLAG_PROPER_LIST) : is_nil(c);
+    size_t remaining = walked + (is_cons(c) ? c->as.cons.length : 0);
+    uint8_t flags = (uint8_t)(VALUE_FLAG_LENGTH_KNOWN | (proper ? VALUE_FLAG_PROPER_LIST : 0));
+
+    c = value;
+    for (size_t i = 0; i < walked; i++)
     {
+      c->flags = (uint8_t)((c->flags & ~VALUE_FLAG_LENGTH_MASK) | flags);
+      c->as.cons.length = remaining--;
       c = cdr(c);
-      ++sz;
     }
-    else if (is_nil(c))
-      return sz;
-    else
-      break;
   }
-  return 0;
+
+  return (value->flags & VALUE_FLAG_PROPER_LIST) ? value->as.cons.length : 0;
+}
+
+bool is_eqv(expr_t a, expr_t b)
+{
+  if ((a == b) || (a->type != b->type))
+    return a == b;
+
+  switch (a->type)
+  {
+  case VALUE_TYPE_NIL:
+    return true;
+  case VALUE_TYPE_BOOL:
+    return as_bool(a) == as_bool(b);
+  case VALUE_TYPE_NUMBER:
+    return as_number(a) == as_number(b);
+  case VALUE_TYPE_STRING:
+    // Strings and names are interned.
+    return as_string(a) == as_string(b);
+  case VALUE_TYPE_ATOM:
+    return as_atom(a) == as_atom(b);
+  default:
+    return false;
+  }
+}
+
+bool is_equal(expr_t a, expr_t b)
+{
+  // The cdrs are followed in a loop, so that long lists do not recurse.
+  while (is_cons(a) && is_cons(b))
+  {
+    if (!is_equal(car(a), car(b)))
+      return false;
+    a = cdr(a);
+    b = cdr(b);
+  }
+
+  if (is_vector(a) && is_vector(b))
+  {
+    if (a->as.vector.count != b->as.vector.count)
+      return false;
+    for (size_t i = 0; i < a->as.vector.count; i++)
+    {
+      if (!is_equal(a->as.vector.items[i], b->as.vector.items[i]))
+        return false;
+    }
+    return true;
+  }
+
+  if (is_array(a) && is_array(b))
+  {
+    size_t count = a->as.array.count;
+    if ((a->as.array.kind != b->as.array.kind) || (count != b->as.array.count))
+      return false;
+    if (a->as.array.kind == ARRAY_KIND_I64)
+      return (count == 0) || (memcmp(a->as.array.data.i64, b->as.array.data.i64, sizeof(int64_t) * count) == 0);
+    for (size_t i = 0; i < count; i++)
+    {
+      if (a->as.array.data.f64[i] != b->as.array.data.f64[i])
+        return false;
+    }
+    return true;
+  }
+  return is_eqv(a, b);
+}
+
+expr_t list_from_vector(crisp_t *crisp, size_t count, expr_t *values)
+{
+  expr_t result = nil_value(crisp);
+  while (count > 0)
+  {
+    result = cons(crisp, values[--count], result);
+  }
+  return result;
+}
+
+expr_t vector_from_list(crisp_t *crisp, expr_t list)
+{
+  expr_t result = vector_value(crisp, length(list), NULL);
+  for (size_t i = 0; pair(list); list = cdr(list), i++)
+  {
+    result->as.vector.items[i] = car(list);
+  }
+  return result;
 }
 
 list_iter_t iter_list(crisp_t *crisp, expr_t lst)
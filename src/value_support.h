@@ -16,6 +16,15 @@ static inline bool pair(expr_t value) { return is_cons(value); }
 bool is_proper_list(expr_t value);
 bool is_improper_list(expr_t value);
 size_t length(expr_t value);
+// Whether two values are the same atom, or equal numbers, strings or
+// booleans. Pairs are only the same as themselves.
+bool is_eqv(expr_t a, expr_t b);
+// Whether two values are eqv, pairs whose cars and cdrs are equal, or
+// vectors or typed arrays of the same length whose elements are equal.
+bool is_equal(expr_t a, expr_t b);
+expr_t list_from_vector(crisp_t *crisp, size_t count, expr_t *values);
+// A vector of the elements of a proper list.
+expr_t vector_from_list(crisp_t *crisp, expr_t list);
 
 // List iteration functions
 list_iter_t iter_list(crisp_t *crisp, expr_t lst);
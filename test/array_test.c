@@ -0,0 +1,164 @@
+#include "simple_test.h"
+#include "array.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+// Long enough for several passes of the SIMD loops and every length of the
+// elements left over after them.
+#define MAX_COUNT 41
+
+static int test_scalar_kernels(void);
+static int test_simd_kernels(void);
+static int test_wrapping(void);
+static int test_storage(void);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  RUN_TEST(test_scalar_kernels);
+  RUN_TEST(test_simd_kernels);
+  RUN_TEST(test_wrapping);
+  RUN_TEST(test_storage);
+  return PASS_CODE;
+}
+
+// Small integers, which doubles add exactly in any order.
+static void fill(double *f, int64_t *i, size_t count, int64_t step)
+{
+  for (size_t n = 0; n < count; n++)
+  {
+    i[n] = ((int64_t)n * step) % 13 - 6;
+    f[n] = (double)i[n];
+  }
+}
+
+static int test_scalar_kernels(void)
+{
+  const array_kernels_t *k = array_scalar_kernels();
+  double f[5] = {3, -1, 4, 1, -5};
+  int64_t i[5] = {3, -1, 4, 1, -5};
+  double fout[5];
+  int64_t iout[5];
+
+  TEST_ASSERT(k->sum_f64(f, 5) == 2.0);
+  TEST_ASSERT(k->sum_f64(f, 0) == 0.0);
+  TEST_ASSERT(k->dot_f64(f, f, 5) == 52.0);
+  TEST_ASSERT(k->min_f64(f, 5) == -5.0);
+  TEST_ASSERT(k->max_f64(f, 5) == 4.0);
+  k->prefix_sum_f64(fout, f, 5);
+  TEST_ASSERT((fout[0] == 3.0) && (fout[2] == 6.0) && (fout[4] == 2.0));
+  k->scale_f64(fout, f, 0.5, 5);
+  TEST_ASSERT((fout[0] == 1.5) && (fout[4] == -2.5));
+
+  TEST_ASSERT(k->sum_i64(i, 5) == 2);
+  TEST_ASSERT(k->dot_i64(i, i, 5) == 52);
+  TEST_ASSERT(k->min_i64(i, 5) == -5);
+  TEST_ASSERT(k->max_i64(i, 5) == 4);
+  k->prefix_sum_i64(iout, i, 5);
+  TEST_ASSERT((iout[0] == 3) && (iout[2] == 6) && (iout[4] == 2));
+  k->mul_i64(iout, i, i, 5);
+  TEST_ASSERT((iout[1] == 1) && (iout[4] == 25));
+  return PASS_CODE;
+}
+
+// The SIMD kernels give the same results as the scalar ones, for every
+// count of elements and with the output written over an input.
+static int test_simd_kernels(void)
+{
+  const array_kernels_t *s = array_scalar_kernels();
+  const array_kernels_t *v = array_simd_kernels();
+  if (v == NULL)
+  {
+    printf("SIMD kernels are not supported, only the scalar ones are tested\n");
+    return PASS_CODE;
+  }
+  TEST_ASSERT(array_kernels() == v);
+
+  double fa[MAX_COUNT], fb[MAX_COUNT], fs[MAX_COUNT], fv[MAX_COUNT];
+  int64_t ia[MAX_COUNT], ib[MAX_COUNT], is[MAX_COUNT], iv[MAX_COUNT];
+  for (size_t n = 0; n <= MAX_COUNT; n++)
+  {
+    fill(fa, ia, n, 5);
+    fill(fb, ib, n, 7);
+
+    TEST_ASSERT(v->sum_f64(fa, n) == s->sum_f64(fa, n));
+    TEST_ASSERT(v->dot_f64(fa, fb, n) == s->dot_f64(fa, fb, n));
+    TEST_ASSERT(v->sum_i64(ia, n) == s->sum_i64(ia, n));
+    TEST_ASSERT(v->dot_i64(ia, ib, n) == s->dot_i64(ia, ib, n));
+    if (n > 0)
+    {
+      TEST_ASSERT(v->min_f64(fa, n) == s->min_f64(fa, n));
+      TEST_ASSERT(v->max_f64(fa, n) == s->max_f64(fa, n));
+      TEST_ASSERT(v->min_i64(ia, n) == s->min_i64(ia, n));
+      TEST_ASSERT(v->max_i64(ia, n) == s->max_i64(ia, n));
+    }
+
+    s->add_f64(fs, fa, fb, n);
+    v->add_f64(fv, fa, fb, n);
+    TEST_ASSERT((n == 0) || (memcmp(fs, fv, sizeof(double) * n) == 0));
+    s->mul_f64(fs, fa, fb, n);
+    v->mul_f64(fv, fa, fb, n);
+    TEST_ASSERT((n == 0) || (memcmp(fs, fv, sizeof(double) * n) == 0));
+    s->scale_f64(fs, fa, -3.0, n);
+    v->scale_f64(fv, fa, -3.0, n);
+    TEST_ASSERT((n == 0) || (memcmp(fs, fv, sizeof(double) * n) == 0));
+    s->add_i64(is, ia, ib, n);
+    v->add_i64(iv, ia, ib, n);
+    TEST_ASSERT((n == 0) || (memcmp(is, iv, sizeof(int64_t) * n) == 0));
+
+    s->prefix_sum_f64(fs, fa, n);
+    v->prefix_sum_f64(fa, fa, n);
+    TEST_ASSERT((n == 0) || (memcmp(fs, fa, sizeof(double) * n) == 0));
+    s->prefix_sum_i64(is, ia, n);
+    v->prefix_sum_i64(ia, ia, n);
+    TEST_ASSERT((n == 0) || (memcmp(is, ia, sizeof(int64_t) * n) == 0));
+  }
+  return PASS_CODE;
+}
+
+// Integer sums wrap around rather than overflow, whichever kernels are
+// used.
+static int test_wrapping(void)
+{
+  int64_t a[9];
+  for (size_t n = 0; n < 9; n++)
+  {
+    a[n] = INT64_MAX;
+  }
+
+  const array_kernels_t *kernels[] = {array_scalar_kernels(), array_kernels()};
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+  {
+    int64_t out[9];
+    TEST_ASSERT(kernels[k]->sum_i64(a, 9) == INT64_MAX - 8);
+    kernels[k]->prefix_sum_i64(out, a, 9);
+    TEST_ASSERT((out[1] == -2) && (out[8] == INT64_MAX - 8));
+    kernels[k]->add_i64(out, a, a, 9);
+    TEST_ASSERT(out[8] == -2);
+    TEST_ASSERT(kernels[k]->max_i64(a, 9) == INT64_MAX);
+  }
+  return PASS_CODE;
+}
+
+// An array is one value, however many elements it has, and the builtins
+// that make arrays from others make only the one.
+static int test_storage(void)
+{
+  crisp_t *crisp = init_interpreter();
+  eval(crisp, read(crisp, "(define n 100000)"), root_env(crisp));
+  eval(crisp, read(crisp, "(define a (make-f64-array n 2))"), root_env(crisp));
+
+  expr_t call = read(crisp, "(array-sum (array-add a (array-scale a 3)))");
+  size_t before = get_gc_stats(crisp).objects_allocated;
+  expr_t sum = eval(crisp, call, root_env(crisp));
+  TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 3);
+  TEST_ASSERT(as_number(sum) == 800000.0);
+
+  crisp_gc(crisp);
+  expr_t a = eval(crisp, read(crisp, "a"), root_env(crisp));
+  TEST_ASSERT(is_array(a) && (a->as.array.count == 100000) && (a->as.array.data.f64[99999] == 2.0));
+  free_interpreter(crisp);
+  return PASS_CODE;
+}
@@ -0,0 +1,139 @@
+#include "simple_test.h"
+#include "builtins.h"
+#include "environment.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+typedef struct
+{
+  crisp_t *crisp;
+} test_fixture_t;
+
+static const builtin_t *descriptor(test_fixture_t *f, const char *name)
+{
+  expr_t fn = NULL;
+  env_get(root_env(f->crisp), intern_string_null_terminated(f->crisp, name), &fn);
+  return builtin_descriptor(fn);
+}
+
+static int test_operand_types(test_fixture_t *f)
+{
+  // Each argument has a mask of its own.
+  const builtin_t *ref = descriptor(f, "vector-ref");
+  TEST_ASSERT(builtin_operand_types(ref, 0) == TYPE_MASK(VALUE_TYPE_VECTOR));
+  TEST_ASSERT(builtin_operand_types(ref, 1) == TYPE_MASK(VALUE_TYPE_NUMBER));
+
+  const builtin_t *set = descriptor(f, "vector-set!");
+  TEST_ASSERT(builtin_operand_types(set, 0) == TYPE_MASK(VALUE_TYPE_VECTOR));
+  TEST_ASSERT(builtin_operand_types(set, 1) == TYPE_MASK(VALUE_TYPE_NUMBER));
+  TEST_ASSERT(builtin_operand_types(set, 2) == TYPE_MASK_ANY);
+
+  // The last mask given holds for the rest.
+  const builtin_t *array_set = descriptor(f, "array-set!");
+  TEST_ASSERT(builtin_operand_types(array_set, 0) == TYPE_MASK(VALUE_TYPE_ARRAY));
+  TEST_ASSERT(builtin_operand_types(array_set, 2) == TYPE_MASK(VALUE_TYPE_NUMBER));
+  const builtin_t *scale = descriptor(f, "array-scale");
+  TEST_ASSERT(builtin_operand_types(scale, 1) == TYPE_MASK(VALUE_TYPE_NUMBER));
+  const builtin_t *accessor = descriptor(f, BUILTIN_RECORD_ACCESSOR);
+  TEST_ASSERT(builtin_operand_types(accessor, 0) == TYPE_MASK(VALUE_TYPE_RECORD_TYPE));
+  TEST_ASSERT(builtin_operand_types(accessor, 1) == TYPE_MASK(VALUE_TYPE_ATOM));
+
+  // Results are of the types described.
+  crisp_t *crisp = f->crisp;
+  expr_t result = eval(crisp, read(crisp, "(vector-set! (make-vector 2) 0 1)"), root_env(crisp));
+  TEST_ASSERT(set->result_types & TYPE_MASK(result->type));
+  result = eval(crisp, read(crisp, "(array-set! (make-f64-array 2) 0 1)"), root_env(crisp));
+  TEST_ASSERT(array_set->result_types & TYPE_MASK(result->type));
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static const builtin_t *descriptor(test_fixture_t *f, const char *name);
+
+// A builtin made outside of the table.
+static expr_t b_first(crisp_t *crisp, size_t argc, expr_t *argv)
+{
+  (void)crisp;
+  (void)argc;
+  return argv[0];
+}
+
+static int test_descriptors(test_fixture_t *);
+static int test_descriptor_of_value(test_fixture_t *);
+static int test_operand_types(test_fixture_t *);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  RUN_TEST_WITH_FIXTURE(test_descriptors);
+  RUN_TEST_WITH_FIXTURE(test_descriptor_of_value);
+  RUN_TEST_WITH_FIXTURE(test_operand_types);
+
+  return PASS_CODE;
+}
+
+static int test_descriptors(test_fixture_t *f)
+{
+  size_t count = 0;
+  const builtin_t *builtins = builtin_descriptors(&count);
+  TEST_ASSERT(count > 0);
+
+  // Each is bound in the root environment with the arity it describes.
+  for (size_t i = 0; i < count; i++)
+  {
+    expr_t fn = NULL;
+    TEST_ASSERT(env_get(root_env(f->crisp), intern_string_null_terminated(f->crisp, builtins[i].name), &fn));
+    TEST_ASSERT(is_builtin(fn));
+    TEST_ASSERT(as_builtin(fn) == builtins[i].fn);
+    TEST_ASSERT(fn->as.fn.min_arity == builtins[i].min_arity);
+    TEST_ASSERT(fn->as.fn.max_arity == builtins[i].max_arity);
+    TEST_ASSERT(((fn->flags & VALUE_FLAG_PURE) != 0) == builtins[i].pure);
+    TEST_ASSERT(builtins[i].operand_types[0] != 0);
+    TEST_ASSERT(builtins[i].result_types != 0);
+    TEST_ASSERT(builtin_descriptor(fn) == &builtins[i]);
+  }
+  return PASS_CODE;
+}
+
+static int test_descriptor_of_value(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  const builtin_t *add = builtin_descriptor(eval(crisp, read(crisp, "+"), root_env(crisp)));
+  TEST_ASSERT(add != NULL);
+  TEST_ASSERT(strcmp(add->name, "+") == 0);
+  TEST_ASSERT(add->pure);
+  TEST_ASSERT(add->min_arity == 1);
+  TEST_ASSERT(add->max_arity == ARITY_VARIADIC);
+  TEST_ASSERT(builtin_operand_types(add, 0) == TYPE_MASK(VALUE_TYPE_NUMBER));
+  TEST_ASSERT(builtin_operand_types(add, 7) == TYPE_MASK(VALUE_TYPE_NUMBER));
+  TEST_ASSERT(add->result_types == TYPE_MASK(VALUE_TYPE_NUMBER));
+
+  const builtin_t *car = builtin_descriptor(eval(crisp, read(crisp, "car"), root_env(crisp)));
+  TEST_ASSERT(car != NULL);
+  TEST_ASSERT(!car->pure);
+  TEST_ASSERT(builtin_operand_types(car, 0) == TYPE_MASK(VALUE_TYPE_CONS));
+
+  // The cons that quasiquote uses has one of its own.
+  const builtin_t *qq = descriptor(f, BUILTIN_QUASIQUOTE_CONS);
+  TEST_ASSERT(qq != NULL);
+  TEST_ASSERT(strcmp(qq->name, BUILTIN_QUASIQUOTE_CONS) == 0);
+
+  // Only builtins have one.
+  TEST_ASSERT(builtin_descriptor(eval(crisp, read(crisp, "(lambda (x) x)"), root_env(crisp))) == NULL);
+  TEST_ASSERT(builtin_descriptor(eval(crisp, read(crisp, "1"), root_env(crisp))) == NULL);
+  TEST_ASSERT(builtin_descriptor(builtin_value(crisp, &b_first, 1, 1)) == NULL);
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
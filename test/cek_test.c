@@ -0,0 +1,224 @@
+#include "simple_test.h"
+#include "interpreter_internal.h"
+
+#include <stdlib.h>
+
+#define TEST_EVAL(src, exp)                                    \
+  if (execute_crisp_code(f->crisp, src, exp,                   \
+                        __FILE__, __LINE__,                    \
+                        false, true, false) != PASS_CODE) {    \
+    return FAIL_CODE;                                          \
+  }
+
+#define TEST_EVAL_FAILURE(src)                                 \
+  if (execute_crisp_code(f->crisp, src, "",                    \
+                        __FILE__, __LINE__,                    \
+                        false, true, true) != PASS_CODE) {     \
+    return FAIL_CODE;                                          \
+  }
+
+typedef struct
+{
+  crisp_t *crisp;
+  bool error_called;
+} test_fixture_t;
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static void error_handler(crisp_t *, void *);
+static char *nested_source(size_t depth);
+static char *long_list_source(size_t count, const char *last);
+
+static int test_depth_limit(test_fixture_t *);
+static int test_deep_nesting(test_fixture_t *);
+static int test_long_lists(test_fixture_t *);
+static int test_escape_continuations(test_fixture_t *);
+static int test_recursive_escape_continuations(test_fixture_t *);
+static int test_lexical_scope(test_fixture_t *);
+static int test_tail_positions(test_fixture_t *);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  RUN_TEST_WITH_FIXTURE(test_depth_limit);
+  RUN_TEST_WITH_FIXTURE(test_deep_nesting);
+  RUN_TEST_WITH_FIXTURE(test_long_lists);
+  RUN_TEST_WITH_FIXTURE(test_escape_continuations);
+  RUN_TEST_WITH_FIXTURE(test_recursive_escape_continuations);
+  RUN_TEST_WITH_FIXTURE(test_lexical_scope);
+  RUN_TEST_WITH_FIXTURE(test_tail_positions);
+
+  return PASS_CODE;
+}
+
+static int test_depth_limit(test_fixture_t *f)
+{
+  char *src = nested_source(100);
+  set_max_eval_depth(f->crisp, 50);
+
+  // Exceeding the limit is reported as an eval error...
+  TEST_EVAL_FAILURE(src);
+  TEST_ASSERT(f->error_called);
+  TEST_ASSERT(eval_stack(f->crisp)->depth == 0);
+
+  // ...and the interpreter is usable afterwards.
+  f->error_called = false;
+  TEST_EVAL("(+ 1 2)", "3");
+  TEST_ASSERT(!f->error_called);
+
+  set_max_eval_depth(f->crisp, 200);
+  TEST_EVAL(src, "100");
+
+  free(src);
+  return PASS_CODE;
+}
+
+static int test_deep_nesting(test_fixture_t *f)
+{
+  char *src = nested_source(10000);
+  TEST_EVAL(src, "10000");
+  TEST_ASSERT(eval_stack(f->crisp)->depth == 0);
+  free(src);
+  return PASS_CODE;
+}
+
+static int test_long_lists(test_fixture_t *f)
+{
+  char *src = long_list_source(999999, "");
+  TEST_EVAL(src, "()");
+  TEST_EVAL("(length big)", "999999");
+  TEST_EVAL("(list? big)", "true");
+
+  // Marking the list must not recurse once per element.
+  crisp_gc(f->crisp);
+  TEST_EVAL("(car big)", "0");
+
+  free(src);
+  return PASS_CODE;
+}
+
+static int test_escape_continuations(test_fixture_t *f)
+{
+  // Normal return
+  TEST_EVAL("(call/ec (lambda (k) 5))", "5");
+  TEST_EVAL("(+ 1 (call/ec (lambda (k) 5)))", "6");
+
+  // Escaping abandons the rest of the computation
+  TEST_EVAL("(+ 1 (call/ec (lambda (k) (+ 10 (k 5)))))", "6");
+  TEST_EVAL("(call/ec (lambda (outer) (+ 1 (call/ec (lambda (inner) (outer 2))))))", "2");
+  TEST_EVAL("(call/ec (lambda (outer) (+ 1 (call/ec (lambda (inner) (inner 2))))))", "3");
+
+  // Escaping through the native frames of a special form
+  TEST_EVAL("(call/ec (lambda (k) (define x (k 7)) 8))", "7");
+
+  // A continuation can not be used once its extent has ended
+  TEST_EVAL("(define saved (call/ec (lambda (k) k)))", "()");
+  TEST_EVAL_FAILURE("(saved 1)");
+  TEST_EVAL_FAILURE("(call/ec 1 2)");
+  TEST_ASSERT(eval_stack(f->crisp)->depth == 0);
+
+  return PASS_CODE;
+}
+
+static int test_recursive_escape_continuations(test_fixture_t *f)
+{
+  set_eval_mode(f->crisp, CRISP_EVAL_MODE_RECURSIVE);
+  TEST_ASSERT(test_escape_continuations(f) == PASS_CODE);
+  return PASS_CODE;
+}
+
+static int test_lexical_scope(test_fixture_t *f)
+{
+  // Free variables resolve in the environment the lambda was defined in,
+  // not the environment it was called from.
+  TEST_EVAL("(define x 1)", "()");
+  TEST_EVAL("(define get-x (lambda () x))", "()");
+  TEST_EVAL("((lambda (x) (get-x)) 2)", "1");
+  TEST_EVAL("(define adder (lambda (n) (lambda (m) (+ n m))))", "()");
+  TEST_EVAL("(define add5 (adder 5))", "()");
+  TEST_EVAL("((lambda (n) (add5 1)) 100)", "6");
+
+  // Closures keep their defining environment alive across collections.
+  crisp_gc(f->crisp);
+  TEST_EVAL("(add5 2)", "7");
+
+  return PASS_CODE;
+}
+
+static int test_tail_positions(test_fixture_t *f)
+{
+  char *src = long_list_source(100000, "end");
+  TEST_EVAL(src, "()");
+  free(src);
+
+  TEST_EVAL("(define walk-if (lambda (l) (if (symbol? (car l)) (car l) (walk-if (cdr l)))))", "()");
+  TEST_EVAL("(define walk-cond (lambda (l) (let ((x (car l))) (cond ((symbol? x) x) (else (walk-cond (cdr l)))))))", "()");
+  TEST_EVAL("(define walk-or (lambda (l) (or (and (symbol? (car l)) (car l)) (begin 1 (walk-or (cdr l))))))", "()");
+  TEST_EVAL("(define walk-letrec (lambda (l)"
+            "  (letrec ((loop (lambda (l) (let* ((x (car l)) (y x)) (if (symbol? y) y (loop (cdr l)))))))"
+            "    (loop l))))", "()");
+
+  // The forms in tail position of a special form are evaluated in tail
+  // position, so the loops run in a bounded number of frames.
+  set_max_eval_depth(f->crisp, 100);
+  TEST_EVAL("(walk-if big)", "end");
+  TEST_EVAL("(walk-cond big)", "end");
+  TEST_EVAL("(walk-or big)", "end");
+  TEST_EVAL("(walk-letrec big)", "end");
+  TEST_ASSERT(eval_stack(f->crisp)->depth == 0);
+  TEST_ASSERT(eval_stack(f->crisp)->env_count == 0);
+
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  fixture->error_called = false;
+  install_error_handler(fixture->crisp, &error_handler, (void *)fixture);
+  set_eval_mode(fixture->crisp, CRISP_EVAL_MODE_CEK);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
+
+static void error_handler(crisp_t *crisp, void *state)
+{
+  (void)crisp;
+  ((test_fixture_t *)state)->error_called = true;
+}
+
+// Builds (+ 1 (+ 1 ... (+ 1 0)))
+static char *nested_source(size_t depth)
+{
+  char *src = malloc((depth * 6) + 2);
+  char *p = src;
+  for (size_t i = 0; i < depth; i++)
+  {
+    memcpy(p, "(+ 1 ", 5);
+    p += 5;
+  }
+  *p++ = '0';
+  memset(p, ')', depth);
+  p += depth;
+  *p = '\0';
+  return src;
+}
+
+// Builds (define big '(0 1 2 ... last))
+static char *long_list_source(size_t count, const char *last)
+{
+  char *src = malloc((count * 8) + strlen(last) + 32);
+  char *p = src;
+  p += sprintf(p, "(define big '(");
+  for (size_t i = 0; i < count; i++)
+  {
+    p += sprintf(p, "%zu ", i % 1000);
+  }
+  sprintf(p, "%s))", last);
+  return src;
+}
@@ -0,0 +1,214 @@
+#include "simple_test.h"
+#include "compiler.h"
+#include "native.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+typedef struct
+{
+  crisp_t *crisp;
+  bool error_called;
+} test_fixture_t;
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static void error_handler(crisp_t *, void *);
+static expr_t run(test_fixture_t *f, const char *src);
+static lambda_t *global_lambda(test_fixture_t *f, const char *name);
+
+static int test_threshold(test_fixture_t *);
+static int test_disabled(test_fixture_t *);
+static int test_numeric_guard(test_fixture_t *);
+static int test_special_forms(test_fixture_t *);
+static int test_inline_restored(test_fixture_t *);
+static int test_native(test_fixture_t *);
+static int test_native_disabled(test_fixture_t *);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  RUN_TEST_WITH_FIXTURE(test_threshold);
+  RUN_TEST_WITH_FIXTURE(test_disabled);
+  RUN_TEST_WITH_FIXTURE(test_numeric_guard);
+  RUN_TEST_WITH_FIXTURE(test_special_forms);
+  RUN_TEST_WITH_FIXTURE(test_inline_restored);
+  RUN_TEST_WITH_FIXTURE(test_native);
+  RUN_TEST_WITH_FIXTURE(test_native_disabled);
+
+  return PASS_CODE;
+}
+
+static int test_threshold(test_fixture_t *f)
+{
+  set_compile_threshold(f->crisp, 3);
+  run(f, "(define sq (lambda (x) (* x x)))");
+  lambda_t *sq = global_lambda(f, "sq");
+
+  TEST_ASSERT(as_number(run(f, "(sq 2)")) == 4.0);
+  TEST_ASSERT(as_number(run(f, "(sq 3)")) == 9.0);
+  TEST_ASSERT(sq->compiled == NULL);
+  TEST_ASSERT(as_number(run(f, "(sq 4)")) == 16.0);
+  TEST_ASSERT(sq->compiled != NULL);
+  TEST_ASSERT(sq->compiled->body_count == 1);
+  TEST_ASSERT(sq->compiled->count == 4);
+  TEST_ASSERT(as_number(run(f, "(sq 5)")) == 25.0);
+
+  // Compiled code survives a collection with its lambda.
+  crisp_gc(f->crisp);
+  TEST_ASSERT(as_number(run(f, "(sq 6)")) == 36.0);
+
+  return PASS_CODE;
+}
+
+static int test_disabled(test_fixture_t *f)
+{
+  set_compile_threshold(f->crisp, 0);
+  run(f, "(define sq (lambda (x) (* x x)))");
+  for (int i = 0; i < 2 * CRISP_COMPILE_DEFAULT_THRESHOLD; i++)
+  {
+    TEST_ASSERT(as_number(run(f, "(sq 2)")) == 4.0);
+  }
+  TEST_ASSERT(global_lambda(f, "sq")->compiled == NULL);
+
+  // The CEK machine does not use the compiler.
+  set_compile_threshold(f->crisp, 1);
+  set_eval_mode(f->crisp, CRISP_EVAL_MODE_CEK);
+  TEST_ASSERT(as_number(run(f, "(sq 2)")) == 4.0);
+  TEST_ASSERT(global_lambda(f, "sq")->compiled == NULL);
+
+  return PASS_CODE;
+}
+
+static int test_numeric_guard(test_fixture_t *f)
+{
+  run(f, "(define add (lambda (a b) (+ a b)))");
+  TEST_ASSERT(as_number(run(f, "(add 1 2)")) == 3.0);
+  TEST_ASSERT(global_lambda(f, "add")->compiled != NULL);
+
+  // Operands that are not numbers are reported by the builtin.
+  TEST_ASSERT(run(f, "(add 1 \"2\")") == NULL);
+  TEST_ASSERT(f->error_called == true);
+
+  // As is a global operator that has been redefined.
+  run(f, "(define + (lambda (a b) (list a b)))");
+  expr_t result = run(f, "(add 1 2)");
+  TEST_ASSERT(is_cons(result));
+  TEST_ASSERT(as_number(car(result)) == 1.0);
+
+  return PASS_CODE;
+}
+
+static int test_special_forms(test_fixture_t *f)
+{
+  run(f, "(define adder (lambda (n) (define last n) (lambda (m) (+ n m))))");
+  run(f, "(define add2 (adder 2))");
+  TEST_ASSERT(global_lambda(f, "adder")->compiled != NULL);
+  TEST_ASSERT(as_number(run(f, "(add2 3)")) == 5.0);
+  TEST_ASSERT(as_number(run(f, "last")) == 2.0);
+  TEST_ASSERT(is_atom(run(f, "((lambda (x) 'x) 1)")));
+
+  // Escapes unwind through compiled code.
+  run(f, "(define leave (lambda (k n) (k n)))");
+  TEST_ASSERT(as_number(run(f, "(call/ec (lambda (k) (+ 1 (leave k 7))))")) == 7.0);
+
+  return PASS_CODE;
+}
+
+static int test_inline_restored(test_fixture_t *f)
+{
+  expr_t node = read(f->crisp, "(define helper (lambda (x) (+ x 1)))");
+  optimize(f->crisp, node);
+  eval(f->crisp, node, root_env(f->crisp));
+  node = read(f->crisp, "(define caller (lambda (x) (helper x)))");
+  TEST_ASSERT(optimize(f->crisp, node).inlined == 1);
+  eval(f->crisp, node, root_env(f->crisp));
+
+  TEST_ASSERT(as_number(run(f, "(caller 1)")) == 2.0);
+  TEST_ASSERT(global_lambda(f, "caller")->compiled != NULL);
+
+  // The code compiled from the inlined body is discarded with it.
+  run(f, "(define helper (lambda (x) (- x 1)))");
+  TEST_ASSERT(as_number(run(f, "(caller 1)")) == 0.0);
+
+  return PASS_CODE;
+}
+
+static int test_native(test_fixture_t *f)
+{
+  // Lists are walked up to the atom that ends them.
+  run(f, "(define sum (lambda (l) (if (symbol? l) 0 (+ (car l) (sum (cdr l))))))");
+  TEST_ASSERT(as_number(run(f, "(sum '(1 2 3 4 . end))")) == 10.0);
+  compiled_t *compiled = global_lambda(f, "sum")->compiled;
+  TEST_ASSERT(compiled != NULL);
+  TEST_ASSERT((compiled->native != NULL) == crisp_native_supported());
+
+  run(f, "(define mix (lambda (a b) (/ (- a b) (* a 2))))");
+  TEST_ASSERT(as_number(run(f, "(mix 6 2)")) == 4.0 / 12.0);
+  run(f, "(define pick (lambda (a b) (and a (or b 'none))))");
+  TEST_ASSERT(is_atom(run(f, "(pick 1 #f)")));
+  TEST_ASSERT(as_number(run(f, "(pick 1 2)")) == 2.0);
+  TEST_ASSERT(is_bool(run(f, "(pick #f 2)")));
+
+  // Operands that are not numbers leave the machine code for the builtin.
+  TEST_ASSERT(run(f, "(mix 6 \"2\")") == NULL);
+  TEST_ASSERT(f->error_called == true);
+  TEST_ASSERT(as_number(run(f, "(mix 4 4)")) == 0.0);
+
+  // Escapes unwind through machine code too.
+  run(f, "(define leave (lambda (k n) (begin (k n) 0)))");
+  TEST_ASSERT(as_number(run(f, "(call/ec (lambda (k) (+ 1 (leave k 7))))")) == 7.0);
+  TEST_ASSERT(as_number(run(f, "(sum '(5 6 . end))")) == 11.0);
+
+  return PASS_CODE;
+}
+
+static int test_native_disabled(test_fixture_t *f)
+{
+  set_native_code(f->crisp, false);
+  run(f, "(define sq (lambda (x) (* x x)))");
+  TEST_ASSERT(as_number(run(f, "(sq 3)")) == 9.0);
+  TEST_ASSERT(global_lambda(f, "sq")->compiled != NULL);
+  TEST_ASSERT(global_lambda(f, "sq")->compiled->native == NULL);
+
+  // Code that was translated runs threaded once native code is turned off.
+  set_native_code(f->crisp, true);
+  run(f, "(define cube (lambda (x) (* x x x)))");
+  TEST_ASSERT(as_number(run(f, "(cube 2)")) == 8.0);
+  set_native_code(f->crisp, false);
+  TEST_ASSERT(as_number(run(f, "(cube 3)")) == 27.0);
+
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  fixture->error_called = false;
+  install_error_handler(fixture->crisp, &error_handler, (void *)fixture);
+  set_eval_mode(fixture->crisp, CRISP_EVAL_MODE_RECURSIVE);
+  set_compile_threshold(fixture->crisp, 1);
+  set_native_code(fixture->crisp, true);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
+
+static void error_handler(crisp_t *crisp, void *state)
+{
+  (void)crisp;
+  ((test_fixture_t *)state)->error_called = true;
+}
+
+static expr_t run(test_fixture_t *f, const char *src)
+{
+  return eval(f->crisp, read(f->crisp, src), root_env(f->crisp));
+}
+
+static lambda_t *global_lambda(test_fixture_t *f, const char *name)
+{
+  return as_lambda(run(f, name));
+}
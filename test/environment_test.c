@@ -14,6 +14,7 @@ typedef struct
 
 
 static int env_test(test_fixture_t* fixture);
+static int global_cell_test(test_fixture_t* fixture);
 static void setup(test_fixture_t* fixture);
 static void teardown(test_fixture_t* fixture);
 
@@ -23,6 +24,7 @@ int main(int argc, char **argv)
   (void)argv;
 
   RUN_TEST_WITH_FIXTURE(env_test);
+  RUN_TEST_WITH_FIXTURE(global_cell_test);
 
   return PASS_CODE;
 }
@@ -106,3 +108,36 @@ static int env_test(test_fixture_t* fixture)
 
   return PASS_CODE;
 }
+
+static int global_cell_test(test_fixture_t* fixture)
+{
+  value_t *v = NULL;
+  env_t* root = env_init(fixture->crisp);
+  env_t* child = env_init_child(fixture->crisp, root);
+
+  TEST_ASSERT(env_get_cell(root, fixture->v1) == NULL);
+
+  env_set(root, fixture->v1, number_value(fixture->crisp, 1.0));
+  global_cell_t* cell = env_get_cell(root, fixture->v1);
+  TEST_ASSERT(cell != NULL);
+  TEST_ASSERT(cell->name == fixture->v1);
+  TEST_ASSERT(as_number(cell->value) == 1.0);
+
+  // Redefinition updates the existing cell in place.
+  env_set(root, fixture->v1, number_value(fixture->crisp, 2.0));
+  TEST_ASSERT(env_get_cell(root, fixture->v1) == cell);
+  TEST_ASSERT(as_number(cell->value) == 2.0);
+  TEST_ASSERT(env_get(child, fixture->v1, &v) == true);
+  TEST_ASSERT(as_number(v) == 2.0);
+
+  // The cell survives the table growing.
+  for (int i = 0; i < 100; i++)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "g%d", i);
+    env_set(root, intern_string_null_terminated(fixture->crisp, name), v);
+  }
+  TEST_ASSERT(env_get_cell(root, fixture->v1) == cell);
+
+  return PASS_CODE;
+}
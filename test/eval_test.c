@@ -20,23 +20,153 @@ typedef struct
   crisp_t *crisp;
 } test_fixture_t;
 
+int test_loops(test_fixture_t *fixture)
+{
+  // The loops walk a list up to the atom that ends it.
+  TEST_EVAL("(define items '(1 2 3 . end))", "()");
+  TEST_EVAL("(let loop ((l items) (sum 0)) (if (symbol? l) sum (loop (cdr l) (+ sum (car l)))))", "6");
+  TEST_EVAL("(let loop () 1)", "1");
+  TEST_EVAL("(let loop ((l items) (n 0))"
+            "  (cond ((symbol? l) n) (else (let ((next (cdr l))) (loop next (+ n 1))))))", "3");
+  TEST_EVAL("(let outer ((l items) (sum 0))"
+            "  (if (symbol? l)"
+            "      sum"
+            "      (outer (cdr l) (let inner ((m items) (sum sum))"
+            "                       (if (symbol? m) sum (inner (cdr m) (+ sum (car l))))))))", "18");
+  TEST_EVAL_FAILURE("(let loop ((l)) l)");
+  TEST_EVAL_FAILURE("(let loop ((l 1)))");
+
+  TEST_EVAL("(do ((l items (cdr l)) (acc '() (cons (car l) acc))) ((symbol? l) acc))", "(3 2 1)");
+  TEST_EVAL("(do ((l items (cdr l))) ((symbol? l)))", "()");
+  TEST_EVAL("(define total 0)", "()");
+  TEST_EVAL("(do ((l items (cdr l)) (k 10)) ((symbol? l) total) (set! total (+ total (* k (car l)))))", "60");
+  TEST_EVAL_FAILURE("(do ((l items (cdr l))) l)");
+  TEST_EVAL_FAILURE("(do ((l)) ((symbol? l)))");
+
+  // A named let that is not a loop is a call.
+  TEST_EVAL("(let walk ((l items)) (if (symbol? l) '() (cons (car l) (walk (cdr l)))))", "(1 2 3)");
+  TEST_EVAL("(let f ((g 1)) (if (number? g) (f f) 'passed))", "passed");
+
+  // Closures made in a loop see the variables of their own time round.
+  TEST_EVAL("(define thunks"
+            "  (let loop ((l items) (acc '()))"
+            "    (if (symbol? l) acc (loop (cdr l) (cons (lambda () (car l)) acc)))))", "()");
+  TEST_EVAL("((car thunks))", "3");
+  TEST_EVAL("((car (cdr thunks)))", "2");
+  TEST_EVAL("(define steps"
+            "  (let loop ((l items) (acc '()))"
+            "    (if (symbol? l) acc (loop (cdr l) (cons (lambda () (set! l (cdr l)) l) acc)))))", "()");
+  TEST_EVAL("((car steps))", "end");
+  TEST_EVAL("((car (cdr steps)))", "(3 . end)");
+
+  // Long enough that a loop that made calls would run out of stack.
+  TEST_EVAL("(define twice"
+            "  (lambda (l) (let loop ((a l) (acc l)) (if (symbol? a) acc (loop (cdr a) (cons (car a) acc))))))",
+            "()");
+  TEST_EVAL("(define ones (do ((d '(1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 . end) (cdr d))"
+            "                  (l '(1 . end) (twice l)))"
+            "                 ((symbol? d) l)))", "()");
+  TEST_EVAL("(let count ((l ones) (n 0)) (if (symbol? l) n (count (cdr l) (+ n 1))))", "131072");
+  return PASS_CODE;
+}
+
+int test_match(test_fixture_t *fixture)
+{
+  // An interpreter of arithmetic, dispatching on the operator.
+  TEST_EVAL("(define calc"
+            "  (lambda (e)"
+            "    (match e"
+            "      (('add a b) (+ (calc a) (calc b)))"
+            "      (('mul a b) (* (calc a) (calc b)))"
+            "      (('neg a) (- 0 (calc a)))"
+            "      (n n))))", "()");
+  TEST_EVAL("(calc '(add 1 (mul 2 (neg 3))))", "-5");
+  TEST_EVAL("(calc 4)", "4");
+
+  // Literals, quoted data, () and wildcards.
+  TEST_EVAL("(define kind"
+            "  (lambda (v)"
+            "    (match v"
+            "      (0 'zero) (\"s\" 'string) (#t 'true) (() 'empty)"
+            "      ('(a b) 'ab) ((_ . ()) 'one) ((_ _ . more) more) (_ 'other))))", "()");
+  TEST_EVAL("(list (kind 0) (kind \"s\") (kind #t) (kind '()) (kind '(a b)))", "(zero string true empty ab)");
+  TEST_EVAL("(list (kind '(x)) (kind '(a b c)) (kind 1) (kind \"t\") (kind 'a))", "(one (c) other other other)");
+
+  // The first clause that matches is taken, variables bind what they match.
+  TEST_EVAL("(match '(1 (2 3)) ((a (b c)) (list c b a)) (x 'no))", "(3 2 1)");
+  TEST_EVAL("(match '(1 2) ((a a2) 'first) ((a b) 'second))", "first");
+  TEST_EVAL("(match (cons 1 2) ((a . b) (+ a b)))", "3");
+
+  // The subject is evaluated once.
+  TEST_EVAL("(define calls 0)", "()");
+  TEST_EVAL("(match (begin (set! calls (+ calls 1)) '(1 2)) ((1 3) 'a) ((1 2) 'b))", "b");
+  TEST_EVAL("calls", "1");
+
+  // Matching in the tail position of a loop.
+  TEST_EVAL("(let loop ((l '(1 2 3)) (sum 0)) (match l (() sum) ((x . rest) (loop rest (+ sum x)))))", "6");
+
+  TEST_EVAL_FAILURE("(match '(1 2) ((a) a))");
+  TEST_EVAL_FAILURE("(match 1 ((a a) a))");
+  TEST_EVAL_FAILURE("(match 1 (if 1))");
+  TEST_EVAL_FAILURE("(match 1 (x))");
+  TEST_EVAL_FAILURE("(match)");
+  return PASS_CODE;
+}
+
 static void setup(test_fixture_t *fixture);
 static void teardown(test_fixture_t *fixture);
 
+// Every test is run against each of the evaluators.
+static crisp_eval_mode_t eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+// And with the compiler both off and compiling every lambda when first called.
+static size_t compile_threshold_under_test = 0;
+
 int test_builtin_type_evaluation(test_fixture_t *fixture);
 int test_math_evaluation(test_fixture_t *fixture);
 int test_lambda_evaluation(test_fixture_t *fixture);
+int test_lexical_scope(test_fixture_t *fixture);
 int test_top_level_defines(test_fixture_t *fixture);
+int test_special_forms(test_fixture_t *fixture);
+int test_loops(test_fixture_t *fixture);
+int test_match(test_fixture_t *fixture);
+int test_case(test_fixture_t *fixture);
+int test_generic(test_fixture_t *fixture);
+int test_parameterize(test_fixture_t *fixture);
+int test_records(test_fixture_t *fixture);
+int test_list_library(test_fixture_t *fixture);
+int test_vectors(test_fixture_t *fixture);
+int test_arrays(test_fixture_t *fixture);
 
 int main(int argc, char **argv)
 {
   (void)argc;
   (void)argv;
 
-  RUN_TEST_WITH_FIXTURE(test_builtin_type_evaluation);
-  RUN_TEST_WITH_FIXTURE(test_math_evaluation);
-  RUN_TEST_WITH_FIXTURE(test_lambda_evaluation);
-  RUN_TEST_WITH_FIXTURE(test_top_level_defines);
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK, CRISP_EVAL_MODE_SPECIALIZING};
+  size_t thresholds[] = {0, 1};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    for (size_t j = 0; j < sizeof(thresholds) / sizeof(thresholds[0]); j++)
+    {
+      eval_mode_under_test = modes[i];
+      compile_threshold_under_test = thresholds[j];
+      RUN_TEST_WITH_FIXTURE(test_builtin_type_evaluation);
+      RUN_TEST_WITH_FIXTURE(test_math_evaluation);
+      RUN_TEST_WITH_FIXTURE(test_lambda_evaluation);
+      RUN_TEST_WITH_FIXTURE(test_lexical_scope);
+      RUN_TEST_WITH_FIXTURE(test_top_level_defines);
+      RUN_TEST_WITH_FIXTURE(test_special_forms);
+      RUN_TEST_WITH_FIXTURE(test_loops);
+      RUN_TEST_WITH_FIXTURE(test_match);
+      RUN_TEST_WITH_FIXTURE(test_case);
+      RUN_TEST_WITH_FIXTURE(test_generic);
+      RUN_TEST_WITH_FIXTURE(test_parameterize);
+      RUN_TEST_WITH_FIXTURE(test_records);
+      RUN_TEST_WITH_FIXTURE(test_list_library);
+      RUN_TEST_WITH_FIXTURE(test_vectors);
+      RUN_TEST_WITH_FIXTURE(test_arrays);
+    }
+  }
 
   return PASS_CODE;
 }
@@ -112,6 +242,13 @@ int test_math_evaluation(test_fixture_t *fixture)
   TEST_EVAL("(* -3 6)", "-18");
   TEST_EVAL("(/ (- (+ 515 (* -87 311)) 296) 27)", "-994");
 
+  // Arity and operand checks
+  TEST_EVAL("(+ 7)", "7");
+  TEST_EVAL_FAILURE("(+)");
+  TEST_EVAL_FAILURE("(+ 1 'a)");
+  TEST_EVAL_FAILURE("(cons 1)");
+  TEST_EVAL_FAILURE("(car '(1) '(2))");
+
   return PASS_CODE;
 }
 
@@ -133,6 +270,42 @@ int test_lambda_evaluation(test_fixture_t *fixture)
   return PASS_CODE;
 }
 
+int test_lexical_scope(test_fixture_t *fixture)
+{
+  // A free variable refers to the binding in scope where the lambda was
+  // made, not to one in scope where it is called.
+  TEST_EVAL("(define x 'global)", "()");
+  TEST_EVAL("(define get-x (lambda () x))", "()");
+  TEST_EVAL("((lambda (x) (get-x)) 'caller)", "global");
+  TEST_EVAL("(let ((x 'let)) (get-x))", "global");
+  TEST_EVAL("(define call (lambda (f x) (f)))", "()");
+  TEST_EVAL("((lambda (x) (call (lambda () x) 'callee)) 'definer)", "definer");
+
+  // Closures capture the environment of the call that made them, which
+  // outlives the call, and each call makes a new one.
+  TEST_EVAL("(define adder (lambda (n) (lambda (m) (+ n m))))", "()");
+  TEST_EVAL("(define add1 (adder 1))", "()");
+  TEST_EVAL("(define add10 (adder 10))", "()");
+  TEST_EVAL("((lambda (n) (list (add1 1) (add10 1))) 100)", "(2 11)");
+
+  // Assignments through a captured variable are seen by every closure that
+  // shares it, and by no other.
+  TEST_EVAL("(define counter (lambda ()"
+            "  (let ((n 0))"
+            "    (cons (lambda () (set! n (+ n 1)) n) (lambda () n)))))", "()");
+  TEST_EVAL("(define c1 (counter))", "()");
+  TEST_EVAL("(define c2 (counter))", "()");
+  TEST_EVAL("((car c1))", "1");
+  TEST_EVAL("((car c1))", "2");
+  TEST_EVAL("((car c2))", "1");
+  TEST_EVAL("(list ((cdr c1)) ((cdr c2)))", "(2 1)");
+
+  // Globals are still looked up when the closure is called.
+  TEST_EVAL("(define x 'redefined)", "()");
+  TEST_EVAL("(get-x)", "redefined");
+  return PASS_CODE;
+}
+
 int test_top_level_defines(test_fixture_t *fixture)
 {
   // Tests from The Scheme Programming Language
@@ -151,12 +324,405 @@ int test_top_level_defines(test_fixture_t *fixture)
   return PASS_CODE;
 }
 
+int test_special_forms(test_fixture_t *fixture)
+{
+  // There are no boolean literals.
+  TEST_EVAL("(define yes (number? 1))", "()");
+  TEST_EVAL("(define no (number? 'no))", "()");
+
+  // Only false is false.
+  TEST_EVAL("(if yes 1 2)", "1");
+  TEST_EVAL("(if no 1 2)", "2");
+  TEST_EVAL("(if '() 1 2)", "1");
+  TEST_EVAL("(if no 1)", "()");
+  TEST_EVAL_FAILURE("(if yes)");
+
+  TEST_EVAL("(cond ((number? 'a) 1) ((symbol? 'a) 2) (else 3))", "2");
+  TEST_EVAL("(cond ((number? 'a) 1) (else 3))", "3");
+  TEST_EVAL("(cond ((number? 'a) 1))", "()");
+  TEST_EVAL("(cond ((+ 1 2)))", "3");
+  TEST_EVAL_FAILURE("(cond 1)");
+
+  TEST_EVAL("(and)", "true");
+  TEST_EVAL("(and 1 2)", "2");
+  TEST_EVAL("(and 1 no undefined)", "false");
+  TEST_EVAL("(or)", "false");
+  TEST_EVAL("(or no 2 undefined)", "2");
+  TEST_EVAL("(begin)", "()");
+  TEST_EVAL("(begin 1 2 3)", "3");
+
+  TEST_EVAL("(let ((x 1) (y 2)) (+ x y))", "3");
+  TEST_EVAL("(let () 5)", "5");
+  TEST_EVAL("(let ((x 1)) (let ((x 2) (y x)) y))", "1");
+  TEST_EVAL("(let ((x 1)) (let* ((x 2) (y x)) y))", "2");
+  TEST_EVAL("(letrec ((ev? (lambda (l) (if (list? l) (od? (cdr l)) yes)))"
+            "         (od? (lambda (l) (if (list? l) (ev? (cdr l)) no))))"
+            "  (ev? '(1 2 . 3)))", "true");
+  TEST_EVAL_FAILURE("(let ((x)) x)");
+  TEST_EVAL_FAILURE("(let ((x 1)))");
+
+  TEST_EVAL("(define n 1)", "()");
+  TEST_EVAL("(set! n (+ n 1))", "()");
+  TEST_EVAL("n", "2");
+  TEST_EVAL_FAILURE("(set! unbound 1)");
+  TEST_EVAL("(define counter (lambda () (let ((count 0)) (lambda () (set! count (+ count 1)) count))))", "()");
+  TEST_EVAL("(define next (counter))", "()");
+  TEST_EVAL("(next)", "1");
+  TEST_EVAL("(next)", "2");
+
+  // The keywords are not variables, binding them does not change the
+  // language.
+  TEST_EVAL("(define quote 1)", "()");
+  TEST_EVAL("'a", "a");
+  TEST_EVAL("((lambda (if) (if yes if 2)) 1)", "1");
+  TEST_EVAL_FAILURE("lambda");
+
+  // With a compile threshold of one, the later calls run compiled.
+  TEST_EVAL("(define pick (lambda (x) (if (number? x) (and x (begin 1 x)) (or no x))))", "()");
+  TEST_EVAL("(pick 'a)", "a");
+  TEST_EVAL("(pick 4)", "4");
+  TEST_EVAL("(pick 'b)", "b");
+
+  return PASS_CODE;
+}
+
+int test_case(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define route"
+            "  (lambda (m)"
+            "    (case m"
+            "      ((get head) 'read)"
+            "      ((post put) 'write)"
+            "      ((1 2) 'number)"
+            "      ((\"s\") 'string)"
+            "      (else 'other))))", "()");
+  TEST_EVAL("(list (route 'get) (route 'head) (route 'post) (route 'put))", "(read read write write)");
+  TEST_EVAL("(list (route 1) (route 2) (route \"s\") (route 'delete) (route '(get)))", "(number number string other other)");
+
+  // The first clause that lists a datum takes it, every form of the clause
+  // is evaluated.
+  TEST_EVAL("(case 'a ((b a) 1) ((a) 2))", "1");
+  TEST_EVAL("(case 'a ((a) 1 2 3))", "3");
+  TEST_EVAL("(case 'z ((a) 1))", "()");
+  TEST_EVAL("(case (car '(x)) ((x) 'yes) (else 'no))", "yes");
+
+  // The key is evaluated once.
+  TEST_EVAL("(define calls 0)", "()");
+  TEST_EVAL("(case (begin (set! calls (+ calls 1)) 'b) ((a) 1) ((b) 2))", "2");
+  TEST_EVAL("calls", "1");
+
+  // Dispatching in the tail position of a loop.
+  TEST_EVAL("(let loop ((l '(up up down up stop)) (n 0))"
+            "  (case (car l)"
+            "    ((up) (loop (cdr l) (+ n 1)))"
+            "    ((down) (loop (cdr l) (- n 1)))"
+            "    (else n)))", "2");
+
+  TEST_EVAL_FAILURE("(case 1 (else 1) ((a) 2))");
+  TEST_EVAL_FAILURE("(case 1 (a))");
+  TEST_EVAL_FAILURE("(case 1 (a 1))");
+  TEST_EVAL_FAILURE("(case)");
+  return PASS_CODE;
+}
+
+int test_generic(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-generic area)", "()");
+  TEST_EVAL("(define-method (area (s number)) (* s s))", "()");
+  TEST_EVAL("(define-method (area (s pair)) (* (car s) (car (cdr s))))", "()");
+  TEST_EVAL("(define-method (area s) 'unknown)", "()");
+  TEST_EVAL("(list (area 3) (area '(2 5)) (area \"x\") (area 'y))", "(9 10 unknown unknown)");
+
+  // The most specific method is chosen, whatever the order they were
+  // defined in.
+  TEST_EVAL("(define-generic combine)", "()");
+  TEST_EVAL("(define-method (combine a b) (list a b))", "()");
+  TEST_EVAL("(define-method (combine a (b string)) 'string-second)", "()");
+  TEST_EVAL("(define-method (combine (a string) b) 'string-first)", "()");
+  TEST_EVAL("(define-method (combine (a number) (b number)) (+ a b))", "()");
+  TEST_EVAL("(list (combine 1 2) (combine \"a\" 1) (combine 1 \"b\") (combine 'x 'y))",
+            "(3 string-first string-second (x y))");
+
+  // One call site seeing many types, before and after a method is added
+  // or replaced.
+  TEST_EVAL("(define areas (lambda (l) (match l (() l) ((x . rest) (cons (area x) (areas rest))))))", "()");
+  TEST_EVAL("(areas (list 1 '(1 2) 2 \"s\" 'a (number? 1) area))", "(1 2 4 unknown unknown unknown unknown)");
+  TEST_EVAL("(define-method (area (s string)) 'text)", "()");
+  TEST_EVAL("(define-method (area (s number)) (+ s s))", "()");
+  TEST_EVAL("(areas (list 1 \"s\" 'a))", "(2 text unknown)");
+
+  // Rest parameters, and tail calls through a method.
+  TEST_EVAL("(define-generic tag)", "()");
+  TEST_EVAL("(define-method (tag (n number) . more) (tag 'number n more))", "()");
+  TEST_EVAL("(define-method (tag (s symbol) . more) (cons s more))", "()");
+  TEST_EVAL("(tag 3 4)", "(number 3 (4))");
+  TEST_EVAL("(define-generic len)", "()");
+  TEST_EVAL("(define-method (len (l pair) n) (len (cdr l) (+ n 1)))", "()");
+  TEST_EVAL("(define-method (len (l null) n) n)", "()");
+  TEST_EVAL("(len '(a b c d) 0)", "4");
+
+  TEST_EVAL_FAILURE("(area)");
+  TEST_EVAL_FAILURE("(combine 1)");
+  TEST_EVAL("(define-generic none)", "()");
+  TEST_EVAL_FAILURE("(none 1)");
+  TEST_EVAL("(define-method (none (x number)) x)", "()");
+  TEST_EVAL_FAILURE("(none 'a)");
+  TEST_EVAL_FAILURE("(define-method (none (x number) y) x)");
+  TEST_EVAL_FAILURE("(define-method (none (x shape)) x)");
+  TEST_EVAL_FAILURE("(define-method (car (x number)) x)");
+  TEST_EVAL_FAILURE("(define-method (none (x)) x)");
+  TEST_EVAL_FAILURE("(define-method none x)");
+  TEST_EVAL_FAILURE("(define-generic)");
+  return PASS_CODE;
+}
+
+int test_parameterize(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define depth (make-parameter 0))", "()");
+  TEST_EVAL("(define indent (make-parameter \"\"))", "()");
+  TEST_EVAL("(depth)", "0");
+  TEST_EVAL("(parameterize ((depth 1)) (depth))", "1");
+  TEST_EVAL("(depth)", "0");
+
+  // Bindings are seen by the procedures called within the body, and the
+  // innermost one wins.
+  TEST_EVAL("(define current (lambda () (list (depth) (indent))))", "()");
+  TEST_EVAL("(parameterize ((depth 1) (indent \"  \"))"
+            "  (list (current) (parameterize ((depth (+ (depth) 1))) (current)) (current)))",
+            "((1 \"  \") (2 \"  \") (1 \"  \"))");
+  TEST_EVAL("(parameterize ((depth 1) (depth 2)) (depth))", "2");
+  TEST_EVAL("(current)", "(0 \"\")");
+
+  // Every value is evaluated before any parameter is bound.
+  TEST_EVAL("(parameterize ((depth 5) (indent (depth))) (indent))", "0");
+  TEST_EVAL("(parameterize () 1 2)", "2");
+
+  // The previous values are restored however the body is left.
+  TEST_EVAL_FAILURE("(parameterize ((depth 7)) (car 1))");
+  TEST_EVAL("(depth)", "0");
+  TEST_EVAL("(call/ec (lambda (k) (parameterize ((depth 8)) (k (depth)))))", "8");
+  TEST_EVAL("(depth)", "0");
+  TEST_EVAL("(parameterize ((depth 1))"
+            "  (list (call/ec (lambda (k) (parameterize ((depth 2) (indent 'x)) (k (current))))) (current)))",
+            "((2 x) (1 \"\"))");
+  TEST_EVAL("(current)", "(0 \"\")");
+
+  TEST_EVAL_FAILURE("(depth 1)");
+  TEST_EVAL_FAILURE("(parameterize ((car 1)) 1)");
+  TEST_EVAL_FAILURE("(parameterize ((depth)) 1)");
+  TEST_EVAL_FAILURE("(parameterize (depth 1) 1)");
+  TEST_EVAL_FAILURE("(parameterize ((depth 1)))");
+  TEST_EVAL_FAILURE("(make-parameter)");
+  return PASS_CODE;
+}
+
+int test_records(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-record-type account (make-account owner balance) account?"
+            "  (owner account-owner)"
+            "  (balance account-balance set-account-balance!)"
+            "  (history account-history set-account-history!))", "()");
+  TEST_EVAL("(define a (make-account 'ann 10))", "()");
+  TEST_EVAL("a", "<account ann 10 ()>");
+  TEST_EVAL("(list (account-owner a) (account-balance a) (account-history a))", "(ann 10 ())");
+  TEST_EVAL("(list (account? a) (account? 'a) (account? '(ann 10)))", "(true false false)");
+
+  // Records are updated in place, and every reference sees the change.
+  TEST_EVAL("(define deposit"
+            "  (lambda (acc n)"
+            "    (set-account-balance! acc (+ (account-balance acc) n))"
+            "    (set-account-history! acc (cons n (account-history acc)))))", "()");
+  TEST_EVAL("(define both (list a a))", "()");
+  TEST_EVAL("(deposit a 5)", "()");
+  TEST_EVAL("(deposit (car (cdr both)) 7)", "()");
+  TEST_EVAL("(list (account-balance (car both)) (account-history a))", "(22 (7 5))");
+
+  // The constructor takes the fields it lists in its own order, or every
+  // field when it is a name alone.
+  TEST_EVAL("(define-record-type pair2 (swap b a) pair2? (a first2) (b second2))", "()");
+  TEST_EVAL("(list (first2 (swap 1 2)) (second2 (swap 1 2)))", "(2 1)");
+  TEST_EVAL("(define-record-type leaf leaf leaf? (value leaf-value))", "()");
+  TEST_EVAL("(leaf-value (leaf 'x))", "x");
+  TEST_EVAL("(leaf? (leaf 1))", "true");
+
+  // Records of different types, and generic functions chosen by them.
+  TEST_EVAL("(leaf? a)", "false");
+  TEST_EVAL("(define-generic describe)", "()");
+  TEST_EVAL("(define-method (describe (r record)) (if (leaf? r) 'leaf 'record))", "()");
+  TEST_EVAL("(define-method (describe x) 'other)", "()");
+  TEST_EVAL("(list (describe a) (describe (leaf 1)) (describe 1))", "(record leaf other)");
+
+  TEST_EVAL_FAILURE("(account-owner (leaf 1))");
+  TEST_EVAL_FAILURE("(account-owner 'ann)");
+  TEST_EVAL_FAILURE("(make-account 'ann)");
+  TEST_EVAL_FAILURE("(account-owner a 1)");
+  TEST_EVAL_FAILURE("(set-account-balance! a)");
+  TEST_EVAL_FAILURE("(define-record-type bad (make-bad z) bad? (x bad-x))");
+  TEST_EVAL_FAILURE("(define-record-type bad (make-bad x) bad? (x bad-x) (x bad-x2))");
+  TEST_EVAL_FAILURE("(define-record-type bad (make-bad x) bad? x)");
+  TEST_EVAL_FAILURE("(define-record-type bad (make-bad x) bad? (x))");
+  TEST_EVAL_FAILURE("(define-record-type bad)");
+  return PASS_CODE;
+}
+
+int test_list_library(test_fixture_t *fixture)
+{
+  TEST_EVAL("(map (lambda (x) (* x x)) '(1 2 3))", "(1 4 9)");
+  TEST_EVAL("(map + '(1 2 3) '(10 20))", "(11 22)");
+  TEST_EVAL("(map car '())", "()");
+  TEST_EVAL("(filter number? '(1 a 2 \"s\" 3))", "(1 2 3)");
+  TEST_EVAL("(filter symbol? '(1 2))", "()");
+  TEST_EVAL("(fold + 0 '(1 2 3 4))", "10");
+  TEST_EVAL("(fold cons '() '(1 2 3))", "(3 2 1)");
+  TEST_EVAL("(fold + 5 '())", "5");
+  TEST_EVAL("(append '(1 2) '() '(3) '(4 5))", "(1 2 3 4 5)");
+  TEST_EVAL("(append '(1) 2)", "(1 . 2)");
+  TEST_EVAL("(append)", "()");
+  TEST_EVAL("(append '() 'a)", "a");
+  TEST_EVAL("(reverse '(1 (2 3) 4))", "(4 (2 3) 1)");
+  TEST_EVAL("(reverse '())", "()");
+  TEST_EVAL("(assoc 'b '((a 1) (b 2) (c 3)))", "(b 2)");
+  TEST_EVAL("(assoc '(1 2) '(((1) one) ((1 2) two)))", "((1 2) two)");
+  TEST_EVAL("(assoc \"x\" '((\"x\" . 1)))", "(\"x\" . 1)");
+  TEST_EVAL("(assoc 'z '((a 1)))", "false");
+
+  // Lambdas and closures are applied, and the last list is shared.
+  TEST_EVAL("(define scale (lambda (k) (lambda (x) (* k x))))", "()");
+  TEST_EVAL("(fold + 0 (map (scale 3) (filter number? '(1 a 2 b 3))))", "18");
+  TEST_EVAL("(define tail '(9))", "()");
+  TEST_EVAL("(define joined (append '(1 2) tail))", "()");
+  TEST_EVAL("(length joined)", "3");
+
+  // Lists far longer than the C stack could recurse over.
+  TEST_EVAL("(define iota (lambda (n) (let loop ((n n) (acc '())) (match n (0 acc) (_ (loop (- n 1) (cons n acc)))))))", "()");
+  TEST_EVAL("(define big (iota 100000))", "()");
+  TEST_EVAL("(fold + 0 (map (lambda (x) (match x (1 1) (_ 0))) big))", "1");
+  TEST_EVAL("(length (map (lambda (x) (* 2 x)) big))", "100000");
+  TEST_EVAL("(length (filter symbol? (reverse (cons 'a big))))", "1");
+  TEST_EVAL("(length (append big big))", "200000");
+
+  // Escapes and errors from within the procedure.
+  TEST_EVAL("(call/ec (lambda (k) (map (lambda (x) (match x (2 (k 'found)) (_ x))) '(1 2 3))))", "found");
+  TEST_EVAL("(map (lambda (x) x) '(1))", "(1)");
+  TEST_EVAL_FAILURE("(map car '(1 2))");
+  TEST_EVAL_FAILURE("(map 1 '(1 2))");
+  TEST_EVAL_FAILURE("(map car '(1 . 2))");
+  TEST_EVAL_FAILURE("(filter number? 1)");
+  TEST_EVAL_FAILURE("(fold + 0 '(a))");
+  TEST_EVAL_FAILURE("(append 1 '(2))");
+  TEST_EVAL_FAILURE("(reverse 'a)");
+  TEST_EVAL_FAILURE("(assoc 'a '(1))");
+  TEST_EVAL_FAILURE("(map car)");
+  return PASS_CODE;
+}
+
 static void setup(test_fixture_t *fixture)
 {
   fixture->crisp = init_interpreter();
+  set_eval_mode(fixture->crisp, eval_mode_under_test);
+  set_compile_threshold(fixture->crisp, compile_threshold_under_test);
 }
 
 static void teardown(test_fixture_t *fixture)
 {
   free_interpreter(fixture->crisp);
 }
+
+int test_vectors(test_fixture_t *fixture)
+{
+  // Vectors evaluate to themselves, quoted or not.
+  TEST_EVAL("#(1 (2 3) \"s\" #(a))", "#(1 (2 3) \"s\" #(a))");
+  TEST_EVAL("'#(a b)", "#(a b)");
+  TEST_EVAL("#()", "#()");
+  TEST_EVAL("(list (vector? #(1)) (vector? '(1)) (vector? 1))", "(true false false)");
+
+  TEST_EVAL("(define v (make-vector 3 0))", "()");
+  TEST_EVAL("(vector-set! v 1 'x)", "()");
+  TEST_EVAL("v", "#(0 x 0)");
+  TEST_EVAL("(list (vector-ref v 0) (vector-ref v 1) (vector-length v))", "(0 x 3)");
+  TEST_EVAL("(make-vector 2)", "#(() ())");
+  TEST_EVAL("(vector 1 (+ 1 1) 'c)", "#(1 2 c)");
+  TEST_EVAL("(vector->list #(1 2 3))", "(1 2 3)");
+  TEST_EVAL("(list->vector '(1 2 3))", "#(1 2 3)");
+  TEST_EVAL("(vector->list (list->vector '()))", "()");
+  TEST_EVAL("(assoc #(1 2) '((#(1) a) (#(1 2) b)))", "(#(1 2) b)");
+
+  // Each element is got and set by its index, here to fill a table of
+  // the fibonacci numbers from the two entries before each.
+  TEST_EVAL("(define fib"
+            "  (lambda (n)"
+            "    (let ((t (make-vector (+ n 1) 1)))"
+            "      (let loop ((i 2))"
+            "        (match (- i n 1)"
+            "          (0 (vector-ref t n))"
+            "          (_ (vector-set! t i (+ (vector-ref t (- i 1)) (vector-ref t (- i 2))))"
+            "             (loop (+ i 1))))))))", "()");
+  TEST_EVAL("(fib 30)", "1.34627e+06");
+  TEST_EVAL("(vector-length (make-vector 100000 0))", "100000");
+
+  TEST_EVAL("(define-generic describe)", "()");
+  TEST_EVAL("(define-method (describe (x vector)) (vector-length x))", "()");
+  TEST_EVAL("(define-method (describe x) 'other)", "()");
+  TEST_EVAL("(list (describe #(1 2)) (describe '(1 2)))", "(2 other)");
+
+  TEST_EVAL_FAILURE("(vector-ref v 3)");
+  TEST_EVAL_FAILURE("(vector-ref v -1)");
+  TEST_EVAL_FAILURE("(vector-ref '(1) 0)");
+  TEST_EVAL_FAILURE("(vector-ref v 'a)");
+  TEST_EVAL_FAILURE("(vector-set! v 3 0)");
+  TEST_EVAL_FAILURE("(vector-length '(1))");
+  TEST_EVAL_FAILURE("(make-vector -1)");
+  TEST_EVAL_FAILURE("(make-vector 'a)");
+  TEST_EVAL_FAILURE("(vector->list '(1))");
+  TEST_EVAL_FAILURE("(list->vector '(1 . 2))");
+  return PASS_CODE;
+}
+
+int test_arrays(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define f (list->f64-array (list (/ 3 2) -2 3 4 5)))", "()");
+  TEST_EVAL("(define i (list->i64-array '(5 -3 9 1 7)))", "()");
+  TEST_EVAL("f", "#f64(1.5 -2 3 4 5)");
+  TEST_EVAL("i", "#i64(5 -3 9 1 7)");
+  TEST_EVAL("(list (array? f) (array? #(1)) (array-length i))", "(true false 5)");
+  TEST_EVAL("(make-f64-array 3)", "#f64(0 0 0)");
+  TEST_EVAL("(make-i64-array 2 -4)", "#i64(-4 -4)");
+  TEST_EVAL("(array->list (list->i64-array '()))", "()");
+
+  TEST_EVAL("(array-set! i 1 10)", "()");
+  TEST_EVAL("(array-set! f 0 (/ 1 4))", "()");
+  TEST_EVAL("(list (array-ref i 1) (array-ref f 0))", "(10 0.25)");
+  TEST_EVAL("(array->list f)", "(0.25 -2 3 4 5)");
+
+  TEST_EVAL("(list (array-sum i) (array-min i) (array-max i) (array-dot i i))", "(32 1 10 256)");
+  TEST_EVAL("(list (array-sum f) (array-min f) (array-max f) (array-dot f f))", "(10.25 -2 5 54.0625)");
+  TEST_EVAL("(array-sum (make-f64-array 0))", "0");
+  TEST_EVAL("(array-add i i)", "#i64(10 20 18 2 14)");
+  TEST_EVAL("(array-mul i i)", "#i64(25 100 81 1 49)");
+  TEST_EVAL("(array-scale i -2)", "#i64(-10 -20 -18 -2 -14)");
+  TEST_EVAL("(array-scale f 2)", "#f64(0.5 -4 6 8 10)");
+  TEST_EVAL("(array-prefix-sum i)", "#i64(5 15 24 25 32)");
+  TEST_EVAL("(array-prefix-sum f)", "#f64(0.25 -1.75 1.25 5.25 10.25)");
+
+  // Arrays long enough to be summed in parallel lanes.
+  TEST_EVAL("(define big (array-prefix-sum (make-i64-array 100000 1)))", "()");
+  TEST_EVAL("(list (array-ref big 99999) (array-min big) (array-max big))", "(100000 1 100000)");
+  TEST_EVAL("(array-sum big)", "5.00005e+09");
+  TEST_EVAL("(array-sum (array-scale (make-f64-array 100001 (/ 1 2)) 4))", "200002");
+
+  // Arrays are equal when their kinds and elements are.
+  TEST_EVAL("(assoc (list->i64-array '(1 2)) (list (cons (list->f64-array '(1 2)) 'f64)"
+            "                                      (cons (list->i64-array '(1 2)) 'i64)))", "(#i64(1 2) . i64)");
+  TEST_EVAL_FAILURE("(array-ref f 5)");
+  TEST_EVAL_FAILURE("(array-ref f 'a)");
+  TEST_EVAL_FAILURE("(array-set! i 0 (/ 3 2))");
+  TEST_EVAL_FAILURE("(array-set! f 0 'a)");
+  TEST_EVAL_FAILURE("(list->i64-array '(1 a))");
+  TEST_EVAL_FAILURE("(make-i64-array -1)");
+  TEST_EVAL_FAILURE("(array-add f i)");
+  TEST_EVAL_FAILURE("(array-dot i (make-i64-array 2))");
+  TEST_EVAL_FAILURE("(array-min (make-f64-array 0))");
+  TEST_EVAL_FAILURE("(array-scale i (/ 1 2))");
+  TEST_EVAL_FAILURE("(array-sum '(1 2))");
+  return PASS_CODE;
+}
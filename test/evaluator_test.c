@@ -4,12 +4,308 @@
 #include "value.h"
 #include "interpreter_internal.h"
 
+#include <stdio.h>
+#include <time.h>
+
 typedef struct
 {
   crisp_t *crisp;
   bool error_called;
 } test_fixture_t;
 
+static int test_region_frames(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define inc (lambda (n) (+ n 1)))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define adder (lambda (n) (lambda (m) (+ n m))))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define make (lambda (n) (letrec ((f (lambda (m) (+ m n)))) f)))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define bad (lambda (n) (car n)))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define leave (lambda (k n) (k n)))"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+    cek_stack_t *stack = eval_stack(crisp);
+
+    // The frame of a call that can not capture it is not garbage
+    // collected, only the result of (+ n 1) is allocated.
+    expr_t call = read(crisp, "(inc (inc 1))");
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    expr_t result = eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 2);
+    TEST_ASSERT(as_number(result) == 3.0);
+    TEST_ASSERT(stack->env_count == 0);
+    TEST_ASSERT(stack->free_envs != NULL);
+
+    // Closures copy what they use out of the frame they were made in.
+    eval(crisp, read(crisp, "(define add2 (adder 2))"), root_env(crisp));
+    crisp_gc(crisp);
+    result = eval(crisp, read(crisp, "(add2 3)"), root_env(crisp));
+    TEST_ASSERT(as_number(result) == 5.0);
+
+    // Including region frames that are captured after all, here by the
+    // shared frame of a letrec.
+    eval(crisp, read(crisp, "(define inc2 (make 1))"), root_env(crisp));
+    TEST_ASSERT(stack->env_count == 0);
+    crisp_gc(crisp);
+    result = eval(crisp, read(crisp, "(inc2 4)"), root_env(crisp));
+    TEST_ASSERT(as_number(result) == 5.0);
+
+    // The region is released by errors and escapes.
+    TEST_ASSERT(eval(crisp, read(crisp, "(inc (bad 1))"), root_env(crisp)) == NULL);
+    TEST_ASSERT(f->error_called == true);
+    f->error_called = false;
+    TEST_ASSERT(stack->env_count == 0);
+
+    result = eval(crisp, read(crisp, "(call/ec (lambda (k) (inc (leave k 7))))"), root_env(crisp));
+    TEST_ASSERT(as_number(result) == 7.0);
+    TEST_ASSERT(stack->env_count == 0);
+  }
+
+  return PASS_CODE;
+}
+
+static int test_flat_closures(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define adder (lambda (n unused) (lambda (m) (+ n m))))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define nest (lambda (a) (lambda (b) (lambda (c) (list a b c)))))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define hide (lambda (x) (lambda (x) (list x 'unused))))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define box (lambda (v) (list (lambda () v) (lambda (n) (set! v n)))))"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // Only the free variables of the lambda are held by its closure.
+    expr_t add2 = eval(crisp, read(crisp, "(adder 2 'big)"), root_env(crisp));
+    TEST_ASSERT(is_lambda(add2));
+    env_t *closure = as_lambda(add2)->env;
+    TEST_ASSERT(closure->parent == root_env(crisp));
+    TEST_ASSERT(closure->table.size == 1);
+
+    // A closure that refers to no local variable needs no environment.
+    expr_t same = eval(crisp, read(crisp, "(hide 1)"), root_env(crisp));
+    TEST_ASSERT(as_lambda(same)->env == root_env(crisp));
+
+    // Free variables of nested lambdas are carried through each level.
+    eval(crisp, read(crisp, "(define inner ((nest 1) 2))"), root_env(crisp));
+    crisp_gc(crisp);
+    expr_t result = eval(crisp, read(crisp, "(inner 3)"), root_env(crisp));
+    TEST_ASSERT(is_nil(cdr(cdr(cdr(result)))));
+    TEST_ASSERT(as_number(car(result)) == 1.0);
+    TEST_ASSERT(as_number(car(cdr(result))) == 2.0);
+    TEST_ASSERT(as_number(car(cdr(cdr(result)))) == 3.0);
+    TEST_ASSERT(as_lambda(eval(crisp, read(crisp, "inner"), root_env(crisp)))->env->table.size == 2);
+
+    // A frame whose variables are assigned is shared by the closures made
+    // in it, rather than copied.
+    eval(crisp, read(crisp, "(define b (box 1))"), root_env(crisp));
+    expr_t get = eval(crisp, read(crisp, "(car b)"), root_env(crisp));
+    TEST_ASSERT(as_lambda(get)->env->shared);
+    eval(crisp, read(crisp, "((car (cdr b)) 2)"), root_env(crisp));
+    crisp_gc(crisp);
+    TEST_ASSERT(as_number(eval(crisp, read(crisp, "((car b))"), root_env(crisp))) == 2.0);
+  }
+
+  return PASS_CODE;
+}
+
+static int test_record_slots(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define-record-type point (make-point y x) point? (x point-x set-point-x!) (y point-y))"),
+       root_env(crisp));
+  eval(crisp, read(crisp, "(define a 1)"), root_env(crisp));
+  eval(crisp, read(crisp, "(define b 2)"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // Making a record allocates only the record, its fields are held in
+    // slots in the order the type lists them.
+    expr_t call = read(crisp, "(make-point a b)");
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    expr_t p = eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 1);
+    TEST_ASSERT(is_record(p));
+    TEST_ASSERT(p->as.record.count == 2);
+    TEST_ASSERT(as_number(p->as.record.slots[0]) == 2.0);
+    TEST_ASSERT(as_number(p->as.record.slots[1]) == 1.0);
+
+    // The slots are traced by the collector.
+    eval(crisp, read(crisp, "(define p (make-point (+ a b) (+ b b)))"), root_env(crisp));
+    crisp_gc(crisp);
+    expr_t x = eval(crisp, read(crisp, "(begin (set-point-x! p (list (point-x p))) p)"), root_env(crisp));
+    crisp_gc(crisp);
+    TEST_ASSERT(as_number(car(x->as.record.slots[0])) == 4.0);
+    TEST_ASSERT(as_number(eval(crisp, read(crisp, "(point-y p)"), root_env(crisp))) == 3.0);
+  }
+
+  return PASS_CODE;
+}
+
+static int test_vector_items(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define n 1000)"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // Making a vector allocates only the vector, whose elements are held
+    // in one array.
+    expr_t call = read(crisp, "(make-vector n n)");
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    expr_t v = eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 1);
+    TEST_ASSERT(is_vector(v));
+    TEST_ASSERT(v->as.vector.count == 1000);
+    TEST_ASSERT(as_number(v->as.vector.items[999]) == 1000.0);
+
+    // The elements are traced by the collector.
+    eval(crisp, read(crisp, "(define v (make-vector 2 0))"), root_env(crisp));
+    eval(crisp, read(crisp, "(vector-set! v 1 (list (+ n 1)))"), root_env(crisp));
+    crisp_gc(crisp);
+    v = eval(crisp, read(crisp, "v"), root_env(crisp));
+    TEST_ASSERT(as_number(car(v->as.vector.items[1])) == 1001.0);
+  }
+
+  return PASS_CODE;
+}
+
+static int test_list_library_allocation(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define l '(1 2 3 4))"), root_env(crisp));
+  eval(crisp, read(crisp, "(define id (lambda (x) x))"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // A pair for each element and the () that ends the result. The
+    // arguments of id are passed in a vector, not a list.
+    expr_t call = read(crisp, "(map id l)");
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 5);
+
+    call = read(crisp, "(filter number? l)");
+    before = get_gc_stats(crisp).objects_allocated;
+    eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 4 + 5);
+
+    TEST_ASSERT(eval_stack(crisp)->args == NULL || eval_stack(crisp)->args->top == 0);
+  }
+
+  return PASS_CODE;
+}
+
+static int test_fusion_allocation(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define l '(1 2 3 4))"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // Unfused, the map makes a list of four for the fold to consume.
+    const char *src = "(fold + 0 (map (lambda (x) (* x x)) l))";
+    expr_t call = read(crisp, src);
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    expr_t result = eval(crisp, call, root_env(crisp));
+    size_t unfused = get_gc_stats(crisp).objects_allocated - before;
+    TEST_ASSERT(as_number(result) == 30.0);
+
+    // Fused, none of its pairs or the () that ends them are made.
+    call = read(crisp, src);
+    TEST_ASSERT(optimize(crisp, call).fused == 1);
+    before = get_gc_stats(crisp).objects_allocated;
+    result = eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(as_number(result) == 30.0);
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated - before + 5 <= unfused);
+
+    TEST_ASSERT(eval_stack(crisp)->args == NULL || eval_stack(crisp)->args->top == 0);
+  }
+
+  return PASS_CODE;
+}
+
+// What running a form and then collecting cost.
+typedef struct
+{
+  size_t allocated;
+  size_t freed;
+  double run_seconds;
+  double collection_seconds;
+} run_cost_t;
+
+// The number the form evaluates to is read before the collection frees it.
+static run_cost_t run_and_collect(crisp_t *crisp, expr_t call, double *result)
+{
+  gc_stats_t before = get_gc_stats(crisp);
+  clock_t start = clock();
+  expr_t value = eval(crisp, call, root_env(crisp));
+  double run_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  *result = ((value != NULL) && is_number(value)) ? as_number(value) : 0.0;
+  size_t allocated = get_gc_stats(crisp).objects_allocated - before.objects_allocated;
+  crisp_gc(crisp);
+
+  gc_stats_t after = get_gc_stats(crisp);
+  return (run_cost_t){allocated, after.objects_freed - before.objects_freed, run_seconds,
+                      after.collection_seconds - before.collection_seconds};
+}
+
+// Fusion over a list long enough for its cost to show, reported with and
+// without it.
+static int test_fusion_benchmark(test_fixture_t *f)
+{
+  const size_t count = 100000;
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define big (vector->list (make-vector 100000 3)))"), root_env(crisp));
+  const char *src = "(fold + 0 (map (lambda (x) (* x x)) (filter number? big)))";
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  const char *names[] = {"recursive", "cek"};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    double result;
+    run_cost_t unfused = run_and_collect(crisp, read(crisp, src), &result);
+    TEST_ASSERT(result == 900000.0);
+
+    expr_t call = read(crisp, src);
+    TEST_ASSERT(optimize(crisp, call).fused == 1);
+    run_cost_t fused = run_and_collect(crisp, call, &result);
+    TEST_ASSERT(result == 900000.0);
+
+    printf("fusion over %zu elements, %s: unfused %zu allocated, %zu freed, %.2f ms running, %.2f ms collecting; "
+           "fused %zu allocated, %zu freed, %.2f ms running, %.2f ms collecting\n",
+           count, names[i], unfused.allocated, unfused.freed, unfused.run_seconds * 1000.0,
+           unfused.collection_seconds * 1000.0, fused.allocated, fused.freed, fused.run_seconds * 1000.0,
+           fused.collection_seconds * 1000.0);
+
+    // Neither the filtered list nor the mapped one is made, so there is a
+    // pair for each of them per element less to allocate, and much less
+    // garbage to collect.
+    TEST_ASSERT(fused.allocated + 2 * count <= unfused.allocated);
+    TEST_ASSERT(fused.freed + count <= unfused.freed);
+  }
+
+  return PASS_CODE;
+}
+
 static void setup(test_fixture_t *fixture);
 static void teardown(test_fixture_t *fixture);
 static void error_handler(crisp_t *, void *);
@@ -19,6 +315,15 @@ static int test_bind_env(test_fixture_t *);
 static int test_bind_env_single(test_fixture_t *);
 static int test_bind_env_improper_list(test_fixture_t *);
 static int test_bind_env_errors(test_fixture_t *);
+static int test_global_cell_cache(test_fixture_t *);
+static int test_builtin_argument_vectors(test_fixture_t *);
+static int test_region_frames(test_fixture_t *);
+static int test_flat_closures(test_fixture_t *);
+static int test_record_slots(test_fixture_t *);
+static int test_vector_items(test_fixture_t *);
+static int test_list_library_allocation(test_fixture_t *);
+static int test_fusion_allocation(test_fixture_t *);
+static int test_fusion_benchmark(test_fixture_t *);
 
 int main(int argc, char **argv)
 {
@@ -29,6 +334,15 @@ int main(int argc, char **argv)
   RUN_TEST_WITH_FIXTURE(test_bind_env_single);
   RUN_TEST_WITH_FIXTURE(test_bind_env_errors);
   RUN_TEST_WITH_FIXTURE(test_bind_env_improper_list);
+  RUN_TEST_WITH_FIXTURE(test_global_cell_cache);
+  RUN_TEST_WITH_FIXTURE(test_builtin_argument_vectors);
+  RUN_TEST_WITH_FIXTURE(test_region_frames);
+  RUN_TEST_WITH_FIXTURE(test_flat_closures);
+  RUN_TEST_WITH_FIXTURE(test_record_slots);
+  RUN_TEST_WITH_FIXTURE(test_vector_items);
+  RUN_TEST_WITH_FIXTURE(test_list_library_allocation);
+  RUN_TEST_WITH_FIXTURE(test_fusion_allocation);
+  RUN_TEST_WITH_FIXTURE(test_fusion_benchmark);
 
   return PASS_CODE;
 }
@@ -159,6 +473,66 @@ static int test_bind_env_errors(test_fixture_t *f)
   return PASS_CODE;
 }
 
+static int test_global_cell_cache(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+
+  // References to globals cache the cell they resolve to.
+  expr_t call = read(crisp, "(+ x 1)");
+  eval(crisp, read(crisp, "(define x 1)"), root_env(crisp));
+  TEST_ASSERT(as_number(eval(crisp, call, root_env(crisp))) == 2.0);
+  TEST_ASSERT(car(call)->as.atom.cell == env_get_cell(root_env(crisp), as_atom(car(call))));
+  TEST_ASSERT(car(cdr(call))->as.atom.cell != NULL);
+
+  // Redefinition is seen through the cached cell.
+  eval(crisp, read(crisp, "(define x 10)"), root_env(crisp));
+  TEST_ASSERT(as_number(eval(crisp, call, root_env(crisp))) == 11.0);
+
+  // Atoms bound by a lambda are never cached.
+  expr_t shadow = read(crisp, "((lambda (+ y) (+ y 1)) - 5)");
+  TEST_ASSERT(as_number(eval(crisp, shadow, root_env(crisp))) == 4.0);
+  expr_t body = car(cdr(cdr(car(shadow))));
+  TEST_ASSERT(car(body)->as.atom.cell == NULL);
+  TEST_ASSERT(as_number(eval(crisp, shadow, root_env(crisp))) == 4.0);
+
+  TEST_ASSERT(f->error_called == false);
+  return PASS_CODE;
+}
+
+static int test_builtin_argument_vectors(test_fixture_t *f)
+{
+  crisp_t *crisp = f->crisp;
+  eval(crisp, read(crisp, "(define a 1)"), root_env(crisp));
+  eval(crisp, read(crisp, "(define b 2)"), root_env(crisp));
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    set_eval_mode(crisp, modes[i]);
+
+    // Only the result of (+ a b) is allocated, the operands are passed
+    // to the builtin without building a list.
+    expr_t call = read(crisp, "(+ a b)");
+    size_t before = get_gc_stats(crisp).objects_allocated;
+    expr_t result = eval(crisp, call, root_env(crisp));
+    TEST_ASSERT(get_gc_stats(crisp).objects_allocated == before + 1);
+    TEST_ASSERT(as_number(result) == 3.0);
+
+    // Arity is checked against the registered range.
+    TEST_ASSERT(eval(crisp, read(crisp, "(car '(1) '(2))"), root_env(crisp)) == NULL);
+    TEST_ASSERT(f->error_called == true);
+    f->error_called = false;
+    TEST_ASSERT(eval(crisp, read(crisp, "(+)"), root_env(crisp)) == NULL);
+    TEST_ASSERT(f->error_called == true);
+    f->error_called = false;
+
+    // The argument stack is balanced after both success and failure.
+    TEST_ASSERT(eval_stack(crisp)->args == NULL || eval_stack(crisp)->args->top == 0);
+  }
+
+  return PASS_CODE;
+}
+
 static void setup(test_fixture_t *fixture)
 {
   fixture->crisp = init_interpreter();
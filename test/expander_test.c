@@ -0,0 +1,343 @@
+#include "simple_test.h"
+#include "expander.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+#define TEST_EVAL(src, exp)                                    \
+  if (execute_crisp_code(fixture->crisp, src, exp,             \
+                        __FILE__, __LINE__,                    \
+                        false, true, false) != PASS_CODE) {    \
+    return FAIL_CODE;                                          \
+  }
+
+#define TEST_EVAL_FAILURE(src)                                 \
+  if (execute_crisp_code(fixture->crisp, src, "",              \
+                        __FILE__, __LINE__,                    \
+                        false, true, true) != PASS_CODE) {     \
+    return FAIL_CODE;                                          \
+  }
+
+// Expand a form without evaluating it.
+#define TEST_EXPAND(src, exp)                                                  \
+  {                                                                            \
+    expr_t node = expand(fixture->crisp, read(fixture->crisp, src));           \
+    TEST_ASSERT(node != NULL);                                                 \
+    if (compare_crisp_value(node, exp, __FILE__, __LINE__) != PASS_CODE)       \
+      return FAIL_CODE;                                                        \
+  }
+
+typedef struct
+{
+  crisp_t *crisp;
+} test_fixture_t;
+
+int test_quasiquote(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define x 2)", "()");
+  TEST_EVAL("`(a b)", "(a b)");
+  TEST_EVAL("`(a ,x c)", "(a 2 c)");
+  TEST_EVAL("`(a ,@(list x 3) c)", "(a 2 3 c)");
+  TEST_EVAL("`(,@(list 1 2))", "(1 2)");
+  TEST_EVAL("`(a ,@'() b)", "(a b)");
+  TEST_EVAL("`(a . ,x)", "(a . 2)");
+  TEST_EVAL("`,x", "2");
+  TEST_EVAL("(let ((x 5)) `(x ,(+ x 1)))", "(x 6)");
+
+  // Only the unquotes of the outermost quasiquote are evaluated.
+  TEST_EVAL("`(1 `(2 ,(3 ,x)))", "(1 (quasiquote (2 (unquote (3 2)))))");
+
+  // The unquoted forms are code, the rest of a template is data.
+  TEST_EVAL("(define-syntax tagged (syntax-rules () ((_ e) (let ((v e)) `(v ,v)))))", "()");
+  TEST_EVAL("(tagged 1)", "(v 1)");
+
+  TEST_EVAL_FAILURE(",x");
+  TEST_EVAL_FAILURE("(quasiquote)");
+  TEST_EVAL_FAILURE("`,@x");
+  TEST_EVAL_FAILURE("`(,@1)");
+
+  // The template is compiled into the code that builds it, in which
+  // constant parts are quoted as they are.
+  TEST_EXPAND("`(a ,x (b c))",
+              "(cons#quasiquote (quote a) (cons#quasiquote x (quote ((b c)))))");
+  TEST_EXPAND("`(a (b c))", "(quote (a (b c)))");
+
+  // Which every evaluation shares.
+  expr_t node = read(fixture->crisp, "`(,x b c)");
+  expr_t template = car(cdr(node));
+  expr_t first = eval(fixture->crisp, node, root_env(fixture->crisp));
+  expr_t second = eval(fixture->crisp, node, root_env(fixture->crisp));
+  TEST_ASSERT((first != NULL) && (second != NULL));
+  TEST_ASSERT(first != second);
+  TEST_ASSERT(cdr(first) == cdr(template));
+  TEST_ASSERT(cdr(second) == cdr(template));
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+
+static crisp_eval_mode_t eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+static size_t compile_threshold_under_test = 0;
+
+int test_syntax_rules(test_fixture_t *fixture);
+int test_ellipsis(test_fixture_t *fixture);
+int test_hygiene(test_fixture_t *fixture);
+int test_macro_scope(test_fixture_t *fixture);
+int test_expanded_once(test_fixture_t *fixture);
+int test_quasiquote(test_fixture_t *fixture);
+int test_loops(test_fixture_t *fixture);
+int test_match(test_fixture_t *fixture);
+int test_generic(test_fixture_t *fixture);
+int test_records(test_fixture_t *fixture);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK, CRISP_EVAL_MODE_SPECIALIZING};
+  size_t thresholds[] = {0, 1};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    for (size_t j = 0; j < sizeof(thresholds) / sizeof(thresholds[0]); j++)
+    {
+      eval_mode_under_test = modes[i];
+      compile_threshold_under_test = thresholds[j];
+      RUN_TEST_WITH_FIXTURE(test_syntax_rules);
+      RUN_TEST_WITH_FIXTURE(test_ellipsis);
+      RUN_TEST_WITH_FIXTURE(test_hygiene);
+      RUN_TEST_WITH_FIXTURE(test_macro_scope);
+      RUN_TEST_WITH_FIXTURE(test_expanded_once);
+      RUN_TEST_WITH_FIXTURE(test_quasiquote);
+      RUN_TEST_WITH_FIXTURE(test_loops);
+      RUN_TEST_WITH_FIXTURE(test_match);
+      RUN_TEST_WITH_FIXTURE(test_generic);
+      RUN_TEST_WITH_FIXTURE(test_records);
+    }
+  }
+
+  return PASS_CODE;
+}
+
+int test_syntax_rules(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-syntax unless"
+            "  (syntax-rules () ((_ test form ...) (if test '() (begin form ...)))))", "()");
+  TEST_EVAL("(unless (number? 'a) 1 2)", "2");
+  TEST_EVAL("(unless (number? 1) 1 2)", "()");
+
+  // The first rule that matches is used, literals match only themselves.
+  TEST_EVAL("(define-syntax arrow"
+            "  (syntax-rules (=>)"
+            "    ((_ a => b) (list 'to a b))"
+            "    ((_ a b) (list 'pair a b))"
+            "    ((_ a . more) (cons 'many '(a . more)))))", "()");
+  TEST_EVAL("(arrow 1 => 2)", "(to 1 2)");
+  TEST_EVAL("(arrow 1 2)", "(pair 1 2)");
+  TEST_EVAL("(arrow 1 2 3)", "(many 1 2 3)");
+  TEST_EVAL_FAILURE("(arrow)");
+
+  // Literal data in a pattern.
+  TEST_EVAL("(define-syntax zero? (syntax-rules () ((_ 0) 'yes) ((_ x) 'no)))", "()");
+  TEST_EVAL("(zero? 0)", "yes");
+  TEST_EVAL("(zero? 1)", "no");
+
+  // A macro may expand to a use of itself.
+  TEST_EVAL("(define-syntax my-or"
+            "  (syntax-rules ()"
+            "    ((_) (number? 'no))"
+            "    ((_ e) e)"
+            "    ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))", "()");
+  TEST_EVAL("(my-or)", "false");
+  TEST_EVAL("(my-or (number? 'a) (number? 'b) 3)", "3");
+
+  TEST_EVAL_FAILURE("(define-syntax bad (lambda (x) x))");
+  TEST_EVAL_FAILURE("(define-syntax bad (syntax-rules () (x)))");
+  TEST_EVAL_FAILURE("(define f (lambda () (define-syntax inner (syntax-rules () ((_) 1)))))");
+  TEST_EVAL("(define-syntax bad (syntax-rules () ((_ x ...) x)))", "()");
+  TEST_EVAL_FAILURE("(bad 1)");
+  return PASS_CODE;
+}
+
+int test_ellipsis(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-syntax my-let"
+            "  (syntax-rules () ((_ ((n v) ...) body ...) ((lambda (n ...) body ...) v ...))))", "()");
+  TEST_EVAL("(my-let ((a 1) (b 2)) (+ a b))", "3");
+  TEST_EVAL("(my-let () 4)", "4");
+
+  // Patterns after an ellipsis, and nested ellipses.
+  TEST_EVAL("(define-syntax last (syntax-rules () ((_ a ... z) '(z a ...))))", "()");
+  TEST_EVAL("(last 1 2 3)", "(3 1 2)");
+  TEST_EVAL("(last 1)", "(1)");
+  TEST_EVAL("(define-syntax flip (syntax-rules () ((_ (a b ...) ...) '((b ... a) ...))))", "()");
+  TEST_EVAL("(flip (1 2 3) (4) (5 6))", "((2 3 1) (4) (6 5))");
+
+  TEST_EVAL("(define-syntax zip (syntax-rules () ((_ (a ...) (b ...)) '((a b) ...))))", "()");
+  TEST_EVAL("(zip (1 2) (3 4))", "((1 3) (2 4))");
+  TEST_EVAL_FAILURE("(zip (1 2) (3))");
+  return PASS_CODE;
+}
+
+int test_hygiene(test_fixture_t *fixture)
+{
+  // The variable a template binds does not capture the one passed in.
+  TEST_EVAL("(define-syntax swap!"
+            "  (syntax-rules () ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))", "()");
+  TEST_EVAL("(define tmp 1)", "()");
+  TEST_EVAL("(define other 2)", "()");
+  TEST_EVAL("(swap! tmp other)", "()");
+  TEST_EVAL("(list tmp other)", "(2 1)");
+  TEST_EVAL("((lambda (tmp x) (swap! tmp x) (list tmp x)) 3 4)", "(4 3)");
+
+  TEST_EVAL("(define-syntax my-or2"
+            "  (syntax-rules () ((_ a b) (let ((t a)) (if t t b)))))", "()");
+  TEST_EVAL("(define t 5)", "()");
+  TEST_EVAL("(my-or2 (number? 'a) t)", "5");
+
+  // Quoted names keep their own.
+  TEST_EVAL("(define-syntax names (syntax-rules () ((_ x) (let ((y x)) (list 'y y)))))", "()");
+  TEST_EVAL("(names 1)", "(y 1)");
+  TEST_EXPAND("(names 1)", "(let ((y#6 1)) (list (quote y) y#6))");
+
+  // Each use of a pattern variable is a form of its own, so evaluating
+  // one use does not decide what the others refer to.
+  TEST_EVAL("(define y 1)", "()");
+  TEST_EVAL("(define-syntax m (syntax-rules () ((_ v e) (list e (let ((v 2)) e)))))", "()");
+  TEST_EVAL("(m y y)", "(1 2)");
+  TEST_EVAL("(m y y)", "(1 2)");
+
+  // Nor does a binding at the use site capture a name the template uses.
+  TEST_EVAL("(define-syntax my-list (syntax-rules () ((_ a) (list a))))", "()");
+  TEST_EVAL("(let ((list (lambda (x) 'captured))) (my-list 1))", "(1)");
+  TEST_EVAL("((lambda (list) (my-list 2)) car)", "(2)");
+  return PASS_CODE;
+}
+
+int test_macro_scope(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-syntax twice (syntax-rules () ((_ e) (begin e e))))", "()");
+  TEST_EVAL("(define n 0)", "()");
+  TEST_EVAL("(twice (set! n (+ n 1)))", "()");
+  TEST_EVAL("n", "2");
+
+  // A variable of the same name hides the macro.
+  TEST_EVAL("((lambda (twice) (twice 3)) (lambda (x) (* x 2)))", "6");
+  TEST_EVAL("(let ((twice list)) (twice 3))", "(3)");
+  TEST_EVAL("'(twice 1)", "(twice 1)");
+
+  // As does a later global.
+  TEST_EVAL("(define twice (lambda (x) (+ x x)))", "()");
+  TEST_EVAL("(twice 4)", "8");
+  return PASS_CODE;
+}
+
+int test_expanded_once(test_fixture_t *fixture)
+{
+  TEST_EVAL("(define-syntax inc! (syntax-rules () ((_ v) (let ((one 1)) (set! v (+ v one))))))", "()");
+  TEST_EVAL("(define count 0)", "()");
+  TEST_EVAL("(define bump (lambda () (inc! count) count))", "()");
+
+  // The body was expanded when the definition was, calling the lambda
+  // does not expand it again.
+  size_t aliases = expander(fixture->crisp)->aliases;
+  TEST_EVAL("(bump)", "1");
+  TEST_EVAL("(bump)", "2");
+  TEST_ASSERT(aliases == expander(fixture->crisp)->aliases);
+
+  // Nor does evaluating the same form again.
+  expr_t node = read(fixture->crisp, "(inc! count)");
+  TEST_ASSERT(eval(fixture->crisp, node, root_env(fixture->crisp)) != NULL);
+  TEST_ASSERT(node->flags & VALUE_FLAG_EXPANDED);
+  aliases = expander(fixture->crisp)->aliases;
+  TEST_ASSERT(eval(fixture->crisp, node, root_env(fixture->crisp)) != NULL);
+  TEST_ASSERT(aliases == expander(fixture->crisp)->aliases);
+  TEST_EVAL("count", "4");
+  return PASS_CODE;
+}
+
+int test_loops(test_fixture_t *fixture)
+{
+  // A do loop is a named let, whose calls in tail position go round again
+  // in the same frame.
+  TEST_EXPAND("(do ((i 0 (+ i 1))) ((symbol? i) i) (f i))",
+              "(let do#loop ((i 0)) (if (symbol? i) (begin i) (begin (f i) (recur#loop do#loop (+ i 1)))))");
+  TEST_EXPAND("(let loop ((l x)) (if (symbol? l) l (loop (cdr l))))",
+              "(let loop ((l x)) (if (symbol? l) l (recur#loop loop (cdr l))))");
+
+  // Any other named let is a letrec of its lambda.
+  TEST_EXPAND("(let f ((n 1)) (g f))", "((letrec ((f (lambda (n) (g f)))) f) 1)");
+  return PASS_CODE;
+}
+
+int test_match(test_fixture_t *fixture)
+{
+  // Each subterm is taken once it is needed, and tested just the once on
+  // any path. The forms of a clause reached by more than one path are
+  // copied.
+  TEST_EXPAND("(match e ((1 . x) x) (_ 0))",
+              "(let ((match#1 e)) (if (pair#match match#1)"
+              " (let ((match#2 (car#match match#1)))"
+              " (if (eqv#match match#2 (quote 1)) (let ((x (cdr#match match#1))) x) (begin 0)))"
+              " (begin 0)))");
+
+  // The variables of the patterns of a template are bound by the template.
+  TEST_EVAL("(define-syntax head (syntax-rules () ((_ e) (match e ((x . _) x) (_ 'none)))))", "()");
+  TEST_EVAL("(define x 5)", "()");
+  TEST_EVAL("(head (list x 2))", "5");
+  TEST_EVAL("(head 'x)", "none");
+  TEST_EVAL("(match (head '(1)) (x (head (list x x))))", "1");
+  return PASS_CODE;
+}
+
+int test_generic(test_fixture_t *fixture)
+{
+  TEST_EXPAND("(define-generic area)", "(define area (make#generic (quote area)))");
+  TEST_EXPAND("(define-method (area (s pair) scale . more) s)",
+              "(add-method#generic area (quote (pair _)) (lambda (s scale . more) s))");
+
+  // A macro that defines methods, whose parameters its template binds.
+  TEST_EVAL("(define-generic show)", "()");
+  TEST_EVAL("(define-syntax show-as (syntax-rules () ((_ type tag) (define-method (show (x type)) (list tag x)))))", "()");
+  TEST_EVAL("(define x 'outer)", "()");
+  TEST_EVAL("(show-as number x)", "()");
+  TEST_EVAL("(show-as symbol 'symbol)", "()");
+  TEST_EVAL("(list (show 1) (show 'a))", "((outer 1) (symbol a))");
+  return PASS_CODE;
+}
+
+int test_records(test_fixture_t *fixture)
+{
+  TEST_EXPAND("(define-record-type point (make-point x) point? (x point-x set-point-x!) (y point-y))",
+              "(let ((type#record (make#record-type (quote point) (quote (x y)))))"
+              " (define point type#record)"
+              " (define make-point (constructor#record type#record (quote (x))))"
+              " (define point? (predicate#record type#record))"
+              " (define point-x (accessor#record type#record (quote x)))"
+              " (define set-point-x! (modifier#record type#record (quote x)))"
+              " (define point-y (accessor#record type#record (quote y))))");
+  TEST_EXPAND("(define-record-type unit unit unit?)",
+              "(let ((type#record (make#record-type (quote unit) (quote ()))))"
+              " (define unit type#record)"
+              " (define unit (constructor#record type#record (quote ())))"
+              " (define unit? (predicate#record type#record)))");
+
+  // A macro that defines a record type with one field.
+  TEST_EVAL("(define-syntax define-box"
+            "  (syntax-rules () ((_ name get) (define-record-type name (name value) box? (value get)))))", "()");
+  TEST_EVAL("(define-box cell cell-value)", "()");
+  TEST_EVAL("(list (cell-value (cell 1)) (box? (cell 2)))", "(1 true)");
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  set_eval_mode(fixture->crisp, eval_mode_under_test);
+  set_compile_threshold(fixture->crisp, compile_threshold_under_test);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
@@ -0,0 +1,174 @@
+#include "simple_test.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+typedef struct
+{
+  crisp_t *crisp;
+  bool error_called;
+} test_fixture_t;
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static void error_handler(crisp_t *, void *);
+static expr_t run(test_fixture_t *f, const char *src);
+static dispatch_t *body_cache(test_fixture_t *f, const char *name);
+
+static int test_monomorphic(test_fixture_t *);
+static int test_polymorphic(test_fixture_t *);
+static int test_megamorphic(test_fixture_t *);
+static int test_invalidation(test_fixture_t *);
+
+// Every test is run against each of the evaluators.
+static crisp_eval_mode_t eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  crisp_eval_mode_t modes[] = {CRISP_EVAL_MODE_RECURSIVE, CRISP_EVAL_MODE_CEK, CRISP_EVAL_MODE_SPECIALIZING};
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+  {
+    eval_mode_under_test = modes[i];
+    RUN_TEST_WITH_FIXTURE(test_monomorphic);
+    RUN_TEST_WITH_FIXTURE(test_polymorphic);
+    RUN_TEST_WITH_FIXTURE(test_megamorphic);
+    RUN_TEST_WITH_FIXTURE(test_invalidation);
+  }
+
+  return PASS_CODE;
+}
+
+static void define_describe(test_fixture_t *f)
+{
+  run(f, "(define-generic describe)");
+  run(f, "(define-method (describe (x number)) 'number)");
+  run(f, "(define-method (describe (x string)) 'string)");
+  run(f, "(define-method (describe x) 'other)");
+  run(f, "(define call (lambda (x) (describe x)))");
+}
+
+static int test_monomorphic(test_fixture_t *f)
+{
+  define_describe(f);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 1)")), "number") == 0);
+
+  dispatch_t *cache = body_cache(f, "call");
+  TEST_ASSERT(cache != NULL);
+  TEST_ASSERT(cache->count == 1);
+  TEST_ASSERT(!cache->megamorphic);
+
+  // The same types hit the entry already there.
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 2)")), "number") == 0);
+  TEST_ASSERT(cache->count == 1);
+
+  // The cache survives a collection along with the form it belongs to.
+  crisp_gc(f->crisp);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 3)")), "number") == 0);
+  TEST_ASSERT(body_cache(f, "call") == cache);
+
+  return PASS_CODE;
+}
+
+static int test_polymorphic(test_fixture_t *f)
+{
+  define_describe(f);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 1)")), "number") == 0);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call \"s\")")), "string") == 0);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 'a)")), "other") == 0);
+
+  dispatch_t *cache = body_cache(f, "call");
+  TEST_ASSERT(cache->count == 3);
+  TEST_ASSERT(!cache->megamorphic);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call \"t\")")), "string") == 0);
+  TEST_ASSERT(cache->count == 3);
+
+  return PASS_CODE;
+}
+
+static int test_megamorphic(test_fixture_t *f)
+{
+  define_describe(f);
+  run(f, "(call 1)");
+  run(f, "(call \"s\")");
+  run(f, "(call 'a)");
+  run(f, "(call '())");
+  run(f, "(call '(1))");
+
+  // A fifth combination of types is not cached, but the method is still
+  // found.
+  dispatch_t *cache = body_cache(f, "call");
+  TEST_ASSERT(cache->count == DISPATCH_CACHE_ENTRIES);
+  TEST_ASSERT(cache->megamorphic);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call car)")), "other") == 0);
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 2)")), "number") == 0);
+
+  return PASS_CODE;
+}
+
+static int test_invalidation(test_fixture_t *f)
+{
+  define_describe(f);
+  run(f, "(call 'a)");
+  run(f, "(call 1)");
+  dispatch_t *cache = body_cache(f, "call");
+  TEST_ASSERT(cache->count == 2);
+
+  // A new method empties the cache the next time the site is called.
+  run(f, "(define-method (describe (x symbol)) 'symbol)");
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 'a)")), "symbol") == 0);
+  TEST_ASSERT(cache->count == 1);
+  TEST_ASSERT(cache->version == as_generic(run(f, "describe"))->version);
+
+  // As does a different generic function at the same site.
+  run(f, "(define-generic describe)");
+  run(f, "(define-method (describe x) 'new)");
+  TEST_ASSERT(strcmp(as_atom(run(f, "(call 1)")), "new") == 0);
+  TEST_ASSERT(cache->generic == run(f, "describe"));
+  TEST_ASSERT(cache->count == 1);
+
+  // A call that no method matches is an error, and caches nothing.
+  run(f, "(define-generic numeric)");
+  run(f, "(define-method (numeric (x number)) x)");
+  run(f, "(define call (lambda (x) (numeric x)))");
+  TEST_ASSERT(run(f, "(call 'a)") == NULL);
+  TEST_ASSERT(f->error_called);
+  TEST_ASSERT(body_cache(f, "call")->count == 0);
+
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  fixture->error_called = false;
+  install_error_handler(fixture->crisp, &error_handler, (void *)fixture);
+  set_eval_mode(fixture->crisp, eval_mode_under_test);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
+
+static void error_handler(crisp_t *crisp, void *state)
+{
+  (void)crisp;
+  ((test_fixture_t *)state)->error_called = true;
+}
+
+static expr_t run(test_fixture_t *f, const char *src)
+{
+  return eval(f->crisp, read(f->crisp, src), root_env(f->crisp));
+}
+
+// The dispatch cache of the call that is the first body of a global
+// lambda, held by the operands of the call.
+static dispatch_t *body_cache(test_fixture_t *f, const char *name)
+{
+  expr_t lambda = run(f, name);
+  expr_t body = car(as_lambda(lambda)->bodies);
+  expr_t meta = cdr(body)->as.cons.meta;
+  return is_dispatch(meta) ? as_dispatch(meta) : NULL;
+}
@@ -154,6 +154,20 @@ int string_table_test(test_fixture_t *f)
     string_table_free(&table);
   }
 
+  // A string is not found as a longer one that it is a prefix of
+  {
+    hash_table_t table;
+    string_table_init(&table);
+
+    const char *test_str = "pppppppppppppppppppppppppppppppppppppppppppppppp";
+    for (size_t i = strlen(test_str); i > 0; i--)
+    {
+      TEST_ASSERT(i == strlen(string_table_store(&table, test_str, i)));
+    }
+
+    string_table_free(&table);
+  }
+
   return PASS_CODE;
 }
 
@@ -0,0 +1,434 @@
+#include "simple_test.h"
+#include "optimizer.h"
+#include "compiler.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+// Fold a form, check how many applications were folded, then evaluate it.
+#define TEST_FOLD(src, count, exp)                                       \
+  {                                                                      \
+    expr_t node = read(f->crisp, src);                                   \
+    TEST_ASSERT(node != NULL);                                           \
+    size_t folded = optimize(f->crisp, node).folded;                           \
+    if (folded != (count))                                               \
+    {                                                                    \
+      printf("\n%s(%d): Test Fail\n", __FILE__, __LINE__);               \
+      printf("  : folded %zu, expected %d: '%s'\n", folded, count, src); \
+      return FAIL_CODE;                                                  \
+    }                                                                    \
+    expr_t value = eval(f->crisp, node, root_env(f->crisp));             \
+    TEST_ASSERT(value != NULL);                                          \
+    if (compare_crisp_value(value, exp, __FILE__, __LINE__) != PASS_CODE) \
+      return FAIL_CODE;                                                  \
+  }
+
+// Optimize a form, check how many calls were inlined, then evaluate it.
+#define TEST_INLINE(src, count, exp)                                      \
+  {                                                                       \
+    expr_t node = read(f->crisp, src);                                    \
+    TEST_ASSERT(node != NULL);                                            \
+    size_t inlined = optimize(f->crisp, node).inlined;                    \
+    if (inlined != (count))                                               \
+    {                                                                     \
+      printf("\n%s(%d): Test Fail\n", __FILE__, __LINE__);                \
+      printf("  : inlined %zu, expected %d: '%s'\n", inlined, count, src); \
+      return FAIL_CODE;                                                   \
+    }                                                                     \
+    expr_t value = eval(f->crisp, node, root_env(f->crisp));              \
+    TEST_ASSERT(value != NULL);                                           \
+    if (compare_crisp_value(value, exp, __FILE__, __LINE__) != PASS_CODE)  \
+      return FAIL_CODE;                                                   \
+  }
+
+// Optimize a form, check how many chains were fused, then evaluate it.
+#define TEST_FUSE(src, count, exp)                                      \
+  {                                                                     \
+    expr_t node = read(f->crisp, src);                                  \
+    TEST_ASSERT(node != NULL);                                          \
+    size_t fused = optimize(f->crisp, node).fused;                      \
+    if (fused != (count))                                               \
+    {                                                                   \
+      printf("\n%s(%d): Test Fail\n", __FILE__, __LINE__);              \
+      printf("  : fused %zu, expected %d: '%s'\n", fused, count, src);  \
+      return FAIL_CODE;                                                 \
+    }                                                                   \
+    expr_t value = eval(f->crisp, node, root_env(f->crisp));            \
+    TEST_ASSERT(value != NULL);                                         \
+    if (compare_crisp_value(value, exp, __FILE__, __LINE__) != PASS_CODE) \
+      return FAIL_CODE;                                                 \
+  }
+
+typedef struct
+{
+  crisp_t *crisp;
+  bool error_called;
+} test_fixture_t;
+
+static crisp_eval_mode_t eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+static size_t compile_threshold_under_test = CRISP_COMPILE_DEFAULT_THRESHOLD;
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static void error_handler(crisp_t *, void *);
+
+static int test_fold_literals(test_fixture_t *);
+static int test_fold_lists(test_fixture_t *);
+static int test_no_fold(test_fixture_t *);
+static int test_shadowed(test_fixture_t *);
+static int test_redefined(test_fixture_t *);
+static int test_fold_is_stable(test_fixture_t *);
+static int test_inline(test_fixture_t *);
+static int test_inline_redefined(test_fixture_t *);
+static int test_inline_scope(test_fixture_t *);
+static int test_no_inline(test_fixture_t *);
+static int test_fusion(test_fixture_t *);
+static int test_fusion_redefined(test_fixture_t *);
+static int test_fusion_stage_redefined(test_fixture_t *);
+static int test_no_fusion(test_fixture_t *);
+static int run_all(void);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+  RUN_TEST(run_all);
+  eval_mode_under_test = CRISP_EVAL_MODE_CEK;
+  RUN_TEST(run_all);
+  eval_mode_under_test = CRISP_EVAL_MODE_SPECIALIZING;
+  RUN_TEST(run_all);
+
+  // Again with every lambda compiled on its first call.
+  eval_mode_under_test = CRISP_EVAL_MODE_RECURSIVE;
+  compile_threshold_under_test = 1;
+  RUN_TEST(run_all);
+
+  return PASS_CODE;
+}
+
+static int run_all(void)
+{
+  RUN_TEST_WITH_FIXTURE(test_fold_literals);
+  RUN_TEST_WITH_FIXTURE(test_fold_lists);
+  RUN_TEST_WITH_FIXTURE(test_no_fold);
+  RUN_TEST_WITH_FIXTURE(test_shadowed);
+  RUN_TEST_WITH_FIXTURE(test_redefined);
+  RUN_TEST_WITH_FIXTURE(test_fold_is_stable);
+  RUN_TEST_WITH_FIXTURE(test_inline);
+  RUN_TEST_WITH_FIXTURE(test_inline_redefined);
+  RUN_TEST_WITH_FIXTURE(test_inline_scope);
+  RUN_TEST_WITH_FIXTURE(test_no_inline);
+  RUN_TEST_WITH_FIXTURE(test_fusion);
+  RUN_TEST_WITH_FIXTURE(test_fusion_redefined);
+  RUN_TEST_WITH_FIXTURE(test_fusion_stage_redefined);
+  RUN_TEST_WITH_FIXTURE(test_no_fusion);
+  return PASS_CODE;
+}
+
+static int test_fold_literals(test_fixture_t *f)
+{
+  TEST_FOLD("1", 0, "1");
+  TEST_FOLD("(+ 1 2)", 1, "3");
+  TEST_FOLD("(* 60 60 24)", 1, "86400");
+  TEST_FOLD("(+ 1 (* 2 3) (- 10 4))", 3, "13");
+  TEST_FOLD("(not (number? \"a\"))", 2, "true");
+
+  // Within special forms.
+  TEST_FOLD("(if (number? 1) (+ 1 2) (* 1 2))", 3, "3");
+  TEST_FOLD("(cond ((number? 'a) 1) (else (+ 2 2)))", 2, "4");
+  TEST_FOLD("(and (+ 1 1) (or (not 1) (* 2 3)))", 3, "6");
+
+  // Constants inside lambdas are folded once, ahead of every call.
+  TEST_FOLD("(define seconds (lambda (days) (* days (* 60 60 24))))", 1, "()");
+  TEST_FOLD("(seconds 2)", 0, "172800");
+
+  // Constant operands of an application that can not be folded.
+  TEST_FOLD("(seconds (+ 1 1))", 1, "172800");
+  TEST_ASSERT(!f->error_called);
+  return PASS_CODE;
+}
+
+static int test_fold_lists(test_fixture_t *f)
+{
+  TEST_FOLD("(list 1 2 3)", 1, "(1 2 3)");
+  TEST_FOLD("(cons 1 '(2 3))", 1, "(1 2 3)");
+  TEST_FOLD("(list? (list 'a 'b))", 2, "true");
+  TEST_FOLD("(define l (lambda () (list 1 (+ 1 1) '(3))))", 2, "()");
+  TEST_FOLD("(l)", 0, "(1 2 (3))");
+  return PASS_CODE;
+}
+
+static int test_no_fold(test_fixture_t *f)
+{
+  TEST_FOLD("(define x 5)", 0, "()");
+  TEST_FOLD("(+ x 1)", 0, "6");
+  TEST_FOLD("'(+ 1 2)", 0, "(+ 1 2)");
+  TEST_FOLD("(car '(1 2))", 0, "1");
+
+  // Impure builtins and user functions are never folded.
+  TEST_FOLD("(define inc (lambda (n) (+ n 1)))", 0, "()");
+  TEST_FOLD("(inc 1)", 0, "2");
+
+  // Operands outside of the domain of a numeric builtin.
+  TEST_FOLD("(define bad (lambda () (+ 1 'a)))", 0, "()");
+  TEST_FOLD("(define bad-list (lambda () (cons (+ 1 \"a\") 2)))", 0, "()");
+
+  // Builtins that may fail on operands of the types they take.
+  TEST_FOLD("(define r (lambda () (reverse '(1 . 2))))", 0, "()");
+  TEST_FOLD("(define a (lambda () (append '(1) 2 '(3))))", 0, "()");
+  TEST_FOLD("(define as (lambda () (assoc 'a '(1))))", 0, "()");
+
+  // A pure builtin that fails on constant operands is left to fail when
+  // the call is evaluated.
+  TEST_FOLD("(define q (lambda () `(,@'(1 . 2))))", 0, "()");
+  TEST_ASSERT(!f->error_called);
+  TEST_ASSERT(eval(f->crisp, read(f->crisp, "(q)"), root_env(f->crisp)) == NULL);
+  TEST_ASSERT(f->error_called);
+  return PASS_CODE;
+}
+
+static int test_shadowed(test_fixture_t *f)
+{
+  TEST_FOLD("(define f (lambda (+) (+ 1 2)))", 0, "()");
+  TEST_FOLD("(f -)", 0, "-1");
+  TEST_FOLD("(define g (lambda (+) (lambda () (+ 1 2))))", 0, "()");
+  TEST_FOLD("((g *))", 0, "2");
+
+  // Only the shadowed name is left alone.
+  TEST_FOLD("(define h (lambda (list) (list (* 2 2))))", 1, "()");
+  TEST_FOLD("(h (lambda (n) n))", 0, "4");
+
+  // Names bound by let forms shadow too, let* only after their binding.
+  TEST_FOLD("(let ((+ -) (x (+ 1 2))) (+ x 1))", 1, "2");
+  TEST_FOLD("(let* ((x (+ 1 2)) (+ -) (y (+ x 1))) (if y (+ 1 2)))", 1, "-1");
+  TEST_FOLD("(letrec ((+ -) (x (+ 1 2))) x)", 0, "-1");
+  return PASS_CODE;
+}
+
+static int test_redefined(test_fixture_t *f)
+{
+  TEST_FOLD("(define day (lambda () (* 60 60 24)))", 1, "()");
+  TEST_FOLD("(day)", 0, "86400");
+
+  // A folded value is discarded once a binding it used is redefined.
+  TEST_FOLD("(define * +)", 0, "()");
+  TEST_FOLD("(day)", 0, "144");
+
+  // Redefinition before folding means the new binding is used.
+  TEST_FOLD("(define + (lambda (a b) 0))", 0, "()");
+  TEST_FOLD("(+ 1 2)", 0, "0");
+  return PASS_CODE;
+}
+
+static int test_fold_is_stable(test_fixture_t *f)
+{
+  expr_t node = read(f->crisp, "(lambda () (+ 1 2))");
+  TEST_ASSERT(optimize(f->crisp, node).folded == 1);
+  TEST_ASSERT(optimize(f->crisp, node).folded == 0);
+
+  node = read(f->crisp, "(- 4 (+ 1 2))");
+  TEST_ASSERT(optimize(f->crisp, node).folded == 2);
+  TEST_ASSERT(optimize(f->crisp, node).folded == 0);
+  TEST_ASSERT(compare_crisp_value(eval(f->crisp, node, root_env(f->crisp)), "1", __FILE__, __LINE__) == PASS_CODE);
+  return PASS_CODE;
+}
+
+static int test_inline(test_fixture_t *f)
+{
+  TEST_INLINE("(define first (lambda (l) (car l)))", 0, "()");
+  TEST_INLINE("(define rest (lambda (l) (cdr l)))", 0, "()");
+  TEST_INLINE("(define second (lambda (l) (first (rest l))))", 2, "()");
+  TEST_INLINE("(second '(1 2 3))", 0, "2");
+
+  // A helper that was itself optimized is inlined from its original form.
+  TEST_INLINE("(define use (lambda (x) (second x)))", 3, "()");
+  TEST_INLINE("(use '(1 2 3))", 0, "2");
+
+  // Variables may be used more than once.
+  TEST_INLINE("(define square (lambda (x) (* x x)))", 0, "()");
+  TEST_INLINE("(define cube (lambda (x) (* x (square x))))", 1, "()");
+  TEST_INLINE("(cube 3)", 0, "27");
+
+  // Inlined bodies of literals are folded.
+  TEST_INLINE("(define nine (lambda () (square 3)))", 1, "()");
+  TEST_INLINE("(nine)", 0, "9");
+  TEST_ASSERT(!f->error_called);
+  return PASS_CODE;
+}
+
+static int test_inline_redefined(test_fixture_t *f)
+{
+  TEST_INLINE("(define first (lambda (l) (car l)))", 0, "()");
+  TEST_INLINE("(define second (lambda (l) (first (cdr l))))", 1, "()");
+  TEST_INLINE("(define use (lambda (x) (second x)))", 2, "()");
+  TEST_INLINE("(define square (lambda (x) (* x x)))", 0, "()");
+  TEST_INLINE("(define nine (lambda () (square 3)))", 1, "()");
+  crisp_gc(f->crisp);
+  TEST_INLINE("(use '(1 2 3))", 0, "2");
+
+  // Redefining an inlined lambda restores the calls to it.
+  TEST_INLINE("(define first (lambda (l) 'redefined))", 0, "()");
+  TEST_INLINE("(second '(1 2 3))", 0, "redefined");
+  TEST_INLINE("(use '(1 2 3))", 0, "redefined");
+  TEST_INLINE("(define square (lambda (x) (+ x x)))", 0, "()");
+  TEST_INLINE("(nine)", 0, "6");
+
+  crisp_gc(f->crisp);
+  TEST_INLINE("(use '(1 2 3))", 0, "redefined");
+  TEST_INLINE("(nine)", 0, "6");
+  return PASS_CODE;
+}
+
+static int test_inline_scope(test_fixture_t *f)
+{
+  // Free variables of an inlined body still refer to globals.
+  TEST_INLINE("(define k 10)", 0, "()");
+  TEST_INLINE("(define add-k (lambda (n) (+ n k)))", 0, "()");
+  TEST_INLINE("(define g (lambda (k) (add-k k)))", 1, "()");
+  TEST_INLINE("(g 1)", 0, "11");
+  TEST_INLINE("(define h (lambda (+) (add-k 2)))", 1, "()");
+  TEST_INLINE("(h -)", 0, "12");
+
+  // Calls to a shadowed name are left alone.
+  TEST_INLINE("(define j (lambda (add-k) (add-k 2)))", 0, "()");
+  TEST_INLINE("(j (lambda (n) n))", 0, "2");
+  return PASS_CODE;
+}
+
+static int test_no_inline(test_fixture_t *f)
+{
+  TEST_INLINE("(define swap (lambda (a b) (cons b a)))", 0, "()");
+  TEST_INLINE("(define pair (lambda (a b) (cons a b)))", 0, "()");
+
+  // Top level calls are only evaluated once.
+  TEST_INLINE("(swap 1 2)", 0, "(2 . 1)");
+
+  // Arguments that are applications must be evaluated in order.
+  TEST_INLINE("(define s (lambda (x) (swap (car x) (cdr x))))", 0, "()");
+  TEST_INLINE("(define p (lambda (x) (pair (car x) (cdr x))))", 1, "()");
+  TEST_INLINE("(p '(1 2))", 0, "(1 2)");
+
+  // ...and exactly once.
+  TEST_INLINE("(define dup (lambda (x) (cons x x)))", 0, "()");
+  TEST_INLINE("(define d (lambda (x) (dup (car x))))", 0, "()");
+  TEST_INLINE("(define ignore (lambda (x) (+ 1 2)))", 0, "()");
+  TEST_INLINE("(define i (lambda (x) (ignore x)))", 0, "()");
+
+  // Recursive lambdas, lambdas with several bodies and closures.
+  TEST_INLINE("(define r (lambda (n) (r n)))", 0, "()");
+  TEST_INLINE("(define r (lambda (n) (r n)))", 0, "()");
+  TEST_INLINE("(define q (lambda (n) (r n)))", 0, "()");
+  TEST_INLINE("(define b (lambda (n) n (car n)))", 0, "()");
+  TEST_INLINE("(define bb (lambda (n) (b n)))", 0, "()");
+  TEST_INLINE("(define c ((lambda (m) (lambda (n) (cons m n))) 1))", 0, "()");
+  TEST_INLINE("(define cc (lambda (n) (c n)))", 0, "()");
+
+  // The size threshold.
+  set_max_inline_size(f->crisp, 2);
+  TEST_INLINE("(define pp (lambda (x) (pair x x)))", 0, "()");
+  set_max_inline_size(f->crisp, 4);
+  TEST_INLINE("(define pp (lambda (x) (pair x x)))", 1, "()");
+  TEST_INLINE("(pp 1)", 0, "(1 . 1)");
+  return PASS_CODE;
+}
+
+static int test_fusion(test_fixture_t *f)
+{
+  TEST_FUSE("(map list (map list '(1 2)))", 1, "(((1)) ((2)))");
+  TEST_FUSE("(filter number? (map not '(1 a)))", 1, "()");
+  TEST_FUSE("(fold + 0 (map (lambda (x) (* x x)) (filter number? '(1 a 2 b 3))))", 1, "14");
+  TEST_FUSE("(fold cons '() (map (lambda (x) (+ x 1)) '()))", 1, "()");
+  TEST_FUSE("(map list (filter symbol? (filter (lambda (x) (not (number? x))) '(1 a \"b\" c))))", 1,
+            "((a) (c))");
+
+  // Each chain in a form is fused on its own.
+  TEST_FUSE("(cons (map list (map list '(1))) (filter number? (map list '(1))))", 2, "((((1))))");
+
+  // Inside a lambda the procedures may refer to its parameters.
+  TEST_FUSE("(define scale (lambda (k l) (map (lambda (x) (* x k)) (filter number? l))))", 1, "()");
+  TEST_FUSE("(scale 10 '(1 a 2))", 0, "(10 20)");
+
+  // Redefining a stage restores the chains it was fused into.
+  TEST_FUSE("(define map (lambda (f l) 'redefined))", 0, "()");
+  TEST_FUSE("(scale 10 '(1 a 2))", 0, "redefined");
+  return PASS_CODE;
+}
+
+static int test_fusion_redefined(test_fixture_t *f)
+{
+  TEST_FUSE("(define h (lambda () (fold + 0 (map (lambda (x) (- x 1)) (filter (lambda (x) (number? x)) '(1 2 3))))))",
+            1, "()");
+  TEST_FUSE("(h)", 0, "3");
+
+  // Redefining a builtin that a procedure of the chain calls restores the
+  // chain, so that each pass is still made in turn.
+  TEST_FUSE("(define log '())", 0, "()");
+  TEST_FUSE("(define number? (lambda (x) (set! log (cons (list 'p x) log)) x))", 0, "()");
+  TEST_FUSE("(define - (lambda (a b) (set! log (cons (list 'm a) log)) a))", 0, "()");
+  TEST_FUSE("(h)", 0, "6");
+  TEST_FUSE("(reverse log)", 0, "((p 1) (p 2) (p 3) (m 1) (m 2) (m 3))");
+  return PASS_CODE;
+}
+
+static int test_fusion_stage_redefined(test_fixture_t *f)
+{
+  TEST_FUSE("(define g (lambda () (fold + 0 (map (lambda (x) (* x 2)) (filter number? '(1 a 2 b))))))", 1,
+            "()");
+  TEST_FUSE("(g)", 0, "6");
+  TEST_FUSE("(g)", 0, "6");
+
+  // Redefining the stage in the middle of a chain that has already run
+  // restores the chain, which then calls the new definition.
+  TEST_FUSE("(define builtin-map map)", 0, "()");
+  TEST_FUSE("(define map (lambda (fn l) (cons 10 l)))", 0, "()");
+  TEST_FUSE("(g)", 0, "13");
+
+  // And the builtin again once it is put back.
+  TEST_FUSE("(define map builtin-map)", 0, "()");
+  TEST_FUSE("(g)", 0, "6");
+  return PASS_CODE;
+}
+
+static int test_no_fusion(test_fixture_t *f)
+{
+  // A single pass has nothing to be fused with.
+  TEST_FUSE("(map list '(1 2))", 0, "((1) (2))");
+
+  // Procedures with effects must see every element of one pass before the
+  // next, as must those that are not known to be free of them.
+  TEST_FUSE("(define n 0)", 0, "()");
+  TEST_FUSE("(map list (map (lambda (x) (set! n (+ n 1)) x) '(1)))", 0, "((1))");
+  TEST_FUSE("(define id (lambda (x) x))", 0, "()");
+  TEST_FUSE("(map list (map id '(1)))", 0, "((1))");
+  TEST_FUSE("(map (lambda (x) (id x)) (map list '(1)))", 0, "((1))");
+  TEST_FUSE("(map car (map list '(1)))", 0, "(1)");
+
+  // As must several lists mapped together.
+  TEST_FUSE("(map cons (map list '(1)) '(2))", 0, "(((1) . 2))");
+
+  // Nor is a stage fused when its name is shadowed.
+  TEST_FUSE("(define s (lambda (map) (map list (filter number? '(1)))))", 0, "()");
+  TEST_FUSE("(s (lambda (f l) l))", 0, "(1)");
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  fixture->error_called = false;
+  install_error_handler(fixture->crisp, &error_handler, (void *)fixture);
+  set_eval_mode(fixture->crisp, eval_mode_under_test);
+  set_compile_threshold(fixture->crisp, compile_threshold_under_test);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
+
+static void error_handler(crisp_t *crisp, void *state)
+{
+  (void)crisp;
+  ((test_fixture_t *)state)->error_called = true;
+}
@@ -40,6 +40,9 @@ int main(int argc, char** argv)
   //  - Dot must be prior to the last datum in the list.
   TEST_PARSE_FAILURE("(1 . 2 3)");
 
+  // The ellipsis of syntax-rules is an atom.
+  TEST_PARSE("(a ... . b)", "(a ... . b)");
+
   // Square bracket lists are treated as normal lists
   TEST_PARSE("[     ]", "()");
   TEST_PARSE("(()[])", "(() ())");
@@ -53,6 +56,16 @@ int main(int argc, char** argv)
   TEST_PARSE("(#t #f)", "(true false)");
   TEST_PARSE("(#T #F)", "(true false)");
 
+  // Vectors
+  TEST_PARSE("#()", "#()");
+  TEST_PARSE("#(1 (2 3) #(a) \"b\")", "#(1 (2 3) #(a) \"b\")");
+  TEST_PARSE("(1 #(2))", "(1 #(2))");
+  TEST_PARSE("'#(1)", "(quote #(1))");
+  TEST_PARSE_FAILURE("#(1 . 2)");
+  TEST_PARSE_FAILURE("# (1)");
+  TEST_PARSE_FAILURE("#a");
+  TEST_PARSE_FAILURE("#(1");
+
   // Strings
   TEST_PARSE("\"one\"", "\"one\"");
   TEST_PARSE("(\"one\")", "(\"one\")");
@@ -62,6 +75,8 @@ int main(int argc, char** argv)
   TEST_PARSE("'(1 2)", "(quote (1 2))");
   TEST_PARSE(",a", "(unquote a)");
   TEST_PARSE(",(1 2)", "(unquote (1 2))");
+  TEST_PARSE(",@a", "(unquote-splicing a)");
+  TEST_PARSE("(1 ,@(2 3))", "(1 (unquote-splicing (2 3)))");
   TEST_PARSE("`a", "(quasiquote a)");
   TEST_PARSE("`(1 2)", "(quasiquote (1 2))");
 
@@ -0,0 +1,152 @@
+#include "simple_test.h"
+#include "value.h"
+#include "interpreter_internal.h"
+
+typedef struct
+{
+  crisp_t *crisp;
+  bool error_called;
+} test_fixture_t;
+
+static void setup(test_fixture_t *fixture);
+static void teardown(test_fixture_t *fixture);
+static void error_handler(crisp_t *, void *);
+static expr_t run(test_fixture_t *f, const char *src);
+static node_t *body_node(test_fixture_t *f, const char *name);
+
+static int test_numeric(test_fixture_t *);
+static int test_direct(test_fixture_t *);
+static int test_operator_guard(test_fixture_t *);
+static int test_errors(test_fixture_t *);
+
+int main(int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  RUN_TEST_WITH_FIXTURE(test_numeric);
+  RUN_TEST_WITH_FIXTURE(test_direct);
+  RUN_TEST_WITH_FIXTURE(test_operator_guard);
+  RUN_TEST_WITH_FIXTURE(test_errors);
+
+  return PASS_CODE;
+}
+
+static int test_numeric(test_fixture_t *f)
+{
+  run(f, "(define sq (lambda (x) (* x x)))");
+  TEST_ASSERT(as_number(run(f, "(sq 3)")) == 9.0);
+
+  node_t *node = body_node(f, "sq");
+  TEST_ASSERT(node != NULL);
+  TEST_ASSERT(node->kind == NODE_KIND_NUMERIC);
+  TEST_ASSERT(node->operand_types == (1u << VALUE_TYPE_NUMBER));
+  TEST_ASSERT(as_number(run(f, "(sq 4)")) == 16.0);
+  TEST_ASSERT(node->kind == NODE_KIND_NUMERIC);
+
+  // A string operand fails the type guard. The builtin reports the error
+  // and the node is left calling the builtin directly.
+  TEST_ASSERT(run(f, "(sq \"a\")") == NULL);
+  TEST_ASSERT(f->error_called == true);
+  TEST_ASSERT(node->kind == NODE_KIND_DIRECT);
+  TEST_ASSERT((node->operand_types & (1u << VALUE_TYPE_STRING)) != 0);
+  TEST_ASSERT(as_number(run(f, "(sq 5)")) == 25.0);
+
+  return PASS_CODE;
+}
+
+static int test_direct(test_fixture_t *f)
+{
+  run(f, "(define pair (lambda (x) (cons x x)))");
+  run(f, "(define twice (lambda (x) (pair (pair x))))");
+  expr_t result = run(f, "(twice 1)");
+  TEST_ASSERT(is_cons(result) && is_cons(car(result)));
+
+  TEST_ASSERT(body_node(f, "pair")->kind == NODE_KIND_DIRECT);
+  TEST_ASSERT(body_node(f, "twice")->kind == NODE_KIND_DIRECT);
+
+  // The node survives a collection along with the form it belongs to.
+  crisp_gc(f->crisp);
+  result = run(f, "(twice 2)");
+  TEST_ASSERT(as_number(car(car(result))) == 2.0);
+
+  return PASS_CODE;
+}
+
+static int test_operator_guard(test_fixture_t *f)
+{
+  run(f, "(define apply1 (lambda (fn x) (fn x)))");
+  TEST_ASSERT(is_bool(run(f, "(apply1 number? 1)")));
+  node_t *node = body_node(f, "apply1");
+  TEST_ASSERT(node->kind == NODE_KIND_DIRECT);
+
+  // A different operator falls back to the generic path for good.
+  TEST_ASSERT(is_cons(run(f, "(apply1 list 1)")));
+  TEST_ASSERT(node->kind == NODE_KIND_GENERIC);
+  TEST_ASSERT(node->operator == NULL);
+  TEST_ASSERT(is_bool(run(f, "(apply1 number? 1)")));
+
+  // Redefining a global operator is seen by the guard.
+  run(f, "(define op (lambda (x) (+ x 1)))");
+  run(f, "(define call-op (lambda (x) (op x)))");
+  TEST_ASSERT(as_number(run(f, "(call-op 1)")) == 2.0);
+  run(f, "(define op (lambda (x) (- x 1)))");
+  TEST_ASSERT(as_number(run(f, "(call-op 1)")) == 0.0);
+  TEST_ASSERT(body_node(f, "call-op")->kind == NODE_KIND_GENERIC);
+
+  return PASS_CODE;
+}
+
+static int test_errors(test_fixture_t *f)
+{
+  // Applications with the wrong number of arguments are never specialized.
+  run(f, "(define bad (lambda (x) (car x x)))");
+  TEST_ASSERT(run(f, "(bad '(1))") == NULL);
+  TEST_ASSERT(f->error_called == true);
+  TEST_ASSERT(body_node(f, "bad")->kind == NODE_KIND_GENERIC);
+
+  // Nor is applying something that is not a function.
+  f->error_called = false;
+  run(f, "(define bad (lambda (x) (x)))");
+  TEST_ASSERT(run(f, "(bad 1)") == NULL);
+  TEST_ASSERT(f->error_called == true);
+  TEST_ASSERT(body_node(f, "bad")->kind == NODE_KIND_GENERIC);
+
+  return PASS_CODE;
+}
+
+static void setup(test_fixture_t *fixture)
+{
+  fixture->crisp = init_interpreter();
+  fixture->error_called = false;
+  install_error_handler(fixture->crisp, &error_handler, (void *)fixture);
+  set_eval_mode(fixture->crisp, CRISP_EVAL_MODE_SPECIALIZING);
+  // These tests look at the nodes of bodies that are evaluated, which
+  // compiled bodies never are.
+  set_compile_threshold(fixture->crisp, 0);
+}
+
+static void teardown(test_fixture_t *fixture)
+{
+  free_interpreter(fixture->crisp);
+}
+
+static void error_handler(crisp_t *crisp, void *state)
+{
+  (void)crisp;
+  ((test_fixture_t *)state)->error_called = true;
+}
+
+static expr_t run(test_fixture_t *f, const char *src)
+{
+  return eval(f->crisp, read(f->crisp, src), root_env(f->crisp));
+}
+
+// The node attached to the first body of a global lambda.
+static node_t *body_node(test_fixture_t *f, const char *name)
+{
+  expr_t lambda = run(f, name);
+  expr_t body = car(as_lambda(lambda)->bodies);
+  expr_t meta = body->as.cons.meta;
+  return is_node(meta) ? as_node(meta) : NULL;
+}
@@ -174,5 +174,38 @@ int main(int argc, char **argv)
     TEST_ASSERT(is_improper_list(v) == false);
   }
 
+  {
+    // Length and properness are cached on each pair once observed.
+    value_t *c = cons(crisp, number_value(crisp, 3), nil_value(crisp));
+    value_t *b = cons(crisp, number_value(crisp, 2), c);
+    value_t *a = cons(crisp, number_value(crisp, 1), b);
+    TEST_ASSERT((a->flags & VALUE_FLAG_LENGTH_KNOWN) == 0);
+    TEST_ASSERT(length(a) == 3);
+    TEST_ASSERT(a->flags & VALUE_FLAG_LENGTH_KNOWN);
+    TEST_ASSERT(a->flags & VALUE_FLAG_PROPER_LIST);
+    TEST_ASSERT(length(b) == 2);
+    TEST_ASSERT(length(c) == 1);
+
+    // A longer list reuses the cache of its tail.
+    value_t *z = cons(crisp, number_value(crisp, 0), a);
+    TEST_ASSERT(length(z) == 4);
+    TEST_ASSERT(is_proper_list(z) == true);
+
+    // Improper lists are cached as such.
+    value_t *d = cons(crisp, number_value(crisp, 1), number_value(crisp, 2));
+    value_t *e = cons(crisp, number_value(crisp, 0), d);
+    TEST_ASSERT(length(e) == 0);
+    TEST_ASSERT(e->flags & VALUE_FLAG_LENGTH_KNOWN);
+    TEST_ASSERT(is_improper_list(e) == true);
+    TEST_ASSERT(is_improper_list(d) == true);
+
+    // Extending a list through its tail pointer resets the cache of the
+    // pair that was changed.
+    value_t *t = cons(crisp, number_value(crisp, 1), nil_value(crisp));
+    TEST_ASSERT(length(t) == 1);
+    set_cdr(t, cons(crisp, number_value(crisp, 2), nil_value(crisp)));
+    TEST_ASSERT(length(t) == 2);
+  }
+
   free_interpreter(crisp);
 }